@@ -0,0 +1,112 @@
+#include <string>
+#include <vector>
+#include <csignal>
+#include <iostream>
+#include <spawn.h>
+#include <sys/wait.h>
+
+
+#include "lib/broker.hpp"
+#include "lib/options.hpp"
+#include "lib/networking.hpp"
+
+
+extern char **environ;
+
+
+auto spawnServer(const std::string &serverBinary, std::vector<std::string> arguments) -> pid_t {
+    arguments.insert(arguments.begin(), serverBinary);
+    std::vector<char *> argv;
+    for (auto &argument: arguments) {
+        argv.push_back(argument.data());
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid;
+    if (posix_spawn(&pid, serverBinary.c_str(), nullptr, nullptr, argv.data(), environ) != 0) {
+        throw std::runtime_error("can't start " + serverBinary);
+    }
+    return pid;
+}
+
+
+struct Shards {
+    std::vector<std::string> endPoints{};
+    std::vector<std::string> readEndPoints{};
+    std::vector<pid_t> pids{};
+};
+
+
+// Starts shard servers and optionally their followers as child processes listening on ipc:// endpoints
+auto spawnShards(const std::string &serverBinary, const std::string &storage, const std::string &directory,
+                 const int64_t shardsCount, const bool withFollowers) -> Shards {
+    Shards shards;
+    for (int64_t shard = 0; shard < shardsCount; shard++) {
+        const auto prefix = "ipc:///tmp/cp-shard-" + std::to_string(shard);
+        const auto path = directory + "/shard-" + std::to_string(shard);
+
+        std::vector<std::string> arguments{"--storage=" + storage, "--path=" + path + (storage == "log" ? ".log" : ".db"),
+                                           "--endpoint=" + prefix};
+        if (withFollowers) {
+            arguments.push_back("--publish=" + prefix + "-changes");
+            arguments.push_back("--publish-sync=" + prefix + "-sync");
+        }
+        shards.endPoints.push_back(prefix);
+        shards.pids.push_back(spawnServer(serverBinary, arguments));
+
+        if (withFollowers) {
+            shards.readEndPoints.push_back(prefix + "-follower");
+            shards.pids.push_back(spawnServer(serverBinary, {
+                    "--storage=log", "--path=" + path + "-follower.log", "--endpoint=" + prefix + "-follower",
+                    "--follow=" + prefix + "-changes", "--follow-sync=" + prefix + "-sync"
+            }));
+        }
+    }
+    return shards;
+}
+
+
+// usage: broker [--endpoint=tcp://<host ip>:4506] [--idle-timeout=6000]
+//               [--backends=ipc:///tmp/cp-shard-0,ipc:///tmp/cp-shard-1 [--read-backends=<followers of backends>]
+//                | --shards=2 [--followers] [--server-binary=./server] [--storage=sqlite|log] [--directory=.]]
+// without --backends the broker starts its shard servers itself and stops them on exit, reads go to followers
+// while they are fresh enough
+auto main(int argc, char *argv[]) -> int {
+    std::vector<pid_t> shardPids;
+    try {
+        const Options options(argc, argv);
+
+        auto backends = options.getList("backends");
+        auto readBackends = options.getList("read-backends");
+        if (backends.empty()) {
+            auto shards = spawnShards(
+                    options.get("server-binary", "./server"),
+                    options.get("storage", "sqlite"),
+                    options.get("directory", "."),
+                    options.getNumber("shards", 2),
+                    options.has("followers")
+            );
+            backends = std::move(shards.endPoints);
+            readBackends = std::move(shards.readEndPoints);
+            shardPids = std::move(shards.pids);
+        }
+
+        Broker broker(backends, readBackends);
+        broker.configureIdleTimeout(options.getNumber("idle-timeout", 6000));
+        broker.configurePullSocketEndPoint(options.get("endpoint", "tcp://" + getIP() + ":4506"));
+        broker.run();
+    } catch (std::runtime_error &err) {
+        std::cout << err.what() << std::endl;
+        for (const auto pid: shardPids) {
+            kill(pid, SIGTERM);
+            waitpid(pid, nullptr, 0);
+        }
+        exit(1);
+    }
+
+    for (const auto pid: shardPids) {
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+
+#include "lib/options.hpp"
+#include "lib/storage.hpp"
+#include "lib/changeFile.hpp"
+
+
+using Clock = std::chrono::steady_clock;
+
+
+constexpr uint64_t progressInterval = 100000;
+
+
+auto report(const std::string &action, const uint64_t rows, const uint64_t bytes, const Clock::time_point start) -> void {
+    const auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << action << " " << rows << " rows (" << bytes << " bytes) in " << std::fixed << std::setprecision(2)
+              << seconds << " s, " << std::setprecision(0) << (seconds > 0 ? rows / seconds : 0) << " rows/s"
+              << std::endl;
+}
+
+
+// rows are streamed straight from storage cursors into the file, memory doesn't grow with the export size
+auto exportChanges(Storage &storage, const std::string &path, const std::string &chatName) -> void {
+    ChangeWriter writer(path);
+    uint64_t rows = 0;
+    const auto start = Clock::now();
+    const auto visitor = [&](const Change &change) {
+        writer.write(change);
+        if (++rows % progressInterval == 0) {
+            report("exported", rows, writer.getBytes(), start);
+        }
+    };
+
+    if (chatName.empty()) {
+        storage.scanChanges(visitor);
+    } else {
+        storage.scanChatChanges(chatName, visitor);
+    }
+    writer.close();
+    report("exported", rows, writer.getBytes(), start);
+}
+
+
+// every batch is one transaction, reimporting the same file is a no-op
+auto importChanges(Storage &storage, const std::string &path, const size_t batchSize) -> void {
+    ChangeReader reader(path);
+    uint64_t rows = 0;
+    const auto start = Clock::now();
+
+    std::vector<Change> batch;
+    batch.reserve(batchSize);
+    Change change;
+    while (reader.read(change)) {
+        batch.push_back(std::move(change));
+        if (batch.size() == batchSize) {
+            storage.applyChanges(batch);
+            rows += batch.size();
+            batch.clear();
+            if (rows % progressInterval < batchSize) {
+                report("imported", rows, reader.getBytes(), start);
+            }
+        }
+    }
+    if (!batch.empty()) {
+        storage.applyChanges(batch);
+        rows += batch.size();
+    }
+    report("imported", rows, reader.getBytes(), start);
+}
+
+
+// usage: chat_tool [--storage=sqlite|log|sharded] [--path=database.db] [--shards=4]
+//                  (--export=<file> [--chat=<chat name>] | --import=<file> [--batch=10000])
+// export without --chat dumps users, chats, members and messages of the whole storage,
+// with it only the chat, its members and senders
+auto main(int argc, char *argv[]) -> int {
+    try {
+        const Options options(argc, argv);
+        const auto engine = options.get("storage", "sqlite");
+        const auto path = options.get("path", engine == "log" ? "database.log" :
+                                               engine == "sharded" ? "database.shards" : "database.db");
+        const auto storage = makeStorage(engine, path, options.getNumber("shards", 4));
+
+        if (options.has("export")) {
+            exportChanges(*storage, options.get("export", ""), options.get("chat", ""));
+        } else if (options.has("import")) {
+            importChanges(*storage, options.get("import", ""), std::max<int64_t>(options.getNumber("batch", 10000), 1));
+        } else {
+            std::cerr << "--export or --import is required" << std::endl;
+            return 1;
+        }
+    } catch (std::runtime_error &exception) {
+        std::cerr << exception.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
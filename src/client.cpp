@@ -1,52 +1,100 @@
 #include <mutex>
 #include <chrono>
+#include <memory>
 #include <string>
 #include <thread>
-#include <random>
 #include <sstream>
 #include <utility>
 #include <iostream>
 #include <zmqpp/zmqpp.hpp>
 
 
+#include "lib/options.hpp"
 #include "lib/messaging.hpp"
-#include "lib/networking.hpp"
+#include "lib/connection.hpp"
+#include "lib/clientCache.hpp"
 
 
 #define RESET   "\033[0m"
 #define RED     "\033[31m"
 
 
+std::string serverEndPoint;
 std::string username;
 
 
-std::vector<std::string> chats;
+// server evicts connections after three missed intervals, see --idle-timeout of server
+constexpr auto heartbeatInterval = std::chrono::seconds(2);
+
+
+// chats and histories survive restarts, only newer ones are requested from server
+std::unique_ptr<ClientCache> cache;
 std::mutex mutex;
+std::chrono::steady_clock::time_point lastRequestTime;
 
 
-constexpr int32_t sendTimeout = 3 * 1000;
-constexpr int32_t receiveTimeout = 3 * 1000;
+// serializes requests of main, updater and heartbeat threads, reconnects once if server dropped the connection
+auto request(Connection &connection, Message &message) -> void {
+    std::lock_guard lockGuard(mutex);
+    const auto original = message;
+    try {
+        connection.request(message);
+    } catch (std::runtime_error &) {
+        if (!connection.reconnect()) {
+            throw;
+        }
+        std::cout << "reconnected to server" << std::endl;
+        message = original;
+        connection.request(message);
+    }
+    lastRequestTime = std::chrono::steady_clock::now();
+}
+
 
+// sends a heartbeat whenever no other request was sent for heartbeatInterval. Heartbeats go through request, so
+// they reconnect after a restart like other requests, and a failed one is retried on the next interval
+auto heartbeater(Connection &connection) -> void {
+    auto failing = false;
+    while (true) {
+        std::this_thread::sleep_for(heartbeatInterval / 4);
+        {
+            std::lock_guard lockGuard(mutex);
+            if (std::chrono::steady_clock::now() - lastRequestTime < heartbeatInterval) {
+                continue;
+            }
+        }
+
+        try {
+            auto message = Message(MessageType::Heartbeat);
+            request(connection, message);
+            failing = false;
+        } catch (std::runtime_error &exception) {
+            if (!failing) {
+                std::cout << "heartbeat failed: " << exception.what() << std::endl;
+            }
+            failing = true;
+            // next attempt waits for an interval instead of a quarter of it
+            std::lock_guard lockGuard(mutex);
+            lastRequestTime = std::chrono::steady_clock::now();
+        }
+    }
+}
 
-auto updater(zmqpp::socket &clientSocket) -> void {
-    static time_t lastChatsUpdateTime{0};
+
+auto updater(Connection &connection) -> void {
+    time_t lastChatsUpdateTime = cache->getLastChatsUpdateTime();
 
     try {
         while (true) {
             auto message = Message(MessageType::UpdateChats, MessageData(lastChatsUpdateTime, username, ""));
-            mutex.lock();
-            sendMessage(clientSocket, message);
-            receiveMessage(clientSocket, message);
-            mutex.unlock();
-
-            for (const auto &chat: message.data.vector) {
-                chats.push_back(chat);
-            }
+            request(connection, message);
 
             if (message.data.vector.empty()) {
                 lastChatsUpdateTime == 0 ? lastChatsUpdateTime = 0 : lastChatsUpdateTime = message.data.time;
             } else {
                 lastChatsUpdateTime = message.data.time;
+                cache->addChats(message.data.vector, lastChatsUpdateTime);
+                cache->save();
             }
 
             std::this_thread::sleep_for(std::chrono::seconds(2));
@@ -57,40 +105,35 @@ auto updater(zmqpp::socket &clientSocket) -> void {
 }
 
 
-auto connectToServer(zmqpp::socket &serverSocket, zmqpp::socket &clientSocket) -> void {
-
-    const std::string serverEndPoint("tcp://192.168.1.2:4506");
-    std::string clientEndPoint("tcp://" + getIP() + ":");
-
-
-    clientSocket.set(zmqpp::socket_option::send_timeout, sendTimeout);
-    clientSocket.set(zmqpp::socket_option::receive_timeout, receiveTimeout);
-
-    serverSocket.set(zmqpp::socket_option::send_timeout, sendTimeout);
-    serverSocket.set(zmqpp::socket_option::receive_timeout, receiveTimeout);
-
-    serverSocket.connect(serverEndPoint);
+// prints events of chats published to this user, e.g. "alice is typing in general"
+auto eventListener(zmqpp::context &context, const std::string &endPoint) -> void {
+    try {
+        zmqpp::socket subscriber(context, zmqpp::socket_type::subscribe);
+        subscriber.connect(endPoint);
+        subscriber.set(zmqpp::socket_option::subscribe, username + '\0');
 
-    // if testing on same machine with server
-    for (int i = 0; i < 5; i++) {
-        try {
-            std::random_device randomDevice;
-            std::mt19937 randomEngine(randomDevice());
-            std::uniform_int_distribution distribution(4000, 9999);
-
-            uint32_t port = distribution(randomEngine);
-            clientSocket.bind(clientEndPoint + std::to_string(port));
-            clientEndPoint += std::to_string(port);
-            break;
-        } catch (zmqpp::exception&) {
-            if (i == 4) {
-                std::cerr << "can't find appropriate port" << std::endl;
-                exit(1);
+        while (true) {
+            zmqpp::message frames;
+            subscriber.receive(frames);
+            if (frames.parts() != 2) {
+                continue;
+            }
+            msgpack::unpacked unpackedPackage;
+            msgpack::unpack(unpackedPackage, static_cast<const char *>(frames.raw_data(1)), frames.size(1));
+            Message event;
+            unpackedPackage.get().convert(event);
+            if (event.type == MessageType::Event && !event.data.vector.empty()) {
+                std::cout << event.data.vector.front() << " is " << event.data.buffer << " in "
+                          << event.data.name << std::endl;
             }
-            continue;
         }
-    }
+    } catch (...) {}
 
+    std::cout << "event listener stopped" << std::endl;
+}
+
+
+auto connectToServer(Connection &connection) -> void {
     std::string password;
     int command;
     std::cout << "Choose:\n    1.Sign in\n    2.Sign up\nEnter number: ";
@@ -109,55 +152,58 @@ auto connectToServer(zmqpp::socket &serverSocket, zmqpp::socket &clientSocket) -
 
     std::cout << "username: ";
     std::cin >> username;
+    cache = std::make_unique<ClientCache>(serverEndPoint, username);
+
+    // a stored session lets sign in skip the password
+    const auto sessionToken = cache->getSessionToken();
+    if (requestType == MessageType::SignIn && !sessionToken.empty() &&
+        connection.authenticate(MessageType::ResumeSession, username, sessionToken) == AuthenticationStatus::Success) {
+        std::cout << "session resumed" << std::endl;
+        return;
+    }
+
     std::cout << "password: ";
     std::cin >> password;
 
 
-    zmqpp::message connectMessage;
-    connectMessage << clientEndPoint;
-    if (!serverSocket.send(connectMessage, true)) {
-        throw std::runtime_error("send error");
-    }
-
+    const auto status = connection.authenticate(requestType, username, password);
     if (requestType == MessageType::SignIn) {
-        auto request = Message(MessageType::SignIn, MessageData(username, password));
-        sendMessage(clientSocket, request);
-
-        Message response;
-        receiveMessage(clientSocket, response);
-
-        if (response.authenticationStatus == AuthenticationStatus::NotExists) {
+        if (status == AuthenticationStatus::NotExists) {
             throw std::runtime_error("user not exists");
-        } else if (response.authenticationStatus == AuthenticationStatus::InvalidPassword) {
+        } else if (status == AuthenticationStatus::InvalidPassword) {
             throw std::runtime_error("invalid password");
-        } else if (response.authenticationStatus == AuthenticationStatus::Success) {
+        } else if (status == AuthenticationStatus::Success) {
             std::cout << "sing in succeeded" << std::endl;
         }
     } else {
-        auto request = Message(MessageType::SignUp, MessageData(username, password));
-        sendMessage(clientSocket, request);
-
-        Message response;
-        receiveMessage(clientSocket, response);
-
-        if (response.authenticationStatus == AuthenticationStatus::Exists) {
+        if (status == AuthenticationStatus::Exists) {
             throw std::runtime_error("user exists");
-        } else if (response.authenticationStatus == AuthenticationStatus::Success) {
+        } else if (status == AuthenticationStatus::Success) {
             std::cout << "sing up succeeded" << std::endl;
         }
     }
+
+    cache->setSessionToken(connection.getSessionToken());
+    cache->save();
 }
 
-auto main() -> int {
+// usage: client [--server=tcp://192.168.1.2:4506] [--endpoint=<own endpoint>] [--events=<server events endpoint>]
+// own endpoint is picked by server transport if omitted, e.g. ipc:///tmp/cp-client-<pid>-0 for ipc:// servers
+auto main(int argc, char *argv[]) -> int {
     try {
-        zmqpp::context context;
+        const Options options(argc, argv);
+        serverEndPoint = options.get("server", "tcp://192.168.1.2:4506");
 
-        zmqpp::socket serverSocket(context, zmqpp::socket_type::push);
-        zmqpp::socket clientSocket(context, zmqpp::socket_type::request);
+        zmqpp::context context;
+        Connection connection(context, serverEndPoint, options.get("endpoint", ""));
 
-        connectToServer(serverSocket, clientSocket);
+        connectToServer(connection);
 
-        std::thread updaterThread(updater, std::ref(clientSocket));
+        std::thread updaterThread(updater, std::ref(connection));
+        std::thread(heartbeater, std::ref(connection)).detach();
+        if (options.has("events")) {
+            std::thread(eventListener, std::ref(context), options.get("events", "")).detach();
+        }
         int32_t command;
         while (true) {
             std::cout << "Choose:\n"
@@ -169,8 +215,23 @@ auto main() -> int {
             std::cin >> command;
 
             if (command == 1) {
-                for (const auto &chat: chats) {
-                    std::cout << "    " << chat << std::endl;
+                // latest activity first, cached names are shown when server can't build the inbox
+                auto message = Message(MessageType::GetRecentChats);
+                request(connection, message);
+                if (message.type != MessageType::GetRecentChats) {
+                    for (const auto &chat: cache->getChats()) {
+                        std::cout << "    " << chat << std::endl;
+                    }
+                    continue;
+                }
+
+                for (size_t i = 0; i < message.data.vector.size() && i < message.data.chatMessages.size(); i++) {
+                    const auto &preview = message.data.chatMessages[i];
+                    std::cout << "    " << message.data.vector[i];
+                    if (i < message.data.numbers.size() && message.data.numbers[i] != 0) {
+                        std::cout << " (" << message.data.numbers[i] << " unread)";
+                    }
+                    std::cout << " " << preview << std::endl;
                 }
             } else if (command == 2) {
                 std::string chatName;
@@ -194,10 +255,7 @@ auto main() -> int {
 
                 auto message = Message(MessageType::CreateChat, msgData);
 
-                mutex.lock();
-                sendMessage(clientSocket, message);
-                receiveMessage(clientSocket, message);
-                mutex.unlock();
+                request(connection, message);
 
                 if (message.type == MessageType::ClientError) {
                     std::cout << RED << message.data.buffer << RESET << std::endl;
@@ -213,12 +271,16 @@ auto main() -> int {
                     std::cout << "Choose:\n"
                                  "    1. Send message\n"
                                  "    2. Show messages\n"
-                                 "    3. Invite user\n"
+                                 "    3. Invite users\n"
                                  "    4. Exit menu\n"
                                  "Enter num: ";
                     std::cin >> command;
 
                     if (command == 1) {
+                        // members see typing indicator while the message is entered, delivery isn't confirmed
+                        auto typing = Message(MessageType::Event, MessageData(chatName, "typing"));
+                        request(connection, typing);
+
                         std::string data;
                         std::cout << "Enter message:" << std::endl;
                         std::cin.ignore();
@@ -229,10 +291,7 @@ auto main() -> int {
                         msgData.buffer = data;
                         auto message = Message(MessageType::CreateMessage, msgData);
 
-                        mutex.lock();
-                        sendMessage(clientSocket, message);
-                        receiveMessage(clientSocket, message);
-                        mutex.unlock();
+                        request(connection, message);
 
                         if (message.type == MessageType::ClientError) {
                             std::cout << RED << message.data.buffer << RESET << std::endl;
@@ -242,34 +301,53 @@ auto main() -> int {
                     } else if (command == 2) {
                         MessageData msgData;
                         msgData.name = chatName;
-                        auto message = Message(MessageType::GetAllMessagesFromChat, msgData);
+                        msgData.time = cache->getLastMessageId(chatName);
+                        auto message = Message(MessageType::GetMessagesFromChatSince, msgData);
 
 
-                        mutex.lock();
-                        sendMessage(clientSocket, message);
-                        receiveMessage(clientSocket, message);
-                        mutex.unlock();
+                        request(connection, message);
                         if (message.type == MessageType::ClientError) {
                             std::cout << RED << message.data.buffer << RESET << std::endl;
                         } else if (message.type == MessageType::ServerError) {
                             std::cout << "Server error" << std::endl;
                         } else {
-                            for (const auto &chatMessage: message.data.chatMessages) {
+                            const auto prunedId = message.data.numbers.empty() ? 0 : message.data.numbers[0];
+                            if (prunedId != 0) {
+                                cache->forgetMessages(chatName, static_cast<int32_t>(prunedId));
+                            }
+                            if (!message.data.chatMessages.empty()) {
+                                cache->addMessages(chatName, message.data.chatMessages, message.data.vector,
+                                                   message.data.time);
+                            }
+                            if (prunedId != 0 || !message.data.chatMessages.empty()) {
+                                cache->save();
+                            }
+                            const auto senders = cache->getSenders(chatName);
+                            for (auto &chatMessage: cache->getMessages(chatName)) {
+                                chatMessage.username = getSenderName(chatMessage, senders);
                                 std::cout << chatMessage << std::endl;
                             }
+
+                            // everything shown is read, cursor of the reply is the latest message id
+                            auto markRead = Message(MessageType::MarkRead, MessageData(message.data.time, chatName, ""));
+                            request(connection, markRead);
                         }
                     } else if (command == 3) {
-                        std::string user;
-                        std::cout << "Enter username: ";
-                        std::cin >> user;
+                        std::string line;
+                        std::cout << "Enter usernames: ";
+                        std::cin.ignore();
+                        std::getline(std::cin, line);
+                        std::stringstream ss(line);
 
                         std::string value;
-                        std::cout << "Share history with user? (y/n): ";
+                        std::cout << "Share history with users? (y/n): ";
                         std::cin >> value;
 
                         MessageData msgData;
                         msgData.name = chatName;
-                        msgData.buffer = user;
+                        for (std::string s; ss >> s;) {
+                            msgData.vector.push_back(s);
+                        }
 
                         if (value == "y" || value == "Y") {
                             msgData.flag = true;
@@ -279,18 +357,25 @@ auto main() -> int {
                             std::cout << "invalid command" << std::endl;
                             break;
                         }
-                        auto message = Message(MessageType::InviteUserToChat, msgData);
+                        auto message = Message(MessageType::InviteUsersToChat, msgData);
 
 
-                        mutex.lock();
-                        sendMessage(clientSocket, message);
-                        receiveMessage(clientSocket, message);
-                        mutex.unlock();
+                        request(connection, message);
 
                         if (message.type == MessageType::ClientError) {
                             std::cout << RED << message.data.buffer << RESET << std::endl;
                         } else if (message.type == MessageType::ServerError) {
                             std::cout << RED << "Server error" << RESET << std::endl;
+                        } else {
+                            for (size_t i = 0; i < message.data.vector.size() && i < message.data.numbers.size(); i++) {
+                                const auto status = static_cast<InviteStatus>(message.data.numbers[i]);
+                                if (status == InviteStatus::AlreadyMember) {
+                                    std::cout << message.data.vector[i] << " is already a member" << std::endl;
+                                } else if (status == InviteStatus::UnknownUser) {
+                                    std::cout << RED << "User " << message.data.vector[i] << " doesn't exists"
+                                              << RESET << std::endl;
+                                }
+                            }
                         }
                     } else if (command == 4) {
                         break;
@@ -2,11 +2,21 @@
 #define CP_AUTH_HPP
 
 
+#include <cstdint>
+
+
 enum class AuthenticationStatus {
     Exists,
     NotExists,
     InvalidPassword,
-    Success
+    Success,
+    InvalidSession
+};
+
+
+struct AuthenticationResult {
+    AuthenticationStatus status{};
+    int32_t userId{-1};
 };
 
 
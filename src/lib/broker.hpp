@@ -0,0 +1,85 @@
+#ifndef CP_BROKER_HPP
+#define CP_BROKER_HPP
+
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <zmqpp/zmqpp.hpp>
+
+#include "metrics.hpp"
+#include "messaging.hpp"
+#include "connection.hpp"
+#include "connectionManager.hpp"
+
+
+// Speaks server protocol to clients and routes their requests to shard servers, each with its own storage.
+// Chat requests go to the shard of the chat name, users are signed up on every shard so that member lookups
+// of createChat and inviteUserToChat stay local to the chat shard. Chat lists are merged from all shards
+class Broker {
+    using Backends = std::vector<std::unique_ptr<Connection>>;
+
+    // Connections of one client. Followers can't resume sessions of their primaries, so readers are signed in
+    // while the client authenticates with its password and then keep their own sessions. Passwords aren't kept,
+    // reads of shards without a reader go to primaries
+    struct Client {
+        std::string username{};
+        Backends backends{};
+        Backends readers{};
+    };
+
+    zmqpp::context context{};
+    zmqpp::socket pullSocket{context, zmqpp::socket_type::pull};
+    std::atomic<bool> running{true};
+
+    std::vector<std::string> backendEndPoints{};
+    std::vector<std::string> readEndPoints{};
+
+    Metrics metrics{};
+    ConnectionManager connections{};
+    std::chrono::milliseconds idleTimeout{};
+
+    auto connectionMonitor() -> void;
+
+    // authenticates client on every shard, the session token is the list of shard tokens followed by tokens
+    // of followers if they are configured
+    auto attachClient(zmqpp::socket &clientSocket, const std::string &clientEndPoint, Client &client) -> void;
+
+    // signs in to follower of shard, retries a few times while a user signed up a moment ago isn't replicated yet
+    auto signInReader(Client &client, size_t shard, const std::string &password) -> void;
+
+    // sends read request to follower of shard if possible and to the primary otherwise
+    auto forwardRead(Client &client, size_t shard, Message &message) -> void;
+
+    auto clientMonitor(uint64_t connectionId, const std::string &clientEndPoint) noexcept -> void;
+
+    // routes request to its shards and replaces it with response
+    auto route(Client &client, Message &message) -> void;
+
+    // sends request to a single shard, reconnects once if shard dropped the connection
+    auto forward(Connection &backend, Message &message) -> void;
+
+public:
+    // readEndPoints are followers of backends in the same order, empty if there are none
+    explicit Broker(std::vector<std::string> backendEndPoints, std::vector<std::string> readEndPoints = {});
+
+    // stable across processes and restarts, placement of chats depends on it
+    static auto shardOf(const std::string &key, size_t shardsCount) -> size_t;
+
+    // connections without requests or heartbeats for idleTimeout milliseconds are closed
+    auto configureIdleTimeout(size_t idleTimeout) -> void;
+
+    auto configurePullSocketEndPoint(const std::string &endPoint) -> void;
+
+    // blocks until stop is called or connection monitor fails
+    auto run() -> void;
+
+    // thread-safe
+    auto stop() -> void;
+};
+
+
+#endif //CP_BROKER_HPP
@@ -0,0 +1,45 @@
+#ifndef CP_CHANGE_FILE_HPP
+#define CP_CHANGE_FILE_HPP
+
+
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <msgpack.hpp>
+
+#include "storage.hpp"
+#include "framing.hpp"
+
+
+// Export files are framed like log segments, every frame is a msgpack Change
+class ChangeWriter {
+    std::ofstream output{};
+    msgpack::sbuffer package{};
+    uint64_t bytes{};
+
+public:
+    explicit ChangeWriter(const std::string &path);
+
+    auto write(const Change &change) -> void;
+
+    // flushes buffered frames, throws if any write failed
+    auto close() -> void;
+
+    auto getBytes() const -> uint64_t;
+};
+
+
+class ChangeReader {
+    FrameReader reader;
+
+public:
+    explicit ChangeReader(const std::string &path);
+
+    // returns false at the end of file, throws on truncated or corrupted frame
+    auto read(Change &change) -> bool;
+
+    auto getBytes() const -> uint64_t;
+};
+
+
+#endif //CP_CHANGE_FILE_HPP
@@ -3,6 +3,8 @@
 
 
 #include <string>
+#include <vector>
+#include <cstdint>
 #include <utility>
 #include <iostream>
 #include <msgpack.hpp>
@@ -12,21 +14,32 @@ struct ChatMessage {
     std::string datetime{};
     std::string username{};
     std::string text{};
+    int32_t id{};
+    // index of username in senders of a dictionary-encoded response, -1 if username is set
+    int32_t sender{-1};
 
     ChatMessage() = default;
 
-    ChatMessage(std::string datetime, std::string username, std::string text) : datetime(std::move(datetime)),
-                                                                                username(std::move(username)),
-                                                                                text(std::move(text)) {}
+    ChatMessage(std::string datetime, std::string username, std::string text, int32_t id = 0) : datetime(std::move(datetime)),
+                                                                                                username(std::move(username)),
+                                                                                                text(std::move(text)),
+                                                                                                id(id) {}
 
     friend auto operator<<(std::ostream &os, const ChatMessage &chatMessage) -> std::ostream& {
-        const auto [datetime, username, text] = chatMessage;
-        os << "| " << datetime << " / " << username << "> " << text;
+        os << "| " << chatMessage.datetime << " / " << chatMessage.username << "> " << chatMessage.text;
         return os;
     }
 
-    MSGPACK_DEFINE (datetime, username, text)
+    MSGPACK_DEFINE (datetime, username, text, id, sender)
 };
 
 
+// Moves usernames of messages into senders, which already known usernames keep their indexes in.
+// Returns number of username bytes removed from messages
+auto encodeSenders(std::vector<ChatMessage> &messages, std::vector<std::string> &senders) -> size_t;
+
+// username of message whichever way it is encoded, empty if its index is out of senders
+auto getSenderName(const ChatMessage &message, const std::vector<std::string> &senders) -> const std::string &;
+
+
 #endif //CP_CHAT_MESSAGE_HPP
@@ -0,0 +1,80 @@
+#ifndef CP_CLIENT_CACHE_HPP
+#define CP_CLIENT_CACHE_HPP
+
+
+#include <map>
+#include <mutex>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <msgpack.hpp>
+
+#include "chatMessage.hpp"
+
+
+// Thread-safe, on-disk cache of chat list and chat histories of one user on one server
+class ClientCache {
+    // messages are encoded with senders, messages of caches written before encoding keep their usernames
+    struct ChatHistory {
+        std::vector<ChatMessage> messages{};
+        int32_t lastMessageId{};
+        std::vector<std::string> senders{};
+
+        MSGPACK_DEFINE (messages, lastMessageId, senders)
+    };
+
+    struct Snapshot {
+        int64_t lastChatsUpdateTime{};
+        std::vector<std::string> chats{};
+        std::map<std::string, ChatHistory> histories{};
+        std::string sessionToken{};
+
+        MSGPACK_DEFINE (lastChatsUpdateTime, chats, histories, sessionToken)
+    };
+
+    std::string path{};
+    std::mutex mutex{};
+    Snapshot snapshot{};
+
+    static auto cacheDirectory() -> std::string;
+
+public:
+    // reads cache file of username on serverEndPoint, starts empty if there is none or it is unreadable
+    ClientCache(const std::string &serverEndPoint, const std::string &username);
+
+    // writes cache to a temporary file and renames it over the old one
+    auto save() -> void;
+
+    auto getSessionToken() -> std::string;
+
+    auto setSessionToken(const std::string &sessionToken) -> void;
+
+    auto getChats() -> std::vector<std::string>;
+
+    auto getLastChatsUpdateTime() -> time_t;
+
+    auto addChats(const std::vector<std::string> &chats, time_t updateTime) -> void;
+
+    // messages are encoded, usernames are resolved with getSenderName and getSenders
+    auto getMessages(const std::string &chatName) -> std::vector<ChatMessage>;
+
+    auto getSenders(const std::string &chatName) -> std::vector<std::string>;
+
+    // id of the newest cached message of chat, 0 if there is none
+    auto getLastMessageId(const std::string &chatName) -> int32_t;
+
+    // drops messages up to prunedId, retention has deleted them on the server
+    auto forgetMessages(const std::string &chatName, int32_t prunedId) -> void;
+
+    // messages are encoded with senders of their response
+    auto addMessages(
+            const std::string &chatName,
+            const std::vector<ChatMessage> &messages,
+            const std::vector<std::string> &senders,
+            int32_t lastMessageId
+    ) -> void;
+};
+
+
+#endif //CP_CLIENT_CACHE_HPP
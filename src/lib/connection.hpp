@@ -0,0 +1,67 @@
+#ifndef CP_CONNECTION_HPP
+#define CP_CONNECTION_HPP
+
+
+#include <string>
+#include <cstdint>
+#include <zmqpp/zmqpp.hpp>
+
+#include "auth.hpp"
+#include "messaging.hpp"
+
+
+// Client side of server protocol: binds request socket, announces its endpoint through push socket and then
+// talks request-reply. Not thread-safe, requests must be serialized by caller
+class Connection {
+    zmqpp::context &context;
+    int32_t timeout{};
+
+    std::string serverEndPoint{};
+    std::string clientEndPoint{};
+    std::string username{};
+    std::string sessionToken{};
+
+    zmqpp::socket serverSocket;
+    zmqpp::socket clientSocket;
+
+    auto configureClientSocket() -> void;
+
+    auto bindClientSocket() -> void;
+
+public:
+    // empty clientEndPoint is chosen by transport of serverEndPoint
+    Connection(
+            zmqpp::context &context,
+            const std::string &serverEndPoint,
+            const std::string &clientEndPoint = "",
+            int32_t timeout = 3 * 1000
+    );
+
+    // requestType is SignIn, SignUp or ResumeSession, secret is password or session token respectively
+    auto authenticate(MessageType requestType, const std::string &username, const std::string &secret) -> AuthenticationStatus;
+
+    // sends message and replaces it with response, requests refused by a restarting server are sent again
+    // after reconnect
+    auto request(Message &message) -> void;
+
+    // keeps connection from being evicted as idle while nothing else is requested
+    auto heartbeat() -> void;
+
+    // recreates request socket after a failed request and resumes the last session, server drops connections
+    // idle for too long and restarts. Retries with backoff while server doesn't answer, returns false if session
+    // can't be resumed
+    auto reconnect() -> bool;
+
+    auto getClientEndPoint() const -> const std::string &;
+
+    // token issued by server on the last successful authentication
+    auto getSessionToken() const -> const std::string &;
+};
+
+
+// ipc:// and inproc:// servers get a unique endpoint of the same transport, tcp:// ones get "tcp://<host ip>:"
+// which is completed with a random free port
+auto defaultClientEndPoint(const std::string &serverEndPoint) -> std::string;
+
+
+#endif //CP_CONNECTION_HPP
@@ -0,0 +1,72 @@
+#ifndef CP_CONNECTION_MANAGER_HPP
+#define CP_CONNECTION_MANAGER_HPP
+
+
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+
+// Thread-safe, owns client monitor threads and tracks their connections. Monitors report activity and
+// check for eviction, threads of finished monitors are joined by reap so they don't pile up over uptime
+class ConnectionManager {
+    struct Entry {
+        std::string endPoint{};
+        std::string username{};
+        std::thread thread{};
+        std::chrono::steady_clock::time_point lastActivity{};
+        size_t bytes{};
+        bool evicted{};
+    };
+
+    std::mutex mutex{};
+    std::unordered_map<uint64_t, Entry> connections{};
+    std::vector<std::thread> finished{};
+    uint64_t nextId{};
+
+    // explicitly locks, moves thread of the connection to finished
+    auto release(uint64_t id) -> void;
+
+    static auto estimateBytes(const Entry &entry) -> size_t;
+
+public:
+    ConnectionManager() = default;
+
+    ConnectionManager(const ConnectionManager &) = delete;
+
+    auto operator=(const ConnectionManager &) -> ConnectionManager & = delete;
+
+    ~ConnectionManager();
+
+    // runs monitor on its own thread with id of the new connection, connection is released when monitor returns
+    auto spawn(const std::string &endPoint, std::function<void(uint64_t)> monitor) -> uint64_t;
+
+    auto attach(uint64_t id, const std::string &username) -> void;
+
+    // records activity of connection, bytes is memory held by its monitor besides the entry
+    auto touch(uint64_t id, size_t bytes) -> void;
+
+    auto isEvicted(uint64_t id) -> bool;
+
+    // marks connections without activity for idleTimeout as evicted, returns their number
+    auto evictIdle(std::chrono::milliseconds idleTimeout) -> size_t;
+
+    // joins threads of finished monitors, returns their number
+    auto reap() -> size_t;
+
+    // waits for all monitors, they must be stopped outside
+    auto joinAll() -> void;
+
+    auto size() -> size_t;
+
+    // estimated memory held by live connections
+    auto bytes() -> size_t;
+};
+
+
+#endif //CP_CONNECTION_MANAGER_HPP
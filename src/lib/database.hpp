@@ -6,85 +6,133 @@
 #include <mutex>
 #include <string>
 #include <vector>
+#include <functional>
 #include <sqlite3.h>
 #include <msgpack.hpp>
 
 #include "user.hpp"
 #include "auth.hpp"
+#include "storage.hpp"
+#include "membershipIndex.hpp"
 #include "chatMessage.hpp"
 
 
-// Thread-safe, based on sqlite3
-class Database {
+// Thread-safe, based on sqlite3, queries go through Query of query.hpp
+class Database : public Storage {
     sqlite3 *db{};
     char *err_msg{};
-    sqlite3_stmt *stmt{};
     std::mutex mutex{};
 
-    // doesn't lock, must be locked outside
-    auto prepareStatement(const char *sqlQuery) noexcept -> bool;
+    static constexpr int32_t vacuumPages = 256;
+    static constexpr int32_t scanChats = 256;
 
-    // doesn't lock, must be locked outside
-    template<class... Args>
-    auto bindStatement(Args... args) noexcept -> bool;
+    // authoritative for chat names and members, updated after their rows are written
+    MembershipIndex membership{};
 
-    // doesn't lock
-    static auto getFormattedDatetime(time_t rawTime) noexcept -> std::string;
+    // doesn't lock, called from constructor only
+    auto loadMembership() -> void;
 
-    // explicitly locks
-    auto executeSqlQuery(const std::string &sql) noexcept -> bool;
+    // explicitly locks, calls body with bounds (from, to] of chat ids, scanChats chats at a time under one lock
+    auto forEachChatRange(const std::function<void(int32_t, int32_t)> &body) -> void;
 
-    // explicitly locks
-    auto getUserPassword(const std::string &username) -> std::string;
+    // explicitly locks, replaces stored password of user by a hash with configured limits unless it changed meanwhile
+    auto rehashPassword(int32_t userId, const std::string &stored, const std::string &password) -> void;
+
+    // doesn't lock, must be locked outside, rolls back if body throws
+    auto runTransaction(const std::function<void()> &body) -> void;
 
-    // implicitly locks by getUserId
-    auto isUserExist(const std::string &username) -> bool;
+    // doesn't lock, must be locked outside, multi-row inserts of members with one allowed raw time
+    auto insertMembers(int32_t chatId, const std::vector<int32_t> &userIds, time_t allowedRawTime) -> void;
 
     // explicitly locks
-    auto getChatId(const std::string &chatName) -> int32_t;
+    auto executeSqlQuery(const std::string &sql) noexcept -> bool;
 
-    // implicitly locks by getChatId
+    // doesn't lock, reads membership index
     auto isChatExists(const std::string &chatName) -> bool;
 
     // doesn't lock, must be locked outside
-    auto getUsername(int id) -> std::string;
+    auto fetchUsername(int id) -> std::string;
+
+    // doesn't lock, must be locked outside, queries bind chatName as ?1 unless it's empty
+    auto visitChanges(
+            const char *sqlUsersQuery,
+            const char *sqlChatsQuery,
+            const char *sqlMembersQuery,
+            const char *sqlMessagesQuery,
+            const std::string &chatName,
+            const std::function<void(const Change &)> &visitor
+    ) -> void;
 
 public:
     Database();
 
     explicit Database(const std::string &path);
 
-    ~Database();
+    ~Database() override;
 
     // explicitly locks
-    auto getUserId(const std::string &username) -> int32_t;
+    auto getUserId(const std::string &username) -> int32_t override;
 
     // explicitly locks
-    auto getAllUsers() -> std::set<User>;
+    auto getUsername(int32_t userId) -> std::string override;
 
-    // implicitly locks by isUserExists and getUserPassword
-    auto authenticateUser(const std::string &username, const std::string &password) -> AuthenticationStatus;
+    // explicitly locks
+    auto getAllUsers() -> std::set<User> override;
+
+    // explicitly locks
+    auto authenticateUser(const std::string &username, const std::string &password) -> AuthenticationResult override;
 
     // explicitly locks
-    auto createUser(const std::string &username, const std::string &password) -> void;
+    auto createUser(const std::string &username, const std::string &password) -> void override;
 
     // explicitly and implicitly locks
-    auto createChat(const std::string &chatName, const int32_t &adminId, const std::vector<int32_t> &userIds) -> bool;
+    auto createChat(const std::string &chatName, const int32_t &adminId, const std::vector<int32_t> &userIds) -> bool override;
 
-    // explicitly locks
-    auto getChatName(int chatId) -> std::string;
+    // doesn't lock, reads membership index
+    auto getChatId(const std::string &chatName) -> int32_t override;
+
+    // doesn't lock, reads membership index
+    auto getChatName(int chatId) -> std::string override;
+
+    // doesn't lock, reads membership index
+    auto getChatsByTime(int32_t userId, time_t rawTime) -> std::vector<std::string> override;
 
     // explicitly and implicitly locks
-    auto getChatsByTime(int32_t userId, time_t rawTime) -> std::vector<std::string>;
+    auto createMessage(const std::string &chatName, int32_t senderId, time_t rawTime, const std::string &data) -> int32_t override;
 
     // explicitly and implicitly locks
-    auto createMessage(const std::string &chatName, int32_t senderId, time_t rawTime, const std::string &data) -> bool;
+    auto getAllMessagesFromChat(const std::string &chatName, int32_t userId) -> std::vector<ChatMessage> override;
 
     // explicitly and implicitly locks
-    auto getAllMessagesFromChat(const std::string &chatName, int32_t userId) -> std::vector<ChatMessage>;
+    auto getMessagesFromChatSince(
+            const std::string &chatName,
+            int32_t userId,
+            int32_t afterId
+    ) -> std::vector<ChatMessage> override;
 
     // explicitly and implicitly locks
-    auto getUserAllowedRawTime(int32_t chatId, int32_t userId) -> time_t;
+    auto getRecentMessages(const std::string &chatName, size_t limit) -> std::vector<StoredMessage> override;
+
+    // doesn't lock, reads membership index
+    auto getUserAllowedRawTime(int32_t chatId, int32_t userId) -> time_t override;
+
+    // doesn't lock, reads membership index
+    auto isChatMember(int32_t chatId, int32_t userId) -> bool override;
+
+    // doesn't lock, reads membership index
+    auto getChatMembers(const std::string &chatName) -> std::vector<ChatMember> override;
+
+    // explicitly locks
+    auto getRecentlyActiveChats(size_t messagesWindow) -> std::vector<std::string> override;
+
+    // explicitly locks
+    auto getRecentlyActiveUsers(size_t messagesWindow) -> std::vector<User> override;
+
+    // explicitly locks once per scanChats chats, foreground queries get the lock between them
+    auto getLastMessages() -> std::vector<Change> override;
+
+    // explicitly locks once per scanChats chats, counts of every chat are taken under one lock
+    auto countMessagesSince(int32_t afterId) -> std::vector<MessageCount> override;
 
     // explicitly and implicitly locks
     auto inviteUserToChat(
@@ -92,7 +140,43 @@ public:
             int32_t invitorId,
             int32_t userId,
             bool allowHistorySharing = false
-    ) -> void;
+    ) -> void override;
+
+    // explicitly and implicitly locks
+    auto inviteUsersToChat(
+            const std::string &chatName,
+            int32_t invitorId,
+            const std::vector<int32_t> &userIds,
+            bool allowHistorySharing = false
+    ) -> std::vector<InviteStatus> override;
+
+    // explicitly locks
+    auto pruneMessages(const std::string &chatName, time_t olderThan, size_t keepLatest, size_t batchSize) -> size_t override;
+
+    // explicitly locks
+    auto getPrunedId(const std::string &chatName) -> int32_t override;
+
+    // explicitly locks, runs incremental vacuum of at most vacuumPages pages
+    auto reclaimSpace() -> int64_t override;
+
+    // explicitly locks
+    auto scanChanges(const std::function<void(const Change &)> &visitor) -> void override;
+
+    // explicitly locks
+    auto openChangeCursor() -> ChangeCursor override;
+
+    // explicitly locks
+    auto scanChangesPage(
+            ChangeCursor &cursor,
+            size_t limit,
+            const std::function<void(const Change &)> &visitor
+    ) -> bool override;
+
+    // explicitly locks
+    auto scanChatChanges(const std::string &chatName, const std::function<void(const Change &)> &visitor) -> void override;
+
+    // explicitly locks
+    auto applyChanges(const std::vector<Change> &changes) -> void override;
 };
 
 
@@ -0,0 +1,105 @@
+#ifndef CP_EVENT_HUB_HPP
+#define CP_EVENT_HUB_HPP
+
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <tuple>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+#include <zmqpp/zmqpp.hpp>
+#include <msgpack.hpp>
+
+#include "user.hpp"
+#include "storage.hpp"
+#include "metrics.hpp"
+#include "messaging.hpp"
+
+
+// Thread-safe, fans ephemeral events such as typing indicators out to online members of a chat through a publish
+// socket, topic of every delivery is recipient username followed by '\0'. Events never touch storage and aren't
+// delivered to users who are offline. Repeated events of a user in a chat are coalesced to one per interval,
+// deliveries beyond queue capacity are dropped. The endpoint is trusted: it isn't authenticated and anyone who reaches
+// it may subscribe to any username or to all of them, so it is meant for ipc:// or loopback only
+class EventHub {
+    struct Delivery {
+        std::string topic{};
+        std::shared_ptr<const msgpack::sbuffer> package{};
+    };
+
+    zmqpp::context context{};
+    zmqpp::socket publishSocket{context, zmqpp::socket_type::publish};
+
+    std::chrono::milliseconds interval{};
+    size_t queueCapacity{};
+
+    std::mutex mutex{};
+    std::condition_variable condition{};
+    std::deque<Delivery> queue{};
+    // user id to its username and number of its connections
+    std::unordered_map<int32_t, std::pair<std::string, size_t>> online{};
+    // sender id, chat name and event kind to the time its last event was published
+    std::map<std::tuple<int32_t, std::string, std::string>, std::chrono::steady_clock::time_point> lastEvents{};
+    bool stopping{};
+
+    std::atomic<uint64_t> published{};
+    std::atomic<uint64_t> coalesced{};
+    std::atomic<uint64_t> delivered{};
+    std::atomic<uint64_t> dropped{};
+
+    std::thread sender{};
+
+    // owns publish socket, forgets coalescing times older than interval from time to time
+    auto sendLoop() -> void;
+
+public:
+    // marks user online while it exists, hub may be null
+    class Presence {
+        EventHub *hub;
+        User user;
+
+    public:
+        Presence(EventHub *hub, User user);
+
+        Presence(const Presence &) = delete;
+
+        auto operator=(const Presence &) -> Presence & = delete;
+
+        ~Presence();
+    };
+
+    // interval is in milliseconds, queueCapacity is number of pending deliveries
+    EventHub(const std::string &endPoint, size_t interval, size_t queueCapacity);
+
+    EventHub(const EventHub &) = delete;
+
+    auto operator=(const EventHub &) -> EventHub & = delete;
+
+    ~EventHub();
+
+    // stops sending and unbinds endpoint, so a process taking over can bind it, later events are dropped
+    auto close() -> void;
+
+    auto connect(const User &user) -> void;
+
+    auto disconnect(const User &user) -> void;
+
+    // queues event for online users except sender for whom isMember holds, returns false if it was coalesced with
+    // a previous one. isMember is called under the hub lock and must not call the hub
+    auto publish(const User &sender, const std::string &chatName, const std::string &kind,
+                 const std::function<bool(int32_t)> &isMember) -> bool;
+
+    auto exportMetrics(Metrics &metrics) -> void;
+};
+
+
+#endif //CP_EVENT_HUB_HPP
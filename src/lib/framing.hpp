@@ -0,0 +1,79 @@
+#ifndef CP_FRAMING_HPP
+#define CP_FRAMING_HPP
+
+
+#include <string>
+#include <ostream>
+#include <fstream>
+#include <cstdint>
+#include <exception>
+#include <msgpack.hpp>
+
+
+// Log segments, change files, recordings and session journals are sequences of frames: 4-byte little-endian size
+// followed by a msgpack value of that size
+constexpr size_t frameHeaderSize = 4;
+
+
+enum class FrameStatus {
+    Read,
+    End,
+    // the rest of the file isn't a whole frame: short header or body, size beyond the end of file or bad body
+    Torn
+};
+
+
+auto writeFrame(std::ostream &output, const msgpack::sbuffer &package) -> void;
+
+auto writeFrame(msgpack::sbuffer &buffer, const msgpack::sbuffer &package) -> void;
+
+
+// Reads frames of a file one by one. Sizes are checked against the bytes left in the file, so a corrupted header
+// can't make the reader allocate more than the file holds
+class FrameReader {
+    std::ifstream input{};
+    std::string body{};
+    uint64_t fileBytes{};
+    uint64_t offset{};
+
+    // reads next frame into body, offset isn't moved
+    auto next() -> FrameStatus;
+
+public:
+    explicit FrameReader(const std::string &path);
+
+    // value is left unspecified unless the frame is read
+    template<class T>
+    auto read(T &value) -> FrameStatus;
+
+    // bytes of whole frames read so far
+    auto getOffset() const -> uint64_t;
+};
+
+
+template<class T>
+auto FrameReader::read(T &value) -> FrameStatus {
+    const auto status = next();
+    if (status != FrameStatus::Read) {
+        return status;
+    }
+
+    try {
+        size_t unpackedBytes = 0;
+        msgpack::unpacked unpacked;
+        msgpack::unpack(unpacked, body.data(), body.size(), unpackedBytes);
+        if (unpackedBytes != body.size()) {
+            return FrameStatus::Torn;
+        }
+        unpacked.get().convert(value);
+    } catch (const std::exception &) {
+        // msgpack reports bad bytes with unpack_error and bad types with type_error, which is a std::bad_cast
+        return FrameStatus::Torn;
+    }
+
+    offset += frameHeaderSize + body.size();
+    return FrameStatus::Read;
+}
+
+
+#endif //CP_FRAMING_HPP
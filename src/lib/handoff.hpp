@@ -0,0 +1,39 @@
+#ifndef CP_HANDOFF_HPP
+#define CP_HANDOFF_HPP
+
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <optional>
+#include <msgpack.hpp>
+
+#include "sessions.hpp"
+
+
+// State a restarting server hands over to the process which replaces it, so that clients resume their sessions
+// and hot chats are served from memory right away
+struct Handoff {
+    std::vector<SessionRecord> sessions{};
+    // usernames resolved by the old process with their ids
+    std::vector<std::pair<std::string, int32_t>> users{};
+    // chats with cached histories, most recently used first
+    std::vector<std::string> chats{};
+
+    MSGPACK_DEFINE (sessions, users, chats)
+};
+
+
+// writes snapshot to a temporary file and renames it, so the new process never reads a partial one
+auto writeHandoff(const std::string &path, const Handoff &handoff) -> void;
+
+// reads snapshot and removes it, so it isn't loaded twice, nullopt if there is none
+auto takeHandoff(const std::string &path) -> std::optional<Handoff>;
+
+// returns false if snapshot didn't appear within timeout
+auto waitForHandoff(const std::string &path, std::chrono::milliseconds timeout) -> bool;
+
+
+#endif //CP_HANDOFF_HPP
@@ -0,0 +1,127 @@
+#ifndef CP_HISTORY_CACHE_HPP
+#define CP_HISTORY_CACHE_HPP
+
+
+#include <list>
+#include <array>
+#include <mutex>
+#include <ctime>
+#include <limits>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include "storage.hpp"
+#include "chatMessage.hpp"
+
+
+// Thread-safe, keeps latest messages of recently read chats in memory, so that history reads of active chats
+// are served without storage and its lock. Callers check membership and pass visibility of the reader, rings
+// don't copy members. Chats are evicted least recently used first when over budget.
+class HistoryCache {
+    // Columnar ring, slot i of every column belongs to the same message, texts are packed into textArena
+    struct Ring {
+        std::vector<int32_t> ids{};
+        std::vector<time_t> rawTimes{};
+        std::vector<int32_t> senderIds{};
+        std::vector<uint32_t> textOffsets{};
+        std::vector<uint32_t> textSizes{};
+        std::string textArena{};
+        size_t liveTextBytes{};
+
+        // slot of the oldest message once ring is full
+        size_t head{};
+        int32_t newestId{};
+
+        // newest raw time and id among chat messages which are not in the ring
+        time_t evictedRawTime{std::numeric_limits<time_t>::min()};
+        int32_t evictedId{};
+
+        std::unordered_map<int32_t, std::string> senderNames{};
+
+        std::list<std::string>::iterator lruPosition{};
+        size_t bytes{};
+    };
+
+    static constexpr size_t defaultCapacity = 256;
+    static constexpr size_t defaultBudget = 64 * 1024 * 1024;
+    static constexpr size_t epochsCount = 64;
+
+    size_t capacity{};
+    size_t budget{};
+
+    std::mutex mutex{};
+    std::unordered_map<std::string, Ring> rings{};
+    std::list<std::string> lru{};
+    size_t totalBytes{};
+
+    // bumped on every write to chats hashed into the slot, lets load detect writes it could miss
+    std::array<uint64_t, epochsCount> epochs{};
+
+    static auto epochSlot(const std::string &chatName) -> size_t;
+
+    // doesn't lock, must be locked outside
+    auto push(Ring &ring, const StoredMessage &message) -> void;
+
+    // doesn't lock, latest messages of chat as storage returns them
+    auto makeRing(const std::vector<StoredMessage> &messages) -> Ring;
+
+    // doesn't lock, must be locked outside, returns false if some of the messages aren't in the ring
+    static auto readRing(const Ring &ring, time_t allowedRawTime, int32_t afterId, std::vector<ChatMessage> &messages) -> bool;
+
+    // doesn't lock, must be locked outside
+    static auto compactArena(Ring &ring) -> void;
+
+    // doesn't lock, must be locked outside
+    static auto estimateBytes(const Ring &ring) -> size_t;
+
+    // doesn't lock, must be locked outside
+    auto touch(Ring &ring, size_t previousBytes) -> void;
+
+    // doesn't lock, must be locked outside, caches ring unless chat was written since loadEpoch
+    auto insert(const std::string &chatName, Ring ring, uint64_t loadEpoch) -> void;
+
+    // doesn't lock, must be locked outside
+    auto remove(const std::string &chatName) -> void;
+
+    // doesn't lock, must be locked outside, evicts other chats before the ring named keep,
+    // which is evicted too if it alone is over budget
+    auto evict(const std::string &keep) -> void;
+
+public:
+    HistoryCache();
+
+    // capacity is number of messages kept per chat, budget is total size of all rings in bytes
+    HistoryCache(size_t capacity, size_t budget);
+
+    // appends message to chat ring if chat is cached
+    auto append(const std::string &chatName, const StoredMessage &message) -> void;
+
+    // loads latest messages of chat from storage unless it is cached, doesn't lock storage and cache together
+    auto load(Storage &storage, const std::string &chatName) -> void;
+
+    // reads messages with id greater than afterId and raw time not less than allowedRawTime of the reader,
+    // returns false if some of them aren't in the ring
+    auto read(const std::string &chatName, time_t allowedRawTime, int32_t afterId, std::vector<ChatMessage> &messages) -> bool;
+
+    // read for a chat which isn't cached, loads it and reads from the loaded messages, so a miss costs one bounded
+    // storage query. Returns false if chat is cached already or the read goes beyond the loaded messages
+    auto loadAndRead(
+            Storage &storage,
+            const std::string &chatName,
+            time_t allowedRawTime,
+            int32_t afterId,
+            std::vector<ChatMessage> &messages
+    ) -> bool;
+
+    auto invalidate(const std::string &chatName) -> void;
+
+    // cached chats, most recently used first
+    auto getChatNames() -> std::vector<std::string>;
+
+    auto size() -> size_t;
+};
+
+
+#endif //CP_HISTORY_CACHE_HPP
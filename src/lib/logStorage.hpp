@@ -0,0 +1,285 @@
+#ifndef CP_LOG_STORAGE_HPP
+#define CP_LOG_STORAGE_HPP
+
+
+#include <set>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <unordered_map>
+#include <msgpack.hpp>
+
+#include "user.hpp"
+#include "auth.hpp"
+#include "storage.hpp"
+#include "membershipIndex.hpp"
+#include "chatMessage.hpp"
+
+
+enum class LogRecordType {
+    User,
+    Chat,
+    Member,
+    Message,
+    Prune,
+    Password
+};
+
+
+// User: id, name = username, data = password hash
+// Chat: id, userId = admin id, rawTime = creation time, name = chat name
+// Member: chatId, userId, rawTime = allowed raw time
+// Message: id, chatId, userId = sender id, rawTime, data = text
+// Prune: id = messages of chatId up to this id are deleted
+// Password: id = user id, data = hash replacing the plain password of an older log
+struct LogRecord {
+    LogRecordType type{};
+    int32_t id{};
+    int32_t chatId{};
+    int32_t userId{};
+    int64_t rawTime{};
+    std::string name{};
+    std::string data{};
+
+    MSGPACK_DEFINE (type, id, chatId, userId, rawTime, name, data)
+};
+
+
+MSGPACK_ADD_ENUM(LogRecordType)
+
+
+// Thread-safe, append-only segmented log, in-memory indexes are rebuilt by replaying segments on startup
+class LogStorage : public Storage {
+    struct UserEntry {
+        std::string username{};
+        std::string password{};
+    };
+
+    struct MessageEntry {
+        int32_t id{};
+        int32_t senderId{};
+        time_t rawTime{};
+        std::string text{};
+    };
+
+    struct ChatEntry {
+        std::string name{};
+        int32_t adminId{};
+        time_t creationRawTime{};
+        std::vector<MessageEntry> messages{};
+        // messages up to this id are pruned, kept by compaction so message ids are never reused
+        int32_t prunedId{};
+    };
+
+    // Segments up to sealedIndex are rewritten by compaction outside the lock, later ones are appended meanwhile
+    // and are moved after the rewritten ones. Passwords and pruned ids are taken at sealing by user and chat id - 1
+    struct Compaction {
+        size_t sealedIndex{};
+        size_t sealedBytes{};
+        size_t sealedGarbageBytes{};
+        std::vector<std::string> passwords{};
+        std::vector<int32_t> prunedIds{};
+        size_t segments{};
+        size_t bytes{};
+    };
+
+    // Records of a batch of changes, validated against indexes and the records before them and appended together.
+    // Names, members and message ids added by the batch are found here until the records are applied
+    struct ChangeBatch {
+        std::vector<LogRecord> records{};
+        std::unordered_map<std::string, int32_t> userIds{};
+        std::unordered_map<std::string, int32_t> chatIds{};
+        std::set<std::pair<int32_t, int32_t>> members{};
+        std::set<std::pair<int32_t, int32_t>> messages{};
+        int32_t lastMessageId{};
+    };
+
+    static constexpr size_t defaultSegmentSize = 64 * 1024 * 1024;
+
+    std::string directory{};
+    size_t segmentSize{};
+    std::mutex mutex{};
+    // taken by reclaimSpace before mutex, one compaction runs at a time
+    std::mutex compactionMutex{};
+
+    std::ofstream segment{};
+    size_t segmentIndex{};
+    size_t segmentBytes{};
+
+    // size of all segments and estimated size of records of pruned messages in them
+    size_t logBytes{};
+    size_t garbageBytes{};
+
+    // ids are dense and start from 1, entry of id is stored at id - 1
+    std::vector<UserEntry> users{};
+    std::vector<ChatEntry> chats{};
+    std::unordered_map<std::string, int32_t> userIdsByName{};
+    std::unordered_map<std::string, int32_t> chatIdsByName{};
+    MembershipIndex membership{};
+    int32_t lastMessageId{};
+
+    auto segmentPath(size_t index) const -> std::string;
+
+    static auto segmentPath(const std::string &directory, size_t index) -> std::string;
+
+    // doesn't lock, called from constructor only
+    auto replay() -> void;
+
+    // explicitly locks, appends a hash with configured limits unless stored password of user changed meanwhile
+    auto rehashPassword(int32_t userId, const std::string &stored, const std::string &password) -> void;
+
+    // doesn't lock, must be locked outside
+    auto openSegment(size_t index) -> void;
+
+    // doesn't lock, must be locked outside, writes record to the current segment
+    auto write(const LogRecord &record, bool flush = true) -> void;
+
+    // doesn't lock, must be locked outside, writes record to the log and then applies it to indexes
+    auto append(const LogRecord &record) -> void;
+
+    // doesn't lock, must be locked outside, writes records with one flush and then applies them
+    auto append(const std::vector<LogRecord> &records) -> void;
+
+    // doesn't lock, must be locked outside, starts a new segment and takes what rewriting the older ones needs
+    auto sealLog() -> Compaction;
+
+    // doesn't lock, reads sealed segments only, writes their live records to the compaction directory
+    auto writeCompaction(Compaction &compaction) const -> void;
+
+    // doesn't lock, must be locked outside, moves segments written since sealing after compacted ones and swaps
+    // directories
+    auto finishCompaction(const Compaction &compaction) -> void;
+
+    // doesn't lock, must be locked outside
+    auto apply(const LogRecord &record) -> void;
+
+    // doesn't lock, must be locked outside
+    auto findChat(const std::string &chatName) -> ChatEntry *;
+
+    // doesn't lock, must be locked outside, adds the record of change to batch unless its row exists, throws if change
+    // refers to an unknown user or chat. Hashes are password hashes of user changes by username
+    auto addChange(const Change &change, const std::unordered_map<std::string, std::string> &hashes,
+                   ChangeBatch &batch) -> void;
+
+    // doesn't lock, must be locked outside
+    auto visitChat(int32_t chatId, const std::function<void(const Change &)> &visitor) -> void;
+
+public:
+    LogStorage();
+
+    explicit LogStorage(const std::string &directory, size_t segmentSize = defaultSegmentSize);
+
+    // explicitly locks
+    auto getUserId(const std::string &username) -> int32_t override;
+
+    // explicitly locks
+    auto getUsername(int32_t userId) -> std::string override;
+
+    // explicitly locks
+    auto getAllUsers() -> std::set<User> override;
+
+    // explicitly locks
+    auto authenticateUser(const std::string &username, const std::string &password) -> AuthenticationResult override;
+
+    // explicitly locks
+    auto createUser(const std::string &username, const std::string &password) -> void override;
+
+    // explicitly locks
+    auto createChat(const std::string &chatName, const int32_t &adminId, const std::vector<int32_t> &userIds) -> bool override;
+
+    // explicitly locks
+    auto getChatId(const std::string &chatName) -> int32_t override;
+
+    // explicitly locks
+    auto getChatName(int chatId) -> std::string override;
+
+    // explicitly locks
+    auto getChatsByTime(int32_t userId, time_t rawTime) -> std::vector<std::string> override;
+
+    // explicitly locks
+    auto createMessage(const std::string &chatName, int32_t senderId, time_t rawTime, const std::string &data) -> int32_t override;
+
+    // explicitly locks
+    auto getAllMessagesFromChat(const std::string &chatName, int32_t userId) -> std::vector<ChatMessage> override;
+
+    // explicitly locks
+    auto getMessagesFromChatSince(
+            const std::string &chatName,
+            int32_t userId,
+            int32_t afterId
+    ) -> std::vector<ChatMessage> override;
+
+    // explicitly locks
+    auto getRecentMessages(const std::string &chatName, size_t limit) -> std::vector<StoredMessage> override;
+
+    // explicitly locks
+    auto getUserAllowedRawTime(int32_t chatId, int32_t userId) -> time_t override;
+
+    // doesn't lock, reads membership index
+    auto isChatMember(int32_t chatId, int32_t userId) -> bool override;
+
+    // explicitly locks
+    auto getChatMembers(const std::string &chatName) -> std::vector<ChatMember> override;
+
+    // explicitly locks
+    auto getRecentlyActiveChats(size_t messagesWindow) -> std::vector<std::string> override;
+
+    // explicitly locks
+    auto getRecentlyActiveUsers(size_t messagesWindow) -> std::vector<User> override;
+
+    // explicitly locks
+    auto getLastMessages() -> std::vector<Change> override;
+
+    // explicitly locks
+    auto countMessagesSince(int32_t afterId) -> std::vector<MessageCount> override;
+
+    // explicitly locks
+    auto inviteUserToChat(
+            const std::string &chatName,
+            int32_t invitorId,
+            int32_t userId,
+            bool allowHistorySharing = false
+    ) -> void override;
+
+    // explicitly locks
+    auto inviteUsersToChat(
+            const std::string &chatName,
+            int32_t invitorId,
+            const std::vector<int32_t> &userIds,
+            bool allowHistorySharing = false
+    ) -> std::vector<InviteStatus> override;
+
+    // explicitly locks, prunes a prefix of chat messages
+    auto pruneMessages(const std::string &chatName, time_t olderThan, size_t keepLatest, size_t batchSize) -> size_t override;
+
+    // explicitly locks
+    auto getPrunedId(const std::string &chatName) -> int32_t override;
+
+    // explicitly locks, compacts log once pruned records take half of it, the lock is held for sealing and the swap
+    // only
+    auto reclaimSpace() -> int64_t override;
+
+    // explicitly locks
+    auto scanChanges(const std::function<void(const Change &)> &visitor) -> void override;
+
+    // explicitly locks
+    auto openChangeCursor() -> ChangeCursor override;
+
+    // explicitly locks
+    auto scanChangesPage(
+            ChangeCursor &cursor,
+            size_t limit,
+            const std::function<void(const Change &)> &visitor
+    ) -> bool override;
+
+    // explicitly locks
+    auto scanChatChanges(const std::string &chatName, const std::function<void(const Change &)> &visitor) -> void override;
+
+    // explicitly locks
+    auto applyChanges(const std::vector<Change> &changes) -> void override;
+};
+
+
+#endif //CP_LOG_STORAGE_HPP
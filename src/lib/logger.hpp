@@ -0,0 +1,169 @@
+#ifndef CP_LOGGER_HPP
+#define CP_LOGGER_HPP
+
+
+#include <mutex>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <concepts>
+#include <string_view>
+#include <condition_variable>
+
+#include "metrics.hpp"
+#include "messaging.hpp"
+
+
+enum class LogLevel {
+    Debug,
+    Info,
+    Warning,
+    Error
+};
+
+
+// lines below this level aren't compiled in, 0 Debug, 1 Info, 2 Warning, 3 Error
+#ifndef CP_LOG_LEVEL
+#define CP_LOG_LEVEL 1
+#endif
+
+
+// connection, user and request a line is about, absent fields aren't written
+struct LogContext {
+    uint64_t connectionId{};
+    std::string_view username{};
+    std::optional<MessageType> type{};
+};
+
+
+// Thread-safe, every thread formats lines into its own ring without locks or allocations, a background thread
+// drains rings every drainInterval and writes them with one write per stream. Info and Debug go to stdout,
+// Warning and Error to stderr. Lines which don't fit into a full ring are dropped and counted
+class Logger {
+    static constexpr size_t ringCapacity = 256;
+    static constexpr size_t usernameCapacity = 32;
+    static constexpr size_t textCapacity = 192;
+    static constexpr auto drainInterval = std::chrono::milliseconds(50);
+
+    // trivial, so ring memory isn't touched until entries are written
+    struct Entry {
+        int64_t timeNs;
+        LogLevel level;
+        uint64_t connectionId;
+        // -1 if line isn't about a request
+        int32_t type;
+        uint8_t usernameSize;
+        uint8_t textSize;
+        char username[usernameCapacity];
+        char text[textCapacity];
+    };
+
+    // single producer single consumer, drained under mutex so there is one consumer at a time
+    struct Ring {
+        std::unique_ptr<Entry[]> entries{new Entry[ringCapacity]};
+        std::atomic<size_t> head{};
+        std::atomic<size_t> tail{};
+    };
+
+    std::mutex mutex{};
+    std::condition_variable condition{};
+    // ring of exited thread is removed once drained, logger holds its last reference
+    std::vector<std::shared_ptr<Ring>> rings{};
+    bool stopping{};
+
+    std::atomic<uint64_t> written{};
+    std::atomic<uint64_t> dropped{};
+
+    std::thread drainer{};
+
+    Logger();
+
+    // ring of calling thread, registered on first use
+    auto localRing() -> Ring &;
+
+    // claims next entry of calling thread, nullptr if its ring is full
+    auto claim(LogLevel level, const LogContext &context) -> Entry *;
+
+    // makes entry claimed by calling thread visible to drainer
+    auto commit() -> void;
+
+    auto drainLoop() -> void;
+
+    // explicitly locks
+    auto drain() -> void;
+
+    static auto append(Entry &entry, std::string_view value) -> void;
+
+    static auto append(Entry &entry, const char *value) -> void;
+
+    static auto append(Entry &entry, const std::string &value) -> void;
+
+    static auto append(Entry &entry, bool value) -> void;
+
+    static auto append(Entry &entry, double value) -> void;
+
+    template<std::integral T>
+    static auto append(Entry &entry, T value) -> void;
+
+public:
+    Logger(const Logger &) = delete;
+
+    auto operator=(const Logger &) -> Logger & = delete;
+
+    // writes lines logged so far
+    ~Logger();
+
+    static auto get() -> Logger &;
+
+    // text is concatenation of parts, it's cut at textCapacity
+    template<class... Parts>
+    auto write(LogLevel level, const LogContext &context, const Parts &... parts) -> void;
+
+    // blocks until lines logged so far are written
+    auto flush() -> void;
+
+    auto exportMetrics(Metrics &metrics) -> void;
+};
+
+
+template<std::integral T>
+auto Logger::append(Entry &entry, const T value) -> void {
+    const auto [end, error] = std::to_chars(entry.text + entry.textSize, entry.text + textCapacity, value);
+    if (error == std::errc()) {
+        entry.textSize = static_cast<uint8_t>(end - entry.text);
+    }
+}
+
+
+template<class... Parts>
+auto Logger::write(const LogLevel level, const LogContext &context, const Parts &... parts) -> void {
+    const auto entry = claim(level, context);
+    if (!entry) {
+        return;
+    }
+    (append(*entry, parts), ...);
+    commit();
+}
+
+
+// lines filtered out by CP_LOG_LEVEL cost nothing, their arguments aren't evaluated
+#define CP_LOG(level, ...)                                                  \
+    do {                                                                    \
+        if constexpr (static_cast<int>(level) >= CP_LOG_LEVEL) {            \
+            Logger::get().write(level, __VA_ARGS__);                        \
+        }                                                                   \
+    } while (false)
+
+#define CP_LOG_DEBUG(...) CP_LOG(LogLevel::Debug, __VA_ARGS__)
+#define CP_LOG_INFO(...) CP_LOG(LogLevel::Info, __VA_ARGS__)
+#define CP_LOG_WARNING(...) CP_LOG(LogLevel::Warning, __VA_ARGS__)
+#define CP_LOG_ERROR(...) CP_LOG(LogLevel::Error, __VA_ARGS__)
+
+
+#endif //CP_LOGGER_HPP
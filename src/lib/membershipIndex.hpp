@@ -0,0 +1,60 @@
+#ifndef CP_MEMBERSHIP_INDEX_HPP
+#define CP_MEMBERSHIP_INDEX_HPP
+
+
+#include <ctime>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "storage.hpp"
+
+
+// Thread-safe, members of every chat and chats of every user, so that access checks don't touch storage.
+// Members are kept as columns sorted by user id, a chat with 100k members takes 1.2 MB and a check is
+// a binary search over 400 KB of ids. Chat names are known for chats added with addChat.
+class MembershipIndex {
+    struct Members {
+        std::vector<int32_t> userIds{};
+        std::vector<time_t> allowedRawTimes{};
+    };
+
+    mutable std::shared_mutex mutex{};
+    std::unordered_map<int32_t, Members> members{};
+    // sorted chat ids
+    std::unordered_map<int32_t, std::vector<int32_t>> userChats{};
+    std::unordered_map<std::string, int32_t> chatIds{};
+    std::unordered_map<int32_t, std::string> chatNames{};
+    size_t size{};
+
+public:
+    auto addChat(int32_t chatId, const std::string &chatName) -> void;
+
+    // returns false if user is already a member, members loaded in user id order are appended
+    auto addMember(int32_t chatId, int32_t userId, time_t allowedRawTime) -> bool;
+
+    // merges users into chat in one pass, existing members are skipped, returns number of added members
+    auto addMembers(int32_t chatId, std::vector<int32_t> userIds, time_t allowedRawTime) -> size_t;
+
+    // -1 if chat isn't known
+    auto getChatId(const std::string &chatName) const -> int32_t;
+
+    // empty if chat isn't known
+    auto getChatName(int32_t chatId) const -> std::string;
+
+    auto findAllowedRawTime(int32_t chatId, int32_t userId) const -> std::optional<time_t>;
+
+    auto getMembers(int32_t chatId) const -> std::vector<ChatMember>;
+
+    // ids of chats which user was allowed into after rawTime
+    auto getChatsByTime(int32_t userId, time_t rawTime) const -> std::vector<int32_t>;
+
+    // number of memberships
+    auto getSize() const -> size_t;
+};
+
+
+#endif //CP_MEMBERSHIP_INDEX_HPP
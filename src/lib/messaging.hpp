@@ -9,6 +9,7 @@
 #include <utility>
 
 
+#include "user.hpp"
 #include "auth.hpp"
 #include "chatMessage.hpp"
 
@@ -23,7 +24,16 @@ enum class MessageType {
     GetAllMessagesFromChat,
     InviteUserToChat,
     ClientError,
-    ServerError
+    ServerError,
+    GetMessagesFromChatSince,
+    ResumeSession,
+    Heartbeat,
+    GetServerStats,
+    GetRecentChats,
+    MarkRead,
+    InviteUsersToChat,
+    Restarting,
+    Event
 };
 
 
@@ -34,6 +44,9 @@ struct MessageData {
     bool flag{};
     std::vector<std::string> vector{};
     std::vector<ChatMessage> chatMessages{};
+    // numbers belonging to entries of vector, e.g. unread counts of chats or invite statuses of users, incremental
+    // history responses carry the pruned id of the chat instead
+    std::vector<int64_t> numbers{};
 
     MessageData() = default;
 
@@ -45,7 +58,7 @@ struct MessageData {
     MessageData(std::string username, std::string buffer) : name(std::move(username)),
                                                             buffer(std::move(buffer)) {}
 
-    MSGPACK_DEFINE (time, name, buffer, flag, vector, chatMessages)
+    MSGPACK_DEFINE (time, name, buffer, flag, vector, chatMessages, numbers)
 };
 
 
@@ -66,8 +79,20 @@ struct Message {
 
 auto sendMessage(zmqpp::socket &socket, const Message &message) -> void;
 
+// sends message packed beforehand
+auto sendPackage(zmqpp::socket &socket, const msgpack::sbuffer &package) -> void;
+
 auto receiveMessage(zmqpp::socket &socket, Message &message) -> void;
 
+// returns false on receive timeout instead of throwing
+auto tryReceiveMessage(zmqpp::socket &socket, Message &message) -> bool;
+
+// enumerator name, e.g. "CreateMessage"
+auto getMessageTypeName(MessageType type) -> std::string;
+
+// throws std::runtime_error for unknown names
+auto parseMessageType(const std::string &name) -> MessageType;
+
 
 MSGPACK_ADD_ENUM(MessageType)
 MSGPACK_ADD_ENUM(AuthenticationStatus)
@@ -0,0 +1,30 @@
+#ifndef CP_METRICS_HPP
+#define CP_METRICS_HPP
+
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+// Thread-safe registry of named gauges and counters, dumped as "name value" lines by GetServerStats
+class Metrics {
+    std::mutex mutex{};
+    std::map<std::string, int64_t> values{};
+
+public:
+    auto set(const std::string &name, int64_t value) -> void;
+
+    auto add(const std::string &name, int64_t delta = 1) -> void;
+
+    // returns 0 for unknown names
+    auto get(const std::string &name) -> int64_t;
+
+    // lines are sorted by name
+    auto dump() -> std::vector<std::string>;
+};
+
+
+#endif //CP_METRICS_HPP
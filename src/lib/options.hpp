@@ -0,0 +1,31 @@
+#ifndef CP_OPTIONS_HPP
+#define CP_OPTIONS_HPP
+
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+
+// Command line options in --name=value form, bare --name means "true"
+class Options {
+    std::unordered_map<std::string, std::string> values{};
+
+public:
+    Options() = default;
+
+    Options(int argc, char *argv[]);
+
+    auto has(const std::string &name) const -> bool;
+
+    auto get(const std::string &name, const std::string &defaultValue) const -> std::string;
+
+    auto getNumber(const std::string &name, int64_t defaultValue) const -> int64_t;
+
+    // comma separated values, empty if option is missing
+    auto getList(const std::string &name) const -> std::vector<std::string>;
+};
+
+
+#endif //CP_OPTIONS_HPP
@@ -0,0 +1,34 @@
+#ifndef CP_PASSWORD_HPP
+#define CP_PASSWORD_HPP
+
+
+#include <string>
+#include <cstddef>
+
+
+// Passwords are stored as salted argon2id hashes in libsodium string format, which carries salt and limits.
+// Rows written before hashing hold plain passwords, they are still verified and rehashed on the next sign-in
+
+// memory of all hashes computed at once, limits of new hashes are sized for it
+constexpr size_t passwordMemoryBudget = 512 * 1024 * 1024;
+
+// sizes limits of new hashes for concurrency hashes at once. Memory of one hash is the budget share, passes are
+// raised as memory shrinks, so a hash takes about as long as with libsodium's interactive limits
+auto configurePasswordHashing(size_t concurrency) -> void;
+
+// throws std::runtime_error if hashing fails, e.g. out of memory
+auto hashPassword(const std::string &password) -> std::string;
+
+auto isPasswordHash(const std::string &stored) -> bool;
+
+// true for plain passwords and hashes with other limits than configured ones
+auto needsRehash(const std::string &stored) -> bool;
+
+// slow on purpose, callers must not hold storage locks while verifying
+auto verifyPassword(const std::string &stored, const std::string &password) -> bool;
+
+// stored itself if it is a hash already, hash of the plain password otherwise
+auto toPasswordHash(const std::string &stored) -> std::string;
+
+
+#endif //CP_PASSWORD_HPP
@@ -0,0 +1,80 @@
+#ifndef CP_PRUNER_HPP
+#define CP_PRUNER_HPP
+
+
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+
+#include "storage.hpp"
+#include "metrics.hpp"
+#include "scheduler.hpp"
+
+
+struct RetentionPolicy {
+    // seconds, 0 keeps messages of any age
+    time_t maxAge{};
+    // 0 keeps any number of messages
+    size_t maxCount{};
+
+    auto isEmpty() const -> bool {
+        return maxAge == 0 && maxCount == 0;
+    }
+};
+
+
+// Background thread enforcing retention. Messages are deleted in batches, every batch takes a bulk scheduler slot
+// and one short storage transaction, so interactive requests wait for one batch at most. Freed space is reclaimed
+// after every pass, onPruned is called from the pruner thread with every chat which lost messages and their number
+class Pruner {
+    Storage &storage;
+    Scheduler &scheduler;
+    Metrics &metrics;
+    RetentionPolicy defaultPolicy{};
+    std::unordered_map<std::string, RetentionPolicy> policies{};
+    size_t batchSize{};
+    std::chrono::milliseconds interval{};
+    std::function<void(const std::string &, size_t)> onPruned{};
+
+    std::mutex mutex{};
+    std::condition_variable condition{};
+    bool running{true};
+    std::thread thread{};
+
+    // returns number of deleted messages
+    auto pruneChat(const std::string &chatName, const RetentionPolicy &policy, int64_t &maxBatchTime) -> size_t;
+
+    auto pass() -> void;
+
+    auto run() noexcept -> void;
+
+public:
+    // policies override defaultPolicy for their chats, an empty default prunes listed chats only
+    Pruner(
+            Storage &storage,
+            Scheduler &scheduler,
+            Metrics &metrics,
+            RetentionPolicy defaultPolicy,
+            std::unordered_map<std::string, RetentionPolicy> policies,
+            size_t batchSize,
+            std::chrono::milliseconds interval,
+            std::function<void(const std::string &, size_t)> onPruned
+    );
+
+    Pruner(const Pruner &) = delete;
+
+    auto operator=(const Pruner &) -> Pruner & = delete;
+
+    // waits for the current batch to finish
+    ~Pruner();
+
+    // "<chat name> <max age> <max count>" lines, names can't contain spaces
+    static auto loadPolicies(const std::string &path) -> std::unordered_map<std::string, RetentionPolicy>;
+};
+
+
+#endif //CP_PRUNER_HPP
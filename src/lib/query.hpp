@@ -0,0 +1,213 @@
+#ifndef CP_QUERY_HPP
+#define CP_QUERY_HPP
+
+
+#include <string>
+#include <cstdint>
+#include <utility>
+#include <concepts>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <sqlite3.h>
+
+
+// blob parameter or column, column blobs are owned by the query like text views
+struct Blob {
+    const void *data{};
+    size_t size{};
+};
+
+
+inline auto bindValue(sqlite3_stmt *stmt, int index, int32_t value) noexcept -> int {
+    return sqlite3_bind_int(stmt, index, value);
+}
+
+
+// matches time_t and int64_t exactly whatever their underlying types are
+template<std::integral T> requires (sizeof(T) == sizeof(int64_t))
+auto bindValue(sqlite3_stmt *stmt, int index, T value) noexcept -> int {
+    return sqlite3_bind_int64(stmt, index, static_cast<sqlite3_int64>(value));
+}
+
+
+// text and blobs are bound with SQLITE_STATIC, they aren't copied and must outlive stepping
+inline auto bindValue(sqlite3_stmt *stmt, int index, std::string_view value) noexcept -> int {
+    // empty view of nullptr would bind NULL
+    return sqlite3_bind_text(stmt, index, value.data() ? value.data() : "", static_cast<int>(value.size()), SQLITE_STATIC);
+}
+
+
+inline auto bindValue(sqlite3_stmt *stmt, int index, const char *value) noexcept -> int {
+    return bindValue(stmt, index, std::string_view(value));
+}
+
+
+inline auto bindValue(sqlite3_stmt *stmt, int index, const std::string &value) noexcept -> int {
+    return bindValue(stmt, index, std::string_view(value));
+}
+
+
+inline auto bindValue(sqlite3_stmt *stmt, int index, Blob value) noexcept -> int {
+    return sqlite3_bind_blob(stmt, index, value.data, static_cast<int>(value.size), SQLITE_STATIC);
+}
+
+
+// reads column of the current row as T, views point into the query and are valid until it's stepped or reset
+template<class T>
+struct Column;
+
+
+template<>
+struct Column<int32_t> {
+    static auto read(sqlite3_stmt *stmt, int index) noexcept -> int32_t {
+        return sqlite3_column_int(stmt, index);
+    }
+};
+
+
+template<>
+struct Column<int64_t> {
+    static auto read(sqlite3_stmt *stmt, int index) noexcept -> int64_t {
+        return sqlite3_column_int64(stmt, index);
+    }
+};
+
+
+template<>
+struct Column<std::string_view> {
+    static auto read(sqlite3_stmt *stmt, int index) noexcept -> std::string_view {
+        // bytes are counted after the conversion to text
+        const auto text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, index));
+        return text ? std::string_view(text, static_cast<size_t>(sqlite3_column_bytes(stmt, index))) : std::string_view();
+    }
+};
+
+
+// copies, for values which outlive the row
+template<>
+struct Column<std::string> {
+    static auto read(sqlite3_stmt *stmt, int index) -> std::string {
+        return std::string(Column<std::string_view>::read(stmt, index));
+    }
+};
+
+
+template<>
+struct Column<Blob> {
+    static auto read(sqlite3_stmt *stmt, int index) noexcept -> Blob {
+        const auto data = sqlite3_column_blob(stmt, index);
+        return Blob{data, static_cast<size_t>(sqlite3_column_bytes(stmt, index))};
+    }
+};
+
+
+template<class... Columns>
+struct FirstColumn {
+    using type = void;
+};
+
+
+template<class First, class... Rest>
+struct FirstColumn<First, Rest...> {
+    using type = First;
+};
+
+
+// Prepared statement whose rows have Columns, prepared once and stepped for many rows. Rows are given to visitors
+// as the columns themselves, text and blobs as views without copies. Throws std::runtime_error on sqlite errors
+template<class... Columns>
+class Query {
+    sqlite3_stmt *stmt{};
+
+    template<class Visitor, size_t... indexes>
+    auto visitRow(Visitor &visitor, std::index_sequence<indexes...>) -> void {
+        visitor(Column<Columns>::read(stmt, static_cast<int>(indexes))...);
+    }
+
+public:
+    Query(sqlite3 *db, const char *sqlQuery) {
+        if (sqlite3_prepare_v2(db, sqlQuery, -1, &stmt, nullptr) != SQLITE_OK) {
+            throw std::runtime_error("sqlite3_prepare_v2 error");
+        }
+    }
+
+    Query(sqlite3 *db, const std::string &sqlQuery) : Query(db, sqlQuery.c_str()) {}
+
+    Query(const Query &) = delete;
+
+    auto operator=(const Query &) -> Query & = delete;
+
+    ~Query() {
+        sqlite3_finalize(stmt);
+    }
+
+    // resets query and binds params to ?1, ?2, ...
+    template<class... Params>
+    auto bind(const Params &... params) -> Query & {
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+        int index = 0;
+        if (((bindValue(stmt, ++index, params) != SQLITE_OK) || ...)) {
+            throw std::runtime_error("sqlite3_bind error");
+        }
+        return *this;
+    }
+
+    // binds one more param after bind, for queries with a variable number of params
+    template<class T>
+    auto bindAt(int index, const T &value) -> Query & {
+        if (bindValue(stmt, index, value) != SQLITE_OK) {
+            throw std::runtime_error("sqlite3_bind error");
+        }
+        return *this;
+    }
+
+    // steps to the end, visitor is called with columns of every row, returns number of rows
+    template<class Visitor>
+    auto forEach(Visitor &&visitor) -> size_t {
+        size_t rows = 0;
+        int status;
+        while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
+            visitRow(visitor, std::index_sequence_for<Columns...>());
+            rows++;
+        }
+        if (status != SQLITE_DONE) {
+            throw std::runtime_error("sqlite3_step error");
+        }
+        return rows;
+    }
+
+    // visits the first row only and resets, returns false if there is no row
+    template<class Visitor>
+    auto first(Visitor &&visitor) -> bool {
+        const auto status = sqlite3_step(stmt);
+        if (status == SQLITE_ROW) {
+            visitRow(visitor, std::index_sequence_for<Columns...>());
+            sqlite3_reset(stmt);
+            return true;
+        }
+        if (status != SQLITE_DONE) {
+            throw std::runtime_error("sqlite3_step error");
+        }
+        return false;
+    }
+
+    // the only column of the first row, defaultValue if there is no row
+    template<class T = typename FirstColumn<Columns...>::type>
+    requires (sizeof...(Columns) == 1 && std::is_arithmetic_v<T>)
+    auto scalar(std::type_identity_t<T> defaultValue) -> T {
+        first([&defaultValue](T value) { defaultValue = value; });
+        return defaultValue;
+    }
+
+    // steps statement which returns no rows
+    auto execute() -> void {
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            throw std::runtime_error("sqlite3_step error");
+        }
+    }
+};
+
+
+#endif //CP_QUERY_HPP
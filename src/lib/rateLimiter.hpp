@@ -0,0 +1,60 @@
+#ifndef CP_RATE_LIMITER_HPP
+#define CP_RATE_LIMITER_HPP
+
+
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include "messaging.hpp"
+
+
+// Requests per second refilled into a bucket of burst tokens, zero rate means unlimited
+struct RateLimit {
+    double rate{};
+    double burst{};
+};
+
+
+// Thread-safe token buckets per user and request type
+class RateLimiter {
+    struct Bucket {
+        double tokens{};
+        std::chrono::steady_clock::time_point updateTime{};
+    };
+
+    std::mutex mutex{};
+    RateLimit defaultLimit{};
+    std::unordered_map<MessageType, RateLimit> limits{};
+    std::unordered_map<uint64_t, Bucket> buckets{};
+
+    // doesn't lock, must be locked outside
+    auto getLimit(MessageType type) const -> RateLimit;
+
+    static auto refill(Bucket &bucket, const RateLimit &limit, std::chrono::steady_clock::time_point now) -> void;
+
+public:
+    RateLimiter() = default;
+
+    explicit RateLimiter(RateLimit defaultLimit);
+
+    auto setDefaultLimit(RateLimit limit) -> void;
+
+    auto setLimit(MessageType type, RateLimit limit) -> void;
+
+    // parses "CreateMessage:5:10,GetAllMessagesFromChat:1:2", rate and then burst
+    auto setLimits(const std::vector<std::string> &specifications) -> void;
+
+    // takes a token of user bucket for type, returns zero if request is admitted
+    // or time after which the next token will be available
+    auto acquire(int32_t userId, MessageType type) -> std::chrono::milliseconds;
+
+    // forgets buckets refilled to their burst, they are equal to new ones
+    auto prune() -> size_t;
+};
+
+
+#endif //CP_RATE_LIMITER_HPP
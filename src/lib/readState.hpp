@@ -0,0 +1,103 @@
+#ifndef CP_READ_STATE_HPP
+#define CP_READ_STATE_HPP
+
+
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <msgpack.hpp>
+
+#include "storage.hpp"
+
+
+struct ChatReadCounter {
+    std::string chatName{};
+    int64_t count{};
+    int32_t lastMessageId{};
+
+    MSGPACK_DEFINE (chatName, count, lastMessageId)
+};
+
+
+struct ReadCursor {
+    int32_t userId{};
+    std::string chatName{};
+    int64_t count{};
+
+    MSGPACK_DEFINE (userId, chatName, count)
+};
+
+
+// Snapshot is consistent with storage up to lastMessageId, later messages are counted from storage on load
+struct ReadStateSnapshot {
+    int32_t lastMessageId{};
+    std::vector<ChatReadCounter> chats{};
+    std::vector<ReadCursor> cursors{};
+
+    MSGPACK_DEFINE (lastMessageId, chats, cursors)
+};
+
+
+// Thread-safe, read cursors of users and unread counts. Every chat counts its messages and a cursor is the count
+// user has read, so a new message is one increment whatever the chat size is and unread count is a subtraction.
+// State is kept in memory and written to a snapshot at most once per flush interval. It is loaded while requests
+// are served: until then counts hold messages created since start only, and loading adds the snapshot and the
+// messages written after it to counters and to cursors set meanwhile
+class ReadState {
+    // ids of latest messages of a chat, cursors set by older ids are approximate
+    static constexpr size_t recentIdsCapacity = 256;
+
+    struct Counter {
+        int64_t count{};
+        int32_t lastMessageId{};
+        std::deque<int32_t> recentIds{};
+        // messages up to this id were counted by loading, ids of a chat are committed in ascending order
+        int32_t loadedId{};
+        // ids counted before loading finished, the ones loading counted too are taken back
+        std::vector<int32_t> loadingIds{};
+    };
+
+    std::string path{};
+    std::chrono::milliseconds flushInterval{};
+
+    std::mutex mutex{};
+    std::unordered_map<std::string, Counter> chats{};
+    std::unordered_map<int32_t, std::unordered_map<std::string, int64_t>> cursors{};
+    int32_t lastMessageId{};
+    // messages up to this id of every chat are in the loaded snapshot
+    int32_t snapshotId{};
+    bool loaded{};
+    bool dirty{};
+    std::chrono::steady_clock::time_point flushTime{};
+
+public:
+    // empty path keeps state in memory only. Reads snapshot and counts messages written after it, without a snapshot
+    // that is every message, so it runs beside serving. Nothing is flushed before it finishes
+    auto load(Storage &storage, const std::string &path, std::chrono::milliseconds flushInterval) -> void;
+
+    // sender who had read everything before its message keeps nothing unread, -1 if sender isn't known
+    auto onMessage(const std::string &chatName, int32_t messageId, int32_t senderId) -> void;
+
+    // user joining a chat starts with nothing unread, cursor of a member is kept
+    auto onJoin(int32_t userId, const std::string &chatName) -> void;
+
+    // the oldest pruned messages of chat up to prunedId are no longer counted, neither as read nor as unread
+    auto onPrune(const std::string &chatName, size_t pruned, int32_t prunedId) -> void;
+
+    // marks messages up to messageId as read, 0 marks the whole chat
+    auto markRead(int32_t userId, const std::string &chatName, int32_t messageId) -> void;
+
+    // users who never marked the chat have all its messages unread
+    auto getUnread(int32_t userId, const std::string &chatName) -> int64_t;
+
+    // writes snapshot if state changed and flush interval passed since the last write, force ignores the interval,
+    // must be called from one thread
+    auto flush(bool force = false) -> void;
+};
+
+
+#endif //CP_READ_STATE_HPP
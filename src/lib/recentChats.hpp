@@ -0,0 +1,60 @@
+#ifndef CP_RECENT_CHATS_HPP
+#define CP_RECENT_CHATS_HPP
+
+
+#include <ctime>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "storage.hpp"
+#include "chatMessage.hpp"
+
+
+// Thread-safe, last activity of every chat with a preview of its last message, so that inboxes are built
+// without reading histories. Loaded from storage once in the background and updated on every created or replicated
+// message, until loading finishes chats missing here are read from storage when an inbox needs them.
+// Inbox of a user is ordered on request by partial sort of its chats, which costs less than keeping
+// an ordered list per member when a message is sent to a large chat
+class RecentChats {
+    static constexpr size_t previewLength = 80;
+
+    struct Activity {
+        int32_t lastMessageId{};
+        time_t rawTime{};
+        std::string senderName{};
+        std::string preview{};
+    };
+
+    mutable std::shared_mutex mutex{};
+    std::unordered_map<std::string, Activity> chats{};
+    std::atomic<bool> loaded{};
+
+    // cuts text to previewLength bytes without splitting UTF-8 sequences
+    static auto makePreview(const std::string &text) -> std::string;
+
+    auto contains(const std::string &chatName) const -> bool;
+
+public:
+    // scans last messages of all chats, runs off the startup path
+    auto load(Storage &storage) -> void;
+
+    // older messages are ignored, so updates may arrive out of order
+    auto update(const std::string &chatName, int32_t messageId, time_t rawTime, const std::string &senderName,
+                const std::string &text) -> void;
+
+    // called when all messages of the chat are deleted
+    auto forget(const std::string &chatName) -> void;
+
+    // limit chats of user with the latest activity first, activity of a chat whose last message is older than
+    // user's allowed raw time is the allowed raw time and its preview is empty. Previews are ChatMessages whose
+    // datetime is the activity time, chatNames[i] is the chat of previews[i]
+    auto getTop(Storage &storage, int32_t userId, size_t limit, std::vector<std::string> &chatNames,
+                std::vector<ChatMessage> &previews) -> void;
+};
+
+
+#endif //CP_RECENT_CHATS_HPP
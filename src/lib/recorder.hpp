@@ -0,0 +1,87 @@
+#ifndef CP_RECORDER_HPP
+#define CP_RECORDER_HPP
+
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <fstream>
+#include <cstdint>
+#include <condition_variable>
+#include <msgpack.hpp>
+
+#include "framing.hpp"
+#include "metrics.hpp"
+#include "messaging.hpp"
+
+
+struct RecordedMessage {
+    // time since recording started
+    int64_t offsetNs{};
+    uint64_t connectionId{};
+    // empty for authentication requests, they carry username themselves
+    std::string username{};
+    Message message{};
+
+    MSGPACK_DEFINE (offsetNs, connectionId, username, message)
+};
+
+
+// Thread-safe, records received messages to a file framed like change files, every frame is a msgpack
+// RecordedMessage. Passwords and session tokens are redacted. Monitors only pack into a shared buffer,
+// a background thread writes it out, records are dropped while the buffer is full
+class Recorder {
+    static constexpr size_t maxBufferedBytes = 64 * 1024 * 1024;
+    static constexpr auto flushInterval = std::chrono::milliseconds(100);
+
+    std::ofstream output{};
+    const std::chrono::steady_clock::time_point start{std::chrono::steady_clock::now()};
+
+    std::mutex mutex{};
+    std::condition_variable condition{};
+    msgpack::sbuffer buffer{};
+    bool stopping{};
+
+    std::atomic<uint64_t> records{};
+    std::atomic<uint64_t> dropped{};
+    std::atomic<uint64_t> bytes{};
+
+    std::thread writer{};
+
+    auto writeLoop() -> void;
+
+    // path itself unless a file is there, then the first of path.1, path.2, ... which isn't
+    static auto choosePath(const std::string &path) -> std::string;
+
+public:
+    // an existing recording, e.g. of the process a restart replaces, is never overwritten, offsets and connection
+    // ids of one file belong to one process
+    explicit Recorder(const std::string &path);
+
+    Recorder(const Recorder &) = delete;
+
+    auto operator=(const Recorder &) -> Recorder & = delete;
+
+    // writes records buffered so far
+    ~Recorder();
+
+    auto record(uint64_t connectionId, const std::string &username, const Message &message) -> void;
+
+    auto exportMetrics(Metrics &metrics) -> void;
+};
+
+
+class RecordReader {
+    FrameReader reader;
+
+public:
+    explicit RecordReader(const std::string &path);
+
+    // returns false at the end of file, throws on truncated or corrupted frame
+    auto read(RecordedMessage &record) -> bool;
+};
+
+
+#endif //CP_RECORDER_HPP
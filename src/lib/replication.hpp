@@ -0,0 +1,246 @@
+#ifndef CP_REPLICATION_HPP
+#define CP_REPLICATION_HPP
+
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <msgpack.hpp>
+#include <zmqpp/zmqpp.hpp>
+
+#include "user.hpp"
+#include "storage.hpp"
+
+
+// Unit of the change stream, one write of primary storage. Heartbeats carry no changes and the sequence of the
+// last published frame. Sync responses carry changes of several frames or one page of a snapshot
+struct ReplicationFrame {
+    uint64_t epoch{};
+    uint64_t sequence{};
+    // milliseconds since unix epoch on primary
+    int64_t publishTime{};
+    std::vector<Change> changes{};
+    // sync responses only, more changes can be requested after sequence
+    bool more{};
+    // sync responses only, snapshot goes on after cursor, sequence is the one it started at
+    bool snapshot{};
+    ChangeCursor cursor{};
+
+    MSGPACK_DEFINE (epoch, sequence, publishTime, changes, more, snapshot, cursor)
+};
+
+
+// Changes after afterSequence of epoch, other epochs and sequences which left the backlog get a snapshot. Snapshots
+// are paged, the next page is requested with snapshot and cursor of the previous one
+struct SyncRequest {
+    uint64_t epoch{};
+    uint64_t afterSequence{};
+    bool snapshot{};
+    ChangeCursor cursor{};
+
+    MSGPACK_DEFINE (epoch, afterSequence, snapshot, cursor)
+};
+
+
+// Decorates storage of a primary server: every committed write is published over a PUB socket, followers which
+// missed frames catch up from the in-memory backlog through a REP socket or get a snapshot if it's too old.
+// Snapshot starts at a sequence and is scanned a page at a time without blocking writes, followers apply
+// the backlog after that sequence once it's complete. Epoch is random per process, sequences of different primary
+// runs can't be confused. Endpoints aren't authenticated, they carry password hashes but must not be exposed
+// beyond the servers' network
+class PublishingStorage : public Storage {
+    static constexpr size_t defaultBacklogCapacity = 64 * 1024;
+
+    std::unique_ptr<Storage> storage{};
+
+    zmqpp::context context{};
+    zmqpp::socket publishSocket{context, zmqpp::socket_type::publish};
+    zmqpp::socket syncSocket{context, zmqpp::socket_type::reply};
+
+    // orders writes with their sequences, guards publishSocket and backlog. Messages are stored before it's taken,
+    // a snapshot may include one which is also in the backlog after its sequence, followers skip it as applied
+    std::mutex mutex{};
+    uint64_t epoch{};
+    uint64_t sequence{};
+    size_t backlogCapacity{};
+    std::deque<ReplicationFrame> backlog{};
+
+    std::atomic<bool> running{true};
+    std::thread syncThread{};
+    // writes after endpoints are released get sequences and go to the backlog only
+    bool released{};
+
+    // doesn't lock, must be locked outside
+    auto publish(std::vector<Change> changes) -> void;
+
+    // doesn't lock, must be locked outside
+    auto sendFrame(const ReplicationFrame &frame) -> void;
+
+    // explicitly locks to read the backlog or to start a snapshot, snapshot pages are scanned without the lock
+    auto makeSyncResponse(const SyncRequest &request) -> ReplicationFrame;
+
+    // answers sync requests and publishes heartbeats
+    auto syncMonitor() noexcept -> void;
+
+public:
+    PublishingStorage(
+            std::unique_ptr<Storage> storage,
+            const std::string &publishEndPoint,
+            const std::string &syncEndPoint,
+            size_t backlogCapacity = defaultBacklogCapacity
+    );
+
+    ~PublishingStorage() override;
+
+    // explicitly locks, stops sync monitor and unbinds both endpoints, so a process taking over can bind them
+    auto releaseEndPoints() -> void;
+
+    auto getUserId(const std::string &username) -> int32_t override;
+
+    auto getUsername(int32_t userId) -> std::string override;
+
+    auto getAllUsers() -> std::set<User> override;
+
+    auto authenticateUser(const std::string &username, const std::string &password) -> AuthenticationResult override;
+
+    // explicitly locks
+    auto createUser(const std::string &username, const std::string &password) -> void override;
+
+    // explicitly locks
+    auto createChat(const std::string &chatName, const int32_t &adminId, const std::vector<int32_t> &userIds) -> bool override;
+
+    auto getChatId(const std::string &chatName) -> int32_t override;
+
+    auto getChatName(int chatId) -> std::string override;
+
+    auto getChatsByTime(int32_t userId, time_t rawTime) -> std::vector<std::string> override;
+
+    // explicitly locks, resolves sender name through storage
+    auto createMessage(const std::string &chatName, int32_t senderId, time_t rawTime, const std::string &data) -> int32_t override;
+
+    // explicitly locks to publish only, messages are stored concurrently. Frames of concurrent messages may go out
+    // of id order, followers keep ids of sqlite storages and give a late message of log storage a new one
+    auto createMessage(const std::string &chatName, const User &sender, time_t rawTime, const std::string &data) -> int32_t;
+
+    auto getAllMessagesFromChat(const std::string &chatName, int32_t userId) -> std::vector<ChatMessage> override;
+
+    auto getMessagesFromChatSince(
+            const std::string &chatName,
+            int32_t userId,
+            int32_t afterId
+    ) -> std::vector<ChatMessage> override;
+
+    auto getRecentMessages(const std::string &chatName, size_t limit) -> std::vector<StoredMessage> override;
+
+    auto getUserAllowedRawTime(int32_t chatId, int32_t userId) -> time_t override;
+
+    auto isChatMember(int32_t chatId, int32_t userId) -> bool override;
+
+    auto getChatMembers(const std::string &chatName) -> std::vector<ChatMember> override;
+
+    auto getRecentlyActiveChats(size_t messagesWindow) -> std::vector<std::string> override;
+
+    auto getRecentlyActiveUsers(size_t messagesWindow) -> std::vector<User> override;
+
+    auto getLastMessages() -> std::vector<Change> override;
+
+    auto countMessagesSince(int32_t afterId) -> std::vector<MessageCount> override;
+
+    // explicitly locks
+    auto inviteUserToChat(
+            const std::string &chatName,
+            int32_t invitorId,
+            int32_t userId,
+            bool allowHistorySharing = false
+    ) -> void override;
+
+    // explicitly locks, invited members are published in one frame
+    auto inviteUsersToChat(
+            const std::string &chatName,
+            int32_t invitorId,
+            const std::vector<int32_t> &userIds,
+            bool allowHistorySharing = false
+    ) -> std::vector<InviteStatus> override;
+
+    // pruning isn't published, followers prune by their own retention policies
+    auto pruneMessages(const std::string &chatName, time_t olderThan, size_t keepLatest, size_t batchSize) -> size_t override;
+
+    auto getPrunedId(const std::string &chatName) -> int32_t override;
+
+    auto reclaimSpace() -> int64_t override;
+
+    auto scanChanges(const std::function<void(const Change &)> &visitor) -> void override;
+
+    auto openChangeCursor() -> ChangeCursor override;
+
+    auto scanChangesPage(
+            ChangeCursor &cursor,
+            size_t limit,
+            const std::function<void(const Change &)> &visitor
+    ) -> bool override;
+
+    auto scanChatChanges(const std::string &chatName, const std::function<void(const Change &)> &visitor) -> void override;
+
+    // explicitly locks
+    auto applyChanges(const std::vector<Change> &changes) -> void override;
+};
+
+
+// Tails change stream of a primary into storage of a follower server, each frame is applied in one transaction. Synchronizes through the sync endpoint
+// on start and whenever a frame is missed, applied changes are reported to onChange from the follower thread
+class Follower {
+    Storage &storage;
+    std::string publishEndPoint{};
+    std::string syncEndPoint{};
+    std::function<void(const Change &)> onChange{};
+
+    zmqpp::context context{};
+
+    // follower thread only, cursor is the position of an unfinished snapshot
+    uint64_t epoch{};
+    uint64_t sequence{};
+    bool snapshot{};
+    ChangeCursor cursor{};
+
+    // primary publish time up to which all changes are applied
+    std::atomic<int64_t> freshTime{};
+    std::atomic<uint64_t> appliedSequence{};
+    std::atomic<uint64_t> resyncs{};
+
+    std::atomic<bool> running{true};
+    std::thread thread{};
+
+    auto apply(const ReplicationFrame &frame) -> void;
+
+    // returns false if primary didn't answer
+    auto sync(zmqpp::socket &syncSocket) -> bool;
+
+    auto follow() noexcept -> void;
+
+public:
+    Follower(
+            Storage &storage,
+            const std::string &publishEndPoint,
+            const std::string &syncEndPoint,
+            std::function<void(const Change &)> onChange
+    );
+
+    ~Follower();
+
+    // how far behind primary the follower is known to be, grows while primary is silent
+    auto lag() const -> std::chrono::milliseconds;
+
+    auto getAppliedSequence() const -> uint64_t;
+
+    auto getResyncs() const -> uint64_t;
+};
+
+
+#endif //CP_REPLICATION_HPP
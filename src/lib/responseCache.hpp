@@ -0,0 +1,81 @@
+#ifndef CP_RESPONSE_CACHE_HPP
+#define CP_RESPONSE_CACHE_HPP
+
+
+#include <list>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <shared_mutex>
+#include <unordered_map>
+#include <msgpack.hpp>
+
+#include "messaging.hpp"
+#include "chatMessage.hpp"
+
+
+// Thread-safe, packed chatMessages and senders of whole history responses per chat and visibility start, so that repeated
+// history reads of a chat only copy bytes. New messages are packed and appended on write instead of invalidating.
+// Chats are evicted least recently used first when over budget
+class ResponseCache {
+    struct Entry {
+        time_t allowedRawTime{};
+        // packed dictionary-encoded ChatMessages without array header
+        std::string body{};
+        uint32_t count{};
+        int32_t lastId{};
+        std::vector<std::string> senders{};
+        std::unordered_map<std::string, int32_t> senderIndexes{};
+        size_t sendersBytes{};
+    };
+
+    struct ChatEntry {
+        std::vector<Entry> entries{};
+        std::list<std::string>::iterator lruPosition{};
+    };
+
+    static constexpr size_t defaultBudget = 32 * 1024 * 1024;
+
+    size_t budget{};
+    size_t bytes{};
+
+    mutable std::shared_mutex mutex{};
+    std::unordered_map<std::string, ChatEntry> chats{};
+    // changes of every chat ever written, lets store detect writes which raced with its storage read
+    std::unordered_map<std::string, uint64_t> generations{};
+    // front is the most recently stored
+    std::list<std::string> lru{};
+
+    static auto getEntryBytes(const Entry &entry) -> size_t;
+
+    // doesn't lock, must be locked outside
+    auto eraseChat(const std::string &chatName) -> void;
+
+public:
+    ResponseCache();
+
+    explicit ResponseCache(size_t budget);
+
+    // packs response to request as if its chatMessages and vector were the cached history and its senders and
+    // time its last id and numbers empty like in responses built by server, returns false on miss
+    auto pack(const Message &request, time_t allowedRawTime, msgpack::sbuffer &package) const -> bool;
+
+    // must be taken before history is read from storage and passed to store
+    auto getGeneration(const std::string &chatName) const -> uint64_t;
+
+    // messages are encoded with senders, ignored if chat changed since generation was taken
+    auto store(const std::string &chatName, time_t allowedRawTime, const std::vector<ChatMessage> &messages,
+               const std::vector<std::string> &senders, uint64_t generation) -> void;
+
+    // appends message with username set to every cached response of the chat, encoding it with senders of
+    // the response, responses whose last id is newer are dropped
+    auto append(const std::string &chatName, time_t rawTime, const ChatMessage &message) -> void;
+
+    auto invalidate(const std::string &chatName) -> void;
+
+    auto getBytes() const -> size_t;
+};
+
+
+#endif //CP_RESPONSE_CACHE_HPP
@@ -0,0 +1,94 @@
+#ifndef CP_SCHEDULER_HPP
+#define CP_SCHEDULER_HPP
+
+
+#include <array>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <condition_variable>
+
+#include "metrics.hpp"
+
+
+enum class RequestClass {
+    // short reads and writes a user waits for
+    Interactive,
+    // history dumps which may scan whole chats
+    Bulk
+};
+
+
+// Thread-safe admission of requests to storage. Each class has its own budget of concurrently running requests,
+// requests of a class are admitted in arrival order and bulk ones only while no interactive request waits
+class Scheduler {
+    // max scheduling delay of requests admitted during one second
+    struct DelayBucket {
+        int64_t second{-1};
+        int64_t maxDelay{};
+    };
+
+    // max delay is exported over this many latest seconds, exports every few hundred milliseconds can't reset it
+    static constexpr size_t delayWindow = 60;
+
+    struct ClassState {
+        size_t budget{};
+        size_t running{};
+        std::deque<uint64_t> queue{};
+
+        // scheduling delay in microseconds, bucket of second is at second % delayWindow
+        uint64_t admitted{};
+        int64_t totalDelay{};
+        std::array<DelayBucket, delayWindow> delayBuckets{};
+    };
+
+    static constexpr size_t defaultInteractiveBudget = 8;
+    static constexpr size_t defaultBulkBudget = 2;
+
+    std::mutex mutex{};
+    std::condition_variable condition{};
+    std::array<ClassState, 2> classes{};
+    uint64_t nextTicket{};
+
+    // doesn't lock, must be locked outside
+    auto canRun(RequestClass requestClass, uint64_t ticket) -> bool;
+
+    // explicitly locks, blocks until request is admitted
+    auto acquire(RequestClass requestClass) -> void;
+
+    // explicitly locks
+    auto release(RequestClass requestClass) -> void;
+
+    static auto getClassName(RequestClass requestClass) -> std::string;
+
+    static auto currentSecond() -> int64_t;
+
+public:
+    // Admits request on construction and releases its budget on destruction
+    class Slot {
+        Scheduler &scheduler;
+        RequestClass requestClass;
+
+    public:
+        Slot(Scheduler &scheduler, RequestClass requestClass);
+
+        Slot(const Slot &) = delete;
+
+        auto operator=(const Slot &) -> Slot & = delete;
+
+        ~Slot();
+    };
+
+    Scheduler();
+
+    Scheduler(size_t interactiveBudget, size_t bulkBudget);
+
+    auto configure(size_t interactiveBudget, size_t bulkBudget) -> void;
+
+    // sets queue, running and scheduling delay gauges of every class, delay max is the max of the latest minute
+    auto exportMetrics(Metrics &metrics) -> void;
+};
+
+
+#endif //CP_SCHEDULER_HPP
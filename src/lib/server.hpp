@@ -0,0 +1,225 @@
+#ifndef CP_SERVER_HPP
+#define CP_SERVER_HPP
+
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <zmqpp/zmqpp.hpp>
+
+#include "user.hpp"
+#include "storage.hpp"
+#include "metrics.hpp"
+#include "messaging.hpp"
+#include "sessions.hpp"
+#include "replication.hpp"
+#include "pruner.hpp"
+#include "handoff.hpp"
+#include "recorder.hpp"
+#include "eventHub.hpp"
+#include "readState.hpp"
+#include "recentChats.hpp"
+#include "scheduler.hpp"
+#include "rateLimiter.hpp"
+#include "historyCache.hpp"
+#include "responseCache.hpp"
+#include "connectionManager.hpp"
+
+
+class Server {
+    std::unique_ptr<Storage> db{};
+    // db itself when configured to publish, its endpoints are released on handoff
+    PublishingStorage *publishing{};
+    std::unique_ptr<HistoryCache> historyCache{std::make_unique<HistoryCache>()};
+    std::unique_ptr<ResponseCache> responseCache{std::make_unique<ResponseCache>()};
+    std::unique_ptr<SessionTable> sessions{std::make_unique<SessionTable>()};
+
+    // set on read-only followers of another server, reads are rejected when it lags more than maxStaleness
+    std::unique_ptr<Follower> follower{};
+    std::chrono::milliseconds maxStaleness{};
+
+    // embedding code may share its context to connect through inproc://
+    zmqpp::context ownContext{};
+    zmqpp::context &context;
+    zmqpp::socket pullSocket{context, zmqpp::socket_type::pull};
+    std::atomic<bool> running{true};
+
+    // set by restart, monitors answer Restarting instead of serving requests and endpoint is handed over
+    std::atomic<bool> draining{};
+    // requests being served, handoff waits for them so the new process sees all their writes
+    std::atomic<size_t> inFlight{};
+    std::string handoffPath{};
+    std::chrono::milliseconds drainTimeout{};
+    // chats cached by the previous process, loaded by warmup
+    std::vector<std::string> handoffChats{};
+
+    // usernames are resolved lazily through storage and remembered, ids never change
+    std::shared_mutex usersMutex{};
+    std::unordered_map<std::string, int32_t> users{};
+
+    // pruned ids of chats are resolved lazily through storage too and refreshed after pruning
+    std::shared_mutex prunedIdsMutex{};
+    std::unordered_map<std::string, int32_t> prunedIds{};
+
+    Metrics metrics{};
+    ConnectionManager connections{};
+
+    // records received messages when configured
+    std::unique_ptr<Recorder> recorder{};
+
+    // fans typing indicators and alike out to online chat members when configured
+    std::unique_ptr<EventHub> events{};
+    std::chrono::milliseconds idleTimeout{};
+
+    // unlimited until configureRateLimits, the server executable configures limits by default, see its usage
+    RateLimiter rateLimiter{};
+    // announcements beyond it are answered with a retry hint by connection monitor instead of spawning monitors
+    size_t maxHandshakes{};
+    std::atomic<size_t> handshakes{};
+
+    RecentChats recentChats{};
+
+    // loaded on run, empty path keeps read cursors in memory only
+    ReadState readState{};
+    std::string readStatePath{};
+    std::chrono::milliseconds readStateFlushInterval{5000};
+
+    // started on run unless both default policy and per chat policies are empty
+    std::unique_ptr<Pruner> pruner{};
+    RetentionPolicy retentionPolicy{};
+    std::unordered_map<std::string, RetentionPolicy> retentionPolicies{};
+    size_t pruneBatch{};
+    std::chrono::milliseconds pruneInterval{};
+
+    // storage requests wait here, so history dumps can't stall interactive requests
+    Scheduler scheduler{};
+
+    size_t warmupWindow{};
+    const std::chrono::steady_clock::time_point startTime{std::chrono::steady_clock::now()};
+    std::atomic<bool> firstRequestServed{};
+
+    auto findUser(const std::string &username) -> std::optional<User>;
+
+    auto rememberUser(const User &user) -> void;
+
+    auto getPrunedId(const std::string &chatName) -> int32_t;
+
+    // called by pruner, forgets cached history and counts of messages chat has lost
+    auto onPruned(const std::string &chatName, size_t pruned) -> void;
+
+    // runs beside serving, loads recent chats and then preloads histories
+    auto warmup() noexcept -> void;
+
+    // loads and removes snapshot of the previous process if there is one
+    auto takeOver() -> void;
+
+    // waits for requests being served, releases endpoints, writes snapshot and then tells connected clients
+    // to reconnect until they are gone or drain timeout passes
+    auto handOver() -> void;
+
+    auto connectionMonitor() -> void;
+
+    auto attachClient(uint64_t connectionId, zmqpp::socket &clientSocket, const std::string &clientEndPoint) -> User;
+
+    auto clientMonitor(uint64_t connectionId, const std::string &clientEndPoint) noexcept -> void;
+
+    // reaps finished monitors, evicts idle connections and refreshes connection gauges
+    auto maintainConnections() -> void;
+
+    static auto estimateBytes(const Message &message) -> size_t;
+
+    // returns false and replaces message with error if follower can't serve it
+    auto admitOnFollower(Message &message) -> bool;
+
+    // writes read state snapshot when it's due, failures are counted and retried when due again
+    auto flushReadState() noexcept -> void;
+
+    // interactive requests which always touch storage, history reads are scheduled on cache miss only
+    static auto isStorageRequest(MessageType type) -> bool;
+
+    // returns false and replaces message with throttling error if user exceeded its rate
+    auto admitByRate(const User &user, Message &message) -> bool;
+
+public:
+    Server();
+
+    explicit Server(zmqpp::context &context);
+
+    static auto get() -> Server &;
+
+    auto configureStorage(std::unique_ptr<Storage> storage) -> void;
+
+    auto configureHistoryCache(size_t capacity, size_t budget) -> void;
+
+    // budget in bytes of packed whole history responses
+    auto configureResponseCache(size_t budget) -> void;
+
+    // publishes committed writes of configured storage to followers, must be called after configureStorage
+    auto configurePublishing(const std::string &publishEndPoint, const std::string &syncEndPoint) -> void;
+
+    // makes server a read-only follower of the publishing server, must be called after configureStorage
+    auto configureFollower(const std::string &publishEndPoint, const std::string &syncEndPoint, size_t maxStaleness) -> void;
+
+    // snapshot of read cursors and unread counts written at most once per flushInterval milliseconds,
+    // empty path keeps them in memory only
+    auto configureReadState(const std::string &path, size_t flushInterval) -> void;
+
+    // policies file has "<chat name> <max age> <max count>" lines which override defaultPolicy, empty path means none.
+    // Messages are pruned every pruneInterval milliseconds in batches of pruneBatch
+    auto configureRetention(
+            RetentionPolicy defaultPolicy,
+            const std::string &policiesPath,
+            size_t pruneBatch,
+            size_t pruneInterval
+    ) -> void;
+
+    // empty path keeps sessions in memory only, lifetime is in seconds
+    auto configureSessions(const std::string &path, time_t lifetime) -> void;
+
+    // number of latest messages whose chats and senders are preloaded on start, 0 preloads none
+    auto configureWarmup(size_t messagesWindow) -> void;
+
+    // connections without requests or heartbeats for idleTimeout milliseconds are closed
+    auto configureIdleTimeout(size_t idleTimeout) -> void;
+
+    // defaultLimit applies to request types without their own "<type>:<rate>:<burst>" limit
+    auto configureRateLimits(RateLimit defaultLimit, const std::vector<std::string> &limits) -> void;
+
+    // number of interactive and bulk requests which may use storage at the same time
+    auto configureScheduler(size_t interactiveBudget, size_t bulkBudget) -> void;
+
+    // number of clients which may be authenticating at the same time, password hashes are sized to fit them in memory
+    auto configureMaxHandshakes(size_t maxHandshakes) -> void;
+
+    // state of a restarted server is written to path and loaded from it on run, clients are told to reconnect
+    // for at most drainTimeout milliseconds
+    auto configureHandoff(const std::string &path, size_t drainTimeout) -> void;
+
+    // ephemeral events are published on endPoint, repeated ones are coalesced to one per interval milliseconds
+    // and deliveries beyond queueCapacity are dropped
+    auto configureEvents(const std::string &endPoint, size_t interval, size_t queueCapacity) -> void;
+
+    // every received message is recorded to path for replay, empty path disables recording
+    auto configureRecording(const std::string &path) -> void;
+
+    auto configurePullSocketEndPoint(const std::string &endPoint) -> void;
+
+    // blocks until stop is called or connection monitor fails
+    auto run() -> void;
+
+    // thread-safe, makes run return after client monitors finish their current requests
+    auto stop() -> void;
+
+    // thread-safe and safe in signal handlers, makes run hand its state and endpoint over to a new process
+    // started with the same handoff path and return, stops like stop without handoff path
+    auto restart() -> void;
+};
+
+
+#endif //CP_SERVER_HPP
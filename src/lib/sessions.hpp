@@ -0,0 +1,87 @@
+#ifndef CP_SESSIONS_HPP
+#define CP_SESSIONS_HPP
+
+
+#include <mutex>
+#include <ctime>
+#include <string>
+#include <fstream>
+#include <optional>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <msgpack.hpp>
+
+#include "user.hpp"
+
+
+// Session as it is handed over to another server process
+struct SessionRecord {
+    std::string token{};
+    int32_t userId{};
+    std::string username{};
+    int64_t expirationTime{};
+
+    MSGPACK_DEFINE (token, userId, username, expirationTime)
+};
+
+
+// Thread-safe, maps tokens issued on sign in to users so that reconnecting clients skip authentication.
+// With a journal path every new session is appended to the journal as a framed SessionRecord and sessions
+// survive restarts
+class SessionTable {
+    struct Session {
+        User user{};
+        time_t expirationTime{};
+    };
+
+    static constexpr time_t defaultLifetime = 7 * 24 * 60 * 60;
+    static constexpr time_t pruneInterval = 60;
+
+    std::string path{};
+    time_t lifetime{};
+
+    std::mutex mutex{};
+    std::ofstream journal{};
+    // records in the journal, live or not
+    size_t journalRecords{};
+    time_t nextPruneTime{};
+    std::unordered_map<std::string, Session> sessions{};
+
+    // doesn't lock, called from constructor only
+    auto load() -> void;
+
+    // doesn't lock, must be locked outside, replaces journal by one holding live sessions only
+    auto rewriteJournal() -> void;
+
+    // doesn't lock, must be locked outside
+    auto writeJournal(const std::string &token, const Session &session) -> void;
+
+    static auto generateToken() -> std::string;
+
+public:
+    SessionTable();
+
+    // empty path keeps sessions in memory only, lifetime is in seconds
+    explicit SessionTable(const std::string &path, time_t lifetime = defaultLifetime);
+
+    auto create(const User &user) -> std::string;
+
+    // returns user of the session if token is valid and belongs to username
+    auto resume(const std::string &username, const std::string &token) -> std::optional<User>;
+
+    // sessions which haven't expired yet
+    auto dump() -> std::vector<SessionRecord>;
+
+    // adds sessions of another table, they are journaled like created ones
+    auto restore(const std::vector<SessionRecord> &records) -> void;
+
+    // drops expired sessions at most once a pruneInterval and rewrites the journal once less than half
+    // of its records are live, returns number of dropped sessions
+    auto prune() -> size_t;
+
+    auto size() -> size_t;
+};
+
+
+#endif //CP_SESSIONS_HPP
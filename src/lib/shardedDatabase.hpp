@@ -0,0 +1,188 @@
+#ifndef CP_SHARDED_DATABASE_HPP
+#define CP_SHARDED_DATABASE_HPP
+
+
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <sqlite3.h>
+
+#include "user.hpp"
+#include "auth.hpp"
+#include "storage.hpp"
+#include "database.hpp"
+#include "chatMessage.hpp"
+
+
+// Thread-safe, users, chats and members are kept in a catalog database, messages of chat with id c are kept in
+// message shard c % shards. Every file has its own connection and lock, so messages of chats in different shards
+// are written in parallel. Message ids are unique across shards and grow in commit order within a shard.
+// Directory keeps the number of shards it was created with
+class ShardedDatabase : public Storage {
+    class Shard {
+        sqlite3 *db{};
+        char *err_msg{};
+
+    public:
+        std::mutex mutex{};
+
+        explicit Shard(const std::string &path);
+
+        Shard(const Shard &) = delete;
+
+        auto operator=(const Shard &) -> Shard & = delete;
+
+        ~Shard();
+
+        auto get() const -> sqlite3 *;
+
+        // doesn't lock, must be locked outside
+        auto executeSqlQuery(const std::string &sql) noexcept -> bool;
+
+        // doesn't lock, must be locked outside, rolls back if body throws
+        auto runTransaction(const std::function<void()> &body) -> void;
+
+        // doesn't lock, must be locked outside, greatest id ever given to a message of the shard
+        auto getLastMessageId() -> int32_t;
+    };
+
+    static constexpr int32_t vacuumPages = 256;
+
+    std::unique_ptr<Database> catalog{};
+    std::vector<std::unique_ptr<Shard>> shards{};
+    // taken under lock of the shard the message is written to
+    std::atomic<int32_t> lastMessageId{};
+
+    // -1 if chat doesn't exist
+    auto shardOf(int32_t chatId) const -> int32_t;
+
+    // explicitly locks catalog for ids which aren't in usernames yet
+    auto resolveUsername(std::unordered_map<int32_t, std::string> &usernames, int32_t userId) -> const std::string &;
+
+    // explicitly locks every shard one by one, values of column of the latest messagesWindow messages of all shards
+    auto selectLatest(const char *column, size_t messagesWindow) -> std::vector<int32_t>;
+
+    // explicitly locks every shard one by one, visitor gets shard index and its locked connection
+    auto forEachShard(const std::function<void(size_t, sqlite3 *)> &visitor) -> void;
+
+public:
+    // shardCount is used only when directory has no shards yet
+    ShardedDatabase(const std::string &directory, size_t shardCount);
+
+    // explicitly locks catalog
+    auto getUserId(const std::string &username) -> int32_t override;
+
+    // explicitly locks catalog
+    auto getUsername(int32_t userId) -> std::string override;
+
+    // explicitly locks catalog
+    auto getAllUsers() -> std::set<User> override;
+
+    // explicitly locks catalog
+    auto authenticateUser(const std::string &username, const std::string &password) -> AuthenticationResult override;
+
+    // explicitly locks catalog
+    auto createUser(const std::string &username, const std::string &password) -> void override;
+
+    // explicitly locks catalog
+    auto createChat(const std::string &chatName, const int32_t &adminId, const std::vector<int32_t> &userIds) -> bool override;
+
+    // doesn't lock, reads membership index
+    auto getChatId(const std::string &chatName) -> int32_t override;
+
+    // doesn't lock, reads membership index
+    auto getChatName(int chatId) -> std::string override;
+
+    // doesn't lock, reads membership index
+    auto getChatsByTime(int32_t userId, time_t rawTime) -> std::vector<std::string> override;
+
+    // explicitly locks shard of chat
+    auto createMessage(const std::string &chatName, int32_t senderId, time_t rawTime, const std::string &data) -> int32_t override;
+
+    // explicitly locks shard of chat and catalog
+    auto getAllMessagesFromChat(const std::string &chatName, int32_t userId) -> std::vector<ChatMessage> override;
+
+    // explicitly locks shard of chat and catalog
+    auto getMessagesFromChatSince(
+            const std::string &chatName,
+            int32_t userId,
+            int32_t afterId
+    ) -> std::vector<ChatMessage> override;
+
+    // explicitly locks shard of chat, then catalog
+    auto getRecentMessages(const std::string &chatName, size_t limit) -> std::vector<StoredMessage> override;
+
+    // doesn't lock, reads membership index
+    auto getUserAllowedRawTime(int32_t chatId, int32_t userId) -> time_t override;
+
+    // doesn't lock, reads membership index
+    auto isChatMember(int32_t chatId, int32_t userId) -> bool override;
+
+    // doesn't lock, reads membership index
+    auto getChatMembers(const std::string &chatName) -> std::vector<ChatMember> override;
+
+    // explicitly locks every shard one by one
+    auto getRecentlyActiveChats(size_t messagesWindow) -> std::vector<std::string> override;
+
+    // explicitly locks every shard one by one and catalog
+    auto getRecentlyActiveUsers(size_t messagesWindow) -> std::vector<User> override;
+
+    // explicitly locks every shard one by one and catalog
+    auto getLastMessages() -> std::vector<Change> override;
+
+    // explicitly locks every shard one by one
+    auto countMessagesSince(int32_t afterId) -> std::vector<MessageCount> override;
+
+    // explicitly locks catalog
+    auto inviteUserToChat(
+            const std::string &chatName,
+            int32_t invitorId,
+            int32_t userId,
+            bool allowHistorySharing = false
+    ) -> void override;
+
+    // explicitly locks catalog
+    auto inviteUsersToChat(
+            const std::string &chatName,
+            int32_t invitorId,
+            const std::vector<int32_t> &userIds,
+            bool allowHistorySharing = false
+    ) -> std::vector<InviteStatus> override;
+
+    // explicitly locks shard of chat
+    auto pruneMessages(const std::string &chatName, time_t olderThan, size_t keepLatest, size_t batchSize) -> size_t override;
+
+    // explicitly locks shard of chat
+    auto getPrunedId(const std::string &chatName) -> int32_t override;
+
+    // explicitly locks every shard one by one, runs incremental vacuum of at most vacuumPages pages of each
+    auto reclaimSpace() -> int64_t override;
+
+    // explicitly locks catalog, then every shard one by one. Messages are visited shard by shard, not in id order
+    auto scanChanges(const std::function<void(const Change &)> &visitor) -> void override;
+
+    // explicitly locks catalog
+    auto openChangeCursor() -> ChangeCursor override;
+
+    // explicitly locks catalog for users, chats and members, then every shard one by one for messages
+    auto scanChangesPage(
+            ChangeCursor &cursor,
+            size_t limit,
+            const std::function<void(const Change &)> &visitor
+    ) -> bool override;
+
+    // explicitly locks catalog, then shard of chat
+    auto scanChatChanges(const std::string &chatName, const std::function<void(const Change &)> &visitor) -> void override;
+
+    // explicitly locks catalog, then every shard. Catalog and every shard apply their part in own transaction,
+    // so a failed batch may be partially applied, applying it again skips the applied rows
+    auto applyChanges(const std::vector<Change> &changes) -> void override;
+};
+
+
+#endif //CP_SHARDED_DATABASE_HPP
@@ -0,0 +1,401 @@
+#include <thread>
+#include <algorithm>
+
+
+#include "../broker.hpp"
+#include "../logger.hpp"
+
+
+constexpr int32_t backendTimeout = 10 * 1000;
+constexpr int32_t sendTimeout = 10 * 1000;
+constexpr int32_t receiveTimeout = 10 * 1000;
+constexpr int32_t pollInterval = 250;
+
+// three missed heartbeats of clients, which send one every 2 seconds while idle
+constexpr size_t defaultIdleTimeout = 6 * 1000;
+
+// inbox size servers use when request doesn't set one
+constexpr int32_t defaultRecentChats = 20;
+
+// signing in to a follower is retried while a new user isn't replicated yet, which usually takes milliseconds
+constexpr int32_t readerSignInAttempts = 3;
+constexpr auto readerSignInBackoff = std::chrono::milliseconds(100);
+
+
+Broker::Broker(
+        std::vector<std::string> backendEndPoints,
+        std::vector<std::string> readEndPoints
+) : backendEndPoints(std::move(backendEndPoints)), readEndPoints(std::move(readEndPoints)),
+    idleTimeout(defaultIdleTimeout) {
+    if (this->backendEndPoints.empty()) {
+        throw std::runtime_error("broker needs at least one backend");
+    }
+    if (!this->readEndPoints.empty() && this->readEndPoints.size() != this->backendEndPoints.size()) {
+        throw std::runtime_error("every backend needs its follower");
+    }
+}
+
+
+auto Broker::shardOf(const std::string &key, const size_t shardsCount) -> size_t {
+    // FNV-1a, std::hash isn't guaranteed to be the same between builds
+    uint64_t hash = 14695981039346656037ull;
+    for (const auto c: key) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash % shardsCount;
+}
+
+
+auto Broker::connectionMonitor() -> void {
+    CP_LOG_INFO({}, "broker connectionMonitor started");
+    try {
+        zmqpp::poller poller;
+        poller.add(pullSocket);
+
+        while (running) {
+            metrics.add("connections.reaped", static_cast<int64_t>(connections.reap()));
+            metrics.add("connections.evicted", static_cast<int64_t>(connections.evictIdle(idleTimeout)));
+            metrics.set("connections.live", static_cast<int64_t>(connections.size()));
+
+            if (!poller.poll(pollInterval) || !poller.has_input(pullSocket)) {
+                continue;
+            }
+
+            zmqpp::message message;
+            pullSocket.receive(message);
+
+            std::string s;
+            message >> s;
+
+            connections.spawn(s, [this, s](const uint64_t connectionId) { clientMonitor(connectionId, s); });
+            metrics.add("connections.accepted");
+        }
+    } catch (zmqpp::exception &exception) {
+        CP_LOG_ERROR({}, "broker connectionMonitor caught zmqpp exception: ", exception.what());
+    }
+    CP_LOG_INFO({}, "broker connectionMonitor exiting");
+}
+
+
+auto Broker::attachClient(
+        zmqpp::socket &clientSocket,
+        const std::string &clientEndPoint,
+        Client &client
+) -> void {
+    clientSocket.set(zmqpp::socket_option::send_timeout, sendTimeout);
+    clientSocket.set(zmqpp::socket_option::receive_timeout, receiveTimeout);
+    clientSocket.connect(clientEndPoint);
+
+    Message authRequest;
+    receiveMessage(clientSocket, authRequest);
+    client.username = authRequest.data.name;
+
+    auto &backends = client.backends;
+    for (const auto &endPoint: backendEndPoints) {
+        backends.push_back(std::make_unique<Connection>(context, endPoint, "", backendTimeout));
+    }
+    client.readers.resize(readEndPoints.size());
+
+    // home shard decides on credentials, the others follow it
+    const auto home = shardOf(client.username, backends.size());
+    auto status = AuthenticationStatus::InvalidSession;
+    if (authRequest.type == MessageType::SignIn || authRequest.type == MessageType::SignUp) {
+        const auto &password = authRequest.data.buffer;
+        status = backends[home]->authenticate(authRequest.type, client.username, password);
+        for (size_t shard = 0; shard < backends.size() && status == AuthenticationStatus::Success; shard++) {
+            if (shard == home) {
+                continue;
+            }
+            status = backends[shard]->authenticate(authRequest.type, client.username, password);
+            // left by a sign up interrupted halfway
+            if (authRequest.type == MessageType::SignUp && status == AuthenticationStatus::Exists) {
+                status = backends[shard]->authenticate(MessageType::SignIn, client.username, password);
+            }
+        }
+        for (size_t shard = 0; status == AuthenticationStatus::Success && shard < client.readers.size(); shard++) {
+            signInReader(client, shard, password);
+        }
+    } else if (authRequest.type == MessageType::ResumeSession) {
+        std::vector<std::string> tokens;
+        for (size_t begin = 0, end; begin <= authRequest.data.buffer.size(); begin = end + 1) {
+            end = std::min(authRequest.data.buffer.find(',', begin), authRequest.data.buffer.size());
+            tokens.push_back(authRequest.data.buffer.substr(begin, end - begin));
+        }
+
+        if (tokens.size() >= backends.size()) {
+            status = AuthenticationStatus::Success;
+            for (size_t shard = 0; shard < backends.size() && status == AuthenticationStatus::Success; shard++) {
+                status = backends[shard]->authenticate(MessageType::ResumeSession, client.username, tokens[shard]);
+            }
+        }
+
+        // followers may have restarted since, their sessions are optional
+        for (size_t shard = 0; status == AuthenticationStatus::Success && shard < client.readers.size() &&
+                               backends.size() + shard < tokens.size(); shard++) {
+            auto reader = std::make_unique<Connection>(context, readEndPoints[shard], "", backendTimeout);
+            const auto &token = tokens[backends.size() + shard];
+            if (!token.empty() && reader->authenticate(MessageType::ResumeSession, client.username, token) ==
+                                  AuthenticationStatus::Success) {
+                client.readers[shard] = std::move(reader);
+            }
+        }
+    } else {
+        sendMessage(clientSocket, Message(MessageType::ClientError));
+        throw std::runtime_error("invalid massage type");
+    }
+
+    Message authResponse;
+    authResponse.authenticationStatus = status;
+    if (status == AuthenticationStatus::Success) {
+        for (const auto &backend: backends) {
+            authResponse.data.buffer += backend->getSessionToken() + ",";
+        }
+        for (const auto &reader: client.readers) {
+            authResponse.data.buffer += (reader ? reader->getSessionToken() : "") + ",";
+        }
+        authResponse.data.buffer.pop_back();
+    }
+    sendMessage(clientSocket, authResponse);
+
+    if (status != AuthenticationStatus::Success) {
+        throw std::runtime_error("auth error");
+    }
+}
+
+
+auto Broker::signInReader(Client &client, const size_t shard, const std::string &password) -> void {
+    for (int32_t attempt = 0; attempt < readerSignInAttempts; attempt++) {
+        if (attempt != 0) {
+            std::this_thread::sleep_for(readerSignInBackoff * attempt);
+        }
+
+        try {
+            auto reader = std::make_unique<Connection>(context, readEndPoints[shard], "", backendTimeout);
+            const auto status = reader->authenticate(MessageType::SignIn, client.username, password);
+            if (status == AuthenticationStatus::Success) {
+                client.readers[shard] = std::move(reader);
+                return;
+            }
+            if (status != AuthenticationStatus::NotExists) {
+                return;
+            }
+        } catch (std::runtime_error &) {
+            return;
+        }
+    }
+}
+
+
+auto Broker::forwardRead(Client &client, const size_t shard, Message &message) -> void {
+    const auto reader = shard < client.readers.size() ? client.readers[shard].get() : nullptr;
+    if (reader) {
+        auto response = message;
+        try {
+            forward(*reader, response);
+            // stale or failed follower, primary answers instead
+            if (response.type != MessageType::ServerError) {
+                metrics.add("reads.follower");
+                message = std::move(response);
+                return;
+            }
+        } catch (std::runtime_error &) {
+            client.readers[shard].reset();
+        }
+    }
+
+    metrics.add("reads.primary");
+    forward(*client.backends[shard], message);
+}
+
+
+auto Broker::forward(Connection &backend, Message &message) -> void {
+    const auto request = message;
+    try {
+        backend.request(message);
+    } catch (std::runtime_error &) {
+        if (!backend.reconnect()) {
+            throw;
+        }
+        metrics.add("backends.reconnected");
+        message = request;
+        backend.request(message);
+    }
+}
+
+
+auto Broker::route(Client &client, Message &message) -> void {
+    auto &backends = client.backends;
+    switch (message.type) {
+        case MessageType::CreateChat: {
+            forward(*backends[shardOf(message.data.buffer, backends.size())], message);
+            break;
+        }
+        case MessageType::CreateMessage:
+        case MessageType::InviteUserToChat:
+        case MessageType::InviteUsersToChat:
+        case MessageType::MarkRead:
+        case MessageType::Event: {
+            forward(*backends[shardOf(message.data.name, backends.size())], message);
+            break;
+        }
+        case MessageType::GetAllMessagesFromChat:
+        case MessageType::GetMessagesFromChatSince: {
+            forwardRead(client, shardOf(message.data.name, backends.size()), message);
+            break;
+        }
+        case MessageType::UpdateChats: {
+            // chats of user are spread over shards, the earliest shard time keeps the next update complete
+            Message merged = message;
+            merged.data.vector.clear();
+            for (size_t shard = 0; shard < backends.size(); shard++) {
+                auto response = message;
+                forwardRead(client, shard, response);
+                if (response.type != MessageType::UpdateChats) {
+                    message = std::move(response);
+                    return;
+                }
+                merged.data.time = shard == 0 ? response.data.time : std::min(merged.data.time, response.data.time);
+                merged.data.vector.insert(merged.data.vector.end(), response.data.vector.begin(),
+                                          response.data.vector.end());
+            }
+            message = std::move(merged);
+            break;
+        }
+        case MessageType::GetRecentChats: {
+            // every shard returns its own top, timestamps are formatted as sortable strings.
+            // Read cursors aren't replicated, so primaries answer
+            if (message.data.time <= 0) {
+                message.data.time = defaultRecentChats;
+            }
+            struct Entry {
+                std::string chatName{};
+                ChatMessage preview{};
+                int64_t unread{};
+            };
+            std::vector<Entry> entries;
+            for (size_t shard = 0; shard < backends.size(); shard++) {
+                auto response = message;
+                forward(*backends[shard], response);
+                if (response.type != MessageType::GetRecentChats) {
+                    message = std::move(response);
+                    return;
+                }
+                const auto &data = response.data;
+                for (size_t i = 0; i < data.vector.size() && i < data.chatMessages.size(); i++) {
+                    entries.push_back(Entry{data.vector[i], data.chatMessages[i],
+                                            i < data.numbers.size() ? data.numbers[i] : 0});
+                }
+            }
+
+            std::stable_sort(entries.begin(), entries.end(), [](const Entry &lhs, const Entry &rhs) -> bool {
+                return lhs.preview.datetime > rhs.preview.datetime;
+            });
+            entries.resize(std::min(entries.size(), static_cast<size_t>(message.data.time)));
+            message.data.vector.clear();
+            message.data.chatMessages.clear();
+            message.data.numbers.clear();
+            for (auto &entry: entries) {
+                message.data.vector.push_back(std::move(entry.chatName));
+                message.data.chatMessages.push_back(std::move(entry.preview));
+                message.data.numbers.push_back(entry.unread);
+            }
+            break;
+        }
+        case MessageType::Heartbeat: {
+            // shards evict idle connections too
+            for (auto &backend: backends) {
+                backend->heartbeat();
+            }
+            for (auto &reader: client.readers) {
+                try {
+                    if (reader) {
+                        reader->heartbeat();
+                    }
+                } catch (std::runtime_error &) {
+                    reader.reset();
+                }
+            }
+            break;
+        }
+        case MessageType::GetServerStats: {
+            std::vector<std::string> lines;
+            for (size_t shard = 0; shard < backends.size(); shard++) {
+                auto response = message;
+                forward(*backends[shard], response);
+                for (const auto &line: response.data.vector) {
+                    lines.push_back("shard" + std::to_string(shard) + "." + line);
+                }
+            }
+            for (const auto &line: metrics.dump()) {
+                lines.push_back("broker." + line);
+            }
+            message.data.vector = std::move(lines);
+            break;
+        }
+        default: {
+            message = Message(MessageType::ClientError, MessageData("Unsupported request"));
+            break;
+        }
+    }
+}
+
+
+auto Broker::clientMonitor(const uint64_t connectionId, const std::string &clientEndPoint) noexcept -> void {
+    try {
+        zmqpp::socket clientSocket(context, zmqpp::socket_type::reply);
+        clientSocket.set(zmqpp::socket_option::linger, 0);
+
+        Client client;
+        attachClient(clientSocket, clientEndPoint, client);
+        connections.attach(connectionId, client.username);
+        connections.touch(connectionId, 0);
+        clientSocket.set(zmqpp::socket_option::receive_timeout, pollInterval);
+
+        while (running) {
+            Message message;
+            if (!tryReceiveMessage(clientSocket, message)) {
+                if (connections.isEvicted(connectionId)) {
+                    throw std::runtime_error("connection evicted as idle");
+                }
+                continue;
+            }
+            connections.touch(connectionId, 0);
+            metrics.add("requests.routed");
+
+            try {
+                route(client, message);
+            } catch (std::runtime_error &exception) {
+                CP_LOG_ERROR(LogContext{connectionId, {}, message.type}, "backend failed: ", exception.what());
+                metrics.add("backends.failed");
+                message = Message(MessageType::ServerError);
+            }
+            sendMessage(clientSocket, message);
+        }
+    } catch (zmqpp::exception &exception) {
+        CP_LOG_WARNING(LogContext{connectionId}, "caught zmq exception: ", exception.what());
+    } catch (std::runtime_error &exception) {
+        CP_LOG_WARNING(LogContext{connectionId}, exception.what());
+    }
+}
+
+
+auto Broker::configureIdleTimeout(const size_t idleTimeout) -> void {
+    this->idleTimeout = std::chrono::milliseconds(idleTimeout);
+}
+
+
+auto Broker::configurePullSocketEndPoint(const std::string &endPoint) -> void {
+    pullSocket.bind(endPoint);
+}
+
+
+auto Broker::run() -> void {
+    connectionMonitor();
+    connections.joinAll();
+}
+
+
+auto Broker::stop() -> void {
+    running = false;
+}
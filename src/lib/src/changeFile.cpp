@@ -0,0 +1,50 @@
+#include <stdexcept>
+
+
+#include "../changeFile.hpp"
+
+
+ChangeWriter::ChangeWriter(const std::string &path) : output(path, std::ios::binary | std::ios::trunc) {
+    if (!output) {
+        throw std::runtime_error("can't open " + path);
+    }
+}
+
+
+auto ChangeWriter::write(const Change &change) -> void {
+    package.clear();
+    msgpack::pack(&package, change);
+
+    writeFrame(output, package);
+    bytes += frameHeaderSize + package.size();
+}
+
+
+auto ChangeWriter::close() -> void {
+    output.close();
+    if (!output) {
+        throw std::runtime_error("export write error");
+    }
+}
+
+
+auto ChangeWriter::getBytes() const -> uint64_t {
+    return bytes;
+}
+
+
+ChangeReader::ChangeReader(const std::string &path) : reader(path) {}
+
+
+auto ChangeReader::read(Change &change) -> bool {
+    const auto status = reader.read(change);
+    if (status == FrameStatus::Torn) {
+        throw std::runtime_error("truncated or corrupted export frame");
+    }
+    return status == FrameStatus::Read;
+}
+
+
+auto ChangeReader::getBytes() const -> uint64_t {
+    return reader.getOffset();
+}
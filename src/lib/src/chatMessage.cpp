@@ -0,0 +1,37 @@
+#include <unordered_map>
+
+
+#include "../chatMessage.hpp"
+
+
+auto encodeSenders(std::vector<ChatMessage> &messages, std::vector<std::string> &senders) -> size_t {
+    std::unordered_map<std::string, int32_t> indexes;
+    for (size_t i = 0; i < senders.size(); i++) {
+        indexes.try_emplace(senders[i], static_cast<int32_t>(i));
+    }
+
+    size_t removedBytes = 0;
+    for (auto &message: messages) {
+        if (message.sender != -1) {
+            continue;
+        }
+        const auto [it, inserted] = indexes.try_emplace(message.username, static_cast<int32_t>(senders.size()));
+        if (inserted) {
+            senders.push_back(message.username);
+        }
+        removedBytes += message.username.size();
+        message.username.clear();
+        message.sender = it->second;
+    }
+    return removedBytes;
+}
+
+
+auto getSenderName(const ChatMessage &message, const std::vector<std::string> &senders) -> const std::string & {
+    static const std::string unknown;
+    if (message.sender == -1) {
+        return message.username;
+    }
+    return message.sender >= 0 && static_cast<size_t>(message.sender) < senders.size() ? senders[message.sender]
+                                                                                        : unknown;
+}
@@ -0,0 +1,159 @@
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <filesystem>
+
+
+#include "../clientCache.hpp"
+
+
+auto ClientCache::cacheDirectory() -> std::string {
+    if (const auto xdgCacheHome = std::getenv("XDG_CACHE_HOME")) {
+        return std::string(xdgCacheHome) + "/cp";
+    }
+    if (const auto home = std::getenv("HOME")) {
+        return std::string(home) + "/.cache/cp";
+    }
+    return ".cp_cache";
+}
+
+
+ClientCache::ClientCache(const std::string &serverEndPoint, const std::string &username) {
+    auto fileName = serverEndPoint + "_" + username;
+    std::replace_if(fileName.begin(), fileName.end(), [](const char c) -> bool {
+        return !std::isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '-' && c != '.';
+    }, '_');
+    path = cacheDirectory() + "/" + fileName + ".cache";
+
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+        return;
+    }
+
+    const std::string package{std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+    try {
+        msgpack::unpacked unpackedSnapshot;
+        msgpack::unpack(unpackedSnapshot, package.data(), package.size());
+        unpackedSnapshot.get().convert(snapshot);
+    } catch (std::exception &) {
+        snapshot = Snapshot();
+    }
+}
+
+
+auto ClientCache::save() -> void {
+    msgpack::sbuffer package;
+    {
+        std::lock_guard lockGuard(mutex);
+        msgpack::pack(&package, snapshot);
+    }
+
+    std::filesystem::create_directories(cacheDirectory());
+    const auto temporaryPath = path + ".tmp";
+    {
+        std::ofstream output(temporaryPath, std::ios::binary | std::ios::trunc);
+        output.write(package.data(), static_cast<std::streamsize>(package.size()));
+        if (!output) {
+            throw std::runtime_error("can't write cache " + temporaryPath);
+        }
+    }
+    std::filesystem::rename(temporaryPath, path);
+}
+
+
+auto ClientCache::getSessionToken() -> std::string {
+    std::lock_guard lockGuard(mutex);
+    return snapshot.sessionToken;
+}
+
+
+auto ClientCache::setSessionToken(const std::string &sessionToken) -> void {
+    std::lock_guard lockGuard(mutex);
+    snapshot.sessionToken = sessionToken;
+}
+
+
+auto ClientCache::getChats() -> std::vector<std::string> {
+    std::lock_guard lockGuard(mutex);
+    return snapshot.chats;
+}
+
+
+auto ClientCache::getLastChatsUpdateTime() -> time_t {
+    std::lock_guard lockGuard(mutex);
+    return snapshot.lastChatsUpdateTime;
+}
+
+
+auto ClientCache::addChats(const std::vector<std::string> &chats, const time_t updateTime) -> void {
+    std::lock_guard lockGuard(mutex);
+    for (const auto &chat: chats) {
+        if (std::find(snapshot.chats.begin(), snapshot.chats.end(), chat) == snapshot.chats.end()) {
+            snapshot.chats.push_back(chat);
+        }
+    }
+    snapshot.lastChatsUpdateTime = updateTime;
+}
+
+
+auto ClientCache::getMessages(const std::string &chatName) -> std::vector<ChatMessage> {
+    std::lock_guard lockGuard(mutex);
+    const auto it = snapshot.histories.find(chatName);
+    return it == snapshot.histories.end() ? std::vector<ChatMessage>() : it->second.messages;
+}
+
+
+auto ClientCache::getSenders(const std::string &chatName) -> std::vector<std::string> {
+    std::lock_guard lockGuard(mutex);
+    const auto it = snapshot.histories.find(chatName);
+    return it == snapshot.histories.end() ? std::vector<std::string>() : it->second.senders;
+}
+
+
+auto ClientCache::getLastMessageId(const std::string &chatName) -> int32_t {
+    std::lock_guard lockGuard(mutex);
+    const auto it = snapshot.histories.find(chatName);
+    return it == snapshot.histories.end() ? 0 : it->second.lastMessageId;
+}
+
+
+auto ClientCache::forgetMessages(const std::string &chatName, const int32_t prunedId) -> void {
+    std::lock_guard lockGuard(mutex);
+    const auto it = snapshot.histories.find(chatName);
+    if (it == snapshot.histories.end()) {
+        return;
+    }
+
+    // messages are cached in id order
+    auto &messages = it->second.messages;
+    messages.erase(messages.begin(), std::upper_bound(messages.begin(), messages.end(), prunedId,
+                                                      [](const int32_t id, const ChatMessage &message) -> bool {
+                                                          return id < message.id;
+                                                      }));
+}
+
+
+auto ClientCache::addMessages(
+        const std::string &chatName,
+        const std::vector<ChatMessage> &messages,
+        const std::vector<std::string> &senders,
+        const int32_t lastMessageId
+) -> void {
+    std::lock_guard lockGuard(mutex);
+    auto &history = snapshot.histories[chatName];
+
+    // indexes of the response are mapped to senders of the chat
+    auto added = messages;
+    for (auto &message: added) {
+        if (message.sender != -1) {
+            message.username = getSenderName(message, senders);
+            message.sender = -1;
+        }
+    }
+    encodeSenders(added, history.senders);
+    history.messages.insert(history.messages.end(), std::make_move_iterator(added.begin()),
+                            std::make_move_iterator(added.end()));
+    history.lastMessageId = std::max(history.lastMessageId, lastMessageId);
+}
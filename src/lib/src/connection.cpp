@@ -0,0 +1,177 @@
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <stdexcept>
+
+
+#include "../connection.hpp"
+#include "../networking.hpp"
+
+
+constexpr int32_t reconnectAttempts = 5;
+constexpr auto initialReconnectBackoff = std::chrono::milliseconds(50);
+
+// busy servers answer announcements with a retry hint, clients follow it a few times
+constexpr int32_t busyAttempts = 3;
+
+
+Connection::Connection(
+        zmqpp::context &context,
+        const std::string &serverEndPoint,
+        const std::string &clientEndPoint,
+        const int32_t timeout
+) : context(context),
+    timeout(timeout),
+    serverEndPoint(serverEndPoint),
+    clientEndPoint(clientEndPoint.empty() ? defaultClientEndPoint(serverEndPoint) : clientEndPoint),
+    serverSocket(context, zmqpp::socket_type::push),
+    clientSocket(context, zmqpp::socket_type::request) {
+
+    serverSocket.set(zmqpp::socket_option::send_timeout, timeout);
+    serverSocket.set(zmqpp::socket_option::receive_timeout, timeout);
+
+    serverSocket.connect(serverEndPoint);
+    configureClientSocket();
+    bindClientSocket();
+}
+
+
+auto Connection::configureClientSocket() -> void {
+    clientSocket.set(zmqpp::socket_option::send_timeout, timeout);
+    clientSocket.set(zmqpp::socket_option::receive_timeout, timeout);
+    // endpoint is bound again on reconnect, unsent requests of the old socket must not hold it
+    clientSocket.set(zmqpp::socket_option::linger, 0);
+}
+
+
+auto Connection::bindClientSocket() -> void {
+    if (clientEndPoint.back() != ':') {
+        clientSocket.bind(clientEndPoint);
+        return;
+    }
+
+    // if testing on same machine with server
+    std::random_device randomDevice;
+    std::mt19937 randomEngine(randomDevice());
+    std::uniform_int_distribution distribution(4000, 9999);
+
+    for (int i = 0; i < 5; i++) {
+        try {
+            const auto endPoint = clientEndPoint + std::to_string(distribution(randomEngine));
+            clientSocket.bind(endPoint);
+            clientEndPoint = endPoint;
+            return;
+        } catch (zmqpp::exception &) {
+            continue;
+        }
+    }
+    throw std::runtime_error("can't find appropriate port");
+}
+
+
+auto Connection::authenticate(
+        const MessageType requestType,
+        const std::string &username,
+        const std::string &secret
+) -> AuthenticationStatus {
+    std::mt19937 randomEngine(std::random_device{}());
+    auto message = Message(requestType, MessageData(username, secret));
+    for (int32_t attempt = 0; attempt < busyAttempts; attempt++) {
+        zmqpp::message connectMessage;
+        connectMessage << clientEndPoint;
+        if (!serverSocket.send(connectMessage, true)) {
+            throw std::runtime_error("send error");
+        }
+
+        message = Message(requestType, MessageData(username, secret));
+        request(message);
+        if (message.type != MessageType::ClientError || message.data.time <= 0) {
+            break;
+        }
+        // clients turned away together mustn't come back together
+        std::uniform_int_distribution jitter(0, message.data.time);
+        std::this_thread::sleep_for(std::chrono::milliseconds(message.data.time + jitter(randomEngine)));
+    }
+    if (message.authenticationStatus == AuthenticationStatus::Success) {
+        this->username = username;
+        sessionToken = message.data.buffer;
+    }
+    return message.authenticationStatus;
+}
+
+
+auto Connection::request(Message &message) -> void {
+    // kept packed, so it can be sent again without a copy of message
+    msgpack::sbuffer package;
+    msgpack::pack(&package, message);
+    sendPackage(clientSocket, package);
+    receiveMessage(clientSocket, message);
+
+    // server didn't serve the request, the process replacing it will
+    if (message.type == MessageType::Restarting) {
+        if (!reconnect()) {
+            throw std::runtime_error("can't resume session after server restart");
+        }
+        sendPackage(clientSocket, package);
+        receiveMessage(clientSocket, message);
+    }
+}
+
+
+auto Connection::heartbeat() -> void {
+    auto message = Message(MessageType::Heartbeat);
+    request(message);
+}
+
+
+auto Connection::reconnect() -> bool {
+    if (sessionToken.empty()) {
+        return false;
+    }
+
+    // a restarted server may still be starting, so failed attempts are retried a few times
+    auto backoff = initialReconnectBackoff;
+    for (int32_t attempt = 0; attempt < reconnectAttempts; attempt++) {
+        if (attempt != 0) {
+            std::this_thread::sleep_for(backoff);
+            backoff *= 2;
+        }
+
+        // request socket can't send again after a missed response
+        clientSocket.close();
+        clientSocket = zmqpp::socket(context, zmqpp::socket_type::request);
+        configureClientSocket();
+        clientSocket.bind(clientEndPoint);
+
+        try {
+            return authenticate(MessageType::ResumeSession, username, sessionToken) == AuthenticationStatus::Success;
+        } catch (std::runtime_error &) {
+            continue;
+        }
+    }
+    return false;
+}
+
+
+auto Connection::getClientEndPoint() const -> const std::string & {
+    return clientEndPoint;
+}
+
+
+auto Connection::getSessionToken() const -> const std::string & {
+    return sessionToken;
+}
+
+
+auto defaultClientEndPoint(const std::string &serverEndPoint) -> std::string {
+    static std::atomic<uint32_t> counter{};
+
+    if (serverEndPoint.rfind("ipc://", 0) == 0) {
+        return "ipc:///tmp/cp-client-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+    } else if (serverEndPoint.rfind("inproc://", 0) == 0) {
+        return "inproc://cp-client-" + std::to_string(counter++);
+    }
+    return "tcp://" + getIP() + ":";
+}
@@ -0,0 +1,130 @@
+#include "../connectionManager.hpp"
+
+
+ConnectionManager::~ConnectionManager() {
+    joinAll();
+}
+
+
+auto ConnectionManager::release(const uint64_t id) -> void {
+    std::lock_guard lockGuard(mutex);
+    const auto it = connections.find(id);
+    if (it == connections.end()) {
+        return;
+    }
+    finished.push_back(std::move(it->second.thread));
+    connections.erase(it);
+}
+
+
+auto ConnectionManager::estimateBytes(const Entry &entry) -> size_t {
+    return sizeof(uint64_t) + sizeof(Entry) + entry.endPoint.capacity() + entry.username.capacity() + entry.bytes;
+}
+
+
+auto ConnectionManager::spawn(const std::string &endPoint, std::function<void(uint64_t)> monitor) -> uint64_t {
+    // lock is held until entry owns the thread, so release of a fast monitor waits for it
+    std::lock_guard lockGuard(mutex);
+    const auto id = nextId++;
+
+    auto &entry = connections[id];
+    entry.endPoint = endPoint;
+    entry.lastActivity = std::chrono::steady_clock::now();
+    entry.thread = std::thread([this, id, monitor = std::move(monitor)] {
+        monitor(id);
+        release(id);
+    });
+    return id;
+}
+
+
+auto ConnectionManager::attach(const uint64_t id, const std::string &username) -> void {
+    std::lock_guard lockGuard(mutex);
+    const auto it = connections.find(id);
+    if (it != connections.end()) {
+        it->second.username = username;
+    }
+}
+
+
+auto ConnectionManager::touch(const uint64_t id, const size_t bytes) -> void {
+    std::lock_guard lockGuard(mutex);
+    const auto it = connections.find(id);
+    if (it != connections.end()) {
+        it->second.lastActivity = std::chrono::steady_clock::now();
+        it->second.bytes = bytes;
+    }
+}
+
+
+auto ConnectionManager::isEvicted(const uint64_t id) -> bool {
+    std::lock_guard lockGuard(mutex);
+    const auto it = connections.find(id);
+    return it == connections.end() || it->second.evicted;
+}
+
+
+auto ConnectionManager::evictIdle(const std::chrono::milliseconds idleTimeout) -> size_t {
+    const auto deadline = std::chrono::steady_clock::now() - idleTimeout;
+
+    std::lock_guard lockGuard(mutex);
+    size_t evicted = 0;
+    for (auto &[id, entry]: connections) {
+        if (!entry.evicted && entry.lastActivity < deadline) {
+            entry.evicted = true;
+            evicted++;
+        }
+    }
+    return evicted;
+}
+
+
+auto ConnectionManager::reap() -> size_t {
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard lockGuard(mutex);
+        threads.swap(finished);
+    }
+
+    // finished monitors are past release, joins don't block for long
+    for (auto &thread: threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    return threads.size();
+}
+
+
+auto ConnectionManager::joinAll() -> void {
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard lockGuard(mutex);
+        for (auto &[id, entry]: connections) {
+            threads.push_back(std::move(entry.thread));
+        }
+    }
+
+    for (auto &thread: threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    reap();
+}
+
+
+auto ConnectionManager::size() -> size_t {
+    std::lock_guard lockGuard(mutex);
+    return connections.size();
+}
+
+
+auto ConnectionManager::bytes() -> size_t {
+    std::lock_guard lockGuard(mutex);
+    size_t bytes = 0;
+    for (const auto &[id, entry]: connections) {
+        bytes += estimateBytes(entry);
+    }
+    return bytes;
+}
@@ -1,36 +1,26 @@
-#include <tuple>
+#include <map>
 #include <utility>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
 
 
 #include "../database.hpp"
+#include "../password.hpp"
+#include "../query.hpp"
 
 
-auto bind(sqlite3_stmt *&sqlite3Stmt, int32_t index, const char *value) noexcept -> bool {
-    return sqlite3_bind_text(sqlite3Stmt, index, value, -1, nullptr) == SQLITE_OK;
-}
-
-
-auto bind(sqlite3_stmt *&sqlite3Stmt, int32_t index, int32_t value) noexcept -> bool {
-    return sqlite3_bind_int(sqlite3Stmt, index, value) == SQLITE_OK;
-}
-
-
-template<class T, size_t index = 0>
-auto bindTuple(
-        sqlite3_stmt *&sqlite3Stmt,
-        const T &tuple
-) noexcept -> typename std::enable_if<index >= std::tuple_size<T>::value, bool>::type {
-    return true;
-}
+// rows of one multi-row members insert, ?1 and ?2 are shared by all rows so the query stays far below
+// the default limit of 999 parameters
+constexpr size_t membersPerInsert = 500;
 
 
-template<class T, size_t index = 0>
-auto bindTuple(
-        sqlite3_stmt *stmt,
-        const T &tuple
-) noexcept -> typename std::enable_if<index < std::tuple_size<T>::value, bool>::type {
-    auto value = std::get<index>(tuple);
-    return bind(stmt, index + 1, value) && bindTuple<T, index + 1>(stmt, tuple);
+auto makeMembersInsertQuery(const size_t rows) -> std::string {
+    std::string sql = "INSERT INTO ChatsInfo(ChatId, UserId, AllowedRawTime) VALUES";
+    for (size_t row = 0; row < rows; row++) {
+        sql += (row == 0 ? " (?1, ?" : ", (?1, ?") + std::to_string(row + 3) + ", ?2)";
+    }
+    return sql;
 }
 
 
@@ -39,182 +29,289 @@ auto Database::executeSqlQuery(const std::string &sql) noexcept -> bool {
 }
 
 
-auto Database::getFormattedDatetime(const time_t rawTime) noexcept -> std::string {
-    time_t _rawTime = rawTime;
-    struct tm *currentTime;
-    time(&_rawTime);
-    currentTime = localtime(&_rawTime);
-
-    const int TIME_STRING_LENGTH = 20;
-    char buffer[TIME_STRING_LENGTH];
-
-    strftime(buffer, TIME_STRING_LENGTH, "%Y-%m-%d %H:%M:%S", currentTime);
-    return std::string(buffer);
-}
-
-
-auto Database::prepareStatement(const char *sqlQuery) noexcept -> bool {
-    return sqlite3_prepare_v2(db, sqlQuery, -1, &stmt, nullptr) == SQLITE_OK;
-}
-
-
-template<class... Args>
-auto Database::bindStatement(Args... args) noexcept -> bool {
-    return bindTuple(stmt, std::make_tuple(args...));
-}
-
-
 auto Database::createChat(
         const std::string &chatName,
         const int32_t &adminId,
         const std::vector<int32_t> &userIds
 ) -> bool {
-    if (isChatExists(chatName)) {
+    if (adminId == -1) {
         return false;
     }
 
     const auto creationRawTime = time(nullptr);
 
-    if (adminId == -1) {
+    // -1 ends the list, repeated users are inserted once
+    std::vector<int32_t> memberIds(userIds.begin(), std::find(userIds.begin(), userIds.end(), -1));
+    std::sort(memberIds.begin(), memberIds.end());
+    memberIds.erase(std::unique(memberIds.begin(), memberIds.end()), memberIds.end());
+
+    std::lock_guard lockGuard(mutex);
+    if (isChatExists(chatName)) {
         return false;
     }
 
-    const auto sqlChatsQuery = "INSERT INTO Chats(Name, AdminId, CreationRawTime) VALUES(?, ?, ?);";
+    int32_t chatId;
+    runTransaction([&] {
+        Query<> insertChat(db, "INSERT INTO Chats(Name, AdminId, CreationRawTime) VALUES(?, ?, ?)");
+        insertChat.bind(chatName, adminId, creationRawTime).execute();
+        chatId = static_cast<int32_t>(sqlite3_last_insert_rowid(db));
+        insertMembers(chatId, memberIds, creationRawTime);
+    });
 
-    mutex.lock();
-    if (!prepareStatement(sqlChatsQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
+    membership.addChat(chatId, chatName);
+    membership.addMembers(chatId, std::move(memberIds), creationRawTime);
+
+    return true;
+}
 
-    if (!bindStatement(chatName.c_str(), adminId, creationRawTime)) {
-        throw std::runtime_error("sqlite3_bind error");
-    }
 
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        throw std::runtime_error("sqlite3_step error");
+auto Database::insertMembers(const int32_t chatId, const std::vector<int32_t> &userIds, const time_t allowedRawTime) -> void {
+    for (size_t offset = 0; offset < userIds.size(); offset += membersPerInsert) {
+        const auto rows = std::min(membersPerInsert, userIds.size() - offset);
+        Query<> insert(db, makeMembersInsertQuery(rows));
+        insert.bind(chatId, allowedRawTime);
+        for (size_t row = 0; row < rows; row++) {
+            insert.bindAt(static_cast<int32_t>(row + 3), userIds[offset + row]);
+        }
+        insert.execute();
     }
+}
 
-    mutex.unlock();
-    const auto chatId = getChatId(chatName);
-    mutex.lock();
 
-    for (const auto &userId : userIds) {
-        const auto sqlChatsInfoQuery = "INSERT INTO ChatsInfo(ChatId, UserId, AllowedRawTime) VALUES(?, ?, ?);";
-        if (userId == -1) {
-            break;
-        }
-        if (!prepareStatement(sqlChatsInfoQuery)) {
-            throw std::runtime_error("sqlite3_prepare_v2 error");
-        }
+auto Database::runTransaction(const std::function<void()> &body) -> void {
+    if (!executeSqlQuery("BEGIN")) {
+        throw std::runtime_error("sqlite3_exec error");
+    }
 
-        if (!bindStatement(chatId, userId, creationRawTime)) {
-            throw std::runtime_error("sqlite3_bind error");
-        }
-        if (sqlite3_step(stmt) != SQLITE_DONE) {
-            throw std::runtime_error("sqlite3_step error");
-        }
+    try {
+        body();
+    } catch (...) {
+        executeSqlQuery("ROLLBACK");
+        throw;
+    }
+
+    if (!executeSqlQuery("COMMIT")) {
+        executeSqlQuery("ROLLBACK");
+        throw std::runtime_error("sqlite3_exec error");
     }
+}
 
-    mutex.unlock();
 
-    return true;
+auto Database::getChatId(const std::string &chatName) -> int32_t {
+    return membership.getChatId(chatName);
 }
 
 
-auto Database::getUserPassword(const std::string &username) -> std::string {
-    const auto sqlQuery = "SELECT Password FROM Users WHERE Username = ?";
+auto Database::isChatExists(const std::string &chatName) -> bool {
+    return getChatId(chatName) != -1;
+}
+
 
+auto Database::getAllUsers() -> std::set<User> {
     std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
+    Query<int32_t, std::string_view> query(db, "SELECT Id, Username FROM Users");
+
+    std::set<User> users;
+    query.forEach([&users](const int32_t id, const std::string_view username) {
+        users.emplace(id, std::string(username));
+    });
+    return users;
+}
+
+
+auto Database::authenticateUser(const std::string &username, const std::string &password) -> AuthenticationResult {
+    int32_t id = -1;
+    std::string storedPassword;
+    {
+        std::lock_guard lockGuard(mutex);
+        Query<int32_t, std::string> query(db, "SELECT Id, Password FROM Users WHERE Username = ?");
+        query.bind(username).first([&id, &storedPassword](const int32_t rowId, std::string rowPassword) {
+            id = rowId;
+            storedPassword = std::move(rowPassword);
+        });
     }
 
-    if (!bindStatement(username.c_str())) {
-        throw std::runtime_error("sqlite3_bind_text error");
+    // hash is verified without the lock, it takes tens of milliseconds
+    if (id == -1) {
+        return AuthenticationResult{AuthenticationStatus::NotExists};
+    }
+    if (!verifyPassword(storedPassword, password)) {
+        return AuthenticationResult{AuthenticationStatus::InvalidPassword};
     }
 
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        return reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
-    } else {
-        throw std::runtime_error("sqlite3_step error");
+    // plain passwords of older files and hashes with other limits are migrated one sign-in at a time
+    if (needsRehash(storedPassword)) {
+        rehashPassword(id, storedPassword, password);
     }
+    return AuthenticationResult{AuthenticationStatus::Success, id};
 }
 
 
-auto Database::getChatId(const std::string &chatName) -> int32_t {
-    const auto sqlQuery = "SELECT Id FROM Chats WHERE Name = ?";
+auto Database::rehashPassword(const int32_t userId, const std::string &stored, const std::string &password) -> void {
+    const auto hash = hashPassword(password);
 
     std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
+    Query<> query(db, "UPDATE Users SET Password = ? WHERE Id = ? AND Password = ?");
+    query.bind(hash, userId, stored).execute();
+}
 
-    if (!bindStatement(chatName.c_str())) {
-        throw std::runtime_error("sqlite3_bind_int error");
-    }
 
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        return sqlite3_column_int(stmt, 0);
-    } else {
-        return -1;
+auto Database::getUserAllowedRawTime(int32_t chatId, int32_t userId) -> time_t {
+    const auto allowedRawTime = membership.findAllowedRawTime(chatId, userId);
+    if (!allowedRawTime) {
+        throw std::runtime_error("user isn't a chat member");
     }
+    return *allowedRawTime;
 }
 
 
-auto Database::isChatExists(const std::string &chatName) -> bool {
-    return getChatId(chatName) != -1;
+auto Database::isChatMember(const int32_t chatId, const int32_t userId) -> bool {
+    return membership.findAllowedRawTime(chatId, userId).has_value();
 }
 
 
-auto Database::getAllUsers() -> std::set<User> {
-    const auto sqlQuery = "SELECT Id, Username FROM Users";
+auto Database::getChatMembers(const std::string &chatName) -> std::vector<ChatMember> {
+    return membership.getMembers(getChatId(chatName));
+}
+
 
+auto Database::getRecentlyActiveChats(const size_t messagesWindow) -> std::vector<std::string> {
     std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
+    Query<std::string_view> query(db, "SELECT Name FROM Chats WHERE Id IN (SELECT ChatId FROM Messages ORDER BY Id DESC LIMIT ?)");
 
-    std::set<User> users;
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        users.insert(
-                User(sqlite3_column_int(stmt, 0), reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)))
-        );
-    }
+    std::vector<std::string> chats;
+    query.bind(static_cast<int64_t>(messagesWindow)).forEach([&chats](const std::string_view chatName) {
+        chats.emplace_back(chatName);
+    });
+    return chats;
+}
+
+
+auto Database::getRecentlyActiveUsers(const size_t messagesWindow) -> std::vector<User> {
+    std::lock_guard lockGuard(mutex);
+    Query<int32_t, std::string_view> query(
+            db, "SELECT Id, Username FROM Users WHERE Id IN (SELECT SenderId FROM Messages ORDER BY Id DESC LIMIT ?)");
 
+    std::vector<User> users;
+    query.bind(static_cast<int64_t>(messagesWindow)).forEach([&users](const int32_t id, const std::string_view username) {
+        users.emplace_back(id, std::string(username));
+    });
     return users;
 }
 
 
-auto Database::authenticateUser(const std::string &username, const std::string &password) -> AuthenticationStatus {
-    if (isUserExist(username)) {
-        if (getUserPassword(username) == password) {
-            return AuthenticationStatus::Success;
-        } else {
-            return AuthenticationStatus::InvalidPassword;
-        }
-    } else {
-        return AuthenticationStatus::NotExists;
+auto Database::forEachChatRange(const std::function<void(int32_t, int32_t)> &body) -> void {
+    const auto lastChatId = [this]() -> int32_t {
+        std::lock_guard lockGuard(mutex);
+        return Query<int32_t>(db, "SELECT IFNULL(MAX(Id), 0) FROM Chats").scalar(0);
+    }();
+    for (int32_t from = 0; from < lastChatId; from += scanChats) {
+        std::lock_guard lockGuard(mutex);
+        body(from, std::min(from + scanChats, lastChatId));
     }
 }
 
 
-auto Database::getUserAllowedRawTime(int32_t chatId, int32_t userId) -> time_t {
-    const auto sqlQuery = "SELECT AllowedRawTime FROM ChatsInfo WHERE ChatId = ? AND UserId = ?";
+auto Database::getLastMessages() -> std::vector<Change> {
+    std::vector<Change> messages;
+    forEachChatRange([this, &messages](const int32_t from, const int32_t to) {
+        Query<int32_t, std::string_view, std::string_view, int64_t, std::string_view> query(
+                db, "SELECT Messages.Id, Chats.Name, Users.Username, Messages.RawTime, Messages.Data "
+                    "FROM Messages JOIN Chats ON Chats.Id = Messages.ChatId "
+                    "JOIN Users ON Users.Id = Messages.SenderId "
+                    "WHERE Messages.Id IN (SELECT MAX(Id) FROM Messages WHERE ChatId > ? AND ChatId <= ? "
+                    "GROUP BY ChatId)");
+        query.bind(from, to).forEach([&messages](const int32_t id, const std::string_view chatName,
+                                                 const std::string_view sender, const int64_t rawTime,
+                                                 const std::string_view text) {
+            messages.push_back(Change{ChangeType::Message, id, std::string(sender), std::string(chatName), rawTime,
+                                      std::string(text)});
+        });
+    });
+    return messages;
+}
 
-    std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
+
+auto Database::countMessagesSince(const int32_t afterId) -> std::vector<MessageCount> {
+    std::vector<MessageCount> counts;
+    forEachChatRange([this, afterId, &counts](const int32_t from, const int32_t to) {
+        Query<std::string_view, int64_t, int32_t> query(
+                db, "SELECT Chats.Name, COUNT(*), MAX(Messages.Id) FROM Messages "
+                    "JOIN Chats ON Chats.Id = Messages.ChatId "
+                    "WHERE Messages.ChatId > ? AND Messages.ChatId <= ? AND Messages.Id > ? GROUP BY Messages.ChatId");
+        query.bind(from, to, afterId).forEach(
+                [&counts](const std::string_view chatName, const int64_t count, const int32_t lastId) {
+                    counts.push_back(MessageCount{std::string(chatName), count, lastId});
+                });
+    });
+    return counts;
+}
+
+
+auto Database::pruneMessages(
+        const std::string &chatName,
+        const time_t olderThan,
+        const size_t keepLatest,
+        const size_t batchSize
+) -> size_t {
+    const auto chatId = getChatId(chatName);
+    if (chatId == -1) {
+        return 0;
     }
 
-    if (!bindStatement(chatId, userId)) {
-        throw std::runtime_error("sqlite_bind error");
+    // one short transaction per batch, foreground queries get the lock between batches
+    std::lock_guard lockGuard(mutex);
+    size_t deleted = 0;
+    runTransaction([&] {
+        // batch is counted first and deleted by the same subquery, DELETE ... RETURNING needs sqlite 3.35
+        const std::string batch = "SELECT Id FROM Messages WHERE ChatId = ?1 AND (RawTime < ?2 OR (?3 > 0 AND Id <= "
+                                  "(SELECT Id FROM Messages WHERE ChatId = ?1 ORDER BY Id DESC LIMIT 1 OFFSET ?3))) "
+                                  "ORDER BY Id LIMIT ?4";
+        int32_t prunedId = 0;
+        Query<int64_t, int32_t> select(db, "SELECT COUNT(*), IFNULL(MAX(Id), 0) FROM (" + batch + ")");
+        select.bind(chatId, olderThan, static_cast<int64_t>(keepLatest), static_cast<int64_t>(batchSize))
+                .first([&deleted, &prunedId](const int64_t count, const int32_t lastId) {
+                    deleted = static_cast<size_t>(count);
+                    prunedId = lastId;
+                });
+        if (deleted != 0) {
+            Query<>(db, "DELETE FROM Messages WHERE Id IN (" + batch + ")")
+                    .bind(chatId, olderThan, static_cast<int64_t>(keepLatest), static_cast<int64_t>(batchSize))
+                    .execute();
+            Query<>(db, "INSERT INTO PrunedChats VALUES(?1, ?2) ON CONFLICT(ChatId) DO UPDATE "
+                        "SET MessageId = MAX(MessageId, excluded.MessageId)").bind(chatId, prunedId).execute();
+        }
+    });
+    return deleted;
+}
+
+
+auto Database::getPrunedId(const std::string &chatName) -> int32_t {
+    const auto chatId = getChatId(chatName);
+    if (chatId == -1) {
+        return 0;
     }
 
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        return sqlite3_column_int(stmt, 0);
-    } else {
-        throw std::runtime_error("sqlite3_step error");
+    std::lock_guard lockGuard(mutex);
+    return Query<int32_t>(db, "SELECT MessageId FROM PrunedChats WHERE ChatId = ?").bind(chatId).scalar(0);
+}
+
+
+auto Database::reclaimSpace() -> int64_t {
+    std::lock_guard lockGuard(mutex);
+    const auto freePages = [this]() -> int64_t {
+        return Query<int64_t>(db, "PRAGMA freelist_count").scalar(0);
+    };
+    const auto pageBytes = Query<int64_t>(db, "PRAGMA page_size").scalar(0);
+
+    const auto before = freePages();
+    if (before == 0) {
+        return 0;
+    }
+    if (!executeSqlQuery("PRAGMA incremental_vacuum(" + std::to_string(vacuumPages) + ");")) {
+        throw std::runtime_error("sqlite3_exec error");
     }
+    return (before - freePages()) * pageBytes;
 }
 
 
@@ -224,25 +321,47 @@ auto Database::inviteUserToChat(
         const int32_t userId,
         bool allowHistorySharing
 ) -> void {
+    inviteUsersToChat(chatName, invitorId, {userId}, allowHistorySharing);
+}
 
+
+auto Database::inviteUsersToChat(
+        const std::string &chatName,
+        const int32_t invitorId,
+        const std::vector<int32_t> &userIds,
+        bool allowHistorySharing
+) -> std::vector<InviteStatus> {
     const auto chatId = getChatId(chatName);
+    if (chatId == -1) {
+        throw std::logic_error("Chat don't exists");
+    }
+
     const auto allowedRawTime = (allowHistorySharing) ?
                                 (getUserAllowedRawTime(chatId, invitorId)) : (time(nullptr));
 
-    const auto sqlQuery = "INSERT INTO ChatsInfo(ChatId, UserId, AllowedRawTime) VALUES(?, ?, ?);";
-
     std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
-
-    if (!bindStatement(chatId, userId, allowedRawTime)) {
-        throw std::runtime_error("sqlite3_bind_int error");
+    std::vector<InviteStatus> statuses;
+    statuses.reserve(userIds.size());
+    std::vector<int32_t> invitedIds;
+    std::unordered_set<int32_t> seenIds;
+    for (const auto userId: userIds) {
+        if (userId == -1) {
+            statuses.push_back(InviteStatus::UnknownUser);
+        } else if (!seenIds.insert(userId).second || membership.findAllowedRawTime(chatId, userId)) {
+            statuses.push_back(InviteStatus::AlreadyMember);
+        } else {
+            statuses.push_back(InviteStatus::Invited);
+            invitedIds.push_back(userId);
+        }
     }
 
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        throw std::runtime_error("sqlite3_step error");
+    if (!invitedIds.empty()) {
+        runTransaction([&] {
+            insertMembers(chatId, invitedIds, allowedRawTime);
+        });
+        membership.addMembers(chatId, std::move(invitedIds), allowedRawTime);
     }
+    return statuses;
 }
 
 
@@ -251,58 +370,29 @@ auto Database::createMessage(
         const int32_t senderId,
         const time_t rawTime,
         const std::string &data
-) -> bool {
+) -> int32_t {
 
     const auto chatId = getChatId(chatName);
     const auto formattedDatetime = getFormattedDatetime(rawTime);
-    const auto sqlQuery = "INSERT INTO Messages(ChatId, SenderId, RawTime, Time, Data) VALUES(?, ?, ?, ?, ?)";
 
     if (chatId == -1) {
-        return false;
+        return -1;
     }
 
     std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
-    if (!bindStatement(chatId, senderId, rawTime, formattedDatetime.c_str(), data.c_str())) {
-        throw std::runtime_error("sqlite3_bind_int error");
-    }
-
-    if (sqlite3_step(stmt) == SQLITE_DONE) {
-        return true;
-    } else {
-        throw std::runtime_error("sqlite3_step error");
-    }
+    Query<> query(db, "INSERT INTO Messages(ChatId, SenderId, RawTime, Time, Data) VALUES(?, ?, ?, ?, ?)");
+    query.bind(chatId, senderId, rawTime, formattedDatetime, data).execute();
+    return static_cast<int32_t>(sqlite3_last_insert_rowid(db));
 }
 
 
 auto Database::getChatsByTime(const int32_t userId, const time_t rawTime) -> std::vector<std::string> {
-    const auto sqlQuery = "SELECT ChatId FROM ChatsInfo WHERE AllowedRawTime > ? AND UserId = ?";
-
-    mutex.lock();
-
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
-
-    if (!bindStatement(rawTime, userId)) {
-        throw std::runtime_error("sqlite3_bind_int error");
-    }
-
-    std::vector<int> chatIds;
-    for (int i = 0; sqlite3_step(stmt) == SQLITE_ROW; i++) {
-        const auto chatId = sqlite3_column_int(stmt, 0);
-        chatIds.push_back(chatId);
-    }
-
-    mutex.unlock();
+    const auto chatIds = membership.getChatsByTime(userId, rawTime);
 
     std::vector<std::string> chats;
     chats.reserve(chatIds.size());
     for (const auto &chatId: chatIds) {
-        // getChatName locks
-        chats.push_back(getChatName(chatId));
+        chats.push_back(membership.getChatName(chatId));
     }
 
     return chats;
@@ -310,55 +400,23 @@ auto Database::getChatsByTime(const int32_t userId, const time_t rawTime) -> std
 
 
 auto Database::getChatName(const int chatId) -> std::string {
-    const auto sqlQuery = "SELECT Name FROM Chats WHERE Id = ?";
-
-    std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
-
-    if (!bindStatement(chatId)) {
-        throw std::runtime_error("sqlite3_bind_int error");
-    }
-
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        return reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
-    } else {
-        return {};
-    }
+    return membership.getChatName(chatId);
 }
 
 
 auto Database::createUser(const std::string &username, const std::string &password) -> void {
+    const auto hash = hashPassword(password);
+
     std::lock_guard lockGuard(mutex);
-    if (!executeSqlQuery("INSERT INTO Users(Username, Password) VALUES('" + username + "', '" + password + "');")) {
-        throw std::runtime_error("sqlite3_exec error");
-    }
+    Query<> query(db, "INSERT INTO Users(Username, Password) VALUES(?, ?)");
+    query.bind(username, hash).execute();
 }
 
 
 auto Database::getUserId(const std::string &username) -> int32_t {
-    const auto sqlQuery = "SELECT Id FROM Users WHERE Username = ?";
-
     std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
-
-    if (!bindStatement(username.c_str())) {
-        throw std::runtime_error("sqlite3_bind_text error");
-    }
-
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        return sqlite3_column_int(stmt, 0);
-    } else {
-        return -1;
-    }
-}
-
-
-auto Database::isUserExist(const std::string &username) -> bool {
-    return getUserId(username) != -1;
+    Query<int32_t> query(db, "SELECT Id FROM Users WHERE Username = ?");
+    return query.bind(username).scalar(-1);
 }
 
 
@@ -373,11 +431,41 @@ Database::Database(const std::string &path) {
     std::string sql = "CREATE TABLE IF NOT EXISTS Users(Id INTEGER PRIMARY KEY AUTOINCREMENT, Username TEXT, Password TEXT);"
                       "CREATE TABLE IF NOT EXISTS Chats(Id INTEGER PRIMARY KEY AUTOINCREMENT, Name TEXT, AdminId INT, CreationRawTime INT);"
                       "CREATE TABLE IF NOT EXISTS ChatsInfo(ChatId INT, UserId INT, AllowedRawTime INT);"
-                      "CREATE TABLE IF NOT EXISTS Messages(Id INTEGER PRIMARY KEY AUTOINCREMENT, ChatId INT, SenderId INT, RawTime INT, Time DATETIME, Data TEXT);";
+                      "CREATE TABLE IF NOT EXISTS Messages(Id INTEGER PRIMARY KEY AUTOINCREMENT, ChatId INT, SenderId INT, RawTime INT, Time DATETIME, Data TEXT);"
+                      "CREATE TABLE IF NOT EXISTS PrunedChats(ChatId INTEGER PRIMARY KEY, MessageId INT);"
+                      "CREATE INDEX IF NOT EXISTS UsersByUsername ON Users(Username);"
+                      "CREATE INDEX IF NOT EXISTS ChatsByName ON Chats(Name);"
+                      "CREATE INDEX IF NOT EXISTS ChatsInfoByChat ON ChatsInfo(ChatId, UserId);"
+                      "CREATE INDEX IF NOT EXISTS ChatsInfoByUser ON ChatsInfo(UserId);"
+                      "CREATE INDEX IF NOT EXISTS MessagesByChat ON Messages(ChatId, RawTime);"
+                      "CREATE INDEX IF NOT EXISTS MessagesByChatAndId ON Messages(ChatId, Id);";
+
+    // has effect on new files only, existing ones are converted by vacuum below
+    if (!executeSqlQuery("PRAGMA auto_vacuum = INCREMENTAL;") || !executeSqlQuery(sql)) {
+        throw std::runtime_error("sqlite3_exec error");
+    }
 
-    if (!executeSqlQuery(sql)) {
+    // pruned pages are returned to the file system by reclaimSpace, which needs incremental auto vacuum
+    const auto autoVacuum = Query<int32_t>(db, "PRAGMA auto_vacuum").scalar(0);
+    if (autoVacuum != 2 && !executeSqlQuery("VACUUM;")) {
         throw std::runtime_error("sqlite3_exec error");
     }
+
+    loadMembership();
+}
+
+
+auto Database::loadMembership() -> void {
+    Query<int32_t, std::string> chats(db, "SELECT Id, Name FROM Chats");
+    chats.forEach([this](const int32_t chatId, const std::string &chatName) {
+        membership.addChat(chatId, chatName);
+    });
+
+    // index order makes every member an append
+    Query<int32_t, int32_t, int64_t> members(db, "SELECT ChatId, UserId, AllowedRawTime FROM ChatsInfo ORDER BY ChatId, UserId");
+    members.forEach([this](const int32_t chatId, const int32_t userId, const int64_t allowedRawTime) {
+        membership.addMember(chatId, userId, allowedRawTime);
+    });
 }
 
 
@@ -390,64 +478,373 @@ Database::~Database() {
 
 auto
 Database::getAllMessagesFromChat(const std::string &chatName, int32_t userId) -> std::vector<ChatMessage> {
+    return getMessagesFromChatSince(chatName, userId, 0);
+}
+
+
+auto Database::getMessagesFromChatSince(
+        const std::string &chatName,
+        const int32_t userId,
+        const int32_t afterId
+) -> std::vector<ChatMessage> {
     const auto chatId = getChatId(chatName);
-    const auto sqlQueryForRawTime = "SELECT AllowedRawTime FROM ChatsInfo WHERE ChatId = ? AND UserId = ?";
+    const auto allowedRawTime = membership.findAllowedRawTime(chatId, userId);
+    if (!allowedRawTime) {
+        throw std::logic_error("Chat don't exists");
+    }
 
+    // senders are joined in, not queried message by message
     std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQueryForRawTime)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
+    Query<std::string_view, std::string_view, std::string_view, int32_t> query(
+            db, "SELECT Messages.Time, Users.Username, Messages.Data, Messages.Id FROM Messages "
+                "LEFT JOIN Users ON Users.Id = Messages.SenderId "
+                "WHERE Messages.ChatId = ? AND Messages.RawTime >= ? AND Messages.Id > ? "
+                "ORDER BY Messages.RawTime, Messages.Id");
 
-    if (!bindStatement(chatId, userId)) {
-        throw std::runtime_error("sqlite_bind error");
-    }
+    std::vector<ChatMessage> messages;
+    query.bind(chatId, *allowedRawTime, afterId).forEach(
+            [&messages](const std::string_view datetime, const std::string_view username, const std::string_view text,
+                        const int32_t id) {
+                messages.emplace_back(std::string(datetime), std::string(username), std::string(text), id);
+            });
+    return messages;
+}
 
-    int32_t allowedRawTime;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        allowedRawTime = sqlite3_column_int(stmt, 0);
-    } else {
-        throw std::logic_error("Chat don't exists");
-    }
 
-    const auto sqlQueryForMessages = "SELECT SenderId, Time, Data FROM Messages WHERE ChatId = ? AND RawTime >= ? ORDER BY RawTime";
+auto Database::getRecentMessages(const std::string &chatName, const size_t limit) -> std::vector<StoredMessage> {
+    const auto chatId = getChatId(chatName);
 
-    if (!prepareStatement(sqlQueryForMessages)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
+    std::lock_guard lockGuard(mutex);
+    Query<int32_t, int32_t, int64_t, std::string_view, std::string_view> query(
+            db, "SELECT Messages.Id, Messages.SenderId, Messages.RawTime, Messages.Data, Users.Username FROM Messages "
+                "LEFT JOIN Users ON Users.Id = Messages.SenderId WHERE Messages.ChatId = ? "
+                "ORDER BY Messages.Id DESC LIMIT ?");
+
+    std::vector<StoredMessage> messages;
+    query.bind(chatId, static_cast<int64_t>(limit)).forEach(
+            [&messages](const int32_t id, const int32_t senderId, const int64_t rawTime, const std::string_view text,
+                        const std::string_view senderName) {
+                messages.push_back(StoredMessage{id, senderId, rawTime, std::string(text), std::string(senderName)});
+            });
+
+    std::reverse(messages.begin(), messages.end());
+    return messages;
+}
 
-    if (!bindStatement(chatId, allowedRawTime)) {
-        throw std::runtime_error("sqlite_bind error");
-    }
 
-    std::vector<ChatMessage> messages;
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        messages.emplace_back(
-                reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)),
-                std::to_string(sqlite3_column_int(stmt, 0)),
-                reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2))
+auto Database::getUsername(const int32_t userId) -> std::string {
+    std::lock_guard lockGuard(mutex);
+    return fetchUsername(userId);
+}
 
-        );
-    }
 
-    for (auto &chatMessage: messages) {
-        chatMessage.username = getUsername(std::stoi(chatMessage.username));
+auto Database::fetchUsername(const int id) -> std::string {
+    Query<std::string_view> query(db, "SELECT Username FROM Users WHERE Id = ?");
+
+    std::string username;
+    if (!query.bind(id).first([&username](const std::string_view value) { username = value; })) {
+        throw std::runtime_error("unknown user id " + std::to_string(id));
     }
+    return username;
+}
 
-    return messages;
+
+auto Database::scanChanges(const std::function<void(const Change &)> &visitor) -> void {
+    std::lock_guard lockGuard(mutex);
+    visitChanges(
+            "SELECT Username, Password FROM Users ORDER BY Id",
+            "SELECT Chats.Name, Users.Username, Chats.CreationRawTime FROM Chats "
+            "JOIN Users ON Users.Id = Chats.AdminId ORDER BY Chats.Id",
+            "SELECT Chats.Name, Users.Username, ChatsInfo.AllowedRawTime FROM ChatsInfo "
+            "JOIN Chats ON Chats.Id = ChatsInfo.ChatId "
+            "JOIN Users ON Users.Id = ChatsInfo.UserId ORDER BY ChatsInfo.rowid",
+            "SELECT Messages.Id, Chats.Name, Users.Username, Messages.RawTime, Messages.Data FROM Messages "
+            "JOIN Chats ON Chats.Id = Messages.ChatId "
+            "JOIN Users ON Users.Id = Messages.SenderId ORDER BY Messages.Id",
+            "",
+            visitor
+    );
+}
+
+
+auto Database::openChangeCursor() -> ChangeCursor {
+    std::lock_guard lockGuard(mutex);
+    ChangeCursor cursor;
+    cursor.lastUserId = Query<int32_t>(db, "SELECT IFNULL(MAX(Id), 0) FROM Users").scalar(0);
+    cursor.lastChatId = Query<int32_t>(db, "SELECT IFNULL(MAX(Id), 0) FROM Chats").scalar(0);
+    return cursor;
 }
 
-auto Database::getUsername(const int id) -> std::string {
-    const auto sqlQuery = "SELECT Username FROM Users WHERE Id = ?";
 
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
+auto Database::scanChangesPage(
+        ChangeCursor &cursor,
+        const size_t limit,
+        const std::function<void(const Change &)> &visitor
+) -> bool {
+    std::lock_guard lockGuard(mutex);
+
+    // every phase is a keyset query from the cursor, a page which finishes a phase goes on with the next one
+    size_t visited = 0;
+    Change change{cursor.type};
+    if (cursor.type == ChangeType::User) {
+        Query<int32_t, std::string_view, std::string_view> users(
+                db, "SELECT Id, Username, Password FROM Users WHERE Id > ? AND Id <= ? ORDER BY Id LIMIT ?");
+        users.bind(cursor.id, cursor.lastUserId, static_cast<int64_t>(limit));
+        visited += users.forEach([&](const int32_t id, const std::string_view username, const std::string_view password) {
+            change.username = username;
+            change.data = password;
+            if (!isPasswordHash(change.data)) {
+                change.data = hashPassword(change.data);
+            }
+            visitor(change);
+            cursor.id = id;
+        });
+        if (visited == limit) {
+            return true;
+        }
+        cursor.type = change.type = ChangeType::Chat;
+        cursor.id = 0;
+        change.data.clear();
+    }
+
+    if (cursor.type == ChangeType::Chat) {
+        Query<int32_t, std::string_view, std::string_view, int64_t> chats(
+                db, "SELECT Chats.Id, Chats.Name, Users.Username, Chats.CreationRawTime FROM Chats "
+                    "JOIN Users ON Users.Id = Chats.AdminId WHERE Chats.Id > ? AND Chats.Id <= ? ORDER BY Chats.Id LIMIT ?");
+        chats.bind(cursor.id, cursor.lastChatId, static_cast<int64_t>(limit - visited));
+        visited += chats.forEach([&](const int32_t id, const std::string_view chatName, const std::string_view admin,
+                                     const int64_t rawTime) {
+            change.chatName = chatName;
+            change.username = admin;
+            change.rawTime = rawTime;
+            visitor(change);
+            cursor.id = id;
+        });
+        if (visited == limit) {
+            return true;
+        }
+        cursor.type = change.type = ChangeType::Member;
+        cursor.chatId = cursor.id = 0;
+    }
+
+    if (cursor.type == ChangeType::Member) {
+        Query<int32_t, int32_t, std::string_view, std::string_view, int64_t> members(
+                db, "SELECT ChatsInfo.ChatId, ChatsInfo.UserId, Chats.Name, Users.Username, ChatsInfo.AllowedRawTime "
+                    "FROM ChatsInfo JOIN Chats ON Chats.Id = ChatsInfo.ChatId JOIN Users ON Users.Id = ChatsInfo.UserId "
+                    "WHERE (ChatsInfo.ChatId, ChatsInfo.UserId) > (?1, ?2) AND ChatsInfo.ChatId <= ?3 "
+                    "AND ChatsInfo.UserId <= ?4 ORDER BY ChatsInfo.ChatId, ChatsInfo.UserId LIMIT ?5");
+        members.bind(cursor.chatId, cursor.id, cursor.lastChatId, cursor.lastUserId, static_cast<int64_t>(limit - visited));
+        visited += members.forEach([&](const int32_t chatId, const int32_t userId, const std::string_view chatName,
+                                       const std::string_view username, const int64_t allowedRawTime) {
+            change.chatName = chatName;
+            change.username = username;
+            change.rawTime = allowedRawTime;
+            visitor(change);
+            cursor.chatId = chatId;
+            cursor.id = userId;
+        });
+        if (visited == limit) {
+            return true;
+        }
+        cursor.type = change.type = ChangeType::Message;
+        cursor.chatId = cursor.id = 0;
+    }
+
+    Query<int32_t, std::string_view, std::string_view, int64_t, std::string_view> messages(
+            db, "SELECT Messages.Id, Chats.Name, Users.Username, Messages.RawTime, Messages.Data FROM Messages "
+                "JOIN Chats ON Chats.Id = Messages.ChatId JOIN Users ON Users.Id = Messages.SenderId "
+                "WHERE Messages.Id > ?1 AND Messages.ChatId <= ?2 AND Messages.SenderId <= ?3 "
+                "ORDER BY Messages.Id LIMIT ?4");
+    messages.bind(cursor.id, cursor.lastChatId, cursor.lastUserId, static_cast<int64_t>(limit - visited));
+    visited += messages.forEach([&](const int32_t id, const std::string_view chatName, const std::string_view sender,
+                                    const int64_t rawTime, const std::string_view text) {
+        change.id = id;
+        change.chatName = chatName;
+        change.username = sender;
+        change.rawTime = rawTime;
+        change.data = text;
+        visitor(change);
+        cursor.id = id;
+    });
+    return visited == limit;
+}
+
+
+auto Database::scanChatChanges(
+        const std::string &chatName,
+        const std::function<void(const Change &)> &visitor
+) -> void {
+    std::lock_guard lockGuard(mutex);
+    visitChanges(
+            "SELECT Username, Password FROM Users WHERE Id IN ("
+            "SELECT AdminId FROM Chats WHERE Name = ?1 UNION "
+            "SELECT UserId FROM ChatsInfo WHERE ChatId = (SELECT Id FROM Chats WHERE Name = ?1) UNION "
+            "SELECT SenderId FROM Messages WHERE ChatId = (SELECT Id FROM Chats WHERE Name = ?1)) ORDER BY Id",
+            "SELECT Chats.Name, Users.Username, Chats.CreationRawTime FROM Chats "
+            "JOIN Users ON Users.Id = Chats.AdminId WHERE Chats.Name = ?1",
+            "SELECT Chats.Name, Users.Username, ChatsInfo.AllowedRawTime FROM ChatsInfo "
+            "JOIN Chats ON Chats.Id = ChatsInfo.ChatId "
+            "JOIN Users ON Users.Id = ChatsInfo.UserId WHERE Chats.Name = ?1 ORDER BY ChatsInfo.rowid",
+            "SELECT Messages.Id, Chats.Name, Users.Username, Messages.RawTime, Messages.Data FROM Messages "
+            "JOIN Chats ON Chats.Id = Messages.ChatId "
+            "JOIN Users ON Users.Id = Messages.SenderId WHERE Chats.Name = ?1 ORDER BY Messages.Id",
+            chatName,
+            visitor
+    );
+}
+
+
+auto Database::visitChanges(
+        const char *sqlUsersQuery,
+        const char *sqlChatsQuery,
+        const char *sqlMembersQuery,
+        const char *sqlMessagesQuery,
+        const std::string &chatName,
+        const std::function<void(const Change &)> &visitor
+) -> void {
+    // rows are stepped one by one, memory doesn't depend on storage size. One change is reused, its strings keep
+    // their capacity, so rows are assigned without allocations once the longest values were seen
+    Query<std::string_view, std::string_view> users(db, sqlUsersQuery);
+    Query<std::string_view, std::string_view, int64_t> chats(db, sqlChatsQuery);
+    Query<std::string_view, std::string_view, int64_t> members(db, sqlMembersQuery);
+    Query<int32_t, std::string_view, std::string_view, int64_t, std::string_view> messages(db, sqlMessagesQuery);
+    if (!chatName.empty()) {
+        users.bind(chatName);
+        chats.bind(chatName);
+        members.bind(chatName);
+        messages.bind(chatName);
+    }
+
+    Change change{ChangeType::User};
+    users.forEach([&](const std::string_view username, const std::string_view password) {
+        change.username = username;
+        change.data = password;
+        // users who haven't signed in since passwords are hashed still hold plain ones, only hashes leave storage
+        if (!isPasswordHash(change.data)) {
+            change.data = hashPassword(change.data);
+        }
+        visitor(change);
+    });
+
+    change.type = ChangeType::Chat;
+    change.data.clear();
+    const auto visitChatRow = [&](const std::string_view rowChatName, const std::string_view username, const int64_t rawTime) {
+        change.chatName = rowChatName;
+        change.username = username;
+        change.rawTime = rawTime;
+        visitor(change);
+    };
+    chats.forEach(visitChatRow);
+
+    change.type = ChangeType::Member;
+    members.forEach(visitChatRow);
+
+    change.type = ChangeType::Message;
+    messages.forEach([&](const int32_t id, const std::string_view rowChatName, const std::string_view sender,
+                         const int64_t rawTime, const std::string_view text) {
+        change.id = id;
+        change.chatName = rowChatName;
+        change.username = sender;
+        change.rawTime = rawTime;
+        change.data = text;
+        visitor(change);
+    });
+}
+
+
+auto Database::applyChanges(const std::vector<Change> &changes) -> void {
+    // plain passwords of old exports are hashed before locking
+    std::unordered_map<std::string, std::string> hashes;
+    for (const auto &change: changes) {
+        if (change.type == ChangeType::User) {
+            hashes[change.username] = toPasswordHash(change.data);
+        }
     }
-    if (!bindStatement(id)) {
-        throw std::runtime_error("sqlite3_bind_text error");
+
+    std::lock_guard lockGuard(mutex);
+
+    Query<int32_t> findUser(db, "SELECT Id FROM Users WHERE Username = ?");
+    Query<> insertUser(db, "INSERT INTO Users(Username, Password) VALUES(?, ?)");
+    Query<> insertChat(db, "INSERT INTO Chats(Name, AdminId, CreationRawTime) VALUES(?, ?, ?)");
+    Query<> insertMember(db, "INSERT INTO ChatsInfo(ChatId, UserId, AllowedRawTime) VALUES(?, ?, ?)");
+    Query<int32_t, int32_t, int64_t, std::string_view> findMessage(
+            db, "SELECT ChatId, SenderId, RawTime, Data FROM Messages WHERE Id = ?");
+    Query<> insertMessage(db, "INSERT INTO Messages(Id, ChatId, SenderId, RawTime, Time, Data) VALUES(?, ?, ?, ?, ?, ?)");
+    Query<> appendMessage(db, "INSERT INTO Messages(ChatId, SenderId, RawTime, Time, Data) VALUES(?, ?, ?, ?, ?)");
+
+    // ids of names resolved in this batch, index is updated once the batch is committed
+    std::unordered_map<std::string, int32_t> userIds;
+    std::unordered_map<std::string, int32_t> chatIds;
+    std::map<std::pair<int32_t, int32_t>, time_t> addedMembers;
+    const auto resolve = [](std::unordered_map<std::string, int32_t> &ids, Query<int32_t> &find,
+                            const std::string &name) -> int32_t {
+        const auto it = ids.find(name);
+        if (it != ids.end()) {
+            return it->second;
+        }
+        const auto id = find.bind(name).scalar(-1);
+        return id == -1 ? -1 : ids[name] = id;
+    };
+
+    runTransaction([&] {
+        for (const auto &change: changes) {
+            if (change.type == ChangeType::User) {
+                if (resolve(userIds, findUser, change.username) == -1) {
+                    insertUser.bind(change.username, hashes.at(change.username)).execute();
+                    userIds[change.username] = static_cast<int32_t>(sqlite3_last_insert_rowid(db));
+                }
+                continue;
+            }
+
+            const auto userId = resolve(userIds, findUser, change.username);
+            if (userId == -1) {
+                throw std::runtime_error("change refers to unknown user " + change.username);
+            }
+
+            if (change.type == ChangeType::Chat) {
+                if (!chatIds.contains(change.chatName) && membership.getChatId(change.chatName) == -1) {
+                    insertChat.bind(change.chatName, userId, change.rawTime).execute();
+                    chatIds[change.chatName] = static_cast<int32_t>(sqlite3_last_insert_rowid(db));
+                }
+                continue;
+            }
+
+            const auto chatIt = chatIds.find(change.chatName);
+            const auto chatId = chatIt != chatIds.end() ? chatIt->second : membership.getChatId(change.chatName);
+            if (chatId == -1) {
+                throw std::runtime_error("change refers to unknown chat " + change.chatName);
+            }
+
+            if (change.type == ChangeType::Member) {
+                if (addedMembers.contains({chatId, userId}) || membership.findAllowedRawTime(chatId, userId)) {
+                    continue;
+                }
+                insertMember.bind(chatId, userId, change.rawTime).execute();
+                addedMembers.emplace(std::make_pair(chatId, userId), change.rawTime);
+            } else if (change.type == ChangeType::Message) {
+                const auto formattedDatetime = getFormattedDatetime(change.rawTime);
+                // stored text is compared in place
+                auto same = false;
+                const auto found = findMessage.bind(change.id).first(
+                        [&](const int32_t storedChatId, const int32_t senderId, const int64_t rawTime,
+                            const std::string_view text) {
+                            same = storedChatId == chatId && senderId == userId && rawTime == change.rawTime &&
+                                   text == change.data;
+                        });
+                if (!found) {
+                    insertMessage.bind(change.id, chatId, userId, change.rawTime, formattedDatetime, change.data).execute();
+                } else if (!same) {
+                    // id is taken by another message
+                    appendMessage.bind(chatId, userId, change.rawTime, formattedDatetime, change.data).execute();
+                }
+            }
+        }
+    });
+
+    for (const auto &[chatName, chatId]: chatIds) {
+        membership.addChat(chatId, chatName);
     }
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        return std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
-    } else {
-        throw std::runtime_error("sqlite3_step error");
+    for (const auto &[key, allowedRawTime]: addedMembers) {
+        membership.addMember(key.first, key.second, allowedRawTime);
     }
 }
@@ -0,0 +1,157 @@
+#include <utility>
+#include <algorithm>
+
+
+#include "../eventHub.hpp"
+
+
+// coalescing times older than interval are forgotten this often
+constexpr auto pruneInterval = std::chrono::seconds(1);
+
+
+EventHub::Presence::Presence(EventHub *hub, User user) : hub(hub), user(std::move(user)) {
+    if (this->hub) {
+        this->hub->connect(this->user);
+    }
+}
+
+
+EventHub::Presence::~Presence() {
+    if (hub) {
+        hub->disconnect(user);
+    }
+}
+
+
+EventHub::EventHub(
+        const std::string &endPoint,
+        const size_t interval,
+        const size_t queueCapacity
+) : interval(interval), queueCapacity(queueCapacity) {
+    publishSocket.bind(endPoint);
+    sender = std::thread(&EventHub::sendLoop, this);
+}
+
+
+EventHub::~EventHub() {
+    close();
+}
+
+
+auto EventHub::close() -> void {
+    {
+        std::lock_guard lockGuard(mutex);
+        stopping = true;
+    }
+    condition.notify_one();
+    if (sender.joinable()) {
+        sender.join();
+        publishSocket.close();
+    }
+}
+
+
+auto EventHub::sendLoop() -> void {
+    auto lastPrune = std::chrono::steady_clock::now();
+    std::deque<Delivery> pending;
+    while (true) {
+        {
+            std::unique_lock lock(mutex);
+            condition.wait_for(lock, pruneInterval, [this] { return stopping || !queue.empty(); });
+            if (stopping) {
+                return;
+            }
+            std::swap(pending, queue);
+
+            const auto now = std::chrono::steady_clock::now();
+            if (now - lastPrune >= pruneInterval) {
+                std::erase_if(lastEvents, [&](const auto &entry) { return now - entry.second >= interval; });
+                lastPrune = now;
+            }
+        }
+
+        for (const auto &delivery: pending) {
+            zmqpp::message message;
+            message << delivery.topic;
+            message.add_raw(delivery.package->data(), delivery.package->size());
+            // publish socket drops messages of slow subscribers itself, it never blocks here
+            if (publishSocket.send(message, true)) {
+                delivered++;
+            } else {
+                dropped++;
+            }
+        }
+        pending.clear();
+    }
+}
+
+
+auto EventHub::connect(const User &user) -> void {
+    std::lock_guard lockGuard(mutex);
+    auto &[username, connections] = online[user.id];
+    username = user.username;
+    connections++;
+}
+
+
+auto EventHub::disconnect(const User &user) -> void {
+    std::lock_guard lockGuard(mutex);
+    const auto it = online.find(user.id);
+    if (it != online.end() && --it->second.second == 0) {
+        online.erase(it);
+    }
+}
+
+
+auto EventHub::publish(
+        const User &sender,
+        const std::string &chatName,
+        const std::string &kind,
+        const std::function<bool(int32_t)> &isMember
+) -> bool {
+    const auto now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard lockGuard(mutex);
+        const auto [it, inserted] = lastEvents.try_emplace(std::make_tuple(sender.id, chatName, kind), now);
+        if (!inserted) {
+            if (now - it->second < interval) {
+                coalesced++;
+                return false;
+            }
+            it->second = now;
+        }
+    }
+
+    // packed once and shared by deliveries to every member
+    auto event = Message(MessageType::Event, MessageData(chatName, kind));
+    event.data.vector.push_back(sender.username);
+    auto package = std::make_shared<msgpack::sbuffer>();
+    msgpack::pack(package.get(), event);
+
+    std::lock_guard lockGuard(mutex);
+    if (stopping) {
+        return false;
+    }
+    // online users are usually far fewer than members of large chats
+    for (const auto &[userId, connection]: online) {
+        if (userId == sender.id || !isMember(userId)) {
+            continue;
+        }
+        if (queue.size() >= queueCapacity) {
+            dropped++;
+            continue;
+        }
+        queue.push_back(Delivery{connection.first + '\0', package});
+    }
+    published++;
+    condition.notify_one();
+    return true;
+}
+
+
+auto EventHub::exportMetrics(Metrics &metrics) -> void {
+    metrics.set("events.published", static_cast<int64_t>(published.load()));
+    metrics.set("events.coalesced", static_cast<int64_t>(coalesced.load()));
+    metrics.set("events.delivered", static_cast<int64_t>(delivered.load()));
+    metrics.set("events.dropped", static_cast<int64_t>(dropped.load()));
+}
@@ -0,0 +1,63 @@
+#include <array>
+#include <stdexcept>
+#include <filesystem>
+
+
+#include "../framing.hpp"
+
+
+auto makeFrameHeader(const msgpack::sbuffer &package) -> std::array<char, frameHeaderSize> {
+    const auto size = static_cast<uint32_t>(package.size());
+    return {
+            static_cast<char>(size & 0xff),
+            static_cast<char>(size >> 8 & 0xff),
+            static_cast<char>(size >> 16 & 0xff),
+            static_cast<char>(size >> 24 & 0xff)
+    };
+}
+
+
+auto writeFrame(std::ostream &output, const msgpack::sbuffer &package) -> void {
+    const auto header = makeFrameHeader(package);
+    output.write(header.data(), frameHeaderSize);
+    output.write(package.data(), static_cast<std::streamsize>(package.size()));
+}
+
+
+auto writeFrame(msgpack::sbuffer &buffer, const msgpack::sbuffer &package) -> void {
+    const auto header = makeFrameHeader(package);
+    buffer.write(header.data(), frameHeaderSize);
+    buffer.write(package.data(), package.size());
+}
+
+
+FrameReader::FrameReader(const std::string &path) : input(path, std::ios::binary) {
+    if (!input) {
+        throw std::runtime_error("can't open " + path);
+    }
+    fileBytes = std::filesystem::file_size(path);
+}
+
+
+auto FrameReader::next() -> FrameStatus {
+    std::array<unsigned char, frameHeaderSize> header{};
+    if (!input.read(reinterpret_cast<char *>(header.data()), frameHeaderSize)) {
+        return input.gcount() == 0 ? FrameStatus::End : FrameStatus::Torn;
+    }
+
+    const uint32_t size = header[0] | header[1] << 8 | header[2] << 16 | static_cast<uint32_t>(header[3]) << 24;
+    if (size > fileBytes - offset - frameHeaderSize) {
+        return FrameStatus::Torn;
+    }
+
+    body.resize(size);
+    if (!input.read(body.data(), size)) {
+        return FrameStatus::Torn;
+    }
+    return FrameStatus::Read;
+}
+
+
+auto FrameReader::getOffset() const -> uint64_t {
+    return offset;
+}
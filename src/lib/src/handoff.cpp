@@ -0,0 +1,56 @@
+#include <thread>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <filesystem>
+
+
+#include "../handoff.hpp"
+
+
+constexpr auto handoffPollInterval = std::chrono::milliseconds(20);
+
+
+auto writeHandoff(const std::string &path, const Handoff &handoff) -> void {
+    msgpack::sbuffer package;
+    msgpack::pack(&package, handoff);
+
+    const auto temporaryPath = path + ".tmp";
+    {
+        std::ofstream output(temporaryPath, std::ios::binary | std::ios::trunc);
+        output.write(package.data(), static_cast<std::streamsize>(package.size()));
+        if (!output) {
+            throw std::runtime_error("can't write handoff " + temporaryPath);
+        }
+    }
+    std::filesystem::rename(temporaryPath, path);
+}
+
+
+auto takeHandoff(const std::string &path) -> std::optional<Handoff> {
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+        return std::nullopt;
+    }
+    const std::string package{std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+    input.close();
+    std::filesystem::remove(path);
+
+    Handoff handoff;
+    msgpack::unpacked unpackedHandoff;
+    msgpack::unpack(unpackedHandoff, package.data(), package.size());
+    unpackedHandoff.get().convert(handoff);
+    return handoff;
+}
+
+
+auto waitForHandoff(const std::string &path, const std::chrono::milliseconds timeout) -> bool {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!std::filesystem::exists(path)) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(handoffPollInterval);
+    }
+    return true;
+}
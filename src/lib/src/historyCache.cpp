@@ -0,0 +1,275 @@
+#include <iterator>
+#include <algorithm>
+#include <functional>
+
+
+#include "../historyCache.hpp"
+
+
+HistoryCache::HistoryCache() : HistoryCache(defaultCapacity, defaultBudget) {}
+
+
+HistoryCache::HistoryCache(const size_t capacity, const size_t budget) : capacity(std::max<size_t>(capacity, 1)),
+                                                                         budget(budget) {}
+
+
+auto HistoryCache::epochSlot(const std::string &chatName) -> size_t {
+    return std::hash<std::string>{}(chatName) % epochsCount;
+}
+
+
+auto HistoryCache::push(Ring &ring, const StoredMessage &message) -> void {
+    const auto textOffset = static_cast<uint32_t>(ring.textArena.size());
+    const auto textSize = static_cast<uint32_t>(message.text.size());
+    ring.textArena += message.text;
+    ring.liveTextBytes += textSize;
+    ring.newestId = std::max(ring.newestId, message.id);
+
+    if (ring.ids.size() < capacity) {
+        ring.ids.push_back(message.id);
+        ring.rawTimes.push_back(message.rawTime);
+        ring.senderIds.push_back(message.senderId);
+        ring.textOffsets.push_back(textOffset);
+        ring.textSizes.push_back(textSize);
+        return;
+    }
+
+    const auto slot = ring.head;
+    ring.evictedRawTime = std::max(ring.evictedRawTime, ring.rawTimes[slot]);
+    ring.evictedId = std::max(ring.evictedId, ring.ids[slot]);
+    ring.liveTextBytes -= ring.textSizes[slot];
+
+    ring.ids[slot] = message.id;
+    ring.rawTimes[slot] = message.rawTime;
+    ring.senderIds[slot] = message.senderId;
+    ring.textOffsets[slot] = textOffset;
+    ring.textSizes[slot] = textSize;
+    ring.head = (slot + 1) % capacity;
+
+    if (ring.textArena.size() > 2 * ring.liveTextBytes + 4096) {
+        compactArena(ring);
+    }
+}
+
+
+auto HistoryCache::compactArena(Ring &ring) -> void {
+    std::string textArena;
+    textArena.reserve(ring.liveTextBytes);
+
+    for (size_t i = 0; i < ring.ids.size(); i++) {
+        const auto slot = (ring.head + i) % ring.ids.size();
+        const auto textOffset = static_cast<uint32_t>(textArena.size());
+        textArena.append(ring.textArena, ring.textOffsets[slot], ring.textSizes[slot]);
+        ring.textOffsets[slot] = textOffset;
+    }
+
+    ring.textArena = std::move(textArena);
+}
+
+
+auto HistoryCache::estimateBytes(const Ring &ring) -> size_t {
+    size_t bytes = sizeof(Ring) + ring.textArena.capacity();
+    bytes += ring.ids.capacity() * (sizeof(int32_t) + sizeof(time_t) + sizeof(int32_t) + 2 * sizeof(uint32_t));
+    for (const auto &[senderId, senderName]: ring.senderNames) {
+        bytes += sizeof(senderId) + sizeof(senderName) + senderName.capacity();
+    }
+    return bytes;
+}
+
+
+auto HistoryCache::touch(Ring &ring, const size_t previousBytes) -> void {
+    lru.splice(lru.begin(), lru, ring.lruPosition);
+    ring.bytes = estimateBytes(ring);
+    totalBytes = totalBytes - previousBytes + ring.bytes;
+}
+
+
+auto HistoryCache::remove(const std::string &chatName) -> void {
+    const auto it = rings.find(chatName);
+    if (it == rings.end()) {
+        return;
+    }
+    totalBytes -= it->second.bytes;
+    lru.erase(it->second.lruPosition);
+    rings.erase(it);
+}
+
+
+auto HistoryCache::evict(const std::string &keep) -> void {
+    auto it = lru.end();
+    while (totalBytes > budget && it != lru.begin()) {
+        const auto candidate = std::prev(it);
+        if (*candidate == keep) {
+            it = candidate;
+            continue;
+        }
+        remove(*candidate);
+    }
+
+    if (totalBytes > budget) {
+        remove(keep);
+    }
+}
+
+
+auto HistoryCache::makeRing(const std::vector<StoredMessage> &messages) -> Ring {
+    Ring ring;
+    // chat may have more messages than capacity, all of them have smaller ids and aren't newer than the oldest one
+    if (messages.size() >= capacity) {
+        ring.evictedRawTime = messages.front().rawTime;
+        ring.evictedId = messages.front().id - 1;
+    }
+    for (const auto &message: messages) {
+        push(ring, message);
+        ring.senderNames.try_emplace(message.senderId, message.senderName);
+    }
+    return ring;
+}
+
+
+auto HistoryCache::readRing(
+        const Ring &ring,
+        const time_t allowedRawTime,
+        const int32_t afterId,
+        std::vector<ChatMessage> &messages
+) -> bool {
+    if (allowedRawTime <= ring.evictedRawTime && afterId < ring.evictedId) {
+        return false;
+    }
+
+    messages.clear();
+    for (size_t i = 0; i < ring.ids.size(); i++) {
+        const auto slot = (ring.head + i) % ring.ids.size();
+        if (ring.ids[slot] <= afterId || ring.rawTimes[slot] < allowedRawTime) {
+            continue;
+        }
+        const auto sender = ring.senderNames.find(ring.senderIds[slot]);
+        messages.emplace_back(
+                getFormattedDatetime(ring.rawTimes[slot]),
+                sender == ring.senderNames.end() ? std::string() : sender->second,
+                ring.textArena.substr(ring.textOffsets[slot], ring.textSizes[slot]),
+                ring.ids[slot]
+        );
+    }
+    return true;
+}
+
+
+auto HistoryCache::insert(const std::string &chatName, Ring ring, const uint64_t loadEpoch) -> void {
+    // message appended while loading could be missed, next read will load again
+    if (epochs[epochSlot(chatName)] != loadEpoch || rings.find(chatName) != rings.end()) {
+        return;
+    }
+
+    lru.push_front(chatName);
+    ring.lruPosition = lru.begin();
+    ring.bytes = estimateBytes(ring);
+    totalBytes += ring.bytes;
+    rings.emplace(chatName, std::move(ring));
+    evict(chatName);
+}
+
+
+auto HistoryCache::append(const std::string &chatName, const StoredMessage &message) -> void {
+    std::lock_guard lockGuard(mutex);
+    epochs[epochSlot(chatName)]++;
+
+    const auto it = rings.find(chatName);
+    if (it == rings.end()) {
+        return;
+    }
+
+    auto &ring = it->second;
+    // message could be already loaded from storage if its write raced with load
+    if (message.id <= ring.newestId && std::find(ring.ids.begin(), ring.ids.end(), message.id) != ring.ids.end()) {
+        return;
+    }
+
+    const auto previousBytes = ring.bytes;
+    push(ring, message);
+    ring.senderNames.try_emplace(message.senderId, message.senderName);
+    touch(ring, previousBytes);
+    evict(chatName);
+}
+
+
+auto HistoryCache::load(Storage &storage, const std::string &chatName) -> void {
+    uint64_t loadEpoch;
+    {
+        std::lock_guard lockGuard(mutex);
+        if (rings.find(chatName) != rings.end()) {
+            return;
+        }
+        loadEpoch = epochs[epochSlot(chatName)];
+    }
+
+    if (storage.getChatId(chatName) == -1) {
+        return;
+    }
+    auto ring = makeRing(storage.getRecentMessages(chatName, capacity));
+
+    std::lock_guard lockGuard(mutex);
+    insert(chatName, std::move(ring), loadEpoch);
+}
+
+
+auto HistoryCache::read(
+        const std::string &chatName,
+        const time_t allowedRawTime,
+        const int32_t afterId,
+        std::vector<ChatMessage> &messages
+) -> bool {
+    std::lock_guard lockGuard(mutex);
+    const auto it = rings.find(chatName);
+    if (it == rings.end() || !readRing(it->second, allowedRawTime, afterId, messages)) {
+        return false;
+    }
+
+    lru.splice(lru.begin(), lru, it->second.lruPosition);
+    return true;
+}
+
+
+auto HistoryCache::loadAndRead(
+        Storage &storage,
+        const std::string &chatName,
+        const time_t allowedRawTime,
+        const int32_t afterId,
+        std::vector<ChatMessage> &messages
+) -> bool {
+    uint64_t loadEpoch;
+    {
+        std::lock_guard lockGuard(mutex);
+        if (rings.find(chatName) != rings.end()) {
+            return false;
+        }
+        loadEpoch = epochs[epochSlot(chatName)];
+    }
+
+    auto ring = makeRing(storage.getRecentMessages(chatName, capacity));
+    // messages are as fresh as a storage read even if the ring isn't cached because of a racing write
+    const auto read = readRing(ring, allowedRawTime, afterId, messages);
+
+    std::lock_guard lockGuard(mutex);
+    insert(chatName, std::move(ring), loadEpoch);
+    return read;
+}
+
+
+auto HistoryCache::invalidate(const std::string &chatName) -> void {
+    std::lock_guard lockGuard(mutex);
+    epochs[epochSlot(chatName)]++;
+    remove(chatName);
+}
+
+
+auto HistoryCache::getChatNames() -> std::vector<std::string> {
+    std::lock_guard lockGuard(mutex);
+    return {lru.begin(), lru.end()};
+}
+
+
+auto HistoryCache::size() -> size_t {
+    std::lock_guard lockGuard(mutex);
+    return totalBytes;
+}
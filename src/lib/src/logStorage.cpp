@@ -0,0 +1,1038 @@
+#include <queue>
+#include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+#include <filesystem>
+#include <unordered_set>
+
+
+#include "../logStorage.hpp"
+#include "../password.hpp"
+#include "../framing.hpp"
+
+
+auto LogStorage::segmentPath(const size_t index) const -> std::string {
+    return segmentPath(directory, index);
+}
+
+
+auto LogStorage::segmentPath(const std::string &directory, const size_t index) -> std::string {
+    char name[32];
+    snprintf(name, sizeof name, "segment-%06zu.log", index);
+    return directory + "/" + name;
+}
+
+
+auto LogStorage::replay() -> void {
+    size_t lastIndex = 0;
+    for (size_t index = 1; std::filesystem::exists(segmentPath(index)); index++) {
+        lastIndex = index;
+    }
+
+    for (size_t index = 1; index <= lastIndex; index++) {
+        const auto path = segmentPath(index);
+
+        FrameStatus status;
+        uint64_t validBytes;
+        {
+            FrameReader reader(path);
+            LogRecord record;
+            while ((status = reader.read(record)) == FrameStatus::Read) {
+                apply(record);
+            }
+            validBytes = reader.getOffset();
+        }
+        logBytes += validBytes;
+
+        // a torn write can only be at the tail of the last segment
+        if (status == FrameStatus::Torn) {
+            if (index != lastIndex) {
+                throw std::runtime_error("corrupted log segment " + path);
+            }
+            std::filesystem::resize_file(path, validBytes);
+        }
+    }
+
+    openSegment(std::max<size_t>(lastIndex, 1));
+}
+
+
+auto LogStorage::openSegment(const size_t index) -> void {
+    if (segment.is_open()) {
+        segment.close();
+    }
+    if (index != segmentIndex) {
+        segmentBytes = std::filesystem::exists(segmentPath(index)) ? std::filesystem::file_size(segmentPath(index)) : 0;
+    }
+    segmentIndex = index;
+    segment.open(segmentPath(index), std::ios::binary | std::ios::app);
+    if (!segment) {
+        throw std::runtime_error("can't open log segment " + segmentPath(index));
+    }
+}
+
+
+auto LogStorage::write(const LogRecord &record, const bool flush) -> void {
+    msgpack::sbuffer package;
+    msgpack::pack(&package, record);
+
+    if (segmentBytes != 0 && segmentBytes + frameHeaderSize + package.size() > segmentSize) {
+        openSegment(segmentIndex + 1);
+    }
+
+    writeFrame(segment, package);
+    if (flush ? !segment.flush() : !segment) {
+        throw std::runtime_error("log segment write error");
+    }
+    segmentBytes += frameHeaderSize + package.size();
+    logBytes += frameHeaderSize + package.size();
+}
+
+
+auto LogStorage::append(const LogRecord &record) -> void {
+    write(record);
+    apply(record);
+}
+
+
+auto LogStorage::append(const std::vector<LogRecord> &records) -> void {
+    for (const auto &record: records) {
+        write(record, false);
+    }
+    if (!segment.flush()) {
+        throw std::runtime_error("log segment write error");
+    }
+    for (const auto &record: records) {
+        apply(record);
+    }
+}
+
+
+auto LogStorage::sealLog() -> Compaction {
+    if (segmentBytes != 0) {
+        openSegment(segmentIndex + 1);
+    }
+
+    Compaction compaction;
+    compaction.sealedIndex = segmentIndex - 1;
+    compaction.sealedBytes = logBytes;
+    compaction.sealedGarbageBytes = garbageBytes;
+    compaction.passwords.reserve(users.size());
+    for (const auto &user: users) {
+        compaction.passwords.push_back(user.password);
+    }
+    compaction.prunedIds.reserve(chats.size());
+    for (const auto &chat: chats) {
+        compaction.prunedIds.push_back(chat.prunedId);
+    }
+    return compaction;
+}
+
+
+auto LogStorage::writeCompaction(Compaction &compaction) const -> void {
+    const auto compactDirectory = directory + ".compact";
+    std::filesystem::remove_all(compactDirectory);
+    std::filesystem::create_directories(compactDirectory);
+
+    // one flush per segment, nothing reads these files before the swap
+    std::ofstream output;
+    size_t outputBytes = 0;
+    const auto write = [&](const LogRecord &record) {
+        msgpack::sbuffer package;
+        msgpack::pack(&package, record);
+        if (compaction.segments == 0 || (outputBytes != 0 && outputBytes + frameHeaderSize + package.size() > segmentSize)) {
+            if (output.is_open()) {
+                output.close();
+                if (!output) {
+                    throw std::runtime_error("compacted segment write error");
+                }
+            }
+            compaction.segments++;
+            output.open(segmentPath(compactDirectory, compaction.segments), std::ios::binary | std::ios::trunc);
+            outputBytes = 0;
+        }
+        writeFrame(output, package);
+        outputBytes += frameHeaderSize + package.size();
+        compaction.bytes += frameHeaderSize + package.size();
+    };
+
+    // sealed segments aren't written anymore, live records keep their order
+    for (size_t index = 1; index <= compaction.sealedIndex; index++) {
+        FrameReader reader(segmentPath(index));
+        LogRecord record;
+        FrameStatus status;
+        while ((status = reader.read(record)) == FrameStatus::Read) {
+            switch (record.type) {
+                case LogRecordType::User: {
+                    if (record.id >= 1 && static_cast<size_t>(record.id) <= compaction.passwords.size()) {
+                        record.data = compaction.passwords[record.id - 1];
+                    }
+                    write(record);
+                    break;
+                }
+                case LogRecordType::Message: {
+                    if (record.chatId < 1 || static_cast<size_t>(record.chatId) > compaction.prunedIds.size() ||
+                        record.id > compaction.prunedIds[record.chatId - 1]) {
+                        write(record);
+                    }
+                    break;
+                }
+                case LogRecordType::Chat:
+                case LogRecordType::Member: {
+                    write(record);
+                    break;
+                }
+                // users are written with their hashes and pruned ids once below
+                case LogRecordType::Prune:
+                case LogRecordType::Password:
+                    break;
+            }
+        }
+        if (status != FrameStatus::End) {
+            throw std::runtime_error("corrupted log segment " + segmentPath(index));
+        }
+    }
+
+    // message ids are never reused, so pruned ids are kept even when no message of the chat is left
+    for (size_t chatId = 1; chatId <= compaction.prunedIds.size(); chatId++) {
+        if (compaction.prunedIds[chatId - 1] != 0) {
+            write(LogRecord{LogRecordType::Prune, compaction.prunedIds[chatId - 1], static_cast<int32_t>(chatId), 0, 0,
+                            {}, {}});
+        }
+    }
+
+    if (output.is_open()) {
+        output.close();
+    }
+    if (!output) {
+        throw std::runtime_error("compacted segment write error");
+    }
+}
+
+
+auto LogStorage::finishCompaction(const Compaction &compaction) -> void {
+    const auto liveDirectory = directory;
+    const auto compactDirectory = liveDirectory + ".compact";
+    const auto oldDirectory = liveDirectory + ".old";
+
+    segment.close();
+    size_t index = compaction.segments;
+    try {
+        // links keep the live directory whole until the swap, the segments are copied where links can't be made
+        for (size_t tail = compaction.sealedIndex + 1; tail <= segmentIndex; tail++) {
+            index++;
+            std::error_code error;
+            std::filesystem::create_hard_link(segmentPath(tail), segmentPath(compactDirectory, index), error);
+            if (error) {
+                std::filesystem::copy_file(segmentPath(tail), segmentPath(compactDirectory, index));
+            }
+        }
+
+        // a crash between renames leaves only the compacted directory, constructor picks it up
+        std::filesystem::rename(liveDirectory, oldDirectory);
+    } catch (...) {
+        openSegment(segmentIndex);
+        throw;
+    }
+    std::filesystem::rename(compactDirectory, liveDirectory);
+    std::filesystem::remove_all(oldDirectory);
+
+    logBytes = compaction.bytes + (logBytes - compaction.sealedBytes);
+    garbageBytes -= std::min(garbageBytes, compaction.sealedGarbageBytes);
+    openSegment(index);
+}
+
+
+auto LogStorage::apply(const LogRecord &record) -> void {
+    switch (record.type) {
+        case LogRecordType::User: {
+            users.push_back(UserEntry{record.name, record.data});
+            userIdsByName.try_emplace(record.name, record.id);
+            break;
+        }
+        case LogRecordType::Chat: {
+            chats.push_back(ChatEntry{record.name, record.userId, record.rawTime, {}});
+            chatIdsByName.try_emplace(record.name, record.id);
+            break;
+        }
+        case LogRecordType::Member: {
+            if (record.chatId < 1 || static_cast<size_t>(record.chatId) > chats.size()) {
+                throw std::out_of_range("member record of unknown chat");
+            }
+            membership.addMember(record.chatId, record.userId, record.rawTime);
+            break;
+        }
+        case LogRecordType::Message: {
+            chats.at(record.chatId - 1).messages.push_back(
+                    MessageEntry{record.id, record.userId, record.rawTime, record.data}
+            );
+            lastMessageId = std::max(lastMessageId, record.id);
+            break;
+        }
+        case LogRecordType::Prune: {
+            auto &chat = chats.at(record.chatId - 1);
+            const auto last = std::upper_bound(
+                    chat.messages.begin(), chat.messages.end(), record.id,
+                    [](const int32_t id, const MessageEntry &message) -> bool {
+                        return id < message.id;
+                    }
+            );
+            for (auto it = chat.messages.begin(); it != last; it++) {
+                garbageBytes += frameHeaderSize + sizeof(LogRecord) + it->text.size();
+            }
+            chat.messages.erase(chat.messages.begin(), last);
+            chat.prunedId = std::max(chat.prunedId, record.id);
+            lastMessageId = std::max(lastMessageId, record.id);
+            break;
+        }
+        case LogRecordType::Password: {
+            users.at(record.id - 1).password = record.data;
+            // the plain user record is dead once compaction rewrites the user with its hash
+            garbageBytes += frameHeaderSize + sizeof(LogRecord) + record.data.size();
+            break;
+        }
+    }
+}
+
+
+auto LogStorage::findChat(const std::string &chatName) -> ChatEntry * {
+    const auto it = chatIdsByName.find(chatName);
+    return it == chatIdsByName.end() ? nullptr : &chats[it->second - 1];
+}
+
+
+LogStorage::LogStorage() : LogStorage("database.log") {}
+
+
+LogStorage::LogStorage(const std::string &directory, const size_t segmentSize) : directory(directory),
+                                                                                 segmentSize(segmentSize) {
+    // leftovers of an interrupted compaction
+    if (!std::filesystem::exists(directory) && std::filesystem::exists(directory + ".compact")) {
+        std::filesystem::rename(directory + ".compact", directory);
+    }
+    std::filesystem::remove_all(directory + ".compact");
+    std::filesystem::remove_all(directory + ".old");
+
+    std::filesystem::create_directories(directory);
+    replay();
+}
+
+
+auto LogStorage::getUserId(const std::string &username) -> int32_t {
+    std::lock_guard lockGuard(mutex);
+    const auto it = userIdsByName.find(username);
+    return it == userIdsByName.end() ? -1 : it->second;
+}
+
+
+auto LogStorage::getUsername(const int32_t userId) -> std::string {
+    std::lock_guard lockGuard(mutex);
+    if (userId < 1 || static_cast<size_t>(userId) > users.size()) {
+        throw std::runtime_error("unknown user");
+    }
+    return users[userId - 1].username;
+}
+
+
+auto LogStorage::getAllUsers() -> std::set<User> {
+    std::lock_guard lockGuard(mutex);
+    std::set<User> result;
+    for (size_t i = 0; i < users.size(); i++) {
+        result.emplace(static_cast<int32_t>(i + 1), users[i].username);
+    }
+    return result;
+}
+
+
+auto LogStorage::authenticateUser(const std::string &username, const std::string &password) -> AuthenticationResult {
+    int32_t id;
+    std::string hash;
+    {
+        std::lock_guard lockGuard(mutex);
+        const auto it = userIdsByName.find(username);
+        if (it == userIdsByName.end()) {
+            return AuthenticationResult{AuthenticationStatus::NotExists};
+        }
+        id = it->second;
+        hash = users[id - 1].password;
+    }
+
+    // hash is verified without the lock, it takes tens of milliseconds
+    if (!verifyPassword(hash, password)) {
+        return AuthenticationResult{AuthenticationStatus::InvalidPassword};
+    }
+
+    // plain passwords of older logs and hashes with other limits are migrated one sign-in at a time
+    if (needsRehash(hash)) {
+        rehashPassword(id, hash, password);
+    }
+    return AuthenticationResult{AuthenticationStatus::Success, id};
+}
+
+
+auto LogStorage::rehashPassword(const int32_t userId, const std::string &stored, const std::string &password) -> void {
+    LogRecord record{LogRecordType::Password, userId, 0, 0, 0, {}, hashPassword(password)};
+
+    std::lock_guard lockGuard(mutex);
+    if (users.at(userId - 1).password == stored) {
+        append(record);
+    }
+}
+
+
+auto LogStorage::createUser(const std::string &username, const std::string &password) -> void {
+    auto hash = hashPassword(password);
+
+    std::lock_guard lockGuard(mutex);
+    LogRecord record;
+    record.type = LogRecordType::User;
+    record.id = static_cast<int32_t>(users.size() + 1);
+    record.name = username;
+    record.data = std::move(hash);
+    append(record);
+}
+
+
+auto LogStorage::createChat(
+        const std::string &chatName,
+        const int32_t &adminId,
+        const std::vector<int32_t> &userIds
+) -> bool {
+    if (adminId == -1) {
+        return false;
+    }
+
+    // -1 ends the list, repeated users are written once
+    std::vector<int32_t> memberIds(userIds.begin(), std::find(userIds.begin(), userIds.end(), -1));
+    std::sort(memberIds.begin(), memberIds.end());
+    memberIds.erase(std::unique(memberIds.begin(), memberIds.end()), memberIds.end());
+
+    std::lock_guard lockGuard(mutex);
+    if (findChat(chatName)) {
+        return false;
+    }
+
+    const auto creationRawTime = time(nullptr);
+
+    std::vector<LogRecord> records;
+    records.reserve(memberIds.size() + 1);
+
+    LogRecord chatRecord;
+    chatRecord.type = LogRecordType::Chat;
+    chatRecord.id = static_cast<int32_t>(chats.size() + 1);
+    chatRecord.userId = adminId;
+    chatRecord.rawTime = creationRawTime;
+    chatRecord.name = chatName;
+    records.push_back(std::move(chatRecord));
+
+    for (const auto &userId: memberIds) {
+        LogRecord memberRecord;
+        memberRecord.type = LogRecordType::Member;
+        memberRecord.chatId = records.front().id;
+        memberRecord.userId = userId;
+        memberRecord.rawTime = creationRawTime;
+        records.push_back(std::move(memberRecord));
+    }
+    append(records);
+
+    return true;
+}
+
+
+auto LogStorage::getChatId(const std::string &chatName) -> int32_t {
+    std::lock_guard lockGuard(mutex);
+    const auto it = chatIdsByName.find(chatName);
+    return it == chatIdsByName.end() ? -1 : it->second;
+}
+
+
+auto LogStorage::getChatName(const int chatId) -> std::string {
+    std::lock_guard lockGuard(mutex);
+    if (chatId < 1 || static_cast<size_t>(chatId) > chats.size()) {
+        return {};
+    }
+    return chats[chatId - 1].name;
+}
+
+
+auto LogStorage::getChatsByTime(const int32_t userId, const time_t rawTime) -> std::vector<std::string> {
+    std::lock_guard lockGuard(mutex);
+    std::vector<std::string> result;
+    for (const auto &chatId: membership.getChatsByTime(userId, rawTime)) {
+        result.push_back(chats[chatId - 1].name);
+    }
+    return result;
+}
+
+
+auto LogStorage::createMessage(
+        const std::string &chatName,
+        const int32_t senderId,
+        const time_t rawTime,
+        const std::string &data
+) -> int32_t {
+    std::lock_guard lockGuard(mutex);
+    const auto it = chatIdsByName.find(chatName);
+    if (it == chatIdsByName.end()) {
+        return -1;
+    }
+
+    LogRecord record;
+    record.type = LogRecordType::Message;
+    record.id = lastMessageId + 1;
+    record.chatId = it->second;
+    record.userId = senderId;
+    record.rawTime = rawTime;
+    record.data = data;
+    append(record);
+
+    return record.id;
+}
+
+
+auto LogStorage::getAllMessagesFromChat(const std::string &chatName, const int32_t userId) -> std::vector<ChatMessage> {
+    return getMessagesFromChatSince(chatName, userId, 0);
+}
+
+
+auto LogStorage::getMessagesFromChatSince(
+        const std::string &chatName,
+        const int32_t userId,
+        const int32_t afterId
+) -> std::vector<ChatMessage> {
+    std::lock_guard lockGuard(mutex);
+    const auto it = chatIdsByName.find(chatName);
+    const auto allowedRawTime = it != chatIdsByName.end() ? membership.findAllowedRawTime(it->second, userId)
+                                                          : std::nullopt;
+    if (!allowedRawTime) {
+        throw std::logic_error("Chat don't exists");
+    }
+    const auto chat = &chats[it->second - 1];
+
+    // messages are appended in id order
+    const auto first = std::upper_bound(
+            chat->messages.begin(), chat->messages.end(), afterId,
+            [](const int32_t id, const MessageEntry &message) -> bool {
+                return id < message.id;
+            }
+    );
+
+    std::vector<ChatMessage> messages;
+    for (auto it = first; it != chat->messages.end(); it++) {
+        const auto &message = *it;
+        if (message.rawTime < *allowedRawTime) {
+            continue;
+        }
+        if (message.senderId < 1 || static_cast<size_t>(message.senderId) > users.size()) {
+            throw std::runtime_error("unknown message sender");
+        }
+        messages.emplace_back(
+                getFormattedDatetime(message.rawTime),
+                users[message.senderId - 1].username,
+                message.text,
+                message.id
+        );
+    }
+
+    return messages;
+}
+
+
+auto LogStorage::getRecentMessages(const std::string &chatName, const size_t limit) -> std::vector<StoredMessage> {
+    std::lock_guard lockGuard(mutex);
+    std::vector<StoredMessage> messages;
+    const auto chat = findChat(chatName);
+    if (!chat) {
+        return messages;
+    }
+
+    const auto first = chat->messages.size() > limit ? chat->messages.end() - static_cast<std::ptrdiff_t>(limit)
+                                                     : chat->messages.begin();
+    messages.reserve(chat->messages.end() - first);
+    for (auto it = first; it != chat->messages.end(); it++) {
+        const auto &sender = users.at(it->senderId - 1).username;
+        messages.push_back(StoredMessage{it->id, it->senderId, it->rawTime, it->text, sender});
+    }
+    return messages;
+}
+
+
+auto LogStorage::getUserAllowedRawTime(const int32_t chatId, const int32_t userId) -> time_t {
+    std::lock_guard lockGuard(mutex);
+    if (chatId < 1 || static_cast<size_t>(chatId) > chats.size()) {
+        throw std::runtime_error("unknown chat");
+    }
+
+    const auto allowedRawTime = membership.findAllowedRawTime(chatId, userId);
+    if (!allowedRawTime) {
+        throw std::runtime_error("user isn't a chat member");
+    }
+    return *allowedRawTime;
+}
+
+
+auto LogStorage::isChatMember(const int32_t chatId, const int32_t userId) -> bool {
+    return membership.findAllowedRawTime(chatId, userId).has_value();
+}
+
+
+auto LogStorage::getChatMembers(const std::string &chatName) -> std::vector<ChatMember> {
+    std::lock_guard lockGuard(mutex);
+    const auto it = chatIdsByName.find(chatName);
+    return it == chatIdsByName.end() ? std::vector<ChatMember>() : membership.getMembers(it->second);
+}
+
+
+auto LogStorage::getRecentlyActiveChats(const size_t messagesWindow) -> std::vector<std::string> {
+    std::lock_guard lockGuard(mutex);
+    const auto firstId = static_cast<int64_t>(lastMessageId) - static_cast<int64_t>(messagesWindow);
+
+    std::vector<std::string> result;
+    for (const auto &chat: chats) {
+        if (!chat.messages.empty() && chat.messages.back().id > firstId) {
+            result.push_back(chat.name);
+        }
+    }
+    return result;
+}
+
+
+auto LogStorage::getRecentlyActiveUsers(const size_t messagesWindow) -> std::vector<User> {
+    std::lock_guard lockGuard(mutex);
+    const auto firstId = static_cast<int64_t>(lastMessageId) - static_cast<int64_t>(messagesWindow);
+
+    std::set<int32_t> senderIds;
+    for (const auto &chat: chats) {
+        for (auto it = chat.messages.rbegin(); it != chat.messages.rend() && it->id > firstId; it++) {
+            senderIds.insert(it->senderId);
+        }
+    }
+
+    std::vector<User> result;
+    for (const auto &senderId: senderIds) {
+        result.emplace_back(senderId, users.at(senderId - 1).username);
+    }
+    return result;
+}
+
+
+auto LogStorage::getLastMessages() -> std::vector<Change> {
+    std::lock_guard lockGuard(mutex);
+    std::vector<Change> messages;
+    for (const auto &chat: chats) {
+        if (chat.messages.empty()) {
+            continue;
+        }
+        const auto &message = chat.messages.back();
+        messages.push_back(Change{ChangeType::Message, message.id, users.at(message.senderId - 1).username, chat.name,
+                                  message.rawTime, message.text});
+    }
+    return messages;
+}
+
+
+auto LogStorage::countMessagesSince(const int32_t afterId) -> std::vector<MessageCount> {
+    std::lock_guard lockGuard(mutex);
+    std::vector<MessageCount> counts;
+    for (const auto &chat: chats) {
+        const auto first = std::upper_bound(
+                chat.messages.begin(), chat.messages.end(), afterId,
+                [](const int32_t id, const MessageEntry &message) -> bool {
+                    return id < message.id;
+                }
+        );
+        if (first != chat.messages.end()) {
+            counts.push_back(MessageCount{chat.name, chat.messages.end() - first, chat.messages.back().id});
+        }
+    }
+    return counts;
+}
+
+
+auto LogStorage::pruneMessages(
+        const std::string &chatName,
+        const time_t olderThan,
+        const size_t keepLatest,
+        const size_t batchSize
+) -> size_t {
+    std::lock_guard lockGuard(mutex);
+    const auto it = chatIdsByName.find(chatName);
+    if (it == chatIdsByName.end()) {
+        return 0;
+    }
+
+    // messages are in id order, raw times grow with ids, so expired messages are a prefix
+    const auto &messages = chats[it->second - 1].messages;
+    size_t count = 0;
+    while (count < batchSize && count < messages.size() &&
+           (messages[count].rawTime < olderThan || (keepLatest != 0 && messages.size() - count > keepLatest))) {
+        count++;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    append(LogRecord{LogRecordType::Prune, messages[count - 1].id, it->second, 0, 0, {}, {}});
+    return count;
+}
+
+
+auto LogStorage::getPrunedId(const std::string &chatName) -> int32_t {
+    std::lock_guard lockGuard(mutex);
+    const auto chat = findChat(chatName);
+    return chat == nullptr ? 0 : chat->prunedId;
+}
+
+
+auto LogStorage::reclaimSpace() -> int64_t {
+    std::lock_guard compactionLockGuard(compactionMutex);
+
+    Compaction compaction;
+    {
+        std::lock_guard lockGuard(mutex);
+        if (garbageBytes == 0 || garbageBytes * 2 < logBytes) {
+            return 0;
+        }
+        compaction = sealLog();
+    }
+
+    // requests are served from the new segment while sealed ones are rewritten
+    writeCompaction(compaction);
+
+    std::lock_guard lockGuard(mutex);
+    const auto oldLogBytes = logBytes;
+    finishCompaction(compaction);
+    return static_cast<int64_t>(oldLogBytes) - static_cast<int64_t>(logBytes);
+}
+
+
+auto LogStorage::inviteUserToChat(
+        const std::string &chatName,
+        const int32_t invitorId,
+        const int32_t userId,
+        bool allowHistorySharing
+) -> void {
+    inviteUsersToChat(chatName, invitorId, {userId}, allowHistorySharing);
+}
+
+
+auto LogStorage::inviteUsersToChat(
+        const std::string &chatName,
+        const int32_t invitorId,
+        const std::vector<int32_t> &userIds,
+        bool allowHistorySharing
+) -> std::vector<InviteStatus> {
+    std::lock_guard lockGuard(mutex);
+    const auto it = chatIdsByName.find(chatName);
+    if (it == chatIdsByName.end()) {
+        throw std::logic_error("Chat don't exists");
+    }
+
+    time_t allowedRawTime = time(nullptr);
+    if (allowHistorySharing) {
+        const auto invitorAllowedRawTime = membership.findAllowedRawTime(it->second, invitorId);
+        if (!invitorAllowedRawTime) {
+            throw std::runtime_error("invitor isn't a chat member");
+        }
+        allowedRawTime = *invitorAllowedRawTime;
+    }
+
+    std::vector<InviteStatus> statuses;
+    statuses.reserve(userIds.size());
+    std::vector<LogRecord> records;
+    std::unordered_set<int32_t> seenIds;
+    for (const auto userId: userIds) {
+        if (userId == -1) {
+            statuses.push_back(InviteStatus::UnknownUser);
+        } else if (!seenIds.insert(userId).second || membership.findAllowedRawTime(it->second, userId)) {
+            statuses.push_back(InviteStatus::AlreadyMember);
+        } else {
+            statuses.push_back(InviteStatus::Invited);
+            records.push_back(LogRecord{LogRecordType::Member, 0, it->second, userId, allowedRawTime, {}, {}});
+        }
+    }
+
+    if (!records.empty()) {
+        append(records);
+    }
+    return statuses;
+}
+
+
+auto LogStorage::visitChat(const int32_t chatId, const std::function<void(const Change &)> &visitor) -> void {
+    const auto &chat = chats[chatId - 1];
+    visitor(Change{ChangeType::Chat, 0, users.at(chat.adminId - 1).username, chat.name, chat.creationRawTime, {}});
+    for (const auto &member: membership.getMembers(chatId)) {
+        visitor(Change{ChangeType::Member, 0, users.at(member.userId - 1).username, chat.name, member.allowedRawTime, {}});
+    }
+}
+
+
+auto LogStorage::scanChanges(const std::function<void(const Change &)> &visitor) -> void {
+    std::lock_guard lockGuard(mutex);
+    for (const auto &user: users) {
+        visitor(Change{ChangeType::User, 0, user.username, {}, 0, toPasswordHash(user.password)});
+    }
+    for (size_t chatId = 1; chatId <= chats.size(); chatId++) {
+        visitChat(static_cast<int32_t>(chatId), visitor);
+    }
+
+    // messages of different chats are merged back into id order
+    std::vector<std::pair<const MessageEntry *, const ChatEntry *>> messages;
+    for (const auto &chat: chats) {
+        for (const auto &message: chat.messages) {
+            messages.emplace_back(&message, &chat);
+        }
+    }
+    std::sort(messages.begin(), messages.end(), [](const auto &lhs, const auto &rhs) -> bool {
+        return lhs.first->id < rhs.first->id;
+    });
+
+    for (const auto &[message, chat]: messages) {
+        visitor(Change{ChangeType::Message, message->id, users.at(message->senderId - 1).username, chat->name,
+                       message->rawTime, message->text});
+    }
+}
+
+
+auto LogStorage::openChangeCursor() -> ChangeCursor {
+    std::lock_guard lockGuard(mutex);
+    ChangeCursor cursor;
+    cursor.lastUserId = static_cast<int32_t>(users.size());
+    cursor.lastChatId = static_cast<int32_t>(chats.size());
+    return cursor;
+}
+
+
+auto LogStorage::scanChangesPage(
+        ChangeCursor &cursor,
+        const size_t limit,
+        const std::function<void(const Change &)> &visitor
+) -> bool {
+    std::lock_guard lockGuard(mutex);
+
+    size_t visited = 0;
+    if (cursor.type == ChangeType::User) {
+        for (; cursor.id < cursor.lastUserId; cursor.id++, visited++) {
+            if (visited == limit) {
+                return true;
+            }
+            const auto &user = users[cursor.id];
+            visitor(Change{ChangeType::User, 0, user.username, {}, 0, toPasswordHash(user.password)});
+        }
+        cursor.type = ChangeType::Chat;
+        cursor.id = 0;
+    }
+
+    if (cursor.type == ChangeType::Chat) {
+        for (; cursor.id < cursor.lastChatId; cursor.id++, visited++) {
+            if (visited == limit) {
+                return true;
+            }
+            const auto &chat = chats[cursor.id];
+            visitor(Change{ChangeType::Chat, 0, users.at(chat.adminId - 1).username, chat.name, chat.creationRawTime, {}});
+        }
+        cursor.type = ChangeType::Member;
+        cursor.chatId = cursor.id = 0;
+    }
+
+    // members are sorted by user id within a chat, the page goes on after the cursor
+    if (cursor.type == ChangeType::Member) {
+        for (cursor.chatId = std::max(cursor.chatId, 1); cursor.chatId <= cursor.lastChatId; cursor.chatId++, cursor.id = 0) {
+            const auto &chat = chats[cursor.chatId - 1];
+            for (const auto &member: membership.getMembers(cursor.chatId)) {
+                if (member.userId <= cursor.id || member.userId > cursor.lastUserId) {
+                    continue;
+                }
+                if (visited == limit) {
+                    return true;
+                }
+                visitor(Change{ChangeType::Member, 0, users.at(member.userId - 1).username, chat.name,
+                               member.allowedRawTime, {}});
+                cursor.id = member.userId;
+                visited++;
+            }
+        }
+        cursor.type = ChangeType::Message;
+        cursor.chatId = cursor.id = 0;
+    }
+
+    // messages of different chats are merged back into id order from the cursor on
+    using Position = std::pair<std::vector<MessageEntry>::const_iterator, const ChatEntry *>;
+    const auto later = [](const Position &lhs, const Position &rhs) -> bool {
+        return lhs.first->id > rhs.first->id;
+    };
+    std::priority_queue<Position, std::vector<Position>, decltype(later)> positions(later);
+    for (int32_t chatId = 1; chatId <= cursor.lastChatId; chatId++) {
+        const auto &chat = chats[chatId - 1];
+        const auto first = std::upper_bound(
+                chat.messages.begin(), chat.messages.end(), cursor.id,
+                [](const int32_t id, const MessageEntry &message) -> bool {
+                    return id < message.id;
+                }
+        );
+        if (first != chat.messages.end()) {
+            positions.emplace(first, &chat);
+        }
+    }
+
+    while (!positions.empty()) {
+        auto [it, chat] = positions.top();
+        positions.pop();
+        if (it->senderId <= cursor.lastUserId) {
+            if (visited == limit) {
+                return true;
+            }
+            visitor(Change{ChangeType::Message, it->id, users.at(it->senderId - 1).username, chat->name, it->rawTime,
+                           it->text});
+            cursor.id = it->id;
+            visited++;
+        }
+        if (++it != chat->messages.end()) {
+            positions.emplace(it, chat);
+        }
+    }
+    return false;
+}
+
+
+auto LogStorage::scanChatChanges(
+        const std::string &chatName,
+        const std::function<void(const Change &)> &visitor
+) -> void {
+    std::lock_guard lockGuard(mutex);
+    const auto it = chatIdsByName.find(chatName);
+    if (it == chatIdsByName.end()) {
+        return;
+    }
+    const auto chat = &chats[it->second - 1];
+
+    std::set<int32_t> userIds{chat->adminId};
+    for (const auto &member: membership.getMembers(it->second)) {
+        userIds.insert(member.userId);
+    }
+    for (const auto &message: chat->messages) {
+        userIds.insert(message.senderId);
+    }
+    for (const auto &userId: userIds) {
+        const auto &user = users.at(userId - 1);
+        visitor(Change{ChangeType::User, 0, user.username, {}, 0, toPasswordHash(user.password)});
+    }
+
+    visitChat(it->second, visitor);
+    for (const auto &message: chat->messages) {
+        visitor(Change{ChangeType::Message, message.id, users.at(message.senderId - 1).username, chat->name,
+                       message.rawTime, message.text});
+    }
+}
+
+
+auto LogStorage::addChange(const Change &change, const std::unordered_map<std::string, std::string> &hashes,
+                          ChangeBatch &batch) -> void {
+    LogRecord record;
+    record.rawTime = change.rawTime;
+
+    const auto findId = [](const std::unordered_map<std::string, int32_t> &ids,
+                           const std::unordered_map<std::string, int32_t> &batchIds,
+                           const std::string &name) -> int32_t {
+        const auto it = ids.find(name);
+        if (it != ids.end()) {
+            return it->second;
+        }
+        const auto batchIt = batchIds.find(name);
+        return batchIt == batchIds.end() ? -1 : batchIt->second;
+    };
+
+    const auto userId = findId(userIdsByName, batch.userIds, change.username);
+    if (change.type == ChangeType::User) {
+        if (userId != -1) {
+            return;
+        }
+        record.type = LogRecordType::User;
+        record.id = static_cast<int32_t>(users.size() + batch.userIds.size() + 1);
+        record.name = change.username;
+        record.data = hashes.at(change.username);
+        batch.userIds.emplace(record.name, record.id);
+        batch.records.push_back(std::move(record));
+        return;
+    }
+
+    if (userId == -1) {
+        throw std::runtime_error("change refers to unknown user " + change.username);
+    }
+    record.userId = userId;
+
+    const auto chatId = findId(chatIdsByName, batch.chatIds, change.chatName);
+    if (change.type == ChangeType::Chat) {
+        if (chatId != -1) {
+            return;
+        }
+        record.type = LogRecordType::Chat;
+        record.id = static_cast<int32_t>(chats.size() + batch.chatIds.size() + 1);
+        record.name = change.chatName;
+        batch.chatIds.emplace(record.name, record.id);
+        batch.records.push_back(std::move(record));
+        return;
+    }
+
+    if (chatId == -1) {
+        throw std::runtime_error("change refers to unknown chat " + change.chatName);
+    }
+    record.chatId = chatId;
+
+    if (change.type == ChangeType::Member) {
+        if (membership.findAllowedRawTime(chatId, userId) || !batch.members.emplace(chatId, userId).second) {
+            return;
+        }
+        record.type = LogRecordType::Member;
+        batch.records.push_back(std::move(record));
+    } else if (change.type == ChangeType::Message) {
+        // ids must grow, an older id is either this message applied before or taken by another one
+        const auto lastId = std::max(lastMessageId, batch.lastMessageId);
+        record.id = change.id;
+        if (change.id <= lastId) {
+            if (batch.messages.contains({chatId, change.id})) {
+                return;
+            }
+            if (static_cast<size_t>(chatId) <= chats.size()) {
+                const auto &messages = chats[chatId - 1].messages;
+                const auto it = std::lower_bound(
+                        messages.begin(), messages.end(), change.id,
+                        [](const MessageEntry &message, const int32_t id) -> bool {
+                            return message.id < id;
+                        }
+                );
+                if (it != messages.end() && it->id == change.id) {
+                    return;
+                }
+            }
+            record.id = lastId + 1;
+        }
+        batch.messages.emplace(chatId, change.id);
+        batch.lastMessageId = record.id;
+        record.type = LogRecordType::Message;
+        record.data = change.data;
+        batch.records.push_back(std::move(record));
+    }
+}
+
+
+auto LogStorage::applyChanges(const std::vector<Change> &changes) -> void {
+    // plain passwords of old exports are hashed before locking
+    std::unordered_map<std::string, std::string> hashes;
+    for (const auto &change: changes) {
+        if (change.type == ChangeType::User) {
+            hashes[change.username] = toPasswordHash(change.data);
+        }
+    }
+
+    // every change is checked before anything is written, the batch is appended with one flush
+    std::lock_guard lockGuard(mutex);
+    ChangeBatch batch;
+    for (const auto &change: changes) {
+        addChange(change, hashes, batch);
+    }
+    if (!batch.records.empty()) {
+        append(batch.records);
+    }
+}
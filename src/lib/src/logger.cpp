@@ -0,0 +1,185 @@
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+
+#include "../logger.hpp"
+
+
+constexpr const char *levelNames[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+
+
+Logger::Logger() {
+    drainer = std::thread(&Logger::drainLoop, this);
+}
+
+
+Logger::~Logger() {
+    {
+        std::lock_guard lockGuard(mutex);
+        stopping = true;
+    }
+    condition.notify_one();
+    drainer.join();
+}
+
+
+auto Logger::get() -> Logger & {
+    static Logger logger;
+    return logger;
+}
+
+
+auto Logger::localRing() -> Ring & {
+    thread_local const auto ring = [this] {
+        auto created = std::make_shared<Ring>();
+        std::lock_guard lockGuard(mutex);
+        rings.push_back(created);
+        return created;
+    }();
+    return *ring;
+}
+
+
+auto Logger::claim(const LogLevel level, const LogContext &context) -> Entry * {
+    auto &ring = localRing();
+    const auto tail = ring.tail.load(std::memory_order_relaxed);
+    if (tail - ring.head.load(std::memory_order_acquire) == ringCapacity) {
+        dropped++;
+        return nullptr;
+    }
+
+    auto &entry = ring.entries[tail % ringCapacity];
+    entry.timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    entry.level = level;
+    entry.connectionId = context.connectionId;
+    entry.type = context.type ? static_cast<int32_t>(*context.type) : -1;
+    entry.usernameSize = static_cast<uint8_t>(std::min(context.username.size(), usernameCapacity));
+    std::memcpy(entry.username, context.username.data(), entry.usernameSize);
+    entry.textSize = 0;
+    return &entry;
+}
+
+
+auto Logger::commit() -> void {
+    auto &ring = localRing();
+    ring.tail.store(ring.tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+
+auto Logger::append(Entry &entry, const std::string_view value) -> void {
+    const auto size = std::min(value.size(), textCapacity - entry.textSize);
+    std::memcpy(entry.text + entry.textSize, value.data(), size);
+    entry.textSize = static_cast<uint8_t>(entry.textSize + size);
+}
+
+
+auto Logger::append(Entry &entry, const char *value) -> void {
+    append(entry, std::string_view(value));
+}
+
+
+auto Logger::append(Entry &entry, const std::string &value) -> void {
+    append(entry, std::string_view(value));
+}
+
+
+auto Logger::append(Entry &entry, const bool value) -> void {
+    append(entry, std::string_view(value ? "true" : "false"));
+}
+
+
+auto Logger::append(Entry &entry, const double value) -> void {
+    char buffer[32];
+    const auto size = std::snprintf(buffer, sizeof(buffer), "%g", value);
+    append(entry, std::string_view(buffer, static_cast<size_t>(std::max(size, 0))));
+}
+
+
+auto Logger::drainLoop() -> void {
+    auto done = false;
+    while (!done) {
+        {
+            std::unique_lock lock(mutex);
+            condition.wait_for(lock, drainInterval, [this] { return stopping; });
+            done = stopping;
+        }
+        drain();
+    }
+}
+
+
+auto Logger::drain() -> void {
+    std::string output;
+    std::string errors;
+    // lines of one second share the formatted date
+    int64_t second = -1;
+    char date[32]{};
+
+    std::lock_guard lockGuard(mutex);
+    uint64_t lines = 0;
+    for (const auto &ring: rings) {
+        const auto head = ring->head.load(std::memory_order_relaxed);
+        const auto tail = ring->tail.load(std::memory_order_acquire);
+        for (auto index = head; index != tail; index++) {
+            const auto &entry = ring->entries[index % ringCapacity];
+            if (entry.timeNs / 1000000000 != second) {
+                second = entry.timeNs / 1000000000;
+                const auto rawTime = static_cast<time_t>(second);
+                struct tm localTime{};
+                localtime_r(&rawTime, &localTime);
+                std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &localTime);
+            }
+
+            auto &line = entry.level >= LogLevel::Warning ? errors : output;
+            char milliseconds[8];
+            std::snprintf(milliseconds, sizeof(milliseconds), ".%03d ", static_cast<int>(entry.timeNs / 1000000 % 1000));
+            line += date;
+            line += milliseconds;
+            line += levelNames[static_cast<int>(entry.level)];
+            if (entry.connectionId != 0) {
+                line += " conn=" + std::to_string(entry.connectionId);
+            }
+            if (entry.usernameSize != 0) {
+                line += " user=";
+                line.append(entry.username, entry.usernameSize);
+            }
+            if (entry.type != -1) {
+                line += " type=" + getMessageTypeName(static_cast<MessageType>(entry.type));
+            }
+            line += ' ';
+            line.append(entry.text, entry.textSize);
+            line += '\n';
+        }
+        ring->head.store(tail, std::memory_order_release);
+        lines += tail - head;
+    }
+    // rings of exited threads, checked again as a thread may log right before exiting
+    std::erase_if(rings, [](const std::shared_ptr<Ring> &ring) -> bool {
+        return ring.use_count() == 1 && ring->head.load() == ring->tail.load();
+    });
+    written += lines;
+
+    if (!output.empty()) {
+        std::cout.write(output.data(), static_cast<std::streamsize>(output.size()));
+        std::cout.flush();
+    }
+    if (!errors.empty()) {
+        std::cerr.write(errors.data(), static_cast<std::streamsize>(errors.size()));
+        std::cerr.flush();
+    }
+}
+
+
+auto Logger::flush() -> void {
+    drain();
+}
+
+
+auto Logger::exportMetrics(Metrics &metrics) -> void {
+    metrics.set("log.written", static_cast<int64_t>(written.load()));
+    metrics.set("log.dropped", static_cast<int64_t>(dropped.load()));
+}
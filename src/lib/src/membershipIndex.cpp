@@ -0,0 +1,147 @@
+#include <mutex>
+#include <algorithm>
+
+
+#include "../membershipIndex.hpp"
+
+
+auto MembershipIndex::addChat(const int32_t chatId, const std::string &chatName) -> void {
+    std::unique_lock lock(mutex);
+    chatIds.try_emplace(chatName, chatId);
+    chatNames.try_emplace(chatId, chatName);
+}
+
+
+auto MembershipIndex::addMember(const int32_t chatId, const int32_t userId, const time_t allowedRawTime) -> bool {
+    std::unique_lock lock(mutex);
+    auto &chat = members[chatId];
+    const auto it = std::lower_bound(chat.userIds.begin(), chat.userIds.end(), userId);
+    if (it != chat.userIds.end() && *it == userId) {
+        return false;
+    }
+
+    const auto position = it - chat.userIds.begin();
+    chat.userIds.insert(it, userId);
+    chat.allowedRawTimes.insert(chat.allowedRawTimes.begin() + position, allowedRawTime);
+
+    auto &chats = userChats[userId];
+    chats.insert(std::lower_bound(chats.begin(), chats.end(), chatId), chatId);
+    size++;
+    return true;
+}
+
+
+auto MembershipIndex::addMembers(
+        const int32_t chatId,
+        std::vector<int32_t> userIds,
+        const time_t allowedRawTime
+) -> size_t {
+    std::sort(userIds.begin(), userIds.end());
+    userIds.erase(std::unique(userIds.begin(), userIds.end()), userIds.end());
+
+    std::unique_lock lock(mutex);
+    auto &chat = members[chatId];
+
+    // inserting thousands of members one by one would move the columns for each of them
+    Members merged;
+    merged.userIds.reserve(chat.userIds.size() + userIds.size());
+    merged.allowedRawTimes.reserve(chat.userIds.size() + userIds.size());
+
+    size_t added = 0;
+    size_t position = 0;
+    for (const auto userId: userIds) {
+        for (; position < chat.userIds.size() && chat.userIds[position] < userId; position++) {
+            merged.userIds.push_back(chat.userIds[position]);
+            merged.allowedRawTimes.push_back(chat.allowedRawTimes[position]);
+        }
+        if (position < chat.userIds.size() && chat.userIds[position] == userId) {
+            continue;
+        }
+        merged.userIds.push_back(userId);
+        merged.allowedRawTimes.push_back(allowedRawTime);
+
+        auto &chats = userChats[userId];
+        chats.insert(std::lower_bound(chats.begin(), chats.end(), chatId), chatId);
+        added++;
+    }
+    for (; position < chat.userIds.size(); position++) {
+        merged.userIds.push_back(chat.userIds[position]);
+        merged.allowedRawTimes.push_back(chat.allowedRawTimes[position]);
+    }
+
+    chat = std::move(merged);
+    size += added;
+    return added;
+}
+
+
+auto MembershipIndex::getChatId(const std::string &chatName) const -> int32_t {
+    std::shared_lock lock(mutex);
+    const auto it = chatIds.find(chatName);
+    return it == chatIds.end() ? -1 : it->second;
+}
+
+
+auto MembershipIndex::getChatName(const int32_t chatId) const -> std::string {
+    std::shared_lock lock(mutex);
+    const auto it = chatNames.find(chatId);
+    return it == chatNames.end() ? std::string() : it->second;
+}
+
+
+auto MembershipIndex::findAllowedRawTime(const int32_t chatId, const int32_t userId) const -> std::optional<time_t> {
+    std::shared_lock lock(mutex);
+    const auto chatIt = members.find(chatId);
+    if (chatIt == members.end()) {
+        return std::nullopt;
+    }
+
+    const auto &chat = chatIt->second;
+    const auto it = std::lower_bound(chat.userIds.begin(), chat.userIds.end(), userId);
+    if (it == chat.userIds.end() || *it != userId) {
+        return std::nullopt;
+    }
+    return chat.allowedRawTimes[it - chat.userIds.begin()];
+}
+
+
+auto MembershipIndex::getMembers(const int32_t chatId) const -> std::vector<ChatMember> {
+    std::shared_lock lock(mutex);
+    std::vector<ChatMember> result;
+    const auto it = members.find(chatId);
+    if (it == members.end()) {
+        return result;
+    }
+
+    const auto &chat = it->second;
+    result.reserve(chat.userIds.size());
+    for (size_t i = 0; i < chat.userIds.size(); i++) {
+        result.push_back(ChatMember{chat.userIds[i], chat.allowedRawTimes[i]});
+    }
+    return result;
+}
+
+
+auto MembershipIndex::getChatsByTime(const int32_t userId, const time_t rawTime) const -> std::vector<int32_t> {
+    std::shared_lock lock(mutex);
+    std::vector<int32_t> result;
+    const auto it = userChats.find(userId);
+    if (it == userChats.end()) {
+        return result;
+    }
+
+    for (const auto &chatId: it->second) {
+        const auto &chat = members.at(chatId);
+        const auto member = std::lower_bound(chat.userIds.begin(), chat.userIds.end(), userId);
+        if (chat.allowedRawTimes[member - chat.userIds.begin()] > rawTime) {
+            result.push_back(chatId);
+        }
+    }
+    return result;
+}
+
+
+auto MembershipIndex::getSize() const -> size_t {
+    std::shared_lock lock(mutex);
+    return size;
+}
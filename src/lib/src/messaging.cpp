@@ -1,11 +1,43 @@
+#include <array>
+#include <stdexcept>
+
+
 #include "../messaging.hpp"
 
 
+// in MessageType order
+const std::array messageTypeNames{
+        "CreateMessage",
+        "Update",
+        "SignIn",
+        "SignUp",
+        "CreateChat",
+        "UpdateChats",
+        "GetAllMessagesFromChat",
+        "InviteUserToChat",
+        "ClientError",
+        "ServerError",
+        "GetMessagesFromChatSince",
+        "ResumeSession",
+        "Heartbeat",
+        "GetServerStats",
+        "GetRecentChats",
+        "MarkRead",
+        "InviteUsersToChat",
+        "Restarting",
+        "Event"
+};
+
+
 auto sendMessage(zmqpp::socket &socket, const Message &message) -> void {
-    zmqpp::message zmqMessage;
     msgpack::sbuffer package;
-
     msgpack::pack(&package, message);
+    sendPackage(socket, package);
+}
+
+
+auto sendPackage(zmqpp::socket &socket, const msgpack::sbuffer &package) -> void {
+    zmqpp::message zmqMessage;
     zmqMessage.add_raw(package.data(), package.size());
 
     if (!socket.send(zmqMessage)) {
@@ -15,13 +47,37 @@ auto sendMessage(zmqpp::socket &socket, const Message &message) -> void {
 
 
 auto receiveMessage(zmqpp::socket &socket, Message &message) -> void {
+    if (!tryReceiveMessage(socket, message)) {
+        throw std::runtime_error("receive timeout");
+    }
+}
+
+
+auto tryReceiveMessage(zmqpp::socket &socket, Message &message) -> bool {
     zmqpp::message zmqMessage;
     if (!socket.receive(zmqMessage)) {
-        throw std::runtime_error("receive timeout");
+        return false;
     }
 
     msgpack::unpacked unpackedPackage;
     msgpack::unpack(unpackedPackage, static_cast<const char *>(zmqMessage.raw_data()), zmqMessage.size(0));
     unpackedPackage.get().convert(message);
+    return true;
 }
 
+
+
+auto getMessageTypeName(const MessageType type) -> std::string {
+    const auto index = static_cast<size_t>(type);
+    return index < messageTypeNames.size() ? messageTypeNames[index] : std::to_string(index);
+}
+
+
+auto parseMessageType(const std::string &name) -> MessageType {
+    for (size_t index = 0; index < messageTypeNames.size(); index++) {
+        if (name == messageTypeNames[index]) {
+            return static_cast<MessageType>(index);
+        }
+    }
+    throw std::runtime_error("unknown message type " + name);
+}
@@ -0,0 +1,31 @@
+#include "../metrics.hpp"
+
+
+auto Metrics::set(const std::string &name, const int64_t value) -> void {
+    std::lock_guard lockGuard(mutex);
+    values[name] = value;
+}
+
+
+auto Metrics::add(const std::string &name, const int64_t delta) -> void {
+    std::lock_guard lockGuard(mutex);
+    values[name] += delta;
+}
+
+
+auto Metrics::get(const std::string &name) -> int64_t {
+    std::lock_guard lockGuard(mutex);
+    const auto it = values.find(name);
+    return it == values.end() ? 0 : it->second;
+}
+
+
+auto Metrics::dump() -> std::vector<std::string> {
+    std::lock_guard lockGuard(mutex);
+    std::vector<std::string> lines;
+    lines.reserve(values.size());
+    for (const auto &[name, value]: values) {
+        lines.push_back(name + " " + std::to_string(value));
+    }
+    return lines;
+}
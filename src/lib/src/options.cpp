@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <stdexcept>
+
+
+#include "../options.hpp"
+
+
+Options::Options(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const std::string argument(argv[i]);
+        if (argument.rfind("--", 0) != 0) {
+            throw std::runtime_error("invalid option " + argument);
+        }
+
+        const auto separator = argument.find('=');
+        if (separator == std::string::npos) {
+            values[argument.substr(2)] = "true";
+        } else {
+            values[argument.substr(2, separator - 2)] = argument.substr(separator + 1);
+        }
+    }
+}
+
+
+auto Options::has(const std::string &name) const -> bool {
+    return values.find(name) != values.end();
+}
+
+
+auto Options::get(const std::string &name, const std::string &defaultValue) const -> std::string {
+    const auto it = values.find(name);
+    return it == values.end() ? defaultValue : it->second;
+}
+
+
+auto Options::getNumber(const std::string &name, const int64_t defaultValue) const -> int64_t {
+    const auto it = values.find(name);
+    if (it == values.end()) {
+        return defaultValue;
+    }
+
+    try {
+        return std::stoll(it->second);
+    } catch (std::logic_error &) {
+        throw std::runtime_error("option --" + name + " must be a number");
+    }
+}
+
+
+auto Options::getList(const std::string &name) const -> std::vector<std::string> {
+    std::vector<std::string> list;
+    const auto it = values.find(name);
+    if (it == values.end()) {
+        return list;
+    }
+
+    size_t begin = 0;
+    while (begin <= it->second.size()) {
+        const auto end = std::min(it->second.find(',', begin), it->second.size());
+        if (end != begin) {
+            list.push_back(it->second.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+    return list;
+}
@@ -0,0 +1,68 @@
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <sodium.h>
+
+
+#include "../password.hpp"
+
+
+// memory times passes of libsodium's interactive limits, kept by every configuration
+constexpr unsigned long long passwordWork =
+        crypto_pwhash_OPSLIMIT_INTERACTIVE * static_cast<unsigned long long>(crypto_pwhash_MEMLIMIT_INTERACTIVE);
+
+// sized for the default 64 handshakes of server
+std::atomic<size_t> passwordMemLimit{passwordMemoryBudget / 64};
+std::atomic<unsigned long long> passwordOpsLimit{passwordWork / (passwordMemoryBudget / 64)};
+
+
+auto initializeSodium() -> void {
+    static const auto initialized = sodium_init() >= 0;
+    if (!initialized) {
+        throw std::runtime_error("sodium_init error");
+    }
+}
+
+
+auto configurePasswordHashing(const size_t concurrency) -> void {
+    const auto memLimit = std::clamp<size_t>(passwordMemoryBudget / std::max<size_t>(concurrency, 1),
+                                             crypto_pwhash_MEMLIMIT_MIN, crypto_pwhash_MEMLIMIT_INTERACTIVE);
+    passwordMemLimit = memLimit;
+    passwordOpsLimit = std::clamp<unsigned long long>(passwordWork / memLimit, crypto_pwhash_OPSLIMIT_INTERACTIVE,
+                                                      crypto_pwhash_OPSLIMIT_MAX);
+}
+
+
+auto hashPassword(const std::string &password) -> std::string {
+    initializeSodium();
+    char hash[crypto_pwhash_STRBYTES];
+    if (crypto_pwhash_str(hash, password.data(), password.size(), passwordOpsLimit, passwordMemLimit) != 0) {
+        throw std::runtime_error("can't hash password");
+    }
+    return hash;
+}
+
+
+auto isPasswordHash(const std::string &stored) -> bool {
+    return stored.rfind(crypto_pwhash_STRPREFIX, 0) == 0;
+}
+
+
+auto needsRehash(const std::string &stored) -> bool {
+    initializeSodium();
+    return !isPasswordHash(stored) || crypto_pwhash_str_needs_rehash(stored.c_str(), passwordOpsLimit, passwordMemLimit) != 0;
+}
+
+
+auto verifyPassword(const std::string &stored, const std::string &password) -> bool {
+    initializeSodium();
+    if (isPasswordHash(stored)) {
+        return crypto_pwhash_str_verify(stored.c_str(), password.data(), password.size()) == 0;
+    }
+    return stored.size() == password.size() && sodium_memcmp(stored.data(), password.data(), stored.size()) == 0;
+}
+
+
+auto toPasswordHash(const std::string &stored) -> std::string {
+    return isPasswordHash(stored) ? stored : hashPassword(stored);
+}
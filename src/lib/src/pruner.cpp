@@ -0,0 +1,147 @@
+#include <fstream>
+#include <sstream>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+
+#include "../pruner.hpp"
+#include "../logger.hpp"
+
+
+using Clock = std::chrono::steady_clock;
+
+
+Pruner::Pruner(
+        Storage &storage,
+        Scheduler &scheduler,
+        Metrics &metrics,
+        const RetentionPolicy defaultPolicy,
+        std::unordered_map<std::string, RetentionPolicy> policies,
+        const size_t batchSize,
+        const std::chrono::milliseconds interval,
+        std::function<void(const std::string &, size_t)> onPruned
+) : storage(storage), scheduler(scheduler), metrics(metrics), defaultPolicy(defaultPolicy),
+    policies(std::move(policies)), batchSize(std::max<size_t>(batchSize, 1)), interval(interval),
+    onPruned(std::move(onPruned)) {
+    thread = std::thread(&Pruner::run, this);
+}
+
+
+Pruner::~Pruner() {
+    {
+        std::lock_guard lockGuard(mutex);
+        running = false;
+    }
+    condition.notify_all();
+    thread.join();
+}
+
+
+auto Pruner::loadPolicies(const std::string &path) -> std::unordered_map<std::string, RetentionPolicy> {
+    std::ifstream input(path);
+    if (!input) {
+        throw std::runtime_error("can't open retention policies " + path);
+    }
+
+    std::unordered_map<std::string, RetentionPolicy> policies;
+    std::string line;
+    while (std::getline(input, line)) {
+        std::istringstream record(line);
+        std::string chatName;
+        RetentionPolicy policy;
+        if (record >> chatName >> policy.maxAge >> policy.maxCount) {
+            policies[chatName] = policy;
+        }
+    }
+    return policies;
+}
+
+
+auto Pruner::pruneChat(const std::string &chatName, const RetentionPolicy &policy, int64_t &maxBatchTime) -> size_t {
+    const auto olderThan = policy.maxAge == 0 ? 0 : time(nullptr) - policy.maxAge;
+
+    size_t pruned = 0;
+    while (true) {
+        {
+            std::lock_guard lockGuard(mutex);
+            if (!running) {
+                break;
+            }
+        }
+
+        Scheduler::Slot slot(scheduler, RequestClass::Bulk);
+        const auto start = Clock::now();
+        const auto deleted = storage.pruneMessages(chatName, olderThan, policy.maxCount, batchSize);
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+        maxBatchTime = std::max<int64_t>(maxBatchTime, elapsed);
+
+        pruned += deleted;
+        if (deleted < batchSize) {
+            break;
+        }
+    }
+
+    if (pruned != 0) {
+        onPruned(chatName, pruned);
+    }
+    return pruned;
+}
+
+
+auto Pruner::pass() -> void {
+    const auto start = Clock::now();
+    size_t pruned = 0;
+    int64_t maxBatchTime = 0;
+
+    if (defaultPolicy.isEmpty()) {
+        for (const auto &[chatName, policy]: policies) {
+            pruned += pruneChat(chatName, policy, maxBatchTime);
+        }
+    } else {
+        for (const auto &message: storage.getLastMessages()) {
+            const auto it = policies.find(message.chatName);
+            pruned += pruneChat(message.chatName, it == policies.end() ? defaultPolicy : it->second, maxBatchTime);
+        }
+    }
+
+    // vacuum is bounded per call too, interactive requests get storage in between
+    int64_t reclaimed = 0;
+    while (true) {
+        Scheduler::Slot slot(scheduler, RequestClass::Bulk);
+        const auto bytes = storage.reclaimSpace();
+        if (bytes <= 0) {
+            break;
+        }
+        reclaimed += bytes;
+    }
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+    metrics.add("retention.passes");
+    metrics.add("retention.pruned_total", static_cast<int64_t>(pruned));
+    metrics.add("retention.reclaimed_bytes_total", reclaimed);
+    metrics.set("retention.last_pass_pruned", static_cast<int64_t>(pruned));
+    metrics.set("retention.last_pass_ms", elapsed);
+    metrics.set("retention.rows_per_s", elapsed == 0 ? static_cast<int64_t>(pruned)
+                                                     : static_cast<int64_t>(pruned) * 1000 / elapsed);
+    // longest time a batch held storage, the worst delay pruning adds to a foreground request
+    metrics.set("retention.batch_us_max", maxBatchTime);
+}
+
+
+auto Pruner::run() noexcept -> void {
+    std::unique_lock lock(mutex);
+    while (running) {
+        lock.unlock();
+        try {
+            pass();
+        } catch (std::exception &exception) {
+            metrics.add("retention.errors");
+            CP_LOG_ERROR({}, "retention pass failed: ", exception.what());
+        }
+        lock.lock();
+        condition.wait_for(lock, interval, [this] {
+            return !running;
+        });
+    }
+}
@@ -0,0 +1,103 @@
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+
+#include "../rateLimiter.hpp"
+
+
+auto bucketKey(const int32_t userId, const MessageType type) -> uint64_t {
+    return static_cast<uint64_t>(static_cast<uint32_t>(userId)) << 32 | static_cast<uint32_t>(type);
+}
+
+
+RateLimiter::RateLimiter(const RateLimit defaultLimit) : defaultLimit(defaultLimit) {}
+
+
+auto RateLimiter::getLimit(const MessageType type) const -> RateLimit {
+    const auto it = limits.find(type);
+    return it == limits.end() ? defaultLimit : it->second;
+}
+
+
+auto RateLimiter::refill(Bucket &bucket, const RateLimit &limit, const std::chrono::steady_clock::time_point now) -> void {
+    const auto elapsed = std::chrono::duration<double>(now - bucket.updateTime).count();
+    bucket.tokens = std::min(limit.burst, bucket.tokens + elapsed * limit.rate);
+    bucket.updateTime = now;
+}
+
+
+auto RateLimiter::setDefaultLimit(const RateLimit limit) -> void {
+    std::lock_guard lockGuard(mutex);
+    defaultLimit = limit;
+}
+
+
+auto RateLimiter::setLimit(const MessageType type, const RateLimit limit) -> void {
+    std::lock_guard lockGuard(mutex);
+    limits[type] = limit;
+}
+
+
+auto RateLimiter::setLimits(const std::vector<std::string> &specifications) -> void {
+    for (const auto &specification: specifications) {
+        const auto first = specification.find(':');
+        const auto second = specification.find(':', first == std::string::npos ? first : first + 1);
+        if (first == std::string::npos) {
+            throw std::runtime_error("rate limit must be <type>:<rate>[:<burst>], got " + specification);
+        }
+
+        RateLimit limit;
+        try {
+            limit.rate = std::stod(specification.substr(first + 1, second - first - 1));
+            limit.burst = second == std::string::npos ? std::max(limit.rate, 1.0)
+                                                      : std::stod(specification.substr(second + 1));
+        } catch (std::logic_error &) {
+            throw std::runtime_error("invalid rate limit " + specification);
+        }
+        setLimit(parseMessageType(specification.substr(0, first)), limit);
+    }
+}
+
+
+auto RateLimiter::acquire(const int32_t userId, const MessageType type) -> std::chrono::milliseconds {
+    const auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard lockGuard(mutex);
+    const auto limit = getLimit(type);
+    if (limit.rate <= 0) {
+        return std::chrono::milliseconds::zero();
+    }
+
+    const auto [it, inserted] = buckets.try_emplace(bucketKey(userId, type), Bucket{limit.burst, now});
+    auto &bucket = it->second;
+    if (!inserted) {
+        refill(bucket, limit, now);
+    }
+
+    if (bucket.tokens >= 1) {
+        bucket.tokens -= 1;
+        return std::chrono::milliseconds::zero();
+    }
+    return std::chrono::milliseconds(static_cast<int64_t>(std::ceil((1 - bucket.tokens) / limit.rate * 1000)));
+}
+
+
+auto RateLimiter::prune() -> size_t {
+    const auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard lockGuard(mutex);
+    size_t pruned = 0;
+    for (auto it = buckets.begin(); it != buckets.end();) {
+        const auto limit = getLimit(static_cast<MessageType>(it->first & 0xffffffff));
+        refill(it->second, limit, now);
+        if (limit.rate <= 0 || it->second.tokens >= limit.burst) {
+            it = buckets.erase(it);
+            pruned++;
+        } else {
+            it++;
+        }
+    }
+    return pruned;
+}
@@ -0,0 +1,213 @@
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <filesystem>
+
+
+#include "../readState.hpp"
+
+
+auto ReadState::load(Storage &storage, const std::string &path, const std::chrono::milliseconds flushInterval) -> void {
+    ReadStateSnapshot snapshot;
+    if (!path.empty() && std::filesystem::exists(path)) {
+        std::ifstream input(path, std::ios::binary);
+        const std::string package((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+        msgpack::unpacked unpackedSnapshot;
+        msgpack::unpack(unpackedSnapshot, package.data(), package.size());
+        unpackedSnapshot.get().convert(snapshot);
+    }
+
+    // messages written after the snapshot, or all of them without one, storage isn't locked meanwhile
+    const auto counts = storage.countMessagesSince(snapshot.lastMessageId);
+
+    std::lock_guard lockGuard(mutex);
+    this->path = path;
+    this->flushInterval = flushInterval;
+
+    std::unordered_map<std::string, int64_t> added;
+    for (const auto &chat: snapshot.chats) {
+        added[chat.chatName] += chat.count;
+        auto &counter = chats[chat.chatName];
+        counter.lastMessageId = std::max(counter.lastMessageId, chat.lastMessageId);
+    }
+    for (const auto &counted: counts) {
+        auto &chat = chats[counted.chatName];
+        chat.loadedId = counted.lastMessageId;
+        chat.lastMessageId = std::max(chat.lastMessageId, counted.lastMessageId);
+        const auto countedTwice = std::count_if(
+                chat.loadingIds.begin(), chat.loadingIds.end(), [&counted](const int32_t id) -> bool {
+                    return id <= counted.lastMessageId;
+                }
+        );
+        added[counted.chatName] += counted.count - countedTwice;
+        lastMessageId = std::max(lastMessageId, counted.lastMessageId);
+    }
+    for (auto &[chatName, chat]: chats) {
+        chat.count += added[chatName];
+        chat.loadingIds = {};
+    }
+
+    // cursors set meanwhile had read everything loading adds before them
+    for (auto &[userId, userCursors]: cursors) {
+        for (auto &[chatName, count]: userCursors) {
+            const auto it = added.find(chatName);
+            count += it == added.end() ? 0 : it->second;
+        }
+    }
+    for (const auto &cursor: snapshot.cursors) {
+        cursors[cursor.userId].try_emplace(cursor.chatName, cursor.count);
+    }
+
+    snapshotId = snapshot.lastMessageId;
+    lastMessageId = std::max(lastMessageId, snapshot.lastMessageId);
+    loaded = true;
+    dirty = true;
+    flushTime = std::chrono::steady_clock::now();
+}
+
+
+auto ReadState::onMessage(const std::string &chatName, const int32_t messageId, const int32_t senderId) -> void {
+    std::lock_guard lockGuard(mutex);
+    auto &chat = chats[chatName];
+    if (!loaded) {
+        chat.loadingIds.push_back(messageId);
+    } else if (messageId <= std::max(snapshotId, chat.loadedId)) {
+        // created before loading counted it, but announced after
+        return;
+    }
+
+    const auto senderIt = cursors.find(senderId);
+    if (senderIt != cursors.end()) {
+        const auto cursorIt = senderIt->second.find(chatName);
+        if (cursorIt != senderIt->second.end() && cursorIt->second == chat.count) {
+            cursorIt->second++;
+        }
+    }
+    chat.count++;
+    chat.lastMessageId = std::max(chat.lastMessageId, messageId);
+    chat.recentIds.insert(std::upper_bound(chat.recentIds.begin(), chat.recentIds.end(), messageId), messageId);
+    if (chat.recentIds.size() > recentIdsCapacity) {
+        chat.recentIds.pop_front();
+    }
+    lastMessageId = std::max(lastMessageId, messageId);
+    dirty = true;
+}
+
+
+auto ReadState::onJoin(const int32_t userId, const std::string &chatName) -> void {
+    std::lock_guard lockGuard(mutex);
+    const auto it = chats.find(chatName);
+    if (cursors[userId].try_emplace(chatName, it == chats.end() ? 0 : it->second.count).second) {
+        dirty = true;
+    }
+}
+
+
+auto ReadState::onPrune(const std::string &chatName, const size_t pruned, const int32_t prunedId) -> void {
+    std::lock_guard lockGuard(mutex);
+    const auto it = chats.find(chatName);
+    if (it == chats.end()) {
+        return;
+    }
+
+    // pruned messages are the oldest ones, a cursor covers them before any newer message
+    auto &chat = it->second;
+    const auto count = std::min(static_cast<int64_t>(pruned), chat.count);
+    chat.count -= count;
+    chat.recentIds.erase(chat.recentIds.begin(),
+                         std::upper_bound(chat.recentIds.begin(), chat.recentIds.end(), prunedId));
+    for (auto &[userId, userCursors]: cursors) {
+        const auto cursorIt = userCursors.find(chatName);
+        if (cursorIt != userCursors.end()) {
+            cursorIt->second = std::max<int64_t>(cursorIt->second - count, 0);
+        }
+    }
+    dirty = true;
+}
+
+
+auto ReadState::markRead(const int32_t userId, const std::string &chatName, const int32_t messageId) -> void {
+    std::lock_guard lockGuard(mutex);
+    const auto it = chats.find(chatName);
+    if (it == chats.end()) {
+        return;
+    }
+
+    const auto &chat = it->second;
+    auto count = chat.count;
+    if (messageId != 0 && messageId < chat.lastMessageId) {
+        // messages after messageId stay unread, beyond recent ids all of them are assumed to be after it
+        const auto newer = chat.recentIds.end() - std::upper_bound(chat.recentIds.begin(), chat.recentIds.end(), messageId);
+        count -= newer;
+    }
+
+    // cursors never move back
+    auto &cursor = cursors[userId][chatName];
+    if (count > cursor) {
+        cursor = count;
+        dirty = true;
+    }
+}
+
+
+auto ReadState::getUnread(const int32_t userId, const std::string &chatName) -> int64_t {
+    std::lock_guard lockGuard(mutex);
+    const auto chatIt = chats.find(chatName);
+    if (chatIt == chats.end()) {
+        return 0;
+    }
+
+    const auto userIt = cursors.find(userId);
+    if (userIt == cursors.end()) {
+        return chatIt->second.count;
+    }
+    const auto cursorIt = userIt->second.find(chatName);
+    return std::max<int64_t>(chatIt->second.count - (cursorIt == userIt->second.end() ? 0 : cursorIt->second), 0);
+}
+
+
+auto ReadState::flush(const bool force) -> void {
+    ReadStateSnapshot snapshot;
+    {
+        std::lock_guard lockGuard(mutex);
+        const auto now = std::chrono::steady_clock::now();
+        // a partial state would replace the snapshot it is still loading from
+        if (!loaded || path.empty() || !dirty || (!force && now - flushTime < flushInterval)) {
+            return;
+        }
+
+        snapshot.lastMessageId = lastMessageId;
+        snapshot.chats.reserve(chats.size());
+        for (const auto &[chatName, chat]: chats) {
+            snapshot.chats.push_back(ChatReadCounter{chatName, chat.count, chat.lastMessageId});
+        }
+        for (const auto &[userId, userCursors]: cursors) {
+            for (const auto &[chatName, count]: userCursors) {
+                snapshot.cursors.push_back(ReadCursor{userId, chatName, count});
+            }
+        }
+        dirty = false;
+        flushTime = now;
+    }
+
+    // written outside the lock, so requests don't wait for the disk
+    msgpack::sbuffer package;
+    msgpack::pack(&package, snapshot);
+
+    const auto temporaryPath = path + ".tmp";
+    std::ofstream output(temporaryPath, std::ios::binary | std::ios::trunc);
+    output.write(package.data(), static_cast<std::streamsize>(package.size()));
+    output.close();
+
+    std::error_code error;
+    if (output) {
+        std::filesystem::rename(temporaryPath, path, error);
+    }
+    if (!output || error) {
+        std::lock_guard lockGuard(mutex);
+        dirty = true;
+        throw std::runtime_error("can't write read state " + path);
+    }
+}
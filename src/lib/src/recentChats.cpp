@@ -0,0 +1,115 @@
+#include <mutex>
+#include <limits>
+#include <algorithm>
+
+
+#include "../recentChats.hpp"
+
+
+auto RecentChats::makePreview(const std::string &text) -> std::string {
+    if (text.size() <= previewLength) {
+        return text;
+    }
+
+    auto length = previewLength;
+    while (length > 0 && (static_cast<unsigned char>(text[length]) & 0xc0) == 0x80) {
+        length--;
+    }
+    return text.substr(0, length);
+}
+
+
+auto RecentChats::contains(const std::string &chatName) const -> bool {
+    std::shared_lock lock(mutex);
+    return chats.contains(chatName);
+}
+
+
+auto RecentChats::load(Storage &storage) -> void {
+    // messages created meanwhile are newer and are kept by update
+    for (const auto &message: storage.getLastMessages()) {
+        update(message.chatName, message.id, message.rawTime, message.username, message.data);
+    }
+    loaded = true;
+}
+
+
+auto RecentChats::update(
+        const std::string &chatName,
+        const int32_t messageId,
+        const time_t rawTime,
+        const std::string &senderName,
+        const std::string &text
+) -> void {
+    std::unique_lock lock(mutex);
+    auto &activity = chats[chatName];
+    if (messageId <= activity.lastMessageId) {
+        return;
+    }
+    activity = Activity{messageId, rawTime, senderName, makePreview(text)};
+}
+
+
+auto RecentChats::forget(const std::string &chatName) -> void {
+    std::unique_lock lock(mutex);
+    chats.erase(chatName);
+}
+
+
+auto RecentChats::getTop(
+        Storage &storage,
+        const int32_t userId,
+        const size_t limit,
+        std::vector<std::string> &chatNames,
+        std::vector<ChatMessage> &previews
+) -> void {
+    struct Entry {
+        std::string chatName{};
+        time_t rawTime{};
+        int32_t lastMessageId{};
+        const Activity *activity{};
+    };
+
+    // membership lookups are in memory for every engine
+    std::vector<Entry> entries;
+    for (auto &chatName: storage.getChatsByTime(userId, std::numeric_limits<time_t>::min())) {
+        const auto allowedRawTime = storage.getUserAllowedRawTime(storage.getChatId(chatName), userId);
+        entries.push_back(Entry{std::move(chatName), allowedRawTime});
+    }
+
+    if (!loaded) {
+        for (const auto &entry: entries) {
+            if (contains(entry.chatName)) {
+                continue;
+            }
+            for (const auto &message: storage.getRecentMessages(entry.chatName, 1)) {
+                update(entry.chatName, message.id, message.rawTime, message.senderName, message.text);
+            }
+        }
+    }
+
+    std::shared_lock lock(mutex);
+    for (auto &entry: entries) {
+        const auto it = chats.find(entry.chatName);
+        if (it != chats.end() && it->second.rawTime >= entry.rawTime) {
+            entry.rawTime = it->second.rawTime;
+            entry.lastMessageId = it->second.lastMessageId;
+            entry.activity = &it->second;
+        }
+    }
+
+    const auto middle = entries.begin() + static_cast<std::ptrdiff_t>(std::min(limit, entries.size()));
+    std::partial_sort(entries.begin(), middle, entries.end(), [](const Entry &lhs, const Entry &rhs) -> bool {
+        return lhs.rawTime != rhs.rawTime ? lhs.rawTime > rhs.rawTime : lhs.lastMessageId > rhs.lastMessageId;
+    });
+
+    for (auto it = entries.begin(); it != middle; it++) {
+        chatNames.push_back(it->chatName);
+        if (it->activity) {
+            previews.emplace_back(getFormattedDatetime(it->rawTime), it->activity->senderName, it->activity->preview,
+                                  it->lastMessageId);
+        } else {
+            previews.emplace_back(getFormattedDatetime(it->rawTime), "", "");
+        }
+    }
+}
@@ -0,0 +1,112 @@
+#include <stdexcept>
+#include <filesystem>
+
+
+#include "../recorder.hpp"
+#include "../logger.hpp"
+
+
+Recorder::Recorder(const std::string &path) {
+    const auto chosenPath = choosePath(path);
+    output.open(chosenPath, std::ios::binary | std::ios::app);
+    if (!output) {
+        throw std::runtime_error("can't open " + chosenPath);
+    }
+    CP_LOG_INFO({}, "recording to ", chosenPath);
+    writer = std::thread(&Recorder::writeLoop, this);
+}
+
+
+auto Recorder::choosePath(const std::string &path) -> std::string {
+    auto chosenPath = path;
+    for (size_t index = 1; std::filesystem::exists(chosenPath); index++) {
+        chosenPath = path + "." + std::to_string(index);
+    }
+    return chosenPath;
+}
+
+
+Recorder::~Recorder() {
+    {
+        std::lock_guard lockGuard(mutex);
+        stopping = true;
+    }
+    condition.notify_one();
+    writer.join();
+}
+
+
+auto Recorder::writeLoop() -> void {
+    auto failed = false;
+    auto done = false;
+    while (!done) {
+        msgpack::sbuffer pending;
+        {
+            std::unique_lock lock(mutex);
+            condition.wait_for(lock, flushInterval, [this] { return stopping; });
+            std::swap(pending, buffer);
+            done = stopping;
+        }
+
+        if (pending.size() == 0 || failed) {
+            continue;
+        }
+        output.write(pending.data(), static_cast<std::streamsize>(pending.size()));
+        if (!output.flush()) {
+            CP_LOG_ERROR({}, "recording write error, recording stopped");
+            failed = true;
+        }
+    }
+}
+
+
+auto Recorder::record(const uint64_t connectionId, const std::string &username, const Message &message) -> void {
+    const int64_t offsetNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+    // same layout MSGPACK_DEFINE gives RecordedMessage, packed outside the lock so monitors only contend for a copy
+    msgpack::sbuffer package;
+    msgpack::packer<msgpack::sbuffer> packer(&package);
+    packer.pack_array(4);
+    packer.pack(offsetNs);
+    packer.pack(connectionId);
+    packer.pack(username);
+    if (message.type == MessageType::SignIn || message.type == MessageType::SignUp ||
+        message.type == MessageType::ResumeSession) {
+        auto redacted = message;
+        redacted.data.buffer.clear();
+        packer.pack(redacted);
+    } else {
+        packer.pack(message);
+    }
+
+    {
+        std::lock_guard lockGuard(mutex);
+        if (buffer.size() + frameHeaderSize + package.size() > maxBufferedBytes) {
+            dropped++;
+            return;
+        }
+        writeFrame(buffer, package);
+    }
+    records++;
+    bytes += frameHeaderSize + package.size();
+}
+
+
+auto Recorder::exportMetrics(Metrics &metrics) -> void {
+    metrics.set("recorder.records", static_cast<int64_t>(records.load()));
+    metrics.set("recorder.dropped", static_cast<int64_t>(dropped.load()));
+    metrics.set("recorder.bytes", static_cast<int64_t>(bytes.load()));
+}
+
+
+RecordReader::RecordReader(const std::string &path) : reader(path) {}
+
+
+auto RecordReader::read(RecordedMessage &record) -> bool {
+    const auto status = reader.read(record);
+    if (status == FrameStatus::Torn) {
+        throw std::runtime_error("truncated or corrupted record frame");
+    }
+    return status == FrameStatus::Read;
+}
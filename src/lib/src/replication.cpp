@@ -0,0 +1,532 @@
+#include <random>
+
+
+#include "../replication.hpp"
+#include "../password.hpp"
+#include "../logger.hpp"
+
+
+constexpr int32_t pollInterval = 250;
+constexpr int32_t syncTimeout = 10 * 1000;
+constexpr int64_t heartbeatInterval = 1000;
+
+// changes in one sync response, followers request again until caught up
+constexpr size_t maxSyncChanges = 4096;
+
+
+auto nowMilliseconds() -> int64_t {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()
+    ).count();
+}
+
+
+template<class T>
+auto sendPacked(zmqpp::socket &socket, const T &value) -> void {
+    msgpack::sbuffer package;
+    msgpack::pack(&package, value);
+
+    zmqpp::message message;
+    message.add_raw(package.data(), package.size());
+    if (!socket.send(message)) {
+        throw std::runtime_error("send timeout");
+    }
+}
+
+
+template<class T>
+auto receivePacked(zmqpp::socket &socket, T &value) -> bool {
+    zmqpp::message message;
+    if (!socket.receive(message)) {
+        return false;
+    }
+
+    msgpack::unpacked unpacked;
+    msgpack::unpack(unpacked, static_cast<const char *>(message.raw_data()), message.size(0));
+    unpacked.get().convert(value);
+    return true;
+}
+
+
+PublishingStorage::PublishingStorage(
+        std::unique_ptr<Storage> storage,
+        const std::string &publishEndPoint,
+        const std::string &syncEndPoint,
+        const size_t backlogCapacity
+) : storage(std::move(storage)), backlogCapacity(backlogCapacity) {
+    std::random_device randomDevice;
+    epoch = static_cast<uint64_t>(randomDevice()) << 32 | randomDevice();
+
+    publishSocket.bind(publishEndPoint);
+    syncSocket.set(zmqpp::socket_option::send_timeout, syncTimeout);
+    syncSocket.bind(syncEndPoint);
+    syncThread = std::thread(&PublishingStorage::syncMonitor, this);
+}
+
+
+PublishingStorage::~PublishingStorage() {
+    running = false;
+    if (syncThread.joinable()) {
+        syncThread.join();
+    }
+}
+
+
+auto PublishingStorage::releaseEndPoints() -> void {
+    running = false;
+    if (syncThread.joinable()) {
+        syncThread.join();
+    }
+
+    std::lock_guard lockGuard(mutex);
+    released = true;
+    publishSocket.close();
+    syncSocket.close();
+}
+
+
+auto PublishingStorage::sendFrame(const ReplicationFrame &frame) -> void {
+    // slow subscribers drop frames and resynchronize, writers never wait for them
+    sendPacked(publishSocket, frame);
+}
+
+
+auto PublishingStorage::publish(std::vector<Change> changes) -> void {
+    ReplicationFrame frame;
+    frame.epoch = epoch;
+    frame.sequence = ++sequence;
+    frame.publishTime = nowMilliseconds();
+    frame.changes = std::move(changes);
+
+    if (!released) {
+        sendFrame(frame);
+    }
+    backlog.push_back(std::move(frame));
+    if (backlog.size() > backlogCapacity) {
+        backlog.pop_front();
+    }
+}
+
+
+auto PublishingStorage::makeSyncResponse(const SyncRequest &request) -> ReplicationFrame {
+    ReplicationFrame response;
+    response.epoch = epoch;
+    response.publishTime = nowMilliseconds();
+    response.sequence = request.afterSequence;
+    response.cursor = request.cursor;
+
+    if (!request.snapshot || request.epoch != epoch) {
+        std::lock_guard lockGuard(mutex);
+        const auto firstSequence = sequence - backlog.size() + 1;
+        if (request.epoch == epoch && request.afterSequence + 1 >= firstSequence && request.afterSequence <= sequence) {
+            for (auto it = backlog.begin() + static_cast<std::ptrdiff_t>(request.afterSequence + 1 - firstSequence);
+                 it != backlog.end() && response.changes.size() < maxSyncChanges; it++) {
+                response.changes.insert(response.changes.end(), it->changes.begin(), it->changes.end());
+                response.sequence = it->sequence;
+            }
+            response.more = response.sequence != sequence;
+            return response;
+        }
+
+        // writes are stored before they get sequences, so the cursor covers everything up to this sequence
+        response.sequence = sequence;
+        response.cursor = storage->openChangeCursor();
+    }
+
+    // later writes the page happens to visit are applied again from the backlog, which skips existing rows
+    response.snapshot = storage->scanChangesPage(response.cursor, maxSyncChanges, [&response](const Change &change) {
+        response.changes.push_back(change);
+    });
+    response.more = true;
+    return response;
+}
+
+
+auto PublishingStorage::syncMonitor() noexcept -> void {
+    try {
+        zmqpp::poller poller;
+        poller.add(syncSocket);
+
+        auto lastHeartbeatTime = nowMilliseconds();
+        while (running) {
+            if (nowMilliseconds() - lastHeartbeatTime >= heartbeatInterval) {
+                std::lock_guard lockGuard(mutex);
+                ReplicationFrame heartbeat;
+                heartbeat.epoch = epoch;
+                heartbeat.sequence = sequence;
+                heartbeat.publishTime = nowMilliseconds();
+                sendFrame(heartbeat);
+                lastHeartbeatTime = heartbeat.publishTime;
+            }
+
+            if (!poller.poll(pollInterval) || !poller.has_input(syncSocket)) {
+                continue;
+            }
+
+            SyncRequest request;
+            receivePacked(syncSocket, request);
+            sendPacked(syncSocket, makeSyncResponse(request));
+        }
+    } catch (std::runtime_error &exception) {
+        CP_LOG_ERROR({}, "replication sync monitor stopped: ", exception.what());
+    }
+}
+
+
+auto PublishingStorage::getUserId(const std::string &username) -> int32_t {
+    return storage->getUserId(username);
+}
+
+
+auto PublishingStorage::getUsername(const int32_t userId) -> std::string {
+    return storage->getUsername(userId);
+}
+
+
+auto PublishingStorage::getAllUsers() -> std::set<User> {
+    return storage->getAllUsers();
+}
+
+
+auto PublishingStorage::authenticateUser(const std::string &username, const std::string &password) -> AuthenticationResult {
+    return storage->authenticateUser(username, password);
+}
+
+
+auto PublishingStorage::createUser(const std::string &username, const std::string &password) -> void {
+    // user is stored from the published change, so followers get the same hash and never the password
+    const auto change = Change{ChangeType::User, 0, username, {}, 0, hashPassword(password)};
+
+    std::lock_guard lockGuard(mutex);
+    storage->applyChanges({change});
+    publish({change});
+}
+
+
+auto PublishingStorage::createChat(
+        const std::string &chatName,
+        const int32_t &adminId,
+        const std::vector<int32_t> &userIds
+) -> bool {
+    std::lock_guard lockGuard(mutex);
+    if (!storage->createChat(chatName, adminId, userIds)) {
+        return false;
+    }
+
+    // members are created with chat creation time, storage doesn't expose it otherwise
+    const auto members = storage->getChatMembers(chatName);
+    auto creationRawTime = time(nullptr);
+    for (const auto &member: members) {
+        creationRawTime = std::min(creationRawTime, member.allowedRawTime);
+    }
+
+    std::vector<Change> changes{Change{ChangeType::Chat, 0, storage->getUsername(adminId), chatName, creationRawTime, {}}};
+    for (const auto &member: members) {
+        changes.push_back(Change{ChangeType::Member, 0, storage->getUsername(member.userId), chatName,
+                                 member.allowedRawTime, {}});
+    }
+    publish(std::move(changes));
+    return true;
+}
+
+
+auto PublishingStorage::getChatId(const std::string &chatName) -> int32_t {
+    return storage->getChatId(chatName);
+}
+
+
+auto PublishingStorage::getChatName(const int chatId) -> std::string {
+    return storage->getChatName(chatId);
+}
+
+
+auto PublishingStorage::getChatsByTime(const int32_t userId, const time_t rawTime) -> std::vector<std::string> {
+    return storage->getChatsByTime(userId, rawTime);
+}
+
+
+auto PublishingStorage::createMessage(
+        const std::string &chatName,
+        const int32_t senderId,
+        const time_t rawTime,
+        const std::string &data
+) -> int32_t {
+    return createMessage(chatName, User(senderId, storage->getUsername(senderId)), rawTime, data);
+}
+
+
+auto PublishingStorage::createMessage(
+        const std::string &chatName,
+        const User &sender,
+        const time_t rawTime,
+        const std::string &data
+) -> int32_t {
+    const auto messageId = storage->createMessage(chatName, sender.id, rawTime, data);
+    if (messageId != -1) {
+        std::lock_guard lockGuard(mutex);
+        publish({Change{ChangeType::Message, messageId, sender.username, chatName, rawTime, data}});
+    }
+    return messageId;
+}
+
+
+auto PublishingStorage::getAllMessagesFromChat(const std::string &chatName, const int32_t userId) -> std::vector<ChatMessage> {
+    return storage->getAllMessagesFromChat(chatName, userId);
+}
+
+
+auto PublishingStorage::getMessagesFromChatSince(
+        const std::string &chatName,
+        const int32_t userId,
+        const int32_t afterId
+) -> std::vector<ChatMessage> {
+    return storage->getMessagesFromChatSince(chatName, userId, afterId);
+}
+
+
+auto PublishingStorage::getRecentMessages(const std::string &chatName, const size_t limit) -> std::vector<StoredMessage> {
+    return storage->getRecentMessages(chatName, limit);
+}
+
+
+auto PublishingStorage::getUserAllowedRawTime(const int32_t chatId, const int32_t userId) -> time_t {
+    return storage->getUserAllowedRawTime(chatId, userId);
+}
+
+
+auto PublishingStorage::isChatMember(const int32_t chatId, const int32_t userId) -> bool {
+    return storage->isChatMember(chatId, userId);
+}
+
+
+auto PublishingStorage::getChatMembers(const std::string &chatName) -> std::vector<ChatMember> {
+    return storage->getChatMembers(chatName);
+}
+
+
+auto PublishingStorage::getRecentlyActiveChats(const size_t messagesWindow) -> std::vector<std::string> {
+    return storage->getRecentlyActiveChats(messagesWindow);
+}
+
+
+auto PublishingStorage::getRecentlyActiveUsers(const size_t messagesWindow) -> std::vector<User> {
+    return storage->getRecentlyActiveUsers(messagesWindow);
+}
+
+
+auto PublishingStorage::getLastMessages() -> std::vector<Change> {
+    return storage->getLastMessages();
+}
+
+
+auto PublishingStorage::countMessagesSince(const int32_t afterId) -> std::vector<MessageCount> {
+    return storage->countMessagesSince(afterId);
+}
+
+
+auto PublishingStorage::inviteUserToChat(
+        const std::string &chatName,
+        const int32_t invitorId,
+        const int32_t userId,
+        const bool allowHistorySharing
+) -> void {
+    std::lock_guard lockGuard(mutex);
+    storage->inviteUserToChat(chatName, invitorId, userId, allowHistorySharing);
+
+    const auto allowedRawTime = storage->getUserAllowedRawTime(storage->getChatId(chatName), userId);
+    publish({Change{ChangeType::Member, 0, storage->getUsername(userId), chatName, allowedRawTime, {}}});
+}
+
+
+auto PublishingStorage::inviteUsersToChat(
+        const std::string &chatName,
+        const int32_t invitorId,
+        const std::vector<int32_t> &userIds,
+        const bool allowHistorySharing
+) -> std::vector<InviteStatus> {
+    std::lock_guard lockGuard(mutex);
+    auto statuses = storage->inviteUsersToChat(chatName, invitorId, userIds, allowHistorySharing);
+
+    const auto chatId = storage->getChatId(chatName);
+    std::vector<Change> changes;
+    for (size_t i = 0; i < userIds.size(); i++) {
+        if (statuses[i] == InviteStatus::Invited) {
+            changes.push_back(Change{ChangeType::Member, 0, storage->getUsername(userIds[i]), chatName,
+                                     storage->getUserAllowedRawTime(chatId, userIds[i]), {}});
+        }
+    }
+    if (!changes.empty()) {
+        publish(std::move(changes));
+    }
+    return statuses;
+}
+
+
+auto PublishingStorage::pruneMessages(
+        const std::string &chatName,
+        const time_t olderThan,
+        const size_t keepLatest,
+        const size_t batchSize
+) -> size_t {
+    return storage->pruneMessages(chatName, olderThan, keepLatest, batchSize);
+}
+
+
+auto PublishingStorage::getPrunedId(const std::string &chatName) -> int32_t {
+    return storage->getPrunedId(chatName);
+}
+
+
+auto PublishingStorage::reclaimSpace() -> int64_t {
+    return storage->reclaimSpace();
+}
+
+
+auto PublishingStorage::scanChanges(const std::function<void(const Change &)> &visitor) -> void {
+    storage->scanChanges(visitor);
+}
+
+
+auto PublishingStorage::openChangeCursor() -> ChangeCursor {
+    return storage->openChangeCursor();
+}
+
+
+auto PublishingStorage::scanChangesPage(
+        ChangeCursor &cursor,
+        const size_t limit,
+        const std::function<void(const Change &)> &visitor
+) -> bool {
+    return storage->scanChangesPage(cursor, limit, visitor);
+}
+
+
+auto PublishingStorage::scanChatChanges(
+        const std::string &chatName,
+        const std::function<void(const Change &)> &visitor
+) -> void {
+    storage->scanChatChanges(chatName, visitor);
+}
+
+
+auto PublishingStorage::applyChanges(const std::vector<Change> &changes) -> void {
+    std::lock_guard lockGuard(mutex);
+    storage->applyChanges(changes);
+    publish(changes);
+}
+
+
+Follower::Follower(
+        Storage &storage,
+        const std::string &publishEndPoint,
+        const std::string &syncEndPoint,
+        std::function<void(const Change &)> onChange
+) : storage(storage), publishEndPoint(publishEndPoint), syncEndPoint(syncEndPoint), onChange(std::move(onChange)) {
+    thread = std::thread(&Follower::follow, this);
+}
+
+
+Follower::~Follower() {
+    running = false;
+    thread.join();
+}
+
+
+auto Follower::apply(const ReplicationFrame &frame) -> void {
+    if (frame.changes.empty()) {
+        return;
+    }
+    storage.applyChanges(frame.changes);
+    for (const auto &change: frame.changes) {
+        onChange(change);
+    }
+}
+
+
+auto Follower::sync(zmqpp::socket &syncSocket) -> bool {
+    while (running) {
+        // an interrupted snapshot goes on from its cursor, followers never serve half of a snapshot as caught up
+        sendPacked(syncSocket, SyncRequest{epoch, sequence, snapshot, cursor});
+
+        ReplicationFrame response;
+        if (!receivePacked(syncSocket, response)) {
+            return false;
+        }
+        apply(response);
+        epoch = response.epoch;
+        sequence = response.sequence;
+        snapshot = response.snapshot;
+        cursor = response.cursor;
+        if (!snapshot) {
+            appliedSequence = sequence;
+        }
+
+        if (!response.more) {
+            freshTime = response.publishTime;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+auto Follower::follow() noexcept -> void {
+    try {
+        zmqpp::socket subscribeSocket(context, zmqpp::socket_type::subscribe);
+        subscribeSocket.set(zmqpp::socket_option::subscribe, "");
+        subscribeSocket.set(zmqpp::socket_option::receive_timeout, pollInterval);
+        // frames published while synchronizing are queued and skipped if already applied
+        subscribeSocket.connect(publishEndPoint);
+
+        auto synced = false;
+        while (running) {
+            if (!synced) {
+                // request socket can't send again after a missed response
+                zmqpp::socket syncSocket(context, zmqpp::socket_type::request);
+                syncSocket.set(zmqpp::socket_option::linger, 0);
+                syncSocket.set(zmqpp::socket_option::send_timeout, syncTimeout);
+                syncSocket.set(zmqpp::socket_option::receive_timeout, syncTimeout);
+                syncSocket.connect(syncEndPoint);
+
+                synced = sync(syncSocket);
+                resyncs++;
+                continue;
+            }
+
+            ReplicationFrame frame;
+            if (!receivePacked(subscribeSocket, frame)) {
+                continue;
+            }
+
+            if (frame.epoch != epoch || frame.sequence > sequence + (frame.changes.empty() ? 0 : 1)) {
+                synced = false;
+                continue;
+            }
+            if (frame.sequence < sequence || (frame.sequence == sequence && !frame.changes.empty())) {
+                continue;
+            }
+
+            apply(frame);
+            sequence = frame.sequence;
+            appliedSequence = sequence;
+            freshTime = frame.publishTime;
+        }
+    } catch (std::runtime_error &exception) {
+        CP_LOG_ERROR({}, "follower stopped: ", exception.what());
+    }
+}
+
+
+auto Follower::lag() const -> std::chrono::milliseconds {
+    return std::chrono::milliseconds(nowMilliseconds() - freshTime);
+}
+
+
+auto Follower::getAppliedSequence() const -> uint64_t {
+    return appliedSequence;
+}
+
+
+auto Follower::getResyncs() const -> uint64_t {
+    return resyncs;
+}
@@ -0,0 +1,182 @@
+#include <mutex>
+#include <algorithm>
+
+
+#include "../responseCache.hpp"
+
+
+ResponseCache::ResponseCache() : ResponseCache(defaultBudget) {}
+
+
+ResponseCache::ResponseCache(const size_t budget) : budget(budget) {}
+
+
+auto ResponseCache::getEntryBytes(const Entry &entry) -> size_t {
+    return entry.body.size() + entry.sendersBytes;
+}
+
+
+auto ResponseCache::eraseChat(const std::string &chatName) -> void {
+    const auto it = chats.find(chatName);
+    if (it == chats.end()) {
+        return;
+    }
+    for (const auto &entry: it->second.entries) {
+        bytes -= getEntryBytes(entry);
+    }
+    lru.erase(it->second.lruPosition);
+    chats.erase(it);
+}
+
+
+auto ResponseCache::pack(const Message &request, const time_t allowedRawTime, msgpack::sbuffer &package) const -> bool {
+    std::shared_lock lock(mutex);
+    const auto chatIt = chats.find(request.data.name);
+    if (chatIt == chats.end()) {
+        return false;
+    }
+
+    const auto &entries = chatIt->second.entries;
+    const auto it = std::find_if(entries.begin(), entries.end(), [allowedRawTime](const Entry &entry) -> bool {
+        return entry.allowedRawTime == allowedRawTime;
+    });
+    if (it == entries.end()) {
+        return false;
+    }
+
+    // same layout MSGPACK_DEFINE gives Message and MessageData
+    msgpack::packer<msgpack::sbuffer> packer(&package);
+    packer.pack_array(3);
+    packer.pack(request.type);
+    packer.pack(request.authenticationStatus);
+    packer.pack_array(7);
+    packer.pack(it->lastId);
+    packer.pack(request.data.name);
+    packer.pack(request.data.buffer);
+    packer.pack(request.data.flag);
+    packer.pack(it->senders);
+    packer.pack_array(it->count);
+    package.write(it->body.data(), it->body.size());
+    // whole histories carry no pruned id, as responses built by server
+    packer.pack_array(0);
+    return true;
+}
+
+
+auto ResponseCache::getGeneration(const std::string &chatName) const -> uint64_t {
+    std::shared_lock lock(mutex);
+    const auto it = generations.find(chatName);
+    return it == generations.end() ? 0 : it->second;
+}
+
+
+auto ResponseCache::store(
+        const std::string &chatName,
+        const time_t allowedRawTime,
+        const std::vector<ChatMessage> &messages,
+        const std::vector<std::string> &senders,
+        const uint64_t generation
+) -> void {
+    Entry entry{allowedRawTime, {}, static_cast<uint32_t>(messages.size()), 0, senders};
+    msgpack::sbuffer body;
+    for (const auto &message: messages) {
+        msgpack::pack(&body, message);
+        entry.lastId = std::max(entry.lastId, message.id);
+    }
+    for (size_t i = 0; i < senders.size(); i++) {
+        entry.senderIndexes.try_emplace(senders[i], static_cast<int32_t>(i));
+        entry.sendersBytes += senders[i].size();
+    }
+    // one response must not evict everything else
+    if (body.size() > budget / 4) {
+        return;
+    }
+    entry.body.assign(body.data(), body.size());
+
+    std::unique_lock lock(mutex);
+    const auto generationIt = generations.find(chatName);
+    if ((generationIt == generations.end() ? 0 : generationIt->second) != generation) {
+        return;
+    }
+
+    auto chatIt = chats.find(chatName);
+    if (chatIt == chats.end()) {
+        lru.push_front(chatName);
+        chatIt = chats.emplace(chatName, ChatEntry{{}, lru.begin()}).first;
+    } else {
+        lru.splice(lru.begin(), lru, chatIt->second.lruPosition);
+    }
+
+    auto &entries = chatIt->second.entries;
+    const auto it = std::find_if(entries.begin(), entries.end(), [allowedRawTime](const Entry &cached) -> bool {
+        return cached.allowedRawTime == allowedRawTime;
+    });
+    if (it != entries.end()) {
+        bytes -= getEntryBytes(*it);
+        entries.erase(it);
+    }
+    bytes += getEntryBytes(entry);
+    entries.push_back(std::move(entry));
+
+    while (bytes > budget && lru.size() > 1) {
+        eraseChat(lru.back());
+    }
+}
+
+
+auto ResponseCache::append(const std::string &chatName, const time_t rawTime, const ChatMessage &message) -> void {
+    auto encoded = message;
+    encoded.username.clear();
+
+    std::unique_lock lock(mutex);
+    generations[chatName]++;
+    const auto chatIt = chats.find(chatName);
+    if (chatIt == chats.end()) {
+        return;
+    }
+
+    auto &entries = chatIt->second.entries;
+    for (auto it = entries.begin(); it != entries.end();) {
+        // concurrent writes may come out of id order, such response can't be appended to
+        if (message.id <= it->lastId) {
+            bytes -= getEntryBytes(*it);
+            it = entries.erase(it);
+            continue;
+        }
+        if (rawTime >= it->allowedRawTime) {
+            const auto [senderIt, inserted] = it->senderIndexes.try_emplace(
+                    message.username, static_cast<int32_t>(it->senders.size()));
+            if (inserted) {
+                it->senders.push_back(message.username);
+                it->sendersBytes += message.username.size();
+                bytes += message.username.size();
+            }
+            encoded.sender = senderIt->second;
+
+            msgpack::sbuffer packed;
+            msgpack::pack(&packed, encoded);
+            it->body.append(packed.data(), packed.size());
+            it->count++;
+            it->lastId = message.id;
+            bytes += packed.size();
+        }
+        it++;
+    }
+
+    while (bytes > budget && !lru.empty()) {
+        eraseChat(lru.back());
+    }
+}
+
+
+auto ResponseCache::invalidate(const std::string &chatName) -> void {
+    std::unique_lock lock(mutex);
+    generations[chatName]++;
+    eraseChat(chatName);
+}
+
+
+auto ResponseCache::getBytes() const -> size_t {
+    std::shared_lock lock(mutex);
+    return bytes;
+}
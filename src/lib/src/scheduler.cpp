@@ -0,0 +1,124 @@
+#include <chrono>
+#include <algorithm>
+
+
+#include "../scheduler.hpp"
+
+
+Scheduler::Slot::Slot(Scheduler &scheduler, const RequestClass requestClass) : scheduler(scheduler),
+                                                                               requestClass(requestClass) {
+    scheduler.acquire(requestClass);
+}
+
+
+Scheduler::Slot::~Slot() {
+    scheduler.release(requestClass);
+}
+
+
+Scheduler::Scheduler() : Scheduler(defaultInteractiveBudget, defaultBulkBudget) {}
+
+
+Scheduler::Scheduler(const size_t interactiveBudget, const size_t bulkBudget) {
+    configure(interactiveBudget, bulkBudget);
+}
+
+
+auto Scheduler::getClassName(const RequestClass requestClass) -> std::string {
+    return requestClass == RequestClass::Interactive ? "interactive" : "bulk";
+}
+
+
+auto Scheduler::currentSecond() -> int64_t {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+
+auto Scheduler::canRun(const RequestClass requestClass, const uint64_t ticket) -> bool {
+    const auto &state = classes[static_cast<size_t>(requestClass)];
+    if (state.queue.front() != ticket || state.running >= state.budget) {
+        return false;
+    }
+    // bulk requests get capacity interactive ones leave
+    return requestClass != RequestClass::Bulk || classes[static_cast<size_t>(RequestClass::Interactive)].queue.empty();
+}
+
+
+auto Scheduler::acquire(const RequestClass requestClass) -> void {
+    const auto enqueueTime = std::chrono::steady_clock::now();
+
+    std::unique_lock lock(mutex);
+    auto &state = classes[static_cast<size_t>(requestClass)];
+    const auto ticket = nextTicket++;
+    state.queue.push_back(ticket);
+
+    condition.wait(lock, [this, requestClass, ticket] {
+        return canRun(requestClass, ticket);
+    });
+
+    state.queue.pop_front();
+    state.running++;
+
+    const auto delay = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - enqueueTime
+    ).count();
+    state.admitted++;
+    state.totalDelay += delay;
+
+    const auto second = currentSecond();
+    auto &bucket = state.delayBuckets[static_cast<size_t>(second) % delayWindow];
+    if (bucket.second != second) {
+        bucket = DelayBucket{second, 0};
+    }
+    bucket.maxDelay = std::max(bucket.maxDelay, static_cast<int64_t>(delay));
+
+    // next request of the class or a bulk one waiting for empty interactive queue may run now
+    condition.notify_all();
+}
+
+
+auto Scheduler::release(const RequestClass requestClass) -> void {
+    {
+        std::lock_guard lockGuard(mutex);
+        classes[static_cast<size_t>(requestClass)].running--;
+    }
+    condition.notify_all();
+}
+
+
+auto Scheduler::configure(const size_t interactiveBudget, const size_t bulkBudget) -> void {
+    {
+        std::lock_guard lockGuard(mutex);
+        classes[static_cast<size_t>(RequestClass::Interactive)].budget = std::max<size_t>(interactiveBudget, 1);
+        classes[static_cast<size_t>(RequestClass::Bulk)].budget = std::max<size_t>(bulkBudget, 1);
+    }
+    condition.notify_all();
+}
+
+
+auto Scheduler::exportMetrics(Metrics &metrics) -> void {
+    const auto second = currentSecond();
+
+    std::lock_guard lockGuard(mutex);
+    for (const auto requestClass: {RequestClass::Interactive, RequestClass::Bulk}) {
+        auto &state = classes[static_cast<size_t>(requestClass)];
+        const auto prefix = "scheduler." + getClassName(requestClass) + ".";
+
+        metrics.set(prefix + "queued", static_cast<int64_t>(state.queue.size()));
+        metrics.set(prefix + "running", static_cast<int64_t>(state.running));
+        metrics.set(prefix + "admitted", static_cast<int64_t>(state.admitted));
+        metrics.set(prefix + "delay_us_total", state.totalDelay);
+        metrics.set(prefix + "delay_us_mean",
+                    state.admitted == 0 ? 0 : state.totalDelay / static_cast<int64_t>(state.admitted));
+
+        int64_t maxDelay = 0;
+        for (const auto &bucket: state.delayBuckets) {
+            if (second - bucket.second < static_cast<int64_t>(delayWindow)) {
+                maxDelay = std::max(maxDelay, bucket.maxDelay);
+            }
+        }
+        metrics.set(prefix + "delay_us_max", maxDelay);
+    }
+}
@@ -0,0 +1,1017 @@
+#include <thread>
+#include <utility>
+#include <optional>
+#include <algorithm>
+
+
+#include "../server.hpp"
+#include "../logger.hpp"
+#include "../password.hpp"
+#include "../messaging.hpp"
+
+
+constexpr int32_t sendTimeout = 10 * 1000;
+constexpr int32_t receiveTimeout = 10 * 1000;
+
+// how often blocked monitors check whether server is stopping
+constexpr int32_t pollInterval = 250;
+
+// three missed heartbeats of clients, which send one every 2 seconds while idle
+constexpr size_t defaultIdleTimeout = 6 * 1000;
+
+constexpr size_t defaultMaxHandshakes = 64;
+
+// clients announced beyond the handshake cap are told to announce again after this delay
+constexpr int32_t busyRetryAfter = 1000;
+// they cost a socket each, announcements beyond it are dropped
+constexpr size_t maxBusyClients = 1024;
+
+// inbox size when request doesn't set one
+constexpr int32_t defaultRecentChats = 20;
+constexpr int32_t maxRecentChats = 1000;
+
+
+// counts request as being served until its monitor is done with it
+class InFlightGuard {
+    std::atomic<size_t> &counter;
+
+public:
+    explicit InFlightGuard(std::atomic<size_t> &counter) : counter(counter) {
+        counter++;
+    }
+
+    InFlightGuard(const InFlightGuard &) = delete;
+
+    auto operator=(const InFlightGuard &) -> InFlightGuard & = delete;
+
+    ~InFlightGuard() {
+        counter--;
+    }
+};
+
+
+auto Server::findUser(const std::string &username) -> std::optional<User> {
+    {
+        std::shared_lock lock(usersMutex);
+        const auto it = users.find(username);
+        if (it != users.end()) {
+            return User(it->second, username);
+        }
+    }
+
+    const auto userId = db->getUserId(username);
+    if (userId == -1) {
+        return std::nullopt;
+    }
+
+    User user(userId, username);
+    rememberUser(user);
+    return user;
+}
+
+
+auto Server::rememberUser(const User &user) -> void {
+    std::unique_lock lock(usersMutex);
+    users.try_emplace(user.username, user.id);
+}
+
+
+auto Server::getPrunedId(const std::string &chatName) -> int32_t {
+    {
+        std::shared_lock lock(prunedIdsMutex);
+        const auto it = prunedIds.find(chatName);
+        if (it != prunedIds.end()) {
+            return it->second;
+        }
+    }
+
+    const auto prunedId = db->getPrunedId(chatName);
+    std::unique_lock lock(prunedIdsMutex);
+    prunedIds.try_emplace(chatName, prunedId);
+    return prunedId;
+}
+
+
+auto Server::onPruned(const std::string &chatName, const size_t pruned) -> void {
+    historyCache->invalidate(chatName);
+    responseCache->invalidate(chatName);
+    if (db->getRecentMessages(chatName, 1).empty()) {
+        recentChats.forget(chatName);
+    }
+
+    const auto prunedId = db->getPrunedId(chatName);
+    {
+        std::unique_lock lock(prunedIdsMutex);
+        prunedIds[chatName] = prunedId;
+    }
+    readState.onPrune(chatName, pruned, prunedId);
+}
+
+
+auto Server::warmup() noexcept -> void {
+    try {
+        // scans last messages of every chat, inboxes read chats it hasn't reached from storage meanwhile
+        recentChats.load(*db);
+
+        // chats the previous process had cached are the hottest ones
+        for (const auto &chat: handoffChats) {
+            historyCache->load(*db, chat);
+        }
+
+        std::vector<std::string> chats;
+        if (warmupWindow != 0) {
+            for (const auto &user: db->getRecentlyActiveUsers(warmupWindow)) {
+                rememberUser(user);
+            }
+
+            chats = db->getRecentlyActiveChats(warmupWindow);
+            for (const auto &chat: chats) {
+                historyCache->load(*db, chat);
+            }
+        }
+
+        const auto elapsed = std::chrono::steady_clock::now() - startTime;
+        CP_LOG_INFO({}, "warmup finished, ", handoffChats.size() + chats.size(), " chats loaded in ",
+                    std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count(), " ms");
+    } catch (std::runtime_error &exception) {
+        CP_LOG_ERROR({}, "warmup failed: ", exception.what());
+    }
+}
+
+
+auto Server::takeOver() -> void {
+    if (handoffPath.empty()) {
+        return;
+    }
+
+    std::optional<Handoff> handoff;
+    try {
+        handoff = takeHandoff(handoffPath);
+    } catch (std::exception &exception) {
+        CP_LOG_ERROR({}, "can't load handoff ", handoffPath, ": ", exception.what());
+        return;
+    }
+    if (!handoff) {
+        return;
+    }
+
+    sessions->restore(handoff->sessions);
+    for (const auto &[username, userId]: handoff->users) {
+        rememberUser(User(userId, username));
+    }
+    handoffChats = std::move(handoff->chats);
+    CP_LOG_INFO({}, "took over ", handoff->sessions.size(), " sessions, ", handoff->users.size(), " users and ",
+                handoffChats.size(), " chats");
+}
+
+
+auto Server::handOver() -> void {
+    const auto start = std::chrono::steady_clock::now();
+    const auto deadline = start + drainTimeout;
+    while (inFlight > 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // nothing writes storage from here on
+    pruner.reset();
+    try {
+        readState.flush(true);
+    } catch (std::runtime_error &exception) {
+        CP_LOG_ERROR({}, "read state flush failed: ", exception.what());
+    }
+
+    Handoff handoff;
+    handoff.sessions = sessions->dump();
+    {
+        std::shared_lock lock(usersMutex);
+        handoff.users.assign(users.begin(), users.end());
+    }
+    handoff.chats = historyCache->getChatNames();
+
+    // new process binds endpoints once snapshot appears
+    pullSocket.close();
+    if (publishing) {
+        publishing->releaseEndPoints();
+    }
+    if (events) {
+        events->close();
+    }
+    try {
+        writeHandoff(handoffPath, handoff);
+    } catch (std::exception &exception) {
+        CP_LOG_ERROR({}, "can't write handoff ", handoffPath, ": ", exception.what());
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - (deadline - drainTimeout);
+    CP_LOG_INFO({}, "handed over ", handoff.sessions.size(), " sessions in ",
+                std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count(), " ms");
+
+    // clients get Restarting on their next request and reconnect to the new process
+    while (connections.size() != 0 && std::chrono::steady_clock::now() < deadline) {
+        maintainConnections();
+        std::this_thread::sleep_for(std::chrono::milliseconds(pollInterval));
+    }
+    running = false;
+}
+
+
+auto Server::connectionMonitor() -> void {
+    CP_LOG_INFO({}, "connectionMonitor started");
+    try {
+        zmqpp::poller poller;
+        poller.add(pullSocket);
+
+        // clients over the handshake cap, answered here without monitors
+        struct BusyClient {
+            std::unique_ptr<zmqpp::socket> socket{};
+            std::chrono::steady_clock::time_point deadline{};
+        };
+        std::vector<BusyClient> busyClients{};
+
+        while (running && !draining) {
+            maintainConnections();
+            flushReadState();
+            if (!poller.poll(pollInterval)) {
+                continue;
+            }
+
+            const auto now = std::chrono::steady_clock::now();
+            std::erase_if(busyClients, [&](BusyClient &client) {
+                if (poller.has_input(*client.socket)) {
+                    Message request;
+                    if (tryReceiveMessage(*client.socket, request)) {
+                        auto response = Message(MessageType::ClientError, MessageData(
+                                "Server is busy, retry in " + std::to_string(busyRetryAfter) + " ms"));
+                        response.data.time = busyRetryAfter;
+                        sendMessage(*client.socket, response);
+                        metrics.add("handshakes.answered_busy");
+                    }
+                } else if (client.deadline > now) {
+                    return false;
+                }
+                poller.remove(*client.socket);
+                return true;
+            });
+
+            if (!poller.has_input(pullSocket)) {
+                continue;
+            }
+
+            zmqpp::message message;
+            pullSocket.receive(message);
+
+            std::string s;
+            message >> s;
+
+            if (handshakes >= maxHandshakes) {
+                metrics.add("handshakes.rejected");
+                if (busyClients.size() < maxBusyClients) {
+                    auto socket = std::make_unique<zmqpp::socket>(context, zmqpp::socket_type::reply);
+                    // answer is flushed on close, the client retries only after busyRetryAfter, when it's gone
+                    socket->set(zmqpp::socket_option::linger, pollInterval);
+                    socket->set(zmqpp::socket_option::receive_timeout, 0);
+                    socket->set(zmqpp::socket_option::send_timeout, 0);
+                    socket->connect(s);
+                    poller.add(*socket);
+                    busyClients.push_back({std::move(socket), now + std::chrono::milliseconds(receiveTimeout)});
+                }
+                continue;
+            }
+            handshakes++;
+            try {
+                connections.spawn(s, [this, s](const uint64_t connectionId) { clientMonitor(connectionId, s); });
+            } catch (...) {
+                handshakes--;
+                throw;
+            }
+            metrics.add("connections.accepted");
+        }
+    } catch (zmqpp::exception &exception) {
+        CP_LOG_ERROR({}, "connectionMonitor caught zmqpp exception: ", exception.what());
+    } catch (...) {
+        CP_LOG_ERROR({}, "connectionMonitor caught undefined exception");
+    }
+    CP_LOG_INFO({}, "connectionMonitor exiting, new connections won't be maintained");
+}
+
+
+auto Server::attachClient(
+        const uint64_t connectionId,
+        zmqpp::socket &clientSocket,
+        const std::string &clientEndPoint
+) -> User {
+    clientSocket.set(zmqpp::socket_option::send_timeout, sendTimeout);
+    clientSocket.set(zmqpp::socket_option::receive_timeout, receiveTimeout);
+
+    clientSocket.connect(clientEndPoint);
+
+    User user;
+    Message authRequest;
+    receiveMessage(clientSocket, authRequest);
+    if (recorder) {
+        recorder->record(connectionId, "", authRequest);
+    }
+
+    user.username = authRequest.data.name;
+
+    AuthenticationStatus status;
+    if (authRequest.type == MessageType::SignIn) {
+        const auto result = db->authenticateUser(authRequest.data.name, authRequest.data.buffer);
+        status = result.status;
+        if (status == AuthenticationStatus::Success) {
+            user.id = result.userId;
+            rememberUser(user);
+        }
+    } else if (authRequest.type == MessageType::ResumeSession) {
+        const auto session = sessions->resume(authRequest.data.name, authRequest.data.buffer);
+        status = session ? AuthenticationStatus::Success : AuthenticationStatus::InvalidSession;
+        if (session) {
+            user = *session;
+        }
+    } else if (authRequest.type == MessageType::SignUp && follower) {
+        sendMessage(clientSocket, Message(MessageType::ClientError, MessageData("Read-only replica")));
+        throw std::runtime_error("sign up on follower");
+    } else if (authRequest.type == MessageType::SignUp) {
+        if (findUser(authRequest.data.name)) {
+            status = AuthenticationStatus::Exists;
+        } else {
+            db->createUser(authRequest.data.name, authRequest.data.buffer);
+            user.id = db->getUserId(user.username);
+            if (user.id == -1) {
+                throw std::runtime_error("unexpected createUser result");
+            }
+            status = AuthenticationStatus::Success;
+            rememberUser(user);
+        }
+    } else {
+        sendMessage(clientSocket, Message(MessageType::ClientError));
+        throw std::runtime_error("invalid massage type");
+    }
+
+
+    Message authResponse;
+    authResponse.authenticationStatus = status;
+    if (status == AuthenticationStatus::Success) {
+        authResponse.data.buffer = authRequest.type == MessageType::ResumeSession ? authRequest.data.buffer
+                                                                                  : sessions->create(user);
+    }
+    sendMessage(clientSocket, authResponse);
+
+    if (status != AuthenticationStatus::Success) {
+        throw std::runtime_error("auth error");
+    }
+
+    if (!firstRequestServed.exchange(true)) {
+        const auto elapsed = std::chrono::steady_clock::now() - startTime;
+        CP_LOG_INFO({}, "first request served ", std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count(),
+                    " ms after start");
+    }
+
+    return user;
+}
+
+
+auto Server::maintainConnections() -> void {
+    metrics.add("connections.reaped", static_cast<int64_t>(connections.reap()));
+    metrics.add("connections.evicted", static_cast<int64_t>(connections.evictIdle(idleTimeout)));
+    metrics.set("handshakes.pending", static_cast<int64_t>(handshakes.load()));
+    metrics.add("sessions.expired", static_cast<int64_t>(sessions->prune()));
+    metrics.set("sessions.live", static_cast<int64_t>(sessions->size()));
+    rateLimiter.prune();
+    scheduler.exportMetrics(metrics);
+    Logger::get().exportMetrics(metrics);
+
+    const auto live = connections.size();
+    const auto bytes = connections.bytes();
+    metrics.set("connections.live", static_cast<int64_t>(live));
+    metrics.set("connections.bytes", static_cast<int64_t>(bytes));
+    metrics.set("response_cache.bytes", static_cast<int64_t>(responseCache->getBytes()));
+    if (recorder) {
+        recorder->exportMetrics(metrics);
+    }
+    if (events) {
+        events->exportMetrics(metrics);
+    }
+    metrics.set("connections.bytes_per_connection", static_cast<int64_t>(live == 0 ? 0 : bytes / live));
+
+    if (follower) {
+        metrics.set("replication.lag_ms", follower->lag().count());
+        metrics.set("replication.applied_sequence", static_cast<int64_t>(follower->getAppliedSequence()));
+        metrics.set("replication.resyncs", static_cast<int64_t>(follower->getResyncs()));
+    }
+}
+
+
+auto Server::flushReadState() noexcept -> void {
+    try {
+        readState.flush();
+    } catch (std::runtime_error &exception) {
+        metrics.add("read_state.flush_errors");
+        CP_LOG_ERROR({}, "read state flush failed: ", exception.what());
+    }
+}
+
+
+auto Server::isStorageRequest(const MessageType type) -> bool {
+    switch (type) {
+        case MessageType::CreateMessage:
+        case MessageType::UpdateChats:
+        case MessageType::CreateChat:
+        case MessageType::InviteUserToChat:
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+auto Server::admitByRate(const User &user, Message &message) -> bool {
+    // heartbeats are what idle clients send, throttling them would get clients evicted
+    if (message.type == MessageType::Heartbeat) {
+        return true;
+    }
+
+    const auto retryAfter = rateLimiter.acquire(user.id, message.type);
+    if (retryAfter.count() == 0) {
+        return true;
+    }
+
+    metrics.add("throttled.total");
+    metrics.add("throttled." + getMessageTypeName(message.type));
+    message = Message(MessageType::ClientError, MessageData(
+            "Rate limit exceeded, retry in " + std::to_string(retryAfter.count()) + " ms"));
+    message.data.time = static_cast<int32_t>(retryAfter.count());
+    return false;
+}
+
+
+auto Server::admitOnFollower(Message &message) -> bool {
+    switch (message.type) {
+        case MessageType::CreateMessage:
+        case MessageType::CreateChat:
+        case MessageType::InviteUserToChat:
+        case MessageType::InviteUsersToChat:
+        case MessageType::MarkRead: {
+            message = Message(MessageType::ClientError, MessageData("Read-only replica"));
+            return false;
+        }
+        case MessageType::UpdateChats:
+        case MessageType::GetRecentChats:
+        case MessageType::GetAllMessagesFromChat:
+        case MessageType::GetMessagesFromChatSince: {
+            if (follower->lag() > maxStaleness) {
+                metrics.add("replication.stale_reads_rejected");
+                message = Message(MessageType::ServerError, MessageData("Replica is stale"));
+                return false;
+            }
+            return true;
+        }
+        default:
+            return true;
+    }
+}
+
+
+auto Server::estimateBytes(const Message &message) -> size_t {
+    auto bytes = sizeof(Message) + message.data.name.capacity() + message.data.buffer.capacity();
+    for (const auto &s: message.data.vector) {
+        bytes += sizeof(s) + s.capacity();
+    }
+    bytes += message.data.numbers.capacity() * sizeof(int64_t);
+    for (const auto &chatMessage: message.data.chatMessages) {
+        bytes += sizeof(chatMessage) + chatMessage.datetime.capacity() + chatMessage.username.capacity() +
+                 chatMessage.text.capacity();
+    }
+    return bytes;
+}
+
+
+auto Server::clientMonitor(const uint64_t connectionId, const std::string &clientEndPoint) noexcept -> void {
+    CP_LOG_DEBUG(LogContext{connectionId}, "clientMonitor started, monitoring ", clientEndPoint);
+
+    // slot taken by connection monitor is given back once the client is attached or the monitor fails
+    bool handshaking = true;
+    try {
+        zmqpp::socket clientSocket(context, zmqpp::socket_type::reply);
+        // evicted client may be gone, pending response must not keep socket alive
+        clientSocket.set(zmqpp::socket_option::linger, 0);
+
+        const auto user = attachClient(connectionId, clientSocket, clientEndPoint);
+        handshaking = false;
+        handshakes--;
+        connections.attach(connectionId, user.username);
+        const EventHub::Presence presence(events.get(), user);
+        connections.touch(connectionId, 0);
+        clientSocket.set(zmqpp::socket_option::receive_timeout, pollInterval);
+
+        while (running) {
+            Message message;
+            if (!tryReceiveMessage(clientSocket, message)) {
+                if (connections.isEvicted(connectionId)) {
+                    throw std::runtime_error("connection of " + user.username + " evicted as idle");
+                }
+                continue;
+            }
+            connections.touch(connectionId, estimateBytes(message));
+            const LogContext request{connectionId, user.username, message.type};
+            if (recorder) {
+                recorder->record(connectionId, user.username, message);
+            }
+
+            // requests which came after restart began are served by the new process
+            const InFlightGuard inFlightGuard(inFlight);
+            if (draining) {
+                metrics.add("restart.requests_redirected");
+                sendMessage(clientSocket, Message(MessageType::Restarting));
+                break;
+            }
+
+            if ((follower && !admitOnFollower(message)) || !admitByRate(user, message)) {
+                sendMessage(clientSocket, message);
+                continue;
+            }
+
+            std::optional<Scheduler::Slot> slot;
+            if (isStorageRequest(message.type)) {
+                slot.emplace(scheduler, RequestClass::Interactive);
+            }
+
+            switch (message.type) {
+                case MessageType::Heartbeat: {
+                    metrics.add("heartbeats.received");
+                    break;
+                }
+                case MessageType::GetServerStats: {
+                    message.data.vector = metrics.dump();
+                    break;
+                }
+                case MessageType::CreateMessage: {
+                    try {
+                        const auto rawTime = time(nullptr);
+                        // publishing storage would look the sender up again otherwise
+                        const auto messageId = publishing
+                                               ? publishing->createMessage(message.data.name, user, rawTime,
+                                                                           message.data.buffer)
+                                               : db->createMessage(message.data.name, user.id, rawTime,
+                                                                   message.data.buffer);
+                        if (messageId == -1) {
+                            sendMessage(clientSocket, Message(MessageType::ClientError,
+                                                              "Chat " + message.data.buffer + " doesn't exists"));
+                            continue;
+                        }
+                        historyCache->append(
+                                message.data.name,
+                                StoredMessage{messageId, user.id, rawTime, message.data.buffer, user.username}
+                        );
+                        recentChats.update(message.data.name, messageId, rawTime, user.username, message.data.buffer);
+                        responseCache->append(message.data.name, rawTime, ChatMessage(
+                                getFormattedDatetime(rawTime), user.username, message.data.buffer, messageId));
+                        readState.onMessage(message.data.name, messageId, user.id);
+                    } catch (std::runtime_error &exception) {
+                        CP_LOG_ERROR(request, exception.what());
+                        sendMessage(clientSocket, Message(MessageType::ServerError));
+                        continue;
+                    }
+                    break;
+                }
+                case MessageType::Update: {
+                    break;
+                }
+                case MessageType::UpdateChats: {
+                    CP_LOG_DEBUG(request, "update chats received");
+                    const auto it = findUser(message.data.name);
+                    if (!it) {
+                        message.type = MessageType::ClientError;
+                        break;
+                    }
+
+                    try {
+                        message.data.vector = db->getChatsByTime(it->id, message.data.time);
+                    } catch (std::runtime_error &exception) {
+                        CP_LOG_ERROR(request, exception.what());
+                        sendMessage(clientSocket, Message(MessageType::ServerError));
+                        continue;
+                    }
+                    message.data.time = time(nullptr);
+                    break;
+                }
+                case MessageType::GetRecentChats: {
+                    const auto limit = message.data.time > 0 ? std::min(message.data.time, maxRecentChats)
+                                                             : defaultRecentChats;
+                    message.data.vector.clear();
+                    message.data.chatMessages.clear();
+                    message.data.numbers.clear();
+                    try {
+                        recentChats.getTop(*db, user.id, limit, message.data.vector, message.data.chatMessages);
+                    } catch (std::runtime_error &exception) {
+                        CP_LOG_ERROR(request, exception.what());
+                        sendMessage(clientSocket, Message(MessageType::ServerError));
+                        continue;
+                    }
+                    for (const auto &chatName: message.data.vector) {
+                        message.data.numbers.push_back(readState.getUnread(user.id, chatName));
+                    }
+                    break;
+                }
+                case MessageType::MarkRead: {
+                    try {
+                        db->getUserAllowedRawTime(db->getChatId(message.data.name), user.id);
+                    } catch (std::runtime_error &) {
+                        sendMessage(clientSocket, Message(MessageType::ClientError, MessageData(
+                                "Chat " + message.data.name + " doesn't exists")));
+                        continue;
+                    }
+                    readState.markRead(user.id, message.data.name, message.data.time);
+                    break;
+                }
+                case MessageType::CreateChat: {
+                    std::vector<int32_t> userIds;
+                    userIds.reserve(message.data.vector.size());
+
+                    auto flag = false;
+                    for (const auto &username: message.data.vector) {
+                        const auto it = findUser(username);
+                        if (it) {
+                            userIds.push_back(it->id);
+                        } else {
+                            message = Message(MessageType::ClientError,
+                                              MessageData("User " + username + " doesn't exists"));
+                            sendMessage(clientSocket, message);
+                            flag = true;
+                            break;
+                        }
+                    }
+
+                    if (!flag) {
+                        try {
+                            if (!db->createChat(message.data.buffer, user.id, userIds)) {
+                                sendMessage(clientSocket,
+                                            Message(MessageType::ClientError, MessageData("Chat exists")));
+                                continue;
+                            }
+                            for (const auto &userId: userIds) {
+                                readState.onJoin(userId, message.data.buffer);
+                            }
+                        } catch (std::runtime_error &exception) {
+                            CP_LOG_ERROR(request, exception.what());
+                            sendMessage(clientSocket, Message(MessageType::ServerError));
+                            continue;
+                        }
+                    }
+                    break;
+                }
+                case MessageType::GetAllMessagesFromChat:
+                case MessageType::GetMessagesFromChatSince: {
+                    const auto afterId = message.type == MessageType::GetAllMessagesFromChat ? 0 : message.data.time;
+
+                    // membership is checked in memory, non-members fall through to the storage error
+                    std::optional<time_t> allowedRawTime;
+                    try {
+                        allowedRawTime = db->getUserAllowedRawTime(db->getChatId(message.data.name), user.id);
+                    } catch (std::runtime_error &) {}
+
+                    // whole histories are answered with packed responses
+                    const auto wholeHistory = afterId == 0 && allowedRawTime;
+                    uint64_t generation = 0;
+                    if (wholeHistory) {
+                        msgpack::sbuffer package;
+                        if (responseCache->pack(message, *allowedRawTime, package)) {
+                            metrics.add("response_cache.hits");
+                            slot.reset();
+                            sendPackage(clientSocket, package);
+                            continue;
+                        }
+                        metrics.add("response_cache.misses");
+                        generation = responseCache->getGeneration(message.data.name);
+                    }
+
+                    try {
+                        if (!allowedRawTime || !historyCache->read(message.data.name, *allowedRawTime, afterId,
+                                                                   message.data.chatMessages)) {
+                            // whole histories may be huge, incremental reads are usually short
+                            Scheduler::Slot historySlot(scheduler, afterId == 0 ? RequestClass::Bulk
+                                                                                : RequestClass::Interactive);
+                            // the loaded ring answers unless the read goes deeper than it
+                            if (!allowedRawTime || !historyCache->loadAndRead(*db, message.data.name, *allowedRawTime,
+                                                                              afterId, message.data.chatMessages)) {
+                                message.data.chatMessages = db->getMessagesFromChatSince(message.data.name, user.id,
+                                                                                         afterId);
+                            }
+                        }
+                    } catch (std::logic_error &exception) {
+                        CP_LOG_WARNING(request, exception.what());
+                        sendMessage(clientSocket, Message(MessageType::ClientError, MessageData(
+                                "Chat " + message.data.name + " doesn't exists")));
+                        continue;
+                    } catch (std::runtime_error &) {
+                        sendMessage(clientSocket, Message(MessageType::ServerError));
+                        continue;
+                    }
+
+                    // cursor for the next incremental request
+                    message.data.time = afterId;
+                    for (const auto &chatMessage: message.data.chatMessages) {
+                        message.data.time = std::max(message.data.time, chatMessage.id);
+                    }
+
+                    // clients drop cached messages which retention has deleted since they were fetched
+                    message.data.numbers.clear();
+                    if (afterId != 0 && allowedRawTime) {
+                        message.data.numbers.push_back(getPrunedId(message.data.name));
+                    }
+
+                    // senders are sent once in vector, messages refer to them by index
+                    message.data.vector.clear();
+                    const auto removedBytes = encodeSenders(message.data.chatMessages, message.data.vector);
+                    int64_t sendersBytes = 0;
+                    for (const auto &sender: message.data.vector) {
+                        sendersBytes += static_cast<int64_t>(sender.size());
+                    }
+                    metrics.add("history.sender_bytes_saved", static_cast<int64_t>(removedBytes) - sendersBytes);
+
+                    if (wholeHistory) {
+                        responseCache->store(message.data.name, *allowedRawTime, message.data.chatMessages,
+                                             message.data.vector, generation);
+                    }
+                    break;
+                }
+                case MessageType::InviteUserToChat: {
+                    const auto it = findUser(message.data.buffer);
+                    if (!it) {
+                        message.type = MessageType::ClientError;
+                        break;
+                    }
+
+                    try {
+                        db->inviteUserToChat(message.data.name, user.id, it->id, message.data.flag);
+                        readState.onJoin(it->id, message.data.name);
+                    } catch (std::logic_error &) {
+                        sendMessage(clientSocket, Message(MessageType::ClientError, MessageData(
+                                "Chat " + message.data.name + " doesn't exists")));
+                        continue;
+                    } catch (std::runtime_error &exception) {
+                        CP_LOG_ERROR(request, exception.what());
+                        sendMessage(clientSocket, Message(MessageType::ServerError));
+                        continue;
+                    }
+                    break;
+                }
+                case MessageType::Event: {
+                    if (!events) {
+                        message = Message(MessageType::ClientError, MessageData("Events are disabled"));
+                        break;
+                    }
+                    // members are checked in the membership index, events never reach storage
+                    const auto chatId = db->getChatId(message.data.name);
+                    if (!db->isChatMember(chatId, user.id)) {
+                        message = Message(MessageType::ClientError, MessageData(
+                                "Chat " + message.data.name + " doesn't exists"));
+                        break;
+                    }
+                    events->publish(user, message.data.name, message.data.buffer, [this, chatId](const int32_t userId) {
+                        return db->isChatMember(chatId, userId);
+                    });
+                    break;
+                }
+                case MessageType::InviteUsersToChat: {
+                    // unknown usernames get their status instead of failing the whole batch
+                    std::vector<int32_t> userIds;
+                    userIds.reserve(message.data.vector.size());
+                    for (const auto &username: message.data.vector) {
+                        const auto it = findUser(username);
+                        userIds.push_back(it ? it->id : -1);
+                    }
+
+                    try {
+                        // thousands of members are a bulk write
+                        Scheduler::Slot inviteSlot(scheduler, RequestClass::Bulk);
+                        const auto statuses = db->inviteUsersToChat(message.data.name, user.id, userIds,
+                                                                    message.data.flag);
+                        message.data.numbers.clear();
+                        message.data.numbers.reserve(statuses.size());
+                        for (size_t i = 0; i < statuses.size(); i++) {
+                            message.data.numbers.push_back(static_cast<int64_t>(statuses[i]));
+                            if (statuses[i] == InviteStatus::Invited) {
+                                readState.onJoin(userIds[i], message.data.name);
+                            }
+                        }
+                    } catch (std::logic_error &) {
+                        sendMessage(clientSocket, Message(MessageType::ClientError, MessageData(
+                                "Chat " + message.data.name + " doesn't exists")));
+                        continue;
+                    } catch (std::runtime_error &exception) {
+                        CP_LOG_ERROR(request, exception.what());
+                        sendMessage(clientSocket, Message(MessageType::ServerError));
+                        continue;
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+
+            // slow clients must not hold storage budget
+            slot.reset();
+            CP_LOG_DEBUG(request, "sending response ", getMessageTypeName(message.type));
+            sendMessage(clientSocket, message);
+        }
+    } catch (zmqpp::exception &exception) {
+        CP_LOG_WARNING(LogContext{connectionId}, "caught zmq exception: ", exception.what());
+    } catch (std::runtime_error &exception) {
+        CP_LOG_WARNING(LogContext{connectionId}, exception.what());
+    }
+
+    if (handshaking) {
+        handshakes--;
+    }
+    CP_LOG_DEBUG(LogContext{connectionId}, "clientMonitor exiting");
+}
+
+
+Server::Server() : context(ownContext), idleTimeout(defaultIdleTimeout), maxHandshakes(defaultMaxHandshakes) {}
+
+
+Server::Server(zmqpp::context &context) : context(context), idleTimeout(defaultIdleTimeout),
+                                          maxHandshakes(defaultMaxHandshakes) {}
+
+
+auto Server::get() -> Server & {
+    static Server instance;
+    return instance;
+}
+
+
+auto Server::configureStorage(std::unique_ptr<Storage> storage) -> void {
+    db = std::move(storage);
+    publishing = nullptr;
+}
+
+
+auto Server::configureHistoryCache(const size_t capacity, const size_t budget) -> void {
+    historyCache = std::make_unique<HistoryCache>(capacity, budget);
+}
+
+
+auto Server::configureResponseCache(const size_t budget) -> void {
+    responseCache = std::make_unique<ResponseCache>(budget);
+}
+
+
+auto Server::configurePublishing(const std::string &publishEndPoint, const std::string &syncEndPoint) -> void {
+    auto storage = std::make_unique<PublishingStorage>(std::move(db), publishEndPoint, syncEndPoint);
+    publishing = storage.get();
+    db = std::move(storage);
+}
+
+
+auto Server::configureFollower(
+        const std::string &publishEndPoint,
+        const std::string &syncEndPoint,
+        const size_t maxStaleness
+) -> void {
+    this->maxStaleness = std::chrono::milliseconds(maxStaleness);
+    // cached rings would miss replicated messages, they are loaded again on next read
+    follower = std::make_unique<Follower>(*db, publishEndPoint, syncEndPoint, [this](const Change &change) {
+        if (change.type == ChangeType::Message) {
+            historyCache->invalidate(change.chatName);
+            recentChats.update(change.chatName, change.id, change.rawTime, change.username, change.data);
+            responseCache->append(change.chatName, change.rawTime, ChatMessage(
+                    getFormattedDatetime(change.rawTime), change.username, change.data, change.id));
+            readState.onMessage(change.chatName, change.id, -1);
+        }
+    });
+}
+
+
+auto Server::configureReadState(const std::string &path, const size_t flushInterval) -> void {
+    readStatePath = path;
+    readStateFlushInterval = std::chrono::milliseconds(flushInterval);
+}
+
+
+auto Server::configureRetention(
+        const RetentionPolicy defaultPolicy,
+        const std::string &policiesPath,
+        const size_t pruneBatch,
+        const size_t pruneInterval
+) -> void {
+    retentionPolicy = defaultPolicy;
+    retentionPolicies = policiesPath.empty() ? std::unordered_map<std::string, RetentionPolicy>()
+                                             : Pruner::loadPolicies(policiesPath);
+    this->pruneBatch = pruneBatch;
+    this->pruneInterval = std::chrono::milliseconds(pruneInterval);
+}
+
+
+auto Server::configureSessions(const std::string &path, const time_t lifetime) -> void {
+    sessions = std::make_unique<SessionTable>(path, lifetime);
+}
+
+
+auto Server::configureWarmup(const size_t messagesWindow) -> void {
+    warmupWindow = messagesWindow;
+}
+
+
+auto Server::configureIdleTimeout(const size_t idleTimeout) -> void {
+    this->idleTimeout = std::chrono::milliseconds(idleTimeout);
+}
+
+
+auto Server::configureRateLimits(const RateLimit defaultLimit, const std::vector<std::string> &limits) -> void {
+    rateLimiter.setDefaultLimit(defaultLimit);
+    rateLimiter.setLimits(limits);
+}
+
+
+auto Server::configureScheduler(const size_t interactiveBudget, const size_t bulkBudget) -> void {
+    scheduler.configure(interactiveBudget, bulkBudget);
+}
+
+
+auto Server::configureMaxHandshakes(const size_t maxHandshakes) -> void {
+    this->maxHandshakes = maxHandshakes;
+    configurePasswordHashing(maxHandshakes);
+}
+
+
+auto Server::configureHandoff(const std::string &path, const size_t drainTimeout) -> void {
+    handoffPath = path;
+    this->drainTimeout = std::chrono::milliseconds(drainTimeout);
+}
+
+
+auto Server::configureEvents(const std::string &endPoint, const size_t interval, const size_t queueCapacity) -> void {
+    events = std::make_unique<EventHub>(endPoint, interval, queueCapacity);
+    const auto isLocal = endPoint.starts_with("ipc://") || endPoint.starts_with("inproc://") ||
+                         endPoint.starts_with("tcp://127.") || endPoint.starts_with("tcp://localhost:");
+    if (!isLocal) {
+        CP_LOG_WARNING({}, "events endpoint ", endPoint, " isn't local, anyone reaching it sees events of every chat");
+    }
+}
+
+
+auto Server::configureRecording(const std::string &path) -> void {
+    recorder = path.empty() ? nullptr : std::make_unique<Recorder>(path);
+}
+
+
+auto Server::configurePullSocketEndPoint(const std::string &endPoint) -> void {
+    pullSocket.bind(endPoint);
+
+    const auto elapsed = std::chrono::steady_clock::now() - startTime;
+    CP_LOG_INFO({}, "accepting connections ", std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count(),
+                " ms after start");
+}
+
+
+auto Server::run() -> void {
+    takeOver();
+
+    std::thread warmupThread(&Server::warmup, this);
+    std::thread pullerThread(&Server::connectionMonitor, this);
+
+    // unread counts are loaded while clients are served, pruning changes counts and starts after them
+    try {
+        const auto start = std::chrono::steady_clock::now();
+        readState.load(*db, readStatePath, readStateFlushInterval);
+        CP_LOG_INFO({}, "read state loaded in ", std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count(), " ms");
+    } catch (std::exception &exception) {
+        CP_LOG_ERROR({}, "can't load read state, unread counts are partial: ", exception.what());
+    }
+    if (!retentionPolicy.isEmpty() || !retentionPolicies.empty()) {
+        pruner = std::make_unique<Pruner>(
+                *db, scheduler, metrics, retentionPolicy, retentionPolicies, pruneBatch, pruneInterval,
+                [this](const std::string &chatName, const size_t pruned) {
+                    onPruned(chatName, pruned);
+                }
+        );
+    }
+
+    pullerThread.join();
+
+    if (draining) {
+        handOver();
+    }
+
+    warmupThread.join();
+
+    pruner.reset();
+    connections.joinAll();
+    recorder.reset();
+    readState.flush(true);
+}
+
+
+auto Server::stop() -> void {
+    running = false;
+}
+
+
+auto Server::restart() -> void {
+    if (handoffPath.empty()) {
+        running = false;
+    } else {
+        draining = true;
+    }
+}
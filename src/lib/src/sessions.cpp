@@ -0,0 +1,174 @@
+#include <stdexcept>
+#include <sodium.h>
+#include <filesystem>
+
+
+#include "../sessions.hpp"
+#include "../framing.hpp"
+
+
+constexpr size_t tokenSize = 32;
+
+
+SessionTable::SessionTable() : SessionTable("") {}
+
+
+SessionTable::SessionTable(const std::string &path, const time_t lifetime) : path(path), lifetime(lifetime) {
+    if (sodium_init() < 0) {
+        throw std::runtime_error("sodium_init error");
+    }
+
+    if (!path.empty()) {
+        load();
+    }
+}
+
+
+auto SessionTable::load() -> void {
+    const auto now = time(nullptr);
+    if (std::filesystem::exists(path)) {
+        // reading stops at a torn tail or at a journal of the old text format, the rewrite below drops it
+        FrameReader reader(path);
+        SessionRecord record;
+        while (reader.read(record) == FrameStatus::Read) {
+            if (record.expirationTime > now) {
+                sessions[record.token] = Session{User(record.userId, record.username),
+                                                 static_cast<time_t>(record.expirationTime)};
+            }
+        }
+    }
+    rewriteJournal();
+    nextPruneTime = now + pruneInterval;
+}
+
+
+auto SessionTable::rewriteJournal() -> void {
+    if (journal.is_open()) {
+        journal.close();
+    }
+
+    const auto temporaryPath = path + ".tmp";
+    {
+        std::ofstream output(temporaryPath, std::ios::binary | std::ios::trunc);
+        for (const auto &[token, session]: sessions) {
+            msgpack::sbuffer package;
+            msgpack::pack(&package, SessionRecord{token, session.user.id, session.user.username,
+                                                  session.expirationTime});
+            writeFrame(output, package);
+        }
+        if (!output.flush()) {
+            throw std::runtime_error("can't write session journal " + temporaryPath);
+        }
+    }
+    std::filesystem::rename(temporaryPath, path);
+    journalRecords = sessions.size();
+
+    journal.open(path, std::ios::binary | std::ios::app);
+    if (!journal) {
+        throw std::runtime_error("can't open session journal " + path);
+    }
+}
+
+
+auto SessionTable::writeJournal(const std::string &token, const Session &session) -> void {
+    msgpack::sbuffer package;
+    msgpack::pack(&package, SessionRecord{token, session.user.id, session.user.username, session.expirationTime});
+    writeFrame(journal, package);
+    journalRecords++;
+}
+
+
+auto SessionTable::generateToken() -> std::string {
+    unsigned char bytes[tokenSize];
+    randombytes_buf(bytes, tokenSize);
+
+    char token[2 * tokenSize + 1];
+    sodium_bin2hex(token, sizeof token, bytes, tokenSize);
+    return token;
+}
+
+
+auto SessionTable::create(const User &user) -> std::string {
+    auto token = generateToken();
+    const auto session = Session{user, time(nullptr) + lifetime};
+
+    std::lock_guard lockGuard(mutex);
+    sessions[token] = session;
+    if (journal.is_open()) {
+        writeJournal(token, session);
+        journal.flush();
+    }
+    return token;
+}
+
+
+auto SessionTable::resume(const std::string &username, const std::string &token) -> std::optional<User> {
+    std::lock_guard lockGuard(mutex);
+    const auto it = sessions.find(token);
+    if (it == sessions.end()) {
+        return std::nullopt;
+    }
+
+    if (it->second.expirationTime <= time(nullptr)) {
+        sessions.erase(it);
+        return std::nullopt;
+    }
+
+    if (it->second.user.username != username) {
+        return std::nullopt;
+    }
+    return it->second.user;
+}
+
+
+auto SessionTable::dump() -> std::vector<SessionRecord> {
+    const auto now = time(nullptr);
+
+    std::lock_guard lockGuard(mutex);
+    std::vector<SessionRecord> records;
+    records.reserve(sessions.size());
+    for (const auto &[token, session]: sessions) {
+        if (session.expirationTime > now) {
+            records.push_back(SessionRecord{token, session.user.id, session.user.username, session.expirationTime});
+        }
+    }
+    return records;
+}
+
+
+auto SessionTable::restore(const std::vector<SessionRecord> &records) -> void {
+    std::lock_guard lockGuard(mutex);
+    for (const auto &record: records) {
+        const auto session = Session{User(record.userId, record.username), static_cast<time_t>(record.expirationTime)};
+        if (!sessions.try_emplace(record.token, session).second || !journal.is_open()) {
+            continue;
+        }
+        writeJournal(record.token, session);
+    }
+    journal.flush();
+}
+
+
+auto SessionTable::prune() -> size_t {
+    const auto now = time(nullptr);
+
+    std::lock_guard lockGuard(mutex);
+    if (now < nextPruneTime) {
+        return 0;
+    }
+    nextPruneTime = now + pruneInterval;
+
+    const auto dropped = std::erase_if(sessions, [now](const auto &entry) {
+        return entry.second.expirationTime <= now;
+    });
+    if (journal.is_open() && journalRecords > 2 * sessions.size()) {
+        rewriteJournal();
+    }
+    return dropped;
+}
+
+
+auto SessionTable::size() -> size_t {
+    std::lock_guard lockGuard(mutex);
+    return sessions.size();
+}
@@ -0,0 +1,675 @@
+#include <utility>
+#include <algorithm>
+#include <filesystem>
+#include <unordered_set>
+
+
+#include "../shardedDatabase.hpp"
+#include "../query.hpp"
+
+
+auto shardPath(const std::string &directory, const size_t index) -> std::string {
+    return (std::filesystem::path(directory) / ("messages-" + std::to_string(index) + ".db")).string();
+}
+
+
+ShardedDatabase::Shard::Shard(const std::string &path) {
+    if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+        throw std::runtime_error("sqlite3_open error");
+    }
+
+    // same table as in Database, autoincrement keeps the greatest given id after pruning
+    std::string sql = "CREATE TABLE IF NOT EXISTS Messages(Id INTEGER PRIMARY KEY AUTOINCREMENT, ChatId INT, SenderId INT, RawTime INT, Time DATETIME, Data TEXT);"
+                      "CREATE TABLE IF NOT EXISTS PrunedChats(ChatId INTEGER PRIMARY KEY, MessageId INT);"
+                      "CREATE INDEX IF NOT EXISTS MessagesByChat ON Messages(ChatId, RawTime);"
+                      "CREATE INDEX IF NOT EXISTS MessagesByChatAndId ON Messages(ChatId, Id);";
+
+    if (!executeSqlQuery("PRAGMA auto_vacuum = INCREMENTAL;") || !executeSqlQuery(sql)) {
+        throw std::runtime_error("sqlite3_exec error");
+    }
+
+    const auto autoVacuum = Query<int32_t>(db, "PRAGMA auto_vacuum").scalar(0);
+    if (autoVacuum != 2 && !executeSqlQuery("VACUUM;")) {
+        throw std::runtime_error("sqlite3_exec error");
+    }
+}
+
+
+ShardedDatabase::Shard::~Shard() {
+    if (err_msg) {
+        sqlite3_free(err_msg);
+    }
+    sqlite3_close(db);
+}
+
+
+auto ShardedDatabase::Shard::get() const -> sqlite3 * {
+    return db;
+}
+
+
+auto ShardedDatabase::Shard::executeSqlQuery(const std::string &sql) noexcept -> bool {
+    return sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &err_msg) == SQLITE_OK;
+}
+
+
+auto ShardedDatabase::Shard::runTransaction(const std::function<void()> &body) -> void {
+    if (!executeSqlQuery("BEGIN")) {
+        throw std::runtime_error("sqlite3_exec error");
+    }
+
+    try {
+        body();
+    } catch (...) {
+        executeSqlQuery("ROLLBACK");
+        throw;
+    }
+
+    if (!executeSqlQuery("COMMIT")) {
+        executeSqlQuery("ROLLBACK");
+        throw std::runtime_error("sqlite3_exec error");
+    }
+}
+
+
+auto ShardedDatabase::Shard::getLastMessageId() -> int32_t {
+    return Query<int32_t>(db, "SELECT seq FROM sqlite_sequence WHERE name = 'Messages'").scalar(0);
+}
+
+
+ShardedDatabase::ShardedDatabase(const std::string &directory, const size_t shardCount) {
+    std::filesystem::create_directories(directory);
+    catalog = std::make_unique<Database>((std::filesystem::path(directory) / "catalog.db").string());
+
+    // chats are assigned to shards by id, so their number can't change once messages are written
+    size_t count = 0;
+    while (std::filesystem::exists(shardPath(directory, count))) {
+        count++;
+    }
+    if (count == 0) {
+        count = std::max<size_t>(shardCount, 1);
+    }
+
+    for (size_t index = 0; index < count; index++) {
+        shards.push_back(std::make_unique<Shard>(shardPath(directory, index)));
+        lastMessageId = std::max(lastMessageId.load(), shards.back()->getLastMessageId());
+    }
+}
+
+
+auto ShardedDatabase::shardOf(const int32_t chatId) const -> int32_t {
+    return chatId < 0 ? -1 : static_cast<int32_t>(static_cast<size_t>(chatId) % shards.size());
+}
+
+
+auto ShardedDatabase::resolveUsername(
+        std::unordered_map<int32_t, std::string> &usernames,
+        const int32_t userId
+) -> const std::string & {
+    auto it = usernames.find(userId);
+    if (it == usernames.end()) {
+        it = usernames.emplace(userId, catalog->getUsername(userId)).first;
+    }
+    return it->second;
+}
+
+
+auto ShardedDatabase::forEachShard(const std::function<void(size_t, sqlite3 *)> &visitor) -> void {
+    for (size_t index = 0; index < shards.size(); index++) {
+        std::lock_guard lockGuard(shards[index]->mutex);
+        visitor(index, shards[index]->get());
+    }
+}
+
+
+auto ShardedDatabase::selectLatest(const char *column, const size_t messagesWindow) -> std::vector<int32_t> {
+    const auto sqlQuery = std::string("SELECT Id, ") + column + " FROM Messages ORDER BY Id DESC LIMIT ?";
+
+    std::vector<std::pair<int32_t, int32_t>> latest;
+    forEachShard([&](size_t, sqlite3 *db) {
+        Query<int32_t, int32_t> query(db, sqlQuery);
+        query.bind(static_cast<int64_t>(messagesWindow)).forEach([&latest](const int32_t id, const int32_t value) {
+            latest.emplace_back(id, value);
+        });
+    });
+
+    // every shard gave its latest messagesWindow, the latest of them all are among those
+    const auto window = std::min(messagesWindow, latest.size());
+    std::partial_sort(latest.begin(), latest.begin() + static_cast<std::ptrdiff_t>(window), latest.end(),
+                      std::greater<>());
+
+    std::vector<int32_t> values;
+    std::unordered_set<int32_t> seen;
+    for (size_t i = 0; i < window; i++) {
+        if (seen.insert(latest[i].second).second) {
+            values.push_back(latest[i].second);
+        }
+    }
+    return values;
+}
+
+
+auto ShardedDatabase::getUserId(const std::string &username) -> int32_t {
+    return catalog->getUserId(username);
+}
+
+
+auto ShardedDatabase::getUsername(const int32_t userId) -> std::string {
+    return catalog->getUsername(userId);
+}
+
+
+auto ShardedDatabase::getAllUsers() -> std::set<User> {
+    return catalog->getAllUsers();
+}
+
+
+auto ShardedDatabase::authenticateUser(const std::string &username, const std::string &password) -> AuthenticationResult {
+    return catalog->authenticateUser(username, password);
+}
+
+
+auto ShardedDatabase::createUser(const std::string &username, const std::string &password) -> void {
+    catalog->createUser(username, password);
+}
+
+
+auto ShardedDatabase::createChat(
+        const std::string &chatName,
+        const int32_t &adminId,
+        const std::vector<int32_t> &userIds
+) -> bool {
+    return catalog->createChat(chatName, adminId, userIds);
+}
+
+
+auto ShardedDatabase::getChatId(const std::string &chatName) -> int32_t {
+    return catalog->getChatId(chatName);
+}
+
+
+auto ShardedDatabase::getChatName(const int chatId) -> std::string {
+    return catalog->getChatName(chatId);
+}
+
+
+auto ShardedDatabase::getChatsByTime(const int32_t userId, const time_t rawTime) -> std::vector<std::string> {
+    return catalog->getChatsByTime(userId, rawTime);
+}
+
+
+auto ShardedDatabase::createMessage(
+        const std::string &chatName,
+        const int32_t senderId,
+        const time_t rawTime,
+        const std::string &data
+) -> int32_t {
+    const auto chatId = getChatId(chatName);
+    const auto shard = shardOf(chatId);
+    const auto formattedDatetime = getFormattedDatetime(rawTime);
+
+    if (shard == -1) {
+        return -1;
+    }
+
+    // id is taken under the shard lock, so ids of a chat are committed in ascending order
+    auto &target = *shards[shard];
+    std::lock_guard lockGuard(target.mutex);
+    const auto id = ++lastMessageId;
+    Query<> insert(target.get(), "INSERT INTO Messages(Id, ChatId, SenderId, RawTime, Time, Data) VALUES(?, ?, ?, ?, ?, ?)");
+    insert.bind(id, chatId, senderId, rawTime, formattedDatetime, data).execute();
+    return id;
+}
+
+
+auto ShardedDatabase::getAllMessagesFromChat(const std::string &chatName, const int32_t userId) -> std::vector<ChatMessage> {
+    return getMessagesFromChatSince(chatName, userId, 0);
+}
+
+
+auto ShardedDatabase::getMessagesFromChatSince(
+        const std::string &chatName,
+        const int32_t userId,
+        const int32_t afterId
+) -> std::vector<ChatMessage> {
+    const auto chatId = getChatId(chatName);
+    time_t allowedRawTime;
+    try {
+        allowedRawTime = catalog->getUserAllowedRawTime(chatId, userId);
+    } catch (std::runtime_error &) {
+        throw std::logic_error("Chat don't exists");
+    }
+
+    std::vector<ChatMessage> messages;
+    std::vector<int32_t> senderIds;
+    {
+        auto &shard = *shards[shardOf(chatId)];
+        std::lock_guard lockGuard(shard.mutex);
+        Query<int32_t, std::string_view, std::string_view, int32_t> query(
+                shard.get(), "SELECT SenderId, Time, Data, Id FROM Messages "
+                             "WHERE ChatId = ? AND RawTime >= ? AND Id > ? ORDER BY RawTime, Id");
+        query.bind(chatId, allowedRawTime, afterId).forEach(
+                [&](const int32_t senderId, const std::string_view datetime, const std::string_view text, const int32_t id) {
+                    senderIds.push_back(senderId);
+                    messages.emplace_back(std::string(datetime), "", std::string(text), id);
+                });
+    }
+
+    // catalog is locked after the shard is released
+    std::unordered_map<int32_t, std::string> usernames;
+    for (size_t i = 0; i < messages.size(); i++) {
+        messages[i].username = resolveUsername(usernames, senderIds[i]);
+    }
+    return messages;
+}
+
+
+auto ShardedDatabase::getRecentMessages(const std::string &chatName, const size_t limit) -> std::vector<StoredMessage> {
+    const auto chatId = getChatId(chatName);
+    if (chatId == -1) {
+        return {};
+    }
+
+    std::vector<StoredMessage> messages;
+    {
+        auto &shard = *shards[shardOf(chatId)];
+        std::lock_guard lockGuard(shard.mutex);
+        Query<int32_t, int32_t, int64_t, std::string_view> query(
+                shard.get(), "SELECT Id, SenderId, RawTime, Data FROM Messages WHERE ChatId = ? ORDER BY Id DESC LIMIT ?");
+        query.bind(chatId, static_cast<int64_t>(limit)).forEach(
+                [&messages](const int32_t id, const int32_t senderId, const int64_t rawTime, const std::string_view text) {
+                    messages.push_back(StoredMessage{id, senderId, rawTime, std::string(text)});
+                });
+    }
+
+    // users live in the catalog, every sender is looked up once
+    std::unordered_map<int32_t, std::string> usernames;
+    for (auto &message: messages) {
+        message.senderName = resolveUsername(usernames, message.senderId);
+    }
+    std::reverse(messages.begin(), messages.end());
+    return messages;
+}
+
+
+auto ShardedDatabase::getUserAllowedRawTime(const int32_t chatId, const int32_t userId) -> time_t {
+    return catalog->getUserAllowedRawTime(chatId, userId);
+}
+
+
+auto ShardedDatabase::isChatMember(const int32_t chatId, const int32_t userId) -> bool {
+    return catalog->isChatMember(chatId, userId);
+}
+
+
+auto ShardedDatabase::getChatMembers(const std::string &chatName) -> std::vector<ChatMember> {
+    return catalog->getChatMembers(chatName);
+}
+
+
+auto ShardedDatabase::getRecentlyActiveChats(const size_t messagesWindow) -> std::vector<std::string> {
+    std::vector<std::string> chats;
+    for (const auto chatId: selectLatest("ChatId", messagesWindow)) {
+        auto chatName = getChatName(chatId);
+        if (!chatName.empty()) {
+            chats.push_back(std::move(chatName));
+        }
+    }
+    return chats;
+}
+
+
+auto ShardedDatabase::getRecentlyActiveUsers(const size_t messagesWindow) -> std::vector<User> {
+    std::vector<User> users;
+    for (const auto userId: selectLatest("SenderId", messagesWindow)) {
+        users.emplace_back(userId, getUsername(userId));
+    }
+    return users;
+}
+
+
+auto ShardedDatabase::getLastMessages() -> std::vector<Change> {
+    std::vector<Change> messages;
+    std::vector<int32_t> senderIds;
+    forEachShard([&](size_t, sqlite3 *db) {
+        Query<int32_t, int32_t, int32_t, int64_t, std::string_view> query(
+                db, "SELECT Id, ChatId, SenderId, RawTime, Data FROM Messages "
+                    "WHERE Id IN (SELECT MAX(Id) FROM Messages GROUP BY ChatId)");
+        query.forEach([&](const int32_t id, const int32_t chatId, const int32_t senderId, const int64_t rawTime,
+                          const std::string_view text) {
+            messages.push_back(Change{ChangeType::Message, id, "", getChatName(chatId), rawTime, std::string(text)});
+            senderIds.push_back(senderId);
+        });
+    });
+
+    std::unordered_map<int32_t, std::string> usernames;
+    for (size_t i = 0; i < messages.size(); i++) {
+        messages[i].username = resolveUsername(usernames, senderIds[i]);
+    }
+    return messages;
+}
+
+
+auto ShardedDatabase::countMessagesSince(const int32_t afterId) -> std::vector<MessageCount> {
+    std::vector<MessageCount> counts;
+    forEachShard([&](size_t, sqlite3 *db) {
+        Query<int32_t, int64_t, int32_t> query(db, "SELECT ChatId, COUNT(*), MAX(Id) FROM Messages WHERE Id > ? GROUP BY ChatId");
+        query.bind(afterId).forEach([&](const int32_t chatId, const int64_t count, const int32_t lastId) {
+            counts.push_back(MessageCount{getChatName(chatId), count, lastId});
+        });
+    });
+    return counts;
+}
+
+
+auto ShardedDatabase::inviteUserToChat(
+        const std::string &chatName,
+        const int32_t invitorId,
+        const int32_t userId,
+        bool allowHistorySharing
+) -> void {
+    catalog->inviteUserToChat(chatName, invitorId, userId, allowHistorySharing);
+}
+
+
+auto ShardedDatabase::inviteUsersToChat(
+        const std::string &chatName,
+        const int32_t invitorId,
+        const std::vector<int32_t> &userIds,
+        bool allowHistorySharing
+) -> std::vector<InviteStatus> {
+    return catalog->inviteUsersToChat(chatName, invitorId, userIds, allowHistorySharing);
+}
+
+
+auto ShardedDatabase::pruneMessages(
+        const std::string &chatName,
+        const time_t olderThan,
+        const size_t keepLatest,
+        const size_t batchSize
+) -> size_t {
+    const auto chatId = getChatId(chatName);
+    if (chatId == -1) {
+        return 0;
+    }
+
+    auto &shard = *shards[shardOf(chatId)];
+    std::lock_guard lockGuard(shard.mutex);
+    size_t deleted = 0;
+    shard.runTransaction([&] {
+        // batch is counted first and deleted by the same subquery, DELETE ... RETURNING needs sqlite 3.35
+        const std::string batch = "SELECT Id FROM Messages WHERE ChatId = ?1 AND (RawTime < ?2 OR (?3 > 0 AND Id <= "
+                                  "(SELECT Id FROM Messages WHERE ChatId = ?1 ORDER BY Id DESC LIMIT 1 OFFSET ?3))) "
+                                  "ORDER BY Id LIMIT ?4";
+        int32_t prunedId = 0;
+        Query<int64_t, int32_t> select(shard.get(), "SELECT COUNT(*), IFNULL(MAX(Id), 0) FROM (" + batch + ")");
+        select.bind(chatId, olderThan, static_cast<int64_t>(keepLatest), static_cast<int64_t>(batchSize))
+                .first([&deleted, &prunedId](const int64_t count, const int32_t lastId) {
+                    deleted = static_cast<size_t>(count);
+                    prunedId = lastId;
+                });
+        if (deleted != 0) {
+            Query<>(shard.get(), "DELETE FROM Messages WHERE Id IN (" + batch + ")")
+                    .bind(chatId, olderThan, static_cast<int64_t>(keepLatest), static_cast<int64_t>(batchSize))
+                    .execute();
+            Query<>(shard.get(), "INSERT INTO PrunedChats VALUES(?1, ?2) ON CONFLICT(ChatId) DO UPDATE "
+                                 "SET MessageId = MAX(MessageId, excluded.MessageId)").bind(chatId, prunedId).execute();
+        }
+    });
+    return deleted;
+}
+
+
+auto ShardedDatabase::getPrunedId(const std::string &chatName) -> int32_t {
+    const auto chatId = getChatId(chatName);
+    if (chatId == -1) {
+        return 0;
+    }
+
+    auto &shard = *shards[shardOf(chatId)];
+    std::lock_guard lockGuard(shard.mutex);
+    return Query<int32_t>(shard.get(), "SELECT MessageId FROM PrunedChats WHERE ChatId = ?").bind(chatId).scalar(0);
+}
+
+
+auto ShardedDatabase::reclaimSpace() -> int64_t {
+    int64_t reclaimed = 0;
+    forEachShard([&](size_t index, sqlite3 *db) {
+        const auto freePages = [db]() -> int64_t {
+            return Query<int64_t>(db, "PRAGMA freelist_count").scalar(0);
+        };
+        const auto pageBytes = Query<int64_t>(db, "PRAGMA page_size").scalar(0);
+
+        const auto before = freePages();
+        if (before == 0) {
+            return;
+        }
+        if (!shards[index]->executeSqlQuery("PRAGMA incremental_vacuum(" + std::to_string(vacuumPages) + ");")) {
+            throw std::runtime_error("sqlite3_exec error");
+        }
+        reclaimed += (before - freePages()) * pageBytes;
+    });
+    return reclaimed;
+}
+
+
+auto ShardedDatabase::scanChanges(const std::function<void(const Change &)> &visitor) -> void {
+    // catalog has no messages, its scan visits users, chats and members only
+    catalog->scanChanges(visitor);
+
+    std::unordered_map<int32_t, std::string> usernames;
+    forEachShard([&](size_t, sqlite3 *db) {
+        Query<int32_t, int32_t, int32_t, int64_t, std::string_view> messages(
+                db, "SELECT Id, ChatId, SenderId, RawTime, Data FROM Messages ORDER BY Id");
+        Change change{ChangeType::Message};
+        messages.forEach([&](const int32_t id, const int32_t chatId, const int32_t senderId, const int64_t rawTime,
+                             const std::string_view text) {
+            change.id = id;
+            change.chatName = getChatName(chatId);
+            change.username = resolveUsername(usernames, senderId);
+            change.rawTime = rawTime;
+            change.data = text;
+            visitor(change);
+        });
+    });
+}
+
+
+auto ShardedDatabase::openChangeCursor() -> ChangeCursor {
+    return catalog->openChangeCursor();
+}
+
+
+auto ShardedDatabase::scanChangesPage(
+        ChangeCursor &cursor,
+        const size_t limit,
+        const std::function<void(const Change &)> &visitor
+) -> bool {
+    size_t visited = 0;
+    if (cursor.type != ChangeType::Message) {
+        // catalog has no messages, a page which gets to them leaves the cursor at their beginning
+        catalog->scanChangesPage(cursor, limit, [&visited, &visitor](const Change &change) {
+            visitor(change);
+            visited++;
+        });
+        if (visited == limit) {
+            return true;
+        }
+    }
+
+    // every shard gives its next messages, the page takes the lowest ids of them all
+    std::vector<StoredMessage> messages;
+    std::vector<int32_t> chatIds;
+    const auto left = static_cast<int64_t>(limit - visited);
+    forEachShard([&](size_t, sqlite3 *db) {
+        Query<int32_t, int32_t, int32_t, int64_t, std::string_view> query(
+                db, "SELECT Id, ChatId, SenderId, RawTime, Data FROM Messages "
+                    "WHERE Id > ? AND ChatId <= ? AND SenderId <= ? ORDER BY Id LIMIT ?");
+        query.bind(cursor.id, cursor.lastChatId, cursor.lastUserId, left).forEach(
+                [&](const int32_t id, const int32_t chatId, const int32_t senderId, const int64_t rawTime,
+                    const std::string_view text) {
+                    messages.push_back(StoredMessage{id, senderId, rawTime, std::string(text)});
+                    chatIds.push_back(chatId);
+                });
+    });
+
+    std::vector<size_t> order(messages.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&messages](const size_t lhs, const size_t rhs) -> bool {
+        return messages[lhs].id < messages[rhs].id;
+    });
+    order.resize(std::min(order.size(), static_cast<size_t>(left)));
+
+    std::unordered_map<int32_t, std::string> usernames;
+    Change change{ChangeType::Message};
+    for (const auto index: order) {
+        const auto &message = messages[index];
+        change.id = message.id;
+        change.chatName = getChatName(chatIds[index]);
+        change.username = resolveUsername(usernames, message.senderId);
+        change.rawTime = message.rawTime;
+        change.data = message.text;
+        visitor(change);
+        cursor.id = message.id;
+    }
+    return visited + order.size() == limit;
+}
+
+
+auto ShardedDatabase::scanChatChanges(
+        const std::string &chatName,
+        const std::function<void(const Change &)> &visitor
+) -> void {
+    // senders are visited as members, only members can write to a chat
+    catalog->scanChatChanges(chatName, visitor);
+
+    const auto chatId = getChatId(chatName);
+    if (chatId == -1) {
+        return;
+    }
+
+    std::unordered_map<int32_t, std::string> usernames;
+    auto &shard = *shards[shardOf(chatId)];
+    std::lock_guard lockGuard(shard.mutex);
+    Query<int32_t, int32_t, int64_t, std::string_view> messages(
+            shard.get(), "SELECT Id, SenderId, RawTime, Data FROM Messages WHERE ChatId = ? ORDER BY Id");
+    Change change{ChangeType::Message};
+    change.chatName = chatName;
+    messages.bind(chatId).forEach([&](const int32_t id, const int32_t senderId, const int64_t rawTime,
+                                      const std::string_view text) {
+        change.id = id;
+        change.username = resolveUsername(usernames, senderId);
+        change.rawTime = rawTime;
+        change.data = text;
+        visitor(change);
+    });
+}
+
+
+auto ShardedDatabase::applyChanges(const std::vector<Change> &changes) -> void {
+    struct ShardMessage {
+        const Change *change{};
+        int32_t chatId{};
+        int32_t senderId{};
+    };
+
+    // chats and senders are written first, messages refer to them
+    std::vector<Change> catalogChanges;
+    std::vector<const Change *> messageChanges;
+    std::unordered_set<std::string> batchUsers;
+    std::unordered_set<std::string> batchChats;
+    for (const auto &change: changes) {
+        if (change.type == ChangeType::Message) {
+            messageChanges.push_back(&change);
+        } else {
+            catalogChanges.push_back(change);
+        }
+        if (change.type == ChangeType::User) {
+            batchUsers.insert(change.username);
+        } else if (change.type == ChangeType::Chat) {
+            batchChats.insert(change.chatName);
+        }
+    }
+
+    // catalog and shards are separate files, messages are checked before the catalog commits its part
+    for (const auto change: messageChanges) {
+        if (!batchChats.contains(change->chatName) && getChatId(change->chatName) == -1) {
+            throw std::runtime_error("change refers to unknown chat " + change->chatName);
+        }
+        if (!batchUsers.contains(change->username) && getUserId(change->username) == -1) {
+            throw std::runtime_error("change refers to unknown user " + change->username);
+        }
+    }
+
+    if (!catalogChanges.empty()) {
+        catalog->applyChanges(catalogChanges);
+    }
+    if (messageChanges.empty()) {
+        return;
+    }
+
+    std::unordered_map<std::string, int32_t> userIds;
+    std::vector<std::vector<ShardMessage>> shardMessages(shards.size());
+    for (const auto change: messageChanges) {
+        const auto chatId = getChatId(change->chatName);
+        if (chatId == -1) {
+            throw std::runtime_error("change refers to unknown chat " + change->chatName);
+        }
+        auto userIt = userIds.find(change->username);
+        if (userIt == userIds.end()) {
+            userIt = userIds.emplace(change->username, getUserId(change->username)).first;
+        }
+        if (userIt->second == -1) {
+            throw std::runtime_error("change refers to unknown user " + change->username);
+        }
+        shardMessages[shardOf(chatId)].push_back(ShardMessage{change, chatId, userIt->second});
+    }
+
+    // every shard is locked in index order, message ids are looked up across all of them
+    std::vector<std::unique_lock<std::mutex>> locks;
+    std::vector<std::unique_ptr<Query<int32_t, int32_t, int64_t, std::string_view>>> findMessages;
+    for (auto &shard: shards) {
+        locks.emplace_back(shard->mutex);
+        findMessages.push_back(std::make_unique<Query<int32_t, int32_t, int64_t, std::string_view>>(
+                shard->get(), "SELECT ChatId, SenderId, RawTime, Data FROM Messages WHERE Id = ?"));
+    }
+
+    for (size_t index = 0; index < shards.size(); index++) {
+        if (shardMessages[index].empty()) {
+            continue;
+        }
+
+        auto &shard = *shards[index];
+        Query<> insertMessage(shard.get(), "INSERT INTO Messages(Id, ChatId, SenderId, RawTime, Time, Data) VALUES(?, ?, ?, ?, ?, ?)");
+        shard.runTransaction([&] {
+            for (const auto &message: shardMessages[index]) {
+                const auto &change = *message.change;
+                // messages keep their ids unless the ids are taken by other messages
+                auto id = change.id;
+                for (size_t other = 0; other < shards.size(); other++) {
+                    auto same = false;
+                    const auto found = findMessages[other]->bind(id).first(
+                            [&](const int32_t chatId, const int32_t senderId, const int64_t rawTime,
+                                const std::string_view text) {
+                                same = chatId == message.chatId && senderId == message.senderId &&
+                                       rawTime == change.rawTime && text == change.data;
+                            });
+                    if (found) {
+                        id = other == index && same ? -1 : lastMessageId + 1;
+                        break;
+                    }
+                }
+                if (id == -1) {
+                    continue;
+                }
+
+                const auto formattedDatetime = getFormattedDatetime(change.rawTime);
+                insertMessage.bind(id, message.chatId, message.senderId, change.rawTime, formattedDatetime, change.data)
+                        .execute();
+                lastMessageId = std::max(lastMessageId.load(), id);
+            }
+        });
+    }
+}
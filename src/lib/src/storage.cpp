@@ -0,0 +1,31 @@
+#include <stdexcept>
+
+
+#include "../storage.hpp"
+#include "../database.hpp"
+#include "../logStorage.hpp"
+#include "../shardedDatabase.hpp"
+
+
+auto makeStorage(const std::string &engine, const std::string &path, const size_t shards) -> std::unique_ptr<Storage> {
+    if (engine == "sqlite") {
+        return std::make_unique<Database>(path);
+    } else if (engine == "log") {
+        return std::make_unique<LogStorage>(path);
+    } else if (engine == "sharded") {
+        return std::make_unique<ShardedDatabase>(path, shards);
+    }
+    throw std::runtime_error("unknown storage engine " + engine);
+}
+
+
+auto getFormattedDatetime(const time_t rawTime) noexcept -> std::string {
+    struct tm currentTime{};
+    localtime_r(&rawTime, &currentTime);
+
+    const int TIME_STRING_LENGTH = 20;
+    char buffer[TIME_STRING_LENGTH];
+
+    strftime(buffer, TIME_STRING_LENGTH, "%Y-%m-%d %H:%M:%S", &currentTime);
+    return std::string(buffer);
+}
@@ -0,0 +1,202 @@
+#ifndef CP_STORAGE_HPP
+#define CP_STORAGE_HPP
+
+
+#include <set>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <msgpack.hpp>
+
+#include "user.hpp"
+#include "auth.hpp"
+#include "chatMessage.hpp"
+
+
+// Raw message row, senderName is username of senderId
+struct StoredMessage {
+    int32_t id{};
+    int32_t senderId{};
+    time_t rawTime{};
+    std::string text{};
+    std::string senderName{};
+};
+
+
+struct MessageCount {
+    std::string chatName{};
+    int64_t count{};
+    int32_t lastMessageId{};
+};
+
+
+struct ChatMember {
+    int32_t userId{};
+    time_t allowedRawTime{};
+};
+
+
+enum class ChangeType {
+    User,
+    Chat,
+    Member,
+    Message
+};
+
+
+// Row of storage addressed by names, so it can be applied to another engine whose ids differ. Message ids are
+// kept, clients use them as cursors
+struct Change {
+    ChangeType type{};
+    // Message: message id
+    int32_t id{};
+    // User: username, Chat: admin, Member: member, Message: sender
+    std::string username{};
+    std::string chatName{};
+    // Chat: creation time, Member: allowed raw time, Message: raw time
+    int64_t rawTime{};
+    // User: password hash, Message: text
+    std::string data{};
+
+    MSGPACK_DEFINE (type, id, username, chatName, rawTime, data)
+};
+
+
+MSGPACK_ADD_ENUM(ChangeType)
+
+
+// Position of a paged scan of changes. Users and chats are bounded by the last ids when the scan was opened, ids
+// only grow, so no visited member or message refers to a user or chat the scan skips. Members are visited chat
+// by chat, messages in id order like scanChanges does, engines which keep ids need them growing
+struct ChangeCursor {
+    int32_t lastUserId{};
+    int32_t lastChatId{};
+    ChangeType type{};
+    // Member: chat of the last visited row
+    int32_t chatId{};
+    // User, Chat, Message: id of the last visited row, Member: its user id
+    int32_t id{};
+
+    MSGPACK_DEFINE (lastUserId, lastChatId, type, chatId, id)
+};
+
+
+// Storage engine interface, every implementation must be thread-safe
+class Storage {
+public:
+    virtual ~Storage() = default;
+
+    virtual auto getUserId(const std::string &username) -> int32_t = 0;
+
+    virtual auto getUsername(int32_t userId) -> std::string = 0;
+
+    virtual auto getAllUsers() -> std::set<User> = 0;
+
+    // userId of result is set on success only
+    virtual auto authenticateUser(const std::string &username, const std::string &password) -> AuthenticationResult = 0;
+
+    virtual auto createUser(const std::string &username, const std::string &password) -> void = 0;
+
+    virtual auto createChat(const std::string &chatName, const int32_t &adminId, const std::vector<int32_t> &userIds) -> bool = 0;
+
+    virtual auto getChatId(const std::string &chatName) -> int32_t = 0;
+
+    virtual auto getChatName(int chatId) -> std::string = 0;
+
+    virtual auto getChatsByTime(int32_t userId, time_t rawTime) -> std::vector<std::string> = 0;
+
+    // returns id of the created message or -1 if chat doesn't exist
+    virtual auto createMessage(const std::string &chatName, int32_t senderId, time_t rawTime, const std::string &data) -> int32_t = 0;
+
+    virtual auto getAllMessagesFromChat(const std::string &chatName, int32_t userId) -> std::vector<ChatMessage> = 0;
+
+    // messages visible to user with id greater than afterId
+    virtual auto getMessagesFromChatSince(
+            const std::string &chatName,
+            int32_t userId,
+            int32_t afterId
+    ) -> std::vector<ChatMessage> = 0;
+
+    // latest messages of chat regardless of visibility, oldest first, with senders resolved
+    virtual auto getRecentMessages(const std::string &chatName, size_t limit) -> std::vector<StoredMessage> = 0;
+
+    virtual auto getUserAllowedRawTime(int32_t chatId, int32_t userId) -> time_t = 0;
+
+    // same check as getUserAllowedRawTime without throwing, for checks of many users who are mostly not members
+    virtual auto isChatMember(int32_t chatId, int32_t userId) -> bool = 0;
+
+    virtual auto getChatMembers(const std::string &chatName) -> std::vector<ChatMember> = 0;
+
+    // chats and senders of the latest messagesWindow messages, used to warm caches up
+    virtual auto getRecentlyActiveChats(size_t messagesWindow) -> std::vector<std::string> = 0;
+
+    virtual auto getRecentlyActiveUsers(size_t messagesWindow) -> std::vector<User> = 0;
+
+    // latest message of every chat which has messages, as Message changes
+    virtual auto getLastMessages() -> std::vector<Change> = 0;
+
+    // number of messages with ids greater than afterId of every chat which has them, every chat is counted at one
+    // moment but chats may be counted at different ones, so storage needn't be locked for the whole scan
+    virtual auto countMessagesSince(int32_t afterId) -> std::vector<MessageCount> = 0;
+
+    virtual auto inviteUserToChat(
+            const std::string &chatName,
+            int32_t invitorId,
+            int32_t userId,
+            bool allowHistorySharing = false
+    ) -> void = 0;
+
+    // invites users in one transaction, -1 ids are reported as unknown users and members as already invited.
+    // Statuses are in order of userIds, throws std::logic_error if chat doesn't exist
+    virtual auto inviteUsersToChat(
+            const std::string &chatName,
+            int32_t invitorId,
+            const std::vector<int32_t> &userIds,
+            bool allowHistorySharing = false
+    ) -> std::vector<InviteStatus> = 0;
+
+    // deletes at most batchSize oldest messages of the chat which are older than olderThan or aren't among its
+    // keepLatest latest ones, 0 keepLatest keeps any count. Returns number of deleted messages
+    virtual auto pruneMessages(const std::string &chatName, time_t olderThan, size_t keepLatest, size_t batchSize) -> size_t = 0;
+
+    // messages of the chat up to this id were deleted by pruneMessages, 0 if none were or chat doesn't exist
+    virtual auto getPrunedId(const std::string &chatName) -> int32_t = 0;
+
+    // returns space freed by pruning to the file system a bounded piece at a time, returns reclaimed bytes
+    virtual auto reclaimSpace() -> int64_t = 0;
+
+    // visits users, chats, members and messages in an order they can be applied in,
+    // storage is locked while scanning so visitor must not call it
+    virtual auto scanChanges(const std::function<void(const Change &)> &visitor) -> void = 0;
+
+    // cursor at the beginning of a paged scan, see ChangeCursor
+    virtual auto openChangeCursor() -> ChangeCursor = 0;
+
+    // visits at most limit changes after cursor and advances it, returns false once the scan is complete.
+    // Storage is locked for one page at a time, so changes made between pages may be visited or not
+    virtual auto scanChangesPage(
+            ChangeCursor &cursor,
+            size_t limit,
+            const std::function<void(const Change &)> &visitor
+    ) -> bool = 0;
+
+    // same as scanChanges for one chat, visited users are its members and senders
+    virtual auto scanChatChanges(const std::string &chatName, const std::function<void(const Change &)> &visitor) -> void = 0;
+
+    // applies changes in one transaction, rows which already exist are skipped,
+    // messages keep their ids unless the ids are taken by other messages
+    virtual auto applyChanges(const std::vector<Change> &changes) -> void = 0;
+};
+
+
+// engine is "sqlite" (path is a database file), "log" (path is a segments directory) or "sharded" (path is
+// a directory of catalog and shards message files, shards is used when it's created)
+auto makeStorage(const std::string &engine, const std::string &path, size_t shards = 4) -> std::unique_ptr<Storage>;
+
+auto getFormattedDatetime(time_t rawTime) noexcept -> std::string;
+
+
+#endif //CP_STORAGE_HPP
@@ -21,4 +21,11 @@ struct User {
 };
 
 
+enum class InviteStatus {
+    Invited,
+    AlreadyMember,
+    UnknownUser
+};
+
+
 #endif //CP_USER_HPP
@@ -0,0 +1,154 @@
+#include <ctime>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+#include <unistd.h>
+#include <sqlite3.h>
+
+
+#include "lib/query.hpp"
+#include "lib/options.hpp"
+#include "lib/database.hpp"
+
+
+static std::atomic<uint64_t> allocations{};
+
+
+auto operator new(const size_t size) -> void * {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto pointer = std::malloc(size ? size : 1)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+
+auto operator delete(void *pointer) noexcept -> void {
+    std::free(pointer);
+}
+
+
+auto operator delete(void *pointer, size_t) noexcept -> void {
+    std::free(pointer);
+}
+
+
+// Fills database at path with one chat of people members and messagesCount messages
+auto populate(const std::string &path, const int64_t messagesCount, const int32_t people) -> void {
+    Database database(path);
+    std::vector<int32_t> userIds;
+    for (int32_t i = 0; i < people; i++) {
+        const auto username = "user" + std::to_string(i);
+        database.createUser(username, "bench");
+        userIds.push_back(database.getUserId(username));
+    }
+    database.createChat("bench", userIds.front(), userIds);
+
+    const auto now = time(nullptr);
+    for (int64_t i = 0; i < messagesCount; i++) {
+        database.createMessage("bench", userIds[i % people], now + i, "message " + std::to_string(i) + " of the bench chat");
+    }
+}
+
+
+// Runs read of the whole chat iterations times, prints allocations and time per query
+template<class Read>
+auto measure(const char *name, const int64_t iterations, Read &&read) -> void {
+    size_t rows = 0;
+    const auto before = allocations.load();
+    const auto start = std::chrono::steady_clock::now();
+    for (int64_t i = 0; i < iterations; i++) {
+        rows = read();
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    const auto allocated = allocations.load() - before;
+
+    std::cout << "    " << name << ": " << rows << " rows, "
+              << static_cast<double>(allocated) / static_cast<double>(iterations) << " allocations, "
+              << std::chrono::duration<double, std::micro>(elapsed).count() / static_cast<double>(iterations)
+              << " us per query" << std::endl;
+}
+
+
+// Reads history of the chat the way it was read before the query layer, with owned columns and a username lookup
+// per message, then with one join, then with one join and views
+auto benchmark(const std::string &path, const int64_t iterations) -> void {
+    sqlite3 *db;
+    if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+        throw std::runtime_error("sqlite3_open error");
+    }
+
+    {
+        Query<int32_t, int32_t, int64_t, std::string> messages(
+                db, "SELECT Id, SenderId, RawTime, Data FROM Messages WHERE ChatId = ?1 ORDER BY Id;");
+        Query<std::string> username(db, "SELECT Username FROM Users WHERE Id = ?1;");
+        measure("owned, lookup per row", iterations, [&]() -> size_t {
+            size_t bytes = 0;
+            const auto rows = messages.bind(1).forEach(
+                    [&](int32_t, int32_t senderId, int64_t, const std::string &data) {
+                        username.bind(senderId).first([&](const std::string &name) { bytes += name.size(); });
+                        bytes += data.size();
+                    });
+            return bytes ? rows : 0;
+        });
+
+        Query<int32_t, std::string, int64_t, std::string> joined(
+                db, "SELECT Messages.Id, Users.Username, Messages.RawTime, Messages.Data FROM Messages "
+                    "LEFT JOIN Users ON Users.Id = Messages.SenderId WHERE Messages.ChatId = ?1 ORDER BY Messages.Id;");
+        measure("owned, join", iterations, [&]() -> size_t {
+            size_t bytes = 0;
+            const auto rows = joined.bind(1).forEach(
+                    [&](int32_t, const std::string &name, int64_t, const std::string &data) {
+                        bytes += name.size() + data.size();
+                    });
+            return bytes ? rows : 0;
+        });
+
+        Query<int32_t, std::string_view, int64_t, std::string_view> views(
+                db, "SELECT Messages.Id, Users.Username, Messages.RawTime, Messages.Data FROM Messages "
+                    "LEFT JOIN Users ON Users.Id = Messages.SenderId WHERE Messages.ChatId = ?1 ORDER BY Messages.Id;");
+        measure("views, join", iterations, [&]() -> size_t {
+            size_t bytes = 0;
+            const auto rows = views.bind(1).forEach(
+                    [&](int32_t, std::string_view name, int64_t, std::string_view data) {
+                        bytes += name.size() + data.size();
+                    });
+            return bytes ? rows : 0;
+        });
+    }
+
+    sqlite3_close(db);
+}
+
+
+// usage: query_bench [--messages=1000] [--people=10] [--iterations=1000]
+auto main(int argc, char *argv[]) -> int {
+    const auto path = "/tmp/cp-query-bench-" + std::to_string(getpid()) + ".db";
+    try {
+        const Options options(argc, argv);
+        const auto messagesCount = options.getNumber("messages", 1000);
+        const auto people = static_cast<int32_t>(options.getNumber("people", 10));
+        const auto iterations = options.getNumber("iterations", 1000);
+
+        populate(path, messagesCount, people);
+        std::cout << messagesCount << " messages of " << people << " people" << std::endl;
+        benchmark(path, iterations);
+
+        // the path the server serves history through, whole messages are built from the views
+        Database database(path);
+        const auto userId = database.getUserId("user0");
+        measure("Database::getMessagesFromChatSince", iterations, [&]() -> size_t {
+            return database.getMessagesFromChatSince("bench", userId, 0).size();
+        });
+    } catch (std::runtime_error &exception) {
+        std::cerr << exception.what() << std::endl;
+        std::remove(path.c_str());
+        return 1;
+    }
+    std::remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,189 @@
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <zmqpp/zmqpp.hpp>
+
+
+#include "lib/options.hpp"
+#include "lib/recorder.hpp"
+#include "lib/messaging.hpp"
+#include "lib/connection.hpp"
+#include "lib/networking.hpp"
+
+
+using Clock = std::chrono::steady_clock;
+
+
+// messages of one recorded connection, the authentication request is replaced by sign up or sign in
+struct RecordedConnection {
+    std::string username{};
+    std::vector<RecordedMessage> requests{};
+};
+
+
+struct ReplayStats {
+    std::mutex mutex{};
+    // microseconds per request type
+    std::map<std::string, std::vector<double>> latencies{};
+    uint64_t errors{};
+    uint64_t failedConnections{};
+};
+
+
+auto loadConnections(const std::string &path) -> std::vector<RecordedConnection> {
+    std::map<uint64_t, RecordedConnection> connections;
+    RecordReader reader(path);
+    RecordedMessage record;
+    while (reader.read(record)) {
+        auto &connection = connections[record.connectionId];
+        switch (record.message.type) {
+            case MessageType::SignIn:
+            case MessageType::SignUp:
+            case MessageType::ResumeSession: {
+                connection.username = record.message.data.name;
+                break;
+            }
+            default: {
+                // recording may start after connection was authenticated
+                if (connection.username.empty()) {
+                    connection.username = record.username;
+                }
+                connection.requests.push_back(std::move(record));
+            }
+        }
+    }
+
+    std::vector<RecordedConnection> result;
+    result.reserve(connections.size());
+    for (auto &[connectionId, connection]: connections) {
+        if (!connection.requests.empty()) {
+            result.push_back(std::move(connection));
+        }
+    }
+    return result;
+}
+
+
+// passwords aren't recorded, every user signs up on a fresh server with the same password
+auto replayConnection(
+        zmqpp::context &context,
+        const std::string &serverEndPoint,
+        const std::string &password,
+        const RecordedConnection &recorded,
+        const Clock::time_point start,
+        const int64_t speed,
+        ReplayStats &stats
+) noexcept -> void {
+    std::map<std::string, std::vector<double>> latencies;
+    uint64_t errors = 0;
+    try {
+        Connection connection(context, serverEndPoint);
+        if (connection.authenticate(MessageType::SignUp, recorded.username, password) != AuthenticationStatus::Success &&
+            connection.authenticate(MessageType::SignIn, recorded.username, password) != AuthenticationStatus::Success) {
+            throw std::runtime_error("can't authenticate " + recorded.username);
+        }
+
+        for (const auto &request: recorded.requests) {
+            if (speed != 0) {
+                std::this_thread::sleep_until(start + std::chrono::nanoseconds(request.offsetNs / speed));
+            }
+
+            auto message = request.message;
+            const auto requestStart = Clock::now();
+            connection.request(message);
+            const auto elapsed = Clock::now() - requestStart;
+
+            latencies[getMessageTypeName(request.message.type)].push_back(
+                    std::chrono::duration<double, std::micro>(elapsed).count());
+            if (message.type == MessageType::ClientError || message.type == MessageType::ServerError) {
+                errors++;
+            }
+        }
+    } catch (std::exception &exception) {
+        std::cerr << recorded.username << ": " << exception.what() << std::endl;
+        std::lock_guard lockGuard(stats.mutex);
+        stats.failedConnections++;
+    }
+
+    std::lock_guard lockGuard(stats.mutex);
+    for (auto &[type, values]: latencies) {
+        auto &merged = stats.latencies[type];
+        merged.insert(merged.end(), values.begin(), values.end());
+    }
+    stats.errors += errors;
+}
+
+
+auto printLatencies(const std::string &name, std::vector<double> &latencies) -> void {
+    std::sort(latencies.begin(), latencies.end());
+    const auto percentile = [&latencies](const double p) -> double {
+        return latencies[static_cast<size_t>(p * static_cast<double>(latencies.size() - 1))];
+    };
+
+    std::cout << std::left << std::setw(28) << name << std::right << std::setw(10) << latencies.size()
+              << std::fixed << std::setprecision(1)
+              << " p50 " << std::setw(10) << percentile(0.5)
+              << " p99 " << std::setw(10) << percentile(0.99)
+              << " max " << std::setw(10) << latencies.back() << " us" << std::endl;
+}
+
+
+// usage: replay --log=<traffic log> [--server=tcp://<host ip>:4506] [--speed=1] [--password=replay]
+// speed multiplies recorded pace, 0 sends every connection's requests back to back. Each recorded connection
+// is replayed by its own connection, so requests of different connections overlap as they did when recorded
+auto main(int argc, char *argv[]) -> int {
+    try {
+        const Options options(argc, argv);
+        if (!options.has("log")) {
+            std::cerr << "--log is required" << std::endl;
+            return 1;
+        }
+        const auto serverEndPoint = options.get("server", "tcp://" + getIP() + ":4506");
+        const auto password = options.get("password", "replay");
+        const auto speed = std::max<int64_t>(options.getNumber("speed", 1), 0);
+
+        const auto connections = loadConnections(options.get("log", ""));
+        size_t requests = 0;
+        for (const auto &connection: connections) {
+            requests += connection.requests.size();
+        }
+        std::cout << "replaying " << requests << " requests of " << connections.size() << " connections" << std::endl;
+
+        zmqpp::context context;
+        ReplayStats stats;
+        std::vector<std::thread> threads;
+        threads.reserve(connections.size());
+        const auto start = Clock::now();
+        for (const auto &connection: connections) {
+            threads.emplace_back(replayConnection, std::ref(context), std::cref(serverEndPoint), std::cref(password),
+                                 std::cref(connection), start, speed, std::ref(stats));
+        }
+        for (auto &thread: threads) {
+            thread.join();
+        }
+        const auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::vector<double> all;
+        for (auto &[type, latencies]: stats.latencies) {
+            all.insert(all.end(), latencies.begin(), latencies.end());
+            printLatencies(type, latencies);
+        }
+        if (!all.empty()) {
+            printLatencies("total", all);
+        }
+        std::cout << std::fixed << std::setprecision(2) << all.size() << " requests in " << seconds << " s, "
+                  << std::setprecision(0) << (seconds > 0 ? static_cast<double>(all.size()) / seconds : 0)
+                  << " requests/s, " << stats.errors << " errors, " << stats.failedConnections
+                  << " failed connections" << std::endl;
+    } catch (std::runtime_error &exception) {
+        std::cerr << exception.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,279 +1,107 @@
-#include <set>
-#include <deque>
+#include <chrono>
 #include <string>
-#include <thread>
-#include <utility>
+#include <vector>
+#include <csignal>
 #include <iostream>
-#include <algorithm>
-#include <zmqpp/zmqpp.hpp>
 
 
-#include "lib/user.hpp"
-#include "lib/database.hpp"
-#include "lib/messaging.hpp"
+#include "lib/server.hpp"
+#include "lib/options.hpp"
+#include "lib/storage.hpp"
+#include "lib/handoff.hpp"
 #include "lib/networking.hpp"
 
 
-constexpr int32_t sendTimeout = 10 * 1000;
-constexpr int32_t receiveTimeout = 10 * 1000;
-
-
-class Server {
-    Database db{};
-
-    zmqpp::context context{};
-    zmqpp::socket pullSocket{context, zmqpp::socket_type::pull};
-
-    std::set<User> users{db.getAllUsers()};
-    std::deque<std::thread> threads;
-
-    auto findUser(const std::string &username) noexcept;
-
-    auto connectionMonitor() -> void;
-
-    auto attachClient(zmqpp::socket &clientSocket, const std::string &clientEndPoint) -> User;
-
-    auto clientMonitor(const std::string &clientEndPoint) noexcept -> void;
-
-public:
-    static auto get() -> Server &;
-
-    auto configurePullSocketEndPoint(const std::string &endPoint) -> void;
-
-    auto run() -> void;
-};
-
-
-auto Server::findUser(const std::string &username) noexcept {
-    return std::find_if(users.begin(), users.end(), [&username](auto user) -> bool {
-        return user.username == username;
-    });
-}
-
-
-auto Server::connectionMonitor() -> void {
-    std::cout << "connectionMonitor started" << std::endl;
+// usage: server [--storage=sqlite|log|sharded] [--path=database.db] [--shards=4]
+//               [--history-capacity=256] [--history-budget=67108864] [--warmup-window=10000]
+//               [--response-cache-budget=33554432] [--endpoint=tcp://<host ip>:4506]
+//               [--sessions=<journal path>] [--session-lifetime=604800] [--idle-timeout=6000]
+//               [--publish=<endpoint> --publish-sync=<endpoint>]
+//               [--follow=<primary publish endpoint> --follow-sync=<primary sync endpoint> [--max-staleness=5000]]
+//               [--rate-limit=50 --rate-burst=100] [--rate-limits=CreateMessage:10:20,...] [--max-handshakes=64]
+//               [--interactive-workers=8] [--bulk-workers=2] [--read-state=<snapshot path>] [--read-state-flush=5000]
+//               [--retention-age=<seconds>] [--retention-count=<messages>] [--retention-file=<policies path>]
+//               [--prune-batch=500] [--prune-interval=60000]
+//               [--handoff=<snapshot path> [--handoff-wait=<milliseconds>] [--drain-timeout=5000]]
+//               [--record=<traffic log path>] [--events=<endpoint> [--event-interval=1000] [--event-queue=10000]]
+// sharded storage writes messages of chats to --shards sqlite files in parallel, their number is fixed once created
+// primary publishes committed writes, follower serves reads only
+// retention applies to every chat, the file overrides it for listed chats, 0 age or count doesn't limit it
+// rate limits are requests per second of a user per request type and are on by default: 50 with bursts of 100,
+// CreateMessage 10 with 20 and GetAllMessagesFromChat 2 with 5 unless --rate-limits lists others, 0 disables them
+// endpoint may also be ipc://<path> for clients on the same machine
+// events such as typing indicators are published to online chat members, clients subscribe to their username.
+// The events endpoint is trusted and local only: it isn't authenticated, any process reaching it may subscribe to ""
+// and see typing and presence of every chat. Bind it to ipc:// or loopback for gateways on the same machine which
+// authenticate their clients, never to a public interface. Server warns when it is bound elsewhere
+// recorded traffic is fed back to a server by replay, passwords and session tokens aren't recorded, a recording
+// already at the path is kept and the next free <path>.1, <path>.2, ... is written instead
+// SIGUSR2 restarts server: it stops serving, releases its endpoints, writes snapshot to handoff path and tells clients
+// to reconnect. Deploy starts the new process with --handoff-wait first, it opens storage once snapshot appears
+auto main(int argc, char *argv[]) -> int {
     try {
-        while (pullSocket) {
-            zmqpp::message message;
-            pullSocket.receive(message);
+        const Options options(argc, argv);
 
-            std::string s;
-            message >> s;
-
-            std::thread connectionMonitorThread(&Server::clientMonitor, &Server::get(), s);
-            threads.push_back(std::move(connectionMonitorThread));
+        // storage must not be opened while the previous process may still write it
+        const auto handoffPath = options.get("handoff", "");
+        if (!handoffPath.empty() && options.has("handoff-wait") &&
+            !waitForHandoff(handoffPath, std::chrono::milliseconds(options.getNumber("handoff-wait", 0)))) {
+            std::cerr << "no handoff from the previous process, starting cold" << std::endl;
         }
-    } catch (zmqpp::exception &exception) {
-        std::cout << "connectionMonitor caught zmqpp exception: " << exception.what() << std::endl;
-    } catch (...) {
-        std::cout << "connectionMonitor caught undefined exception" << std::endl;
-    }
-    std::cout << "connectionMonitor exiting, new connections won't be maintained" << std::endl;
-}
-
-
-auto Server::attachClient(zmqpp::socket &clientSocket, const std::string &clientEndPoint) -> User {
-    clientSocket.set(zmqpp::socket_option::send_timeout, sendTimeout);
-    clientSocket.set(zmqpp::socket_option::receive_timeout, receiveTimeout);
-
-    clientSocket.connect(clientEndPoint);
 
-    User user;
-    Message authRequest;
-    receiveMessage(clientSocket, authRequest);
+        const auto engine = options.get("storage", "sqlite");
+        const auto path = options.get("path", engine == "log" ? "database.log" :
+                                               engine == "sharded" ? "database.shards" : "database.db");
 
-    user.username = authRequest.data.name;
-
-    AuthenticationStatus status;
-    if (authRequest.type == MessageType::SignIn) {
-        if (findUser(authRequest.data.name) == users.end()) {
-            status = AuthenticationStatus::NotExists;
-        } else {
-            status = db.authenticateUser(authRequest.data.name, authRequest.data.buffer);
-            user.id = db.getUserId(user.username);
+        Server::get().configureStorage(makeStorage(engine, path, options.getNumber("shards", 4)));
+        if (options.has("publish")) {
+            Server::get().configurePublishing(options.get("publish", ""), options.get("publish-sync", ""));
         }
-    } else if (authRequest.type == MessageType::SignUp) {
-        if (findUser(authRequest.data.name) != users.end()) {
-            status = AuthenticationStatus::Exists;
-        } else {
-            db.createUser(authRequest.data.name, authRequest.data.buffer);
-            user.id = db.getUserId(user.username);
-            if (user.id == -1) {
-                throw std::runtime_error("unexpected createUser result");
-            }
-            status = AuthenticationStatus::Success;
-            users.insert(user);
+        if (options.has("follow")) {
+            Server::get().configureFollower(
+                    options.get("follow", ""),
+                    options.get("follow-sync", ""),
+                    options.getNumber("max-staleness", 5000)
+            );
         }
-    } else {
-        sendMessage(clientSocket, Message(MessageType::ClientError));
-        throw std::runtime_error("invalid massage type");
-    }
-
-
-    Message authResponse;
-    authResponse.authenticationStatus = status;
-    sendMessage(clientSocket, authResponse);
-
-    if (status != AuthenticationStatus::Success) {
-        throw std::runtime_error("auth error");
-    }
-
-    return user;
-}
-
-
-auto Server::clientMonitor(const std::string &clientEndPoint) noexcept -> void {
-    std::cout << "new clientMonitor started, monitoring " << clientEndPoint << " port" << std::endl;
-
-    try {
-        zmqpp::socket clientSocket(context, zmqpp::socket_type::reply);
-
-        User user = attachClient(clientSocket, clientEndPoint);
-
-        while (true) {
-            Message message;
-            receiveMessage(clientSocket, message);
-            switch (message.type) {
-                case MessageType::CreateMessage: {
-                    try {
-                        if (!db.createMessage(message.data.name, user.id, time(nullptr), message.data.buffer)) {
-                            sendMessage(clientSocket, Message(MessageType::ClientError,
-                                                              "Chat " + message.data.buffer + " doesn't exists"));
-                            continue;
-                        }
-                    } catch (std::runtime_error &exception) {
-                        std::cerr << exception.what() << std::endl;
-                        sendMessage(clientSocket, Message(MessageType::ServerError));
-                        continue;
-                    }
-                    break;
-                }
-                case MessageType::Update: {
-                    break;
-                }
-                case MessageType::UpdateChats: {
-                    std::cout << "update chats received" << std::endl;
-                    auto it = findUser(message.data.name);
-                    if (it == users.end()) {
-                        message.type = MessageType::ClientError;
-                        break;
-                    }
-
-                    try {
-                        message.data.vector = db.getChatsByTime(it->id, message.data.time);
-                    } catch (std::runtime_error &exception) {
-                        std::cerr << exception.what() << std::endl;
-                        sendMessage(clientSocket, Message(MessageType::ServerError));
-                        continue;
-                    }
-                    message.data.time = time(nullptr);
-                    break;
-                }
-                case MessageType::CreateChat: {
-                    std::vector<int32_t> userIds;
-                    userIds.reserve(message.data.vector.size());
-
-                    auto flag = false;
-                    for (const auto &username: message.data.vector) {
-                        auto it = findUser(username);
-                        if (it != users.end()) {
-                            userIds.push_back(it->id);
-                        } else {
-                            message = Message(MessageType::ClientError,
-                                              MessageData("User " + username + " doesn't exists"));
-                            sendMessage(clientSocket, message);
-                            flag = true;
-                            break;
-                        }
-                    }
-
-                    if (!flag) {
-                        try {
-                            if (!db.createChat(message.data.buffer, user.id, userIds)) {
-                                sendMessage(clientSocket,
-                                            Message(MessageType::ClientError, MessageData("Chat exists")));
-                                continue;
-                            }
-                        } catch (std::runtime_error &exception) {
-                            std::cerr << exception.what() << std::endl;
-                            sendMessage(clientSocket, Message(MessageType::ServerError));
-                            continue;
-                        }
-                    }
-                    break;
-                }
-                case MessageType::GetAllMessagesFromChat: {
-                    try {
-                        message.data.chatMessages = db.getAllMessagesFromChat(message.data.name, user.id);
-                    } catch (std::logic_error &exception) {
-                        std::cerr << exception.what() << std::endl;
-                        sendMessage(clientSocket, Message(MessageType::ClientError, MessageData(
-                                "Chat " + message.data.name + " doesn't exists")));
-                        continue;
-                    } catch (std::runtime_error &) {
-                        sendMessage(clientSocket, Message(MessageType::ServerError));
-                        continue;
-                    }
-                    break;
-                }
-                case MessageType::InviteUserToChat: {
-                    auto it = findUser(message.data.buffer);
-                    if (it == users.end()) {
-                        message.type = MessageType::ClientError;
-                        break;
-                    }
-
-                    try {
-                        db.inviteUserToChat(message.data.name, user.id, it->id, message.data.flag);
-                    } catch (std::runtime_error &exception) {
-                        std::cerr << exception.what() << std::endl;
-                        sendMessage(clientSocket, Message(MessageType::ServerError));
-                        continue;
-                    }
-                    break;
-                }
-                default:
-                    break;
-            }
-
-            std::cout << "sending request back" << std::endl;
-            sendMessage(clientSocket, message);
+        Server::get().configureHistoryCache(
+                options.getNumber("history-capacity", 256),
+                options.getNumber("history-budget", 64 * 1024 * 1024)
+        );
+        Server::get().configureResponseCache(options.getNumber("response-cache-budget", 32 * 1024 * 1024));
+        Server::get().configureSessions(options.get("sessions", ""), options.getNumber("session-lifetime", 604800));
+        Server::get().configureRetention(
+                RetentionPolicy{options.getNumber("retention-age", 0),
+                                static_cast<size_t>(options.getNumber("retention-count", 0))},
+                options.get("retention-file", ""),
+                options.getNumber("prune-batch", 500),
+                options.getNumber("prune-interval", 60000)
+        );
+        Server::get().configureReadState(options.get("read-state", ""), options.getNumber("read-state-flush", 5000));
+        Server::get().configureRateLimits(
+                RateLimit{static_cast<double>(options.getNumber("rate-limit", 50)),
+                          static_cast<double>(options.getNumber("rate-burst", 100))},
+                options.has("rate-limits") ? options.getList("rate-limits")
+                                           : std::vector<std::string>{"CreateMessage:10:20", "GetAllMessagesFromChat:2:5"}
+        );
+        Server::get().configureScheduler(
+                options.getNumber("interactive-workers", 8),
+                options.getNumber("bulk-workers", 2)
+        );
+        Server::get().configureMaxHandshakes(options.getNumber("max-handshakes", 64));
+        Server::get().configureIdleTimeout(options.getNumber("idle-timeout", 6000));
+        Server::get().configureWarmup(options.getNumber("warmup-window", 10000));
+        Server::get().configureHandoff(handoffPath, options.getNumber("drain-timeout", 5000));
+        Server::get().configureRecording(options.get("record", ""));
+        if (options.has("events")) {
+            Server::get().configureEvents(
+                    options.get("events", ""),
+                    options.getNumber("event-interval", 1000),
+                    options.getNumber("event-queue", 10000)
+            );
         }
-    } catch (zmqpp::exception &exception) {
-        std::cerr << "caught zmq exception: " << exception.what() << std::endl;
-    } catch (std::runtime_error &exception) {
-        std::cerr << exception.what() << std::endl;
-    }
-
-    std::cout << "client monitor exiting" << std::endl;
-}
-
-
-auto Server::get() -> Server & {
-    static Server instance;
-    return instance;
-}
-
-
-auto Server::configurePullSocketEndPoint(const std::string &endPoint) -> void {
-    pullSocket.bind(endPoint);
-}
-
-
-auto Server::run() -> void {
-    std::thread pullerThread(&Server::connectionMonitor, &Server::get());
-    pullerThread.join();
-
-    for (auto &thread: threads) {
-        thread.join();
-    }
-}
-
-
-auto main() -> int {
-    try {
-        Server::get().configurePullSocketEndPoint("tcp://" + getIP() + ":4506");
+        Server::get().configurePullSocketEndPoint(options.get("endpoint", "tcp://" + getIP() + ":4506"));
+        std::signal(SIGUSR2, [](int) { Server::get().restart(); });
         Server::get().run();
     } catch (std::runtime_error &err) {
         std::cout << err.what() << std::endl;
@@ -0,0 +1,295 @@
+#include <ctime>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+#include <filesystem>
+
+
+#include "lib/options.hpp"
+#include "lib/storage.hpp"
+#include "lib/password.hpp"
+
+
+using Clock = std::chrono::steady_clock;
+
+
+auto expect(const bool condition, const std::string &what) -> void {
+    if (!condition) {
+        throw std::runtime_error("check failed: " + what);
+    }
+}
+
+
+// Behaviour every engine must share, servers and followers switch engines without noticing
+auto checkConformance(const std::string &engine, const std::string &path, const std::string &copyPath) -> void {
+    time_t now{};
+    constexpr int32_t messagesCount = 10;
+    std::vector<int32_t> messageIds;
+    {
+        auto storage = makeStorage(engine, path);
+
+        storage->createUser("alice", "alice password");
+        storage->createUser("bob", "bob password");
+        storage->createUser("carol", "carol password");
+        const auto alice = storage->getUserId("alice");
+        const auto bob = storage->getUserId("bob");
+        const auto carol = storage->getUserId("carol");
+        expect(alice != -1 && bob != -1 && alice != bob, "created users have ids");
+        expect(storage->getUserId("nobody") == -1, "unknown user has no id");
+        expect(storage->getUsername(bob) == "bob", "username of id");
+        expect(storage->getAllUsers().size() == 3, "all users");
+
+        const auto signIn = storage->authenticateUser("alice", "alice password");
+        expect(signIn.status == AuthenticationStatus::Success && signIn.userId == alice, "sign in");
+        expect(storage->authenticateUser("alice", "bob password").status == AuthenticationStatus::InvalidPassword,
+               "wrong password");
+        expect(storage->authenticateUser("nobody", "").status == AuthenticationStatus::NotExists, "unknown user");
+
+        expect(storage->createChat("general", alice, {alice, bob}), "chat is created");
+        expect(!storage->createChat("general", bob, {bob}), "chat name is taken");
+        const auto chatId = storage->getChatId("general");
+        expect(chatId != -1 && storage->getChatName(chatId) == "general", "chat id and name");
+        expect(storage->getChatId("nowhere") == -1, "unknown chat has no id");
+        expect(storage->getChatMembers("general").size() == 2, "chat members");
+        expect(storage->getChatsByTime(bob, 0) == std::vector<std::string>{"general"}, "chats of member");
+        expect(storage->getChatsByTime(carol, 0).empty(), "chats of non-member");
+
+        // after chat creation, hashing passwords of new users takes a while
+        now = time(nullptr);
+
+        expect(storage->createMessage("nowhere", alice, now, "lost") == -1, "message to unknown chat");
+        for (int32_t i = 0; i < messagesCount; i++) {
+            const auto id = storage->createMessage("general", i % 2 ? bob : alice, now + i, "message " + std::to_string(i));
+            expect(messageIds.empty() || id > messageIds.back(), "message ids grow");
+            messageIds.push_back(id);
+        }
+
+        const auto messages = storage->getMessagesFromChatSince("general", bob, 0);
+        expect(messages.size() == messagesCount, "whole history");
+        expect(messages[1].username == "bob" && messages[1].text == "message 1" && messages[1].id == messageIds[1],
+               "history message");
+        expect(storage->getMessagesFromChatSince("general", bob, messageIds[6]).size() == 3, "history since id");
+        expect(storage->getAllMessagesFromChat("general", alice).size() == messagesCount, "all messages");
+
+        const auto recent = storage->getRecentMessages("general", 3);
+        expect(recent.size() == 3 && recent.front().id == messageIds[7] && recent.back().senderId == bob,
+               "recent messages, oldest first");
+        expect(storage->getLastMessages().size() == 1 && storage->getLastMessages()[0].id == messageIds.back(),
+               "last message of chat");
+        const auto counts = storage->countMessagesSince(messageIds[4]);
+        expect(counts.size() == 1 && counts[0].count == 5 && counts[0].lastMessageId == messageIds.back(),
+               "messages since id");
+
+        const auto statuses = storage->inviteUsersToChat("general", alice, {carol, -1, alice});
+        expect(statuses == std::vector<InviteStatus>{InviteStatus::Invited, InviteStatus::UnknownUser,
+                                                     InviteStatus::AlreadyMember}, "invite statuses");
+        expect(storage->getChatMembers("general").size() == 3, "invited member");
+        expect(storage->isChatMember(storage->getChatId("general"), carol) &&
+               !storage->isChatMember(storage->getChatId("general"), -1), "chat member check");
+
+        expect(storage->pruneMessages("general", 0, messagesCount - 2, 1000) == 2, "pruned by count");
+        expect(storage->getMessagesFromChatSince("general", bob, 0).size() == messagesCount - 2, "pruned history");
+        expect(storage->getPrunedId("general") == messageIds[1], "pruned id");
+        storage->reclaimSpace();
+        const auto id = storage->createMessage("general", alice, now + messagesCount, "after pruning");
+        expect(id > messageIds.back(), "pruned ids aren't reused");
+        messageIds.push_back(id);
+
+        auto copy = makeStorage(engine, copyPath);
+        std::vector<Change> changes;
+        storage->scanChanges([&changes](const Change &change) {
+            changes.push_back(change);
+        });
+        for (const auto &change: changes) {
+            expect(change.type != ChangeType::User || isPasswordHash(change.data), "only password hashes leave storage");
+        }
+        copy->applyChanges(changes);
+        copy->applyChanges(changes);
+        const auto copied = copy->getMessagesFromChatSince("general", copy->getUserId("carol"), 0);
+        expect(copy->authenticateUser("bob", "bob password").status == AuthenticationStatus::Success, "copied user");
+        expect(copy->getChatMembers("general").size() == 3, "copied members");
+        expect(copied.size() == messagesCount - 1 && copied.back().id == id, "copied messages keep ids");
+
+        // a batch is applied whole or not at all
+        auto failed = false;
+        try {
+            copy->applyChanges({Change{ChangeType::User, 0, "erin", {}, 0, hashPassword("erin password")},
+                                Change{ChangeType::Message, 0, "nobody", "general", now, "lost"}});
+        } catch (std::runtime_error &) {
+            failed = true;
+        }
+        expect(failed && copy->getUserId("erin") == -1, "batch with an unknown sender applies nothing");
+
+        // pages are applied one by one like snapshot pages of replication, users created after the cursor was
+        // opened are left out together with their members and messages
+        auto pagedCopy = makeStorage(engine, copyPath + "-paged");
+        auto cursor = storage->openChangeCursor();
+        storage->createUser("dave", "dave password");
+        const auto dave = storage->getUserId("dave");
+        storage->inviteUsersToChat("general", alice, {dave});
+        messageIds.push_back(storage->createMessage("general", dave, now + messagesCount, "after opening"));
+        for (auto more = true; more;) {
+            std::vector<Change> page;
+            more = storage->scanChangesPage(cursor, 4, [&page](const Change &change) {
+                page.push_back(change);
+            });
+            expect(page.size() <= 4, "page size");
+            pagedCopy->applyChanges(page);
+        }
+        const auto paged = pagedCopy->getMessagesFromChatSince("general", pagedCopy->getUserId("carol"), 0);
+        expect(pagedCopy->getUserId("dave") == -1 && pagedCopy->getChatMembers("general").size() == 3,
+               "paged scan is bounded by the cursor");
+        expect(paged.size() == messagesCount - 1 && paged.back().id == id, "paged messages keep ids");
+    }
+
+    auto reopened = makeStorage(engine, path);
+    expect(reopened->authenticateUser("carol", "carol password").status == AuthenticationStatus::Success,
+           "users survive reopening");
+    expect(reopened->getMessagesFromChatSince("general", reopened->getUserId("alice"), 0).back().id == messageIds.back(),
+           "messages survive reopening");
+    expect(reopened->createMessage("general", reopened->getUserId("alice"), now + messagesCount + 1, "") >
+           messageIds.back(), "ids grow after reopening");
+}
+
+
+auto report(const std::string &action, const int64_t count, const Clock::time_point start) -> void {
+    const auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << "    " << std::left << std::setw(24) << action << std::right << std::fixed << std::setprecision(2)
+              << seconds * 1e6 / static_cast<double>(count) << " us per call" << std::endl;
+}
+
+
+// Writes messagesCount messages round robin into chatsCount chats, then reads histories back
+auto benchmark(const std::string &engine, const std::string &path, const int64_t messagesCount,
+               const int64_t chatsCount) -> void {
+    auto storage = makeStorage(engine, path);
+    storage->createUser("bench", "bench");
+    const auto userId = storage->getUserId("bench");
+    for (int64_t chat = 0; chat < chatsCount; chat++) {
+        storage->createChat("chat" + std::to_string(chat), userId, {userId});
+    }
+
+    const auto rawTime = time(nullptr);
+    const std::string text(64, 'x');
+    auto start = Clock::now();
+    for (int64_t i = 0; i < messagesCount; i++) {
+        storage->createMessage("chat" + std::to_string(i % chatsCount), userId, rawTime + i, text);
+    }
+    report("createMessage", messagesCount, start);
+
+    start = Clock::now();
+    for (int64_t chat = 0; chat < chatsCount; chat++) {
+        storage->getMessagesFromChatSince("chat" + std::to_string(chat), userId, 0);
+    }
+    report("whole chat history", chatsCount, start);
+
+    const auto reads = std::max<int64_t>(messagesCount / 10, 1);
+    start = Clock::now();
+    for (int64_t i = 0; i < reads; i++) {
+        storage->getRecentMessages("chat" + std::to_string(i % chatsCount), 50);
+    }
+    report("50 recent messages", reads, start);
+}
+
+
+// Writes a synthetic storage to measure startup against: users "user<i>" with password "password", chats "chat<i>"
+// of members consecutive users each and messages round robin over chats. Changes go in batches through applyChanges
+// with one shared hash, so generating 1M users doesn't hash 1M passwords
+auto generate(const std::string &engine, const std::string &path, const int64_t usersCount, const int64_t chatsCount,
+              const int64_t membersCount, const int64_t messagesCount) -> void {
+    constexpr size_t batchSize = 10000;
+    auto storage = makeStorage(engine, path);
+    const auto hash = hashPassword("password");
+    const auto rawTime = time(nullptr) - messagesCount;
+    const auto memberOf = [&](const int64_t chat, const int64_t member) -> std::string {
+        return "user" + std::to_string((chat * membersCount + member) % usersCount);
+    };
+
+    std::vector<Change> batch;
+    const auto add = [&](Change change) {
+        batch.push_back(std::move(change));
+        if (batch.size() == batchSize) {
+            storage->applyChanges(batch);
+            batch.clear();
+        }
+    };
+
+    const auto start = Clock::now();
+    for (int64_t user = 0; user < usersCount; user++) {
+        add(Change{ChangeType::User, 0, "user" + std::to_string(user), {}, 0, hash});
+    }
+    for (int64_t chat = 0; chat < chatsCount; chat++) {
+        const auto chatName = "chat" + std::to_string(chat);
+        add(Change{ChangeType::Chat, 0, memberOf(chat, 0), chatName, rawTime, {}});
+        for (int64_t member = 0; member < membersCount; member++) {
+            add(Change{ChangeType::Member, 0, memberOf(chat, member), chatName, rawTime, {}});
+        }
+    }
+    const std::string text(64, 'x');
+    for (int64_t i = 0; i < messagesCount; i++) {
+        const auto chat = i % chatsCount;
+        add(Change{ChangeType::Message, static_cast<int32_t>(i + 1), memberOf(chat, i / chatsCount % membersCount),
+                   "chat" + std::to_string(chat), rawTime + i, text});
+    }
+    if (!batch.empty()) {
+        storage->applyChanges(batch);
+    }
+
+    std::cout << engine << ": generated " << usersCount << " users, " << chatsCount << " chats and " << messagesCount
+              << " messages in " << path << " in " << std::fixed << std::setprecision(1)
+              << std::chrono::duration<double>(Clock::now() - start).count() << " s" << std::endl;
+}
+
+
+// usage: storage_bench [--engines=sqlite,log,sharded] [--messages=10000] [--chats=10] [--check-only]
+//        storage_bench --generate=<path> [--engines=sqlite] [--users=1000000] [--chats=10000] [--members=20]
+//                      [--messages=1000000]
+// Exits with 1 if an engine fails a conformance check. --generate writes a synthetic storage of the first engine
+// to path and keeps it, e.g. for transport_bench --startup
+auto main(int argc, char *argv[]) -> int {
+    const auto directory = std::filesystem::temp_directory_path() / ("cp-storage-bench-" + std::to_string(getpid()));
+    auto failed = false;
+    try {
+        const Options options(argc, argv);
+        if (options.has("generate")) {
+            const auto engines = options.getList("engines");
+            generate(engines.empty() ? "sqlite" : engines.front(), options.get("generate", ""),
+                     std::max<int64_t>(options.getNumber("users", 1000000), 1),
+                     std::max<int64_t>(options.getNumber("chats", 10000), 1),
+                     std::max<int64_t>(options.getNumber("members", 20), 1),
+                     options.getNumber("messages", 1000000));
+            return 0;
+        }
+        auto engines = options.getList("engines");
+        if (engines.empty()) {
+            engines = {"sqlite", "log", "sharded"};
+        }
+        const auto messagesCount = options.getNumber("messages", 10000);
+        const auto chatsCount = std::max<int64_t>(options.getNumber("chats", 10), 1);
+
+        for (const auto &engine: engines) {
+            const auto path = (directory / engine).string();
+            std::filesystem::create_directories(directory);
+            try {
+                checkConformance(engine, path + "-check", path + "-copy");
+                std::cout << engine << ": conformance ok" << std::endl;
+                if (!options.has("check-only")) {
+                    benchmark(engine, path + "-bench", messagesCount, chatsCount);
+                }
+            } catch (std::exception &exception) {
+                std::cerr << engine << ": " << exception.what() << std::endl;
+                failed = true;
+            }
+            std::filesystem::remove_all(directory);
+        }
+    } catch (std::runtime_error &exception) {
+        std::cerr << exception.what() << std::endl;
+        failed = true;
+    }
+    std::filesystem::remove_all(directory);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,187 @@
+#include <ctime>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <unistd.h>
+#include <zmqpp/zmqpp.hpp>
+
+
+#include "lib/server.hpp"
+#include "lib/options.hpp"
+#include "lib/storage.hpp"
+#include "lib/messaging.hpp"
+#include "lib/connection.hpp"
+#include "lib/networking.hpp"
+
+
+// Runs server in process on endPoint and measures round trip of requests sent through one connection
+auto benchmark(const std::string &endPoint, const int64_t requests) -> void {
+    zmqpp::context context;
+
+    Server server(context);
+    server.configureStorage(makeStorage("sqlite", ":memory:"));
+    server.configureWarmup(0);
+    server.configurePullSocketEndPoint(endPoint);
+    std::thread serverThread(&Server::run, &server);
+
+    std::vector<double> latencies;
+    latencies.reserve(requests);
+    try {
+        Connection connection(context, endPoint);
+        if (connection.authenticate(MessageType::SignUp, "bench", "bench") != AuthenticationStatus::Success) {
+            throw std::runtime_error("sign up failed");
+        }
+
+        for (int64_t i = 0; i < requests; i++) {
+            auto message = Message(MessageType::UpdateChats, MessageData(0, "bench", ""));
+
+            const auto start = std::chrono::steady_clock::now();
+            connection.request(message);
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+
+            latencies.push_back(std::chrono::duration<double, std::micro>(elapsed).count());
+        }
+    } catch (std::runtime_error &exception) {
+        std::cerr << endPoint << ": " << exception.what() << std::endl;
+    }
+
+    server.stop();
+    serverThread.join();
+
+    if (latencies.empty()) {
+        return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    const auto percentile = [&latencies](const double p) -> double {
+        return latencies[static_cast<size_t>(p * static_cast<double>(latencies.size() - 1))];
+    };
+
+    std::cout << std::left << std::setw(40) << endPoint << std::fixed << std::setprecision(1)
+              << " p50 " << std::setw(8) << percentile(0.5)
+              << " p99 " << std::setw(8) << percentile(0.99)
+              << " max " << std::setw(8) << latencies.back() << " us" << std::endl;
+}
+
+
+// Sizes of a history response of a chat with a few active people, plain and dictionary-encoded. Memory counts
+// message structs and heap of their usernames, short ones fit into std::string itself
+auto measureHistoryEncoding(const int64_t messagesCount) -> void {
+    const std::vector<std::string> people{"anna", "bob.smith", "ekaterina.ivanova", "mohammed.al-rashid", "li"};
+
+    std::vector<ChatMessage> messages;
+    messages.reserve(messagesCount);
+    const auto rawTime = time(nullptr);
+    for (int64_t i = 0; i < messagesCount; i++) {
+        // some people write more than others
+        const auto &username = people[(i * i + i / 3) % people.size()];
+        messages.emplace_back(getFormattedDatetime(rawTime + i), username,
+                              std::string(static_cast<size_t>(20 + i % 60), 'x'), static_cast<int32_t>(i + 1));
+    }
+
+    const auto measure = [](const MessageData &data) -> std::pair<size_t, size_t> {
+        msgpack::sbuffer package;
+        msgpack::pack(&package, Message(MessageType::GetAllMessagesFromChat, data));
+
+        auto memory = data.chatMessages.size() * sizeof(ChatMessage);
+        for (const auto &message: data.chatMessages) {
+            memory += message.username.capacity() > std::string().capacity() ? message.username.capacity() + 1 : 0;
+        }
+        for (const auto &sender: data.vector) {
+            memory += sizeof(std::string) + sender.capacity() + 1;
+        }
+        return {package.size(), memory};
+    };
+
+    MessageData plain;
+    plain.chatMessages = messages;
+    const auto [plainWire, plainMemory] = measure(plain);
+
+    MessageData encoded;
+    encoded.chatMessages = std::move(messages);
+    encodeSenders(encoded.chatMessages, encoded.vector);
+    for (auto &message: encoded.chatMessages) {
+        message.username.shrink_to_fit();
+    }
+    const auto [encodedWire, encodedMemory] = measure(encoded);
+
+    std::cout << messagesCount << " messages of " << people.size() << " people" << std::endl
+              << "    wire   " << plainWire << " -> " << encodedWire << " bytes" << std::endl
+              << "    memory " << plainMemory << " -> " << encodedMemory << " bytes" << std::endl;
+}
+
+
+// Opens storage like server does and measures how long after start the first client gets its inbox. Server runs
+// in process on inproc:// with the warmup window of server, the client signs in as user0 of storage_bench --generate
+auto measureStartup(const std::string &engine, const std::string &path) -> void {
+    const auto endPoint = std::string("inproc://cp-startup");
+    const auto start = std::chrono::steady_clock::now();
+    const auto since = [&start]() -> double {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    zmqpp::context context;
+    Server server(context);
+    server.configureStorage(makeStorage(engine, path));
+    const auto opened = since();
+    server.configureWarmup(10000);
+    server.configurePullSocketEndPoint(endPoint);
+    std::thread serverThread(&Server::run, &server);
+
+    double signedIn = 0;
+    double answered = 0;
+    try {
+        Connection connection(context, endPoint);
+        if (connection.authenticate(MessageType::SignIn, "user0", "password") != AuthenticationStatus::Success) {
+            throw std::runtime_error("sign in failed");
+        }
+        signedIn = since();
+
+        auto message = Message(MessageType::GetRecentChats);
+        connection.request(message);
+        if (message.type != MessageType::GetRecentChats) {
+            throw std::runtime_error("no inbox");
+        }
+        answered = since();
+    } catch (std::runtime_error &exception) {
+        std::cerr << path << ": " << exception.what() << std::endl;
+    }
+
+    server.stop();
+    serverThread.join();
+
+    std::cout << engine << " " << path << std::fixed << std::setprecision(1) << std::endl
+              << "    storage opened " << opened << " ms, signed in " << signedIn << " ms, inbox "
+              << answered << " ms after start" << std::endl
+              << "    stopped " << since() << " ms after start, once background loading finished" << std::endl;
+}
+
+
+// usage: transport_bench [--requests=10000] [--history-messages=10000]
+//        transport_bench --startup=<storage path> [--storage=sqlite|log|sharded]
+// --startup measures time to the first request against a storage written by storage_bench --generate only
+auto main(int argc, char *argv[]) -> int {
+    try {
+        const Options options(argc, argv);
+        if (options.has("startup")) {
+            measureStartup(options.get("storage", "sqlite"), options.get("startup", ""));
+            return 0;
+        }
+        const auto requests = options.getNumber("requests", 10000);
+
+        measureHistoryEncoding(options.getNumber("history-messages", 10000));
+
+        benchmark("inproc://cp-bench", requests);
+        benchmark("ipc:///tmp/cp-bench-" + std::to_string(getpid()), requests);
+        benchmark("tcp://127.0.0.1:4507", requests);
+        benchmark("tcp://" + getIP() + ":4508", requests);
+    } catch (std::runtime_error &exception) {
+        std::cerr << exception.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}